@@ -67,6 +67,9 @@
 #define CONF_IGMP_QUERIER_TIMEOUT               15
 #define CONF_HELLO_INTERVAL                     16
 #define CONF_DISABLE_VIFS                       17
+#define CONF_REGISTER_ENCAP                     18
+#define CONF_IPC_TIMEOUT                        19
+#define CONF_IPC_BUDGET                         20
 
 /*
  * Beginnings of a refactor of the static uvifs[] array
@@ -91,6 +94,9 @@ struct iflist {
  */
 uint16_t pim_timer_hello_interval = PIM_TIMER_HELLO_INTERVAL;
 uint16_t pim_timer_hello_holdtime = PIM_TIMER_HELLO_HOLDTIME;
+int      register_kernel_encap    = FALSE;
+u_int    ipc_timeout              = IPC_TIMEOUT;
+u_int    ipc_budget               = IPC_BUDGET;
 
 /*
  * Forward declarations.
@@ -513,6 +519,12 @@ static int parse_option(char *word)
 	return CONF_SCOPED;
     if (EQUAL(word, "hello-interval"))
 	return CONF_HELLO_INTERVAL;
+    if (EQUAL(word, "register-encap"))
+	return CONF_REGISTER_ENCAP;
+    if (EQUAL(word, "ipc-timeout"))
+	return CONF_IPC_TIMEOUT;
+    if (EQUAL(word, "ipc-budget"))
+	return CONF_IPC_BUDGET;
 
     return CONF_UNKNOWN;
 }
@@ -549,7 +561,7 @@ static void validate_prefix_len(uint32_t *len)
  *
  * Syntax:
  * phyint <local-addr | ifname> [disable | enable]
- *                              [igmpv2  | igmpv3]
+ *                              [igmpv2  | igmpv3] [fast-leave]
  *                              [dr-priority <1-4294967294>]
  *                              [ttl-threshold <1-255>]
  *                              [distance <1-255>] [metric <1-1024>]
@@ -615,6 +627,11 @@ static int parse_phyint(char *s)
 		continue;
 	    }
 
+	    if (EQUAL(w, "fast-leave")) {
+		v->uv_flags |= VIFF_FAST_LEAVE;
+		continue;
+	    }
+
 	    if (EQUAL(w, "altnet")) {
 		if (EQUAL((w = next_word(&s)), "")) {
 		    WARN("Missing ALTNET for phyint %s", inet_fmt(local, s1, sizeof(s1)));
@@ -1188,6 +1205,109 @@ int parse_hello_interval(char *s)
 }
 
 
+/**
+ * parse_register_encap - Parse register-encap option
+ * @s: Input data
+ *
+ * Who encapsulates the data packets of a DR to the RP: pimd, in PIM
+ * Register messages, or the kernel, in IP-in-IP tunnels.  The latter
+ * requires all DRs and RPs to use it, so it is off by default.
+ *
+ * Syntax:
+ *	    register-encap <pim | kernel>
+ *
+ * Returns:
+ * %TRUE if successful, otherwise %FALSE.
+ */
+static int parse_register_encap(char *s)
+{
+    char *w;
+
+    w = next_word(&s);
+    if (EQUAL(w, "pim")) {
+	register_kernel_encap = FALSE;
+    } else if (EQUAL(w, "kernel")) {
+#ifdef __linux__
+	register_kernel_encap = TRUE;
+#else
+	WARN("register-encap kernel is only supported on Linux");
+	return FALSE;
+#endif
+    } else {
+	WARN("Invalid register-encap %s; defaulting to pim", w);
+	return FALSE;
+    }
+
+    logit(LOG_INFO, 0, "register-encap %s", w);
+
+    return TRUE;
+}
+
+
+/**
+ * parse_ipc_timeout - Parse ipc-timeout option
+ * @s: Input data
+ *
+ * Seconds an IPC client may be idle, or not read its reply, before it
+ * is disconnected.  Zero disables the timeout.
+ *
+ * Syntax:
+ *	    ipc-timeout <SEC>
+ *
+ * Returns:
+ * %TRUE if successful, otherwise %FALSE.
+ */
+static int parse_ipc_timeout(char *s)
+{
+    u_int value;
+    char *w;
+
+    w = next_word(&s);
+    if (sscanf(w, "%u", &value) != 1 || value > 86400) {
+	WARN("Invalid ipc-timeout %s; defaulting to %u", w, IPC_TIMEOUT);
+	ipc_timeout = IPC_TIMEOUT;
+	return FALSE;
+    }
+
+    logit(LOG_INFO, 0, "ipc-timeout is %u", value);
+    ipc_timeout = value;
+
+    return TRUE;
+}
+
+
+/**
+ * parse_ipc_budget - Parse ipc-budget option
+ * @s: Input data
+ *
+ * Milliseconds a slice of a large IPC reply, e.g. the routing table,
+ * may take to render before the daemon goes back to routing.
+ *
+ * Syntax:
+ *	    ipc-budget <MSEC>
+ *
+ * Returns:
+ * %TRUE if successful, otherwise %FALSE.
+ */
+static int parse_ipc_budget(char *s)
+{
+    u_int value;
+    char *w;
+
+    w = next_word(&s);
+    if (sscanf(w, "%u", &value) != 1 || value < 1 || value > 1000) {
+	WARN("Invalid ipc-budget %s; defaulting to %u", w, IPC_BUDGET);
+	ipc_budget = IPC_BUDGET;
+	return FALSE;
+    }
+
+    logit(LOG_INFO, 0, "ipc-budget is %u msec", value);
+    ipc_budget = value;
+
+    return TRUE;
+}
+
+
 /**
  * parse_spt_threshold - Parse spt-threshold option
  * @s: String token
@@ -1513,6 +1633,7 @@ void config_vifs_from_file(void)
     /* Reset flags on file (re)load */
     cand_rp_flag = FALSE;
     cand_bsr_flag = FALSE;
+    register_kernel_encap = FALSE;
 
     fp = fopen(config_file, "r");
     if (!fp) {
@@ -1584,6 +1705,18 @@ void config_vifs_from_file(void)
 		parse_hello_interval(s);
 		break;
 
+	    case CONF_REGISTER_ENCAP:
+		parse_register_encap(s);
+		break;
+
+	    case CONF_IPC_TIMEOUT:
+		parse_ipc_timeout(s);
+		break;
+
+	    case CONF_IPC_BUDGET:
+		parse_ipc_budget(s);
+		break;
+
 	    default:
 		logit(LOG_WARNING, 0, "%s:%u - Unknown command '%s'", config_file, lineno, w);
 		error_flag = TRUE;
@@ -150,7 +150,7 @@ unsigned long debug = 0x00000000;        /* If (long) is smaller than
 					  * 4 bytes, then we are in
 					  * trouble.
 					  */
-static int log_syslog = 0;
+int log_syslog = 0;
 
 
 char *packet_kind(int proto, int type, int code)
@@ -500,9 +500,10 @@ void dump_vifs(FILE *fp, int detail)
 
 void dump_ssm(FILE *fp, int detail)
 {
-    struct listaddr *group, *source;
+    struct listaddr *group;
     struct uvif *v;
     vifi_t vifi;
+    uint32_t i;
     int first = 1;
 
     (void)detail;
@@ -519,8 +520,8 @@ void dump_ssm(FILE *fp, int detail)
 	    }
 
 	    fprintf(fp, " %3u  %-15s ", vifi, inet_fmt(group->al_addr, s1, sizeof(s1)));
-	    for (source = group->al_sources; source; source = source->al_next)
-		fprintf(fp, "%s ", inet_fmt(source->al_addr, s1, sizeof(s1)));
+	    for (i = 0; i < group->al_nsources; i++)
+		fprintf(fp, "%s ", inet_fmt(group->al_sources[i]->al_addr, s1, sizeof(s1)));
 	    fprintf(fp, "\n");
 	}
     }
@@ -584,8 +585,11 @@ int log_list(char *buf, size_t len)
  * Log errors and other messages to the system log daemon and to stderr,
  * according to the severity of the message and the current debug level.
  * For errors of severity LOG_ERR or worse, terminate the program.
+ *
+ * Called via the logit() macro, which skips the call, and evaluating
+ * the arguments, for messages that are not logged, see LOG_ENABLED().
  */
-void logit(int severity, int syserr, const char *format, ...)
+void log_msg(int severity, int syserr, const char *format, ...)
 {
     va_list ap;
     char msg[211];
@@ -593,15 +597,15 @@ void logit(int severity, int syserr, const char *format, ...)
     struct tm *thyme;
     time_t lt;
 
+    if (!LOG_ENABLED(severity))
+	goto done;
+
     va_start(ap, format);
     vsnprintf(msg, sizeof(msg), format, ap);
     va_end(ap);
 
     /* pimd running in foreground */
     if (!log_syslog) {
-	if (!debug && severity > loglevel)
-	    goto done;
-
 	gettimeofday(&now, NULL);
 	lt = now.tv_sec;
 	thyme = localtime(&lt);
@@ -620,23 +624,20 @@ void logit(int severity, int syserr, const char *format, ...)
     }
 
     /*
-     * Always log things that are worse than warnings, no matter what
-     * the log_nmsgs rate limiter says.
+     * Things worse than warnings are always logged, no matter what the
+     * log_nmsgs rate limiter says, see LOG_ENABLED().
      *
-     * Only count things at the defined loglevel or worse in the rate limiter
-     * and exclude debugging (since if you put daemon.debug in syslog.conf
-     * you probably actually want to log the debugging messages so they
-     * shouldn't be rate-limited)
+     * Exclude debugging from the rate limiter count (since if you put
+     * daemon.debug in syslog.conf you probably actually want to log the
+     * debugging messages so they shouldn't be rate-limited)
      */
-    if ((severity < LOG_WARNING) || (log_nmsgs < LOG_MAX_MSGS)) {
-	if ((severity <= loglevel) && (severity != LOG_DEBUG))
-	    log_nmsgs++;
+    if (severity != LOG_DEBUG)
+	log_nmsgs++;
 
-	if (syserr)
-	    syslog(severity, "%s: %s", msg, strerror(syserr));
-	else
-	    syslog(severity, "%s", msg);
-    }
+    if (syserr)
+	syslog(severity, "%s: %s", msg, strerror(syserr));
+    else
+	syslog(severity, "%s", msg);
 
   done:
 #ifndef CONTINUE_ON_ERROR
@@ -734,13 +735,60 @@ static void dump_route(FILE *fp, mrtentry_t *r)
     fprintf(fp, "\nTIMERS:  Entry    JP    RS  Assert VIFS:");
     for (vifi = 0; vifi < numvifs; vifi++)
 	fprintf(fp, "  %d", vifi);
-    fprintf(fp, "\n         %5d  %4d  %4d  %6d      ",
-	    r->entry_timer, r->jp_timer, r->rs_timer, r->assert_timer);
+    fprintf(fp, "\n         %5u  %4u  %4u  %6u      ",
+	    MRT_TIMER_LEFT(r->entry_timer), MRT_TIMER_LEFT(r->jp_timer),
+	    MRT_TIMER_LEFT(r->rs_timer), MRT_TIMER_LEFT(r->assert_timer));
     for (vifi = 0; vifi < numvifs; vifi++)
-	fprintf(fp, " %2d", r->vif_timers[vifi]);
+	fprintf(fp, " %2u", MRT_TIMER_LEFT(r->vif_timers[vifi]));
     fprintf(fp, "\n");
 }
 
+/*
+ * One routing entry of dump_pim_mrt(), the (*,G) or an (S,G) of group
+ * @g, or with @g NULL the (*,*,RP) entry @r.  Returns the number of
+ * kernel cache mirrors of the entry.
+ */
+u_int dump_mrt_entry(FILE *fp, grpentry_t *g, mrtentry_t *r)
+{
+    u_int mirrors = 0;
+    kernel_cache_t *kc;
+
+    if (!g || r == g->grp_route) {
+	if (r->flags & MRTF_KERNEL_CACHE) {
+	    for (kc = r->kernel_cache; kc; kc = kc->next)
+		mirrors++;
+	}
+    } else if (r->flags & MRTF_KERNEL_CACHE) {
+	mirrors++;
+    }
+
+    fprintf(fp, "\n");
+    if (!g) {
+	/* Print the (*,*,RP) routing info */
+	fprintf(fp, "Source           Group            RP Address       Flags              (*,*,RP)=\n");
+	fprintf(fp, "%-15s  ", inet_fmt(r->source->address, s1, sizeof(s1)));
+	fprintf(fp, "%-15s  ", "*");
+	fprintf(fp, "%-15s ", "");
+    } else {
+	if (r == g->grp_route) {
+	    /* Print the (*,G) routing info */
+	    fprintf(fp, "Source           Group            RP Address       Flags              (*,G)=\n");
+	    fprintf(fp, "%-15s  ", "*");
+	} else {
+	    /* Print the (S,G) routing info */
+	    fprintf(fp, "Source           Group            RP Address       Flags              (S,G)=\n");
+	    fprintf(fp, "%-15s  ", inet_fmt(r->source->address, s1, sizeof(s1)));
+	}
+	fprintf(fp, "%-15s  ", inet_fmt(g->group, s1, sizeof(s1)));
+	fprintf(fp, "%-15s ", IN_PIM_SSM_RANGE(g->group) ? "SSM" :
+		(g->active_rp_grp ? inet_fmt(g->rpaddr, s2, sizeof(s2)) : "NULL"));
+    }
+
+    dump_route(fp, r);
+
+    return mirrors;
+}
+
 void dump_pim_mrt(FILE *fp, int detail)
 {
     grpentry_t *g;
@@ -748,7 +796,6 @@ void dump_pim_mrt(FILE *fp, int detail)
     u_int number_of_cache_mirrors = 0;
     u_int number_of_groups = 0;
     cand_rp_t *rp;
-    kernel_cache_t *kc;
 
     if (detail)
 	fprintf(fp, "\nMulticast Routing Table");
@@ -757,59 +804,19 @@ void dump_pim_mrt(FILE *fp, int detail)
     for (g = grplist->next; g; g = g->next) {
 	number_of_groups++;
 
-	r = g->grp_route;
-	if (r) {
-	    if (r->flags & MRTF_KERNEL_CACHE) {
-		for (kc = r->kernel_cache; kc; kc = kc->next)
-		    number_of_cache_mirrors++;
-	    }
-
-	    /* Print the (*,G) routing info */
-	    fprintf(fp, "\n");
-	    fprintf(fp, "Source           Group            RP Address       Flags              (*,G)=\n");
-	    fprintf(fp, "%-15s  ", "*");
-	    fprintf(fp, "%-15s  ", inet_fmt(g->group, s1, sizeof(s1)));
-	    fprintf(fp, "%-15s ", IN_PIM_SSM_RANGE(g->group) ? "SSM" :
-		    (g->active_rp_grp ? inet_fmt(g->rpaddr, s2, sizeof(s2)) : "NULL"));
-
-	    dump_route(fp, r);
-	}
+	if (g->grp_route)
+	    number_of_cache_mirrors += dump_mrt_entry(fp, g, g->grp_route);
 
 	/* Print all (S,G) routing info */
-	for (r = g->mrtlink; r; r = r->grpnext) {
-	    if (r->flags & MRTF_KERNEL_CACHE)
-		number_of_cache_mirrors++;
-
-	    /* Print the routing info */
-	    fprintf(fp, "\n");
-	    fprintf(fp, "Source           Group            RP Address       Flags              (S,G)=\n");
-	    fprintf(fp, "%-15s  ", inet_fmt(r->source->address, s1, sizeof(s1)));
-	    fprintf(fp, "%-15s  ", inet_fmt(g->group, s2, sizeof(s2)));
-	    fprintf(fp, "%-15s ", IN_PIM_SSM_RANGE(g->group) ? "SSM" :
-		    (g->active_rp_grp ? inet_fmt(g->rpaddr, s2, sizeof(s2)) : "NULL"));
-
-	    dump_route(fp, r);
-	}
+	for (r = g->mrtlink; r; r = r->grpnext)
+	    number_of_cache_mirrors += dump_mrt_entry(fp, g, r);
     }/* for all groups */
 
     /* Print the (*,*,R) routing entries */
     for (rp = cand_rp_list; rp; rp = rp->next) {
 	r = rp->rpentry->mrtlink;
-	if (r) {
-	    if (r->flags & MRTF_KERNEL_CACHE) {
-		for (kc = r->kernel_cache; kc; kc = kc->next)
-		    number_of_cache_mirrors++;
-	    }
-
-	    /* Print the (*,*,RP) routing info */
-	    fprintf(fp, "\n");
-	    fprintf(fp, "Source           Group            RP Address       Flags              (*,*,RP)=\n");
-	    fprintf(fp, "%-15s  ", inet_fmt(r->source->address, s1, sizeof(s1)));
-	    fprintf(fp, "%-15s  ", "*");
-	    fprintf(fp, "%-15s ", "");
-
-	    dump_route(fp, r);
-	}
+	if (r)
+	    number_of_cache_mirrors += dump_mrt_entry(fp, NULL, r);
     } /* For all (*,*,RP) */
 
     fprintf(fp, "Number of Groups: %u\n", number_of_groups);
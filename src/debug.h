@@ -46,11 +46,34 @@
 extern unsigned long	debug;
 extern int              loglevel;
 extern int              log_nmsgs;
-#define IF_DEBUG(l)	if (debug && (debug & (l)))
+extern int              log_syslog;
 
 #define LOG_MAX_MSGS	100	/* if > 100/minute then shut up for a while */
 #define LOG_SHUT_UP	600	/* shut up for 10 minutes */
 
+#ifdef NO_DEBUG_LOGGING		/* configure --disable-debug-logging */
+#define IF_DEBUG(l)	if (0)
+#else
+#define IF_DEBUG(l)	if (debug && (debug & (l)))
+#endif
+
+/* Is a message of severity @s logged at all, i.e., worth formatting? */
+#define LOG_ENABLED(s)	(log_syslog					\
+			 ? (s) <= loglevel && ((s) < LOG_WARNING || log_nmsgs < LOG_MAX_MSGS) \
+			 : debug || (s) <= loglevel)
+
+/*
+ * The arguments, e.g. inet_fmt() calls, are only evaluated if the
+ * message is logged.  Errors always reach log_msg(), which exits.
+ */
+#define logit(severity, syserr, fmt, args...)				\
+    do {								\
+	int _sev = (severity);						\
+									\
+	if (_sev <= LOG_ERR || LOG_ENABLED(_sev))			\
+	    log_msg(_sev, syserr, fmt, ##args);				\
+    } while (0)
+
 /* Debug values definition */
 /* DVMRP reserved for future use */
 #define DEBUG_DVMRP_PRUNE     0x00000001
@@ -114,6 +137,7 @@ extern void	dump_frame		(char *desc, void *dump, size_t len);
 extern int	log_level		(int proto, int type, int code);
 extern void	dump_vifs		(FILE *fp, int detail);
 extern void	dump_ssm		(FILE *fp, int detail);
+extern u_int	dump_mrt_entry		(FILE *fp, grpentry_t *g, mrtentry_t *r);
 extern void	dump_pim_mrt		(FILE *fp, int detail);
 extern int	dump_rp_set		(FILE *fp, int detail);
 
@@ -122,7 +146,7 @@ extern int      log_str2lvl             (char *level);
 extern const char *log_lvl2str          (int val);
 extern int      log_list                (char *buf, size_t len);
 
-extern void	logit			(int severity, int syserr, const char *fmt, ...)
+extern void	log_msg			(int severity, int syserr, const char *fmt, ...)
 						__attribute__ ((format (printf, 3, 4)));
 
 #endif /* PIMD_DEBUG_H_ */
@@ -48,6 +48,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <ctype.h>
@@ -125,13 +126,29 @@
 typedef void (*cfunc_t)  (void *);
 typedef void (*ihfunc_t) (int);
 
+/* Input handler flags, see register_input_handler() */
+#define IH_LEVEL        0x00	/* Called while fd is readable      */
+#define IH_EDGE         0x01	/* Called on arrival, must drain fd */
+#define IH_WRITE        0x02	/* Called while fd is writable      */
+#define IH_BATCH        32	/* Max packets read per handler call */
+
+/* Changes for IPC subscribers, see ipc_route_event() */
+#define IPC_EV_ADD      1	/* Created, neighbor up, or group joined */
+#define IPC_EV_DEL      2	/* Deleted, neighbor down, or group left */
+#define IPC_EV_CHANGE   3	/* Route incoming or outgoing interfaces */
+
+/* IPC clients, see ipc_age() and slice_done() */
+#define IPC_TIMEOUT     30	/* sec idle, or not reading a reply  */
+#define IPC_BUDGET      5	/* msec per slice of a large reply   */
+
 #include "dvmrp.h"     /* Added for further compatibility and convenience */
 #include "pimd.h"
+#include "vif.h"
 #include "mrt.h"
 #include "igmpv2.h"
 #include "igmpv3.h"
-#include "vif.h"
 #include "debug.h"
+#include "pool.h"
 #include "pathnames.h"
 #ifdef RSRR
 #include "rsrr.h"
@@ -145,6 +162,21 @@ typedef void (*ihfunc_t) (int);
 #define ENABLINGSTR(val)        (val) ? "enabling" : "disabling"
 #define is_set(flag, flags)     (((flag) & (flags)) == (flag))
 
+/* Hash an IPv4 address for the mrt.c and IGMP group hash tables */
+static inline uint32_t addr_hash(uint32_t addr)
+{
+    uint32_t h = addr;
+
+    /* MurmurHash3 finalizer, mixes all bits into the low ones */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
 /*
  * Various definitions to make it working for different platforms
  */
@@ -244,16 +276,12 @@ typedef void (*ihfunc_t) (int);
 #define UCAST_DEFAULT_ROUTE_METRIC     1024
 
 #define TIMER_INTERVAL		5	/* 5 sec virtual timer granularity  */
+#define TIMER_HZ		10	/* Callout queue ticks per second   */
+#define ROUTE_INTERVAL		1	/* 1 sec routing entry aging tick   */
 
-/*
- * TODO: recalculate the messages sizes, probably with regard to the MTU
- */
-/* We must assume "safe" maximum atleast until we handle MTU correctly. */
-#define MAX_JP_MESSAGE_SIZE     (576 \
-				- sizeof(struct ip) \
-				- sizeof(pim_header_t) \
-				- sizeof(pim_jp_header_t))
-#define MAX_JP_MESSAGE_POOL_NUMBER 8
+/* Join/Prune messages are packed to fill the MTU, but at least this */
+#define MIN_JP_MTU		576
+#define JP_WORKING_MIN		64	/* Initial Join/Prune entries per neighbor */
 
 #ifdef RSRR
 #define BIT_ZERO(X)		((X) = 0)
@@ -283,12 +311,112 @@ typedef void (*ihfunc_t) (int);
  */
 #define			SEND_BUF_SIZE (128*1024)  /* Maximum buff size to
 						   * send a packet */
-#define			RECV_BUF_SIZE (128*1024)  /* Maximum buff size to
-						   * receive a packet */
 #define                 SO_SEND_BUF_SIZE_MAX (256*1024)
 #define                 SO_SEND_BUF_SIZE_MIN (48*1024)
 #define                 SO_RECV_BUF_SIZE_MAX (256*1024)
 #define                 SO_RECV_BUF_SIZE_MIN (48*1024)
+#define			RX_SLOT_SIZE (9*1024)	  /* Expected max size of a
+						   * received datagram */
+#define			RX_SLOT_MAX  (73*1024)	  /* Room for IP_MAXPACKET
+						   * after RX_SLOT_SIZE, and
+						   * aligned slots */
+#define			PIM_SEND_BATCH 32	  /* Max packets per
+						   * send_pim_batch() */
+
+/*
+ * Batched receive ring, see k_recv_batch().  Each slot holds one
+ * datagram of up to RX_SLOT_MAX bytes.
+ */
+struct rxstats {
+    uint64_t	calls;		/* Wakeups with at least one packet      */
+    uint64_t	packets;	/* Packets received                      */
+    uint64_t	oversized;	/* Larger than RX_SLOT_SIZE, kept        */
+    uint64_t	truncated;	/* Dropped, MSG_TRUNC                    */
+    uint32_t	overflow;	/* Dropped by kernel, socket buffer full */
+    uint32_t	max_batch;	/* Largest batch so far                  */
+    uint64_t	batch[6];	/* Batch sizes: 1, 2-3, 4-7, 8-15, 16-31, 32+ */
+};
+
+struct rxmsg {
+    char       *buf;
+    ssize_t	len;
+    int		ifindex;	/* From IP_PKTINFO, or -1 */
+};
+
+struct rxring {
+    char	       *mem;	/* All slots, RX_SLOT_MAX each */
+    char	       *slot[IH_BATCH];
+    struct rxmsg	msg[IH_BATCH];
+    struct rxstats	stats;
+};
+
+/* Unicast RPF lookups, see k_req_incoming() */
+struct rpfstats {
+    uint64_t	hits;		/* Answered from the RPF cache         */
+    uint64_t	misses;		/* Synchronous lookups in the kernel   */
+    uint64_t	async;		/* Pipelined lookups after a change    */
+    uint64_t	notifications;	/* Route changes from the kernel       */
+    uint64_t	changes;	/* Lookups with a new result           */
+    uint64_t	lost;		/* Pipelined lookups sent again        */
+    uint64_t	evicted;	/* Cache entries freed to make room    */
+};
+
+/* Cache miss upcalls, see process_cache_miss() */
+struct upcallstats {
+    uint64_t	misses;		/* IGMPMSG_NOCACHE from the kernel      */
+    uint64_t	limited;	/* Dropped, out of tokens for the (S,G) */
+    uint64_t	negative;	/* Negative cache entries installed     */
+    uint64_t	expired;	/* ... removed when timing out          */
+    uint64_t	flushed;	/* ... removed when a route got oifs    */
+};
+
+/* Kernel MFC updates, see k_chg_mfc() and k_mfc_flush() */
+struct mfcstats {
+    uint64_t	requests;	/* Calls to k_chg_mfc() and k_del_mfc() */
+    uint64_t	syscalls;	/* MRT_ADD_MFC and MRT_DEL_MFC issued   */
+    uint64_t	coalesced;	/* Requests replaced by a later one     */
+    uint64_t	flushes;	/* Passes with at least one update      */
+    uint32_t	max_batch;	/* Most updates in one pass             */
+    uint64_t	rp_changes;	/* Passes following an RP change        */
+    uint64_t	rp_saved;	/* Syscalls coalesced in those passes   */
+};
+
+/* Join/Prune messages, see pack_and_send_jp_message() */
+struct jpstats {
+    uint64_t	entries;	/* Join/Prune entries queued            */
+    uint64_t	duplicates;	/* ... dropped, already queued          */
+    uint64_t	messages;	/* Join/Prune messages sent             */
+    uint64_t	batches;	/* Calls to send_pim_batch()            */
+    uint64_t	split;		/* Groups split over two messages       */
+    uint64_t	received;	/* Join/Prune messages received         */
+    uint64_t	rx_entries;	/* ... sources in them                  */
+    uint64_t	malformed;	/* ... dropped, truncated or malformed  */
+    uint64_t	suppressed;	/* Ours deferred, overheard on the LAN  */
+    uint64_t	overrides;	/* Joins scheduled to override a Prune  */
+    uint64_t	fast_prunes;	/* Prunes from the last tracked router  */
+    uint64_t	tracked;	/* ... ignored, other routers joined    */
+};
+
+/* IGMP leaves, see accept_leave_message() */
+#define LEAVE_BUCKETS	8
+struct leavestats {
+    uint64_t	fast;		/* Last host left, no queries sent      */
+    uint64_t	tracked;	/* ... other hosts remain, ignored      */
+    uint64_t	latency[LEAVE_BUCKETS]; /* Leave to prune, see leave_ms */
+};
+
+/* Register encapsulation, see send_pim_register() */
+struct regstats {
+    uint64_t	hits;		/* Data packets with (S,G) state cached */
+    uint64_t	misses;		/* ... looked up the slow way           */
+    uint64_t	sent;		/* Registers sent without copying       */
+    uint64_t	copied;		/* ... copied, to be fragmented         */
+    uint64_t	failed;		/* ... not sent, other send errors      */
+    uint64_t	suppressed;	/* Not sent, Register-Stop received     */
+    uint64_t	tunnels;	/* Kernel encapsulation tunnels to RPs  */
+    uint64_t	decap_hits;	/* RP: registers taking the fast path   */
+    uint64_t	decap_misses;	/* RP: ... the full validation          */
+};
 
 
 /*
@@ -296,11 +424,28 @@ typedef void (*ihfunc_t) (int);
  */
 extern uint16_t         pim_timer_hello_interval;
 extern uint16_t         pim_timer_hello_holdtime;
+extern u_int            ipc_timeout;
+extern u_int            ipc_budget;
 
 /* TODO: describe the variables and clean up */
-extern char		*igmp_recv_buf;
+extern struct rxring	igmp_rx;
 extern char		*igmp_send_buf;
-extern char		*pim_recv_buf;
+extern struct rxring	pim_rx;
+extern struct rpfstats	rpf_stats;
+extern struct mfcstats	mfc_stats;
+extern struct upcallstats upcall_stats;
+extern struct regstats	reg_stats;
+extern struct jpstats	jp_stats;
+extern struct leavestats leave_stats;
+extern uint32_t		register_gen;
+extern uint32_t		decap_gen;
+extern int		register_kernel_encap;
+extern kernel_cache_t	*negative_cache;
+extern struct pool	srcentry_pool;
+extern struct pool	grpentry_pool;
+extern struct pool	mrtentry_pool;
+extern struct pool	kernel_cache_pool;
+extern struct pool	regstate_pool;
 extern char		*pim_send_buf;
 extern int		igmp_socket;
 extern int		pim_socket;
@@ -308,10 +453,9 @@ extern uint32_t		allhosts_group;
 extern uint32_t		allrouters_group;
 extern uint32_t		allreports_group;
 extern uint32_t		allpimrouters_group;
-extern build_jp_message_t *build_jp_message_pool;
-extern int		build_jp_message_pool_counter;
 
 extern uint32_t		virtual_time;
+extern uint32_t		route_clock;
 extern char            *ident;
 extern char	       *config_file;
 extern char            *prognm;
@@ -383,6 +527,11 @@ extern uint32_t		igmp_querier_timeout;
 /* mrt.c */
 extern srcentry_t 	*srclist;
 extern grpentry_t 	*grplist;
+extern uint64_t		mrt_generation;
+extern uint64_t		mrt_tomb_lost;
+extern time_t		mrt_epoch;
+extern struct mrt_tomb	mrt_tombs[MRT_TOMBS];
+extern uint64_t		mrt_ntombs;
 
 /* vif.c */
 extern struct uvif	uvifs[MAXVIFS];
@@ -472,10 +621,14 @@ extern int		errno;
 extern void	timer_init		(void);
 extern void	timer_exit		(void);
 extern void	timer_age_queue		(int);
+extern void	timer_age_queue_ms	(int);
 extern int	timer_next_delay	(void);
+extern int	timer_next_delay_ms	(void);
 extern int	timer_set		(int, cfunc_t, void *);
+extern int	timer_set_ms		(int, cfunc_t, void *);
 extern void	timer_clear		(int);
 extern int	timer_get		(int);
+extern int	timer_get_ms		(int);
 
 /* config.c */
 extern void	config_vifs_from_kernel	(void);
@@ -502,9 +655,12 @@ extern void	accept_membership_query	(int ifi, uint32_t src, uint32_t dst, uint32
 extern void	accept_group_report	(int ifi, uint32_t src, uint32_t dst, uint32_t group, int r_type);
 extern void	accept_leave_message	(int ifi, uint32_t src, uint32_t dst, uint32_t group);
 extern void	accept_membership_report(int ifi, uint32_t src, uint32_t dst, struct igmpv3_report *report, ssize_t reportlen);
+extern void	flush_groups		(struct uvif *v);
 
 /* inet.c */
 extern int	inet_cksum		(uint16_t *addr, u_int len);
+extern uint16_t	inet_cksum_update	(uint16_t cksum, uint16_t old, uint16_t new);
+extern uint16_t	inet_cksum_update32	(uint16_t cksum, uint32_t old, uint32_t new);
 extern int	inet_valid_host		(uint32_t naddr);
 extern int	inet_valid_mask		(uint32_t mask);
 extern int	inet_valid_subnet	(uint32_t nsubnet, uint32_t nmask);
@@ -515,12 +671,20 @@ extern uint32_t	inet_parse		(char *s, int n);
 /* ipc.c */
 extern void	ipc_init		(char *sockfile);
 extern void	ipc_exit		(void);
+extern void	ipc_age			(void);
+extern void	ipc_route_event		(int op, mrtentry_t *mrt);
+extern void	ipc_nbr_event		(int op, pim_nbr_entry_t *nbr);
+extern void	ipc_rp_event		(int op, rp_grp_entry_t *entry);
+extern void	ipc_igmp_event		(int op, vifi_t vifi, uint32_t group, uint32_t source);
 
 /* kern.c */
 extern void	k_set_sndbuf		(int socket, int bufsize, int minsize);
 extern void	k_set_rcvbuf		(int socket, int bufsize, int minsize);
 extern void	k_hdr_include		(int socket, int val);
 extern void	k_set_pktinfo		(int socket, int val);
+extern int	k_rx_init		(int socket, struct rxring *rx);
+extern void	k_rx_exit		(struct rxring *rx);
+extern int	k_recv_batch		(int socket, struct rxring *rx);
 extern void	k_set_ttl		(int socket, int t);
 extern void	k_set_loop		(int socket, int l);
 extern void	k_set_if		(int socket, uint32_t ifa);
@@ -529,16 +693,22 @@ extern void	k_join			(int socket, uint32_t grp, struct uvif *v);
 extern void	k_leave			(int socket, uint32_t grp, struct uvif *v);
 extern void	k_init_pim		(int socket);
 extern void	k_stop_pim		(int socket);
+extern void	k_regtun_init		(int socket);
+extern void	k_regtun_exit		(void);
+extern int	k_regtun_input		(vifi_t vifi);
 extern int	k_del_mfc		(int socket, uint32_t source, uint32_t group);
-extern int	k_chg_mfc		(int socket, uint32_t source, uint32_t group, vifi_t iif, uint8_t *oifs,
+extern int	k_chg_mfc		(int socket, uint32_t source, uint32_t group, vifi_t iif, vifset_t oifs,
                                          uint32_t rp_addr);
+extern void	k_mfc_flush		(void);
+extern void	k_mfc_rp_change		(void);
 extern void	k_add_vif		(int socket, vifi_t vifi, struct uvif *v);
 extern void	k_del_vif		(int socket, vifi_t vifi, struct uvif *v);
 extern int	k_get_vif_count		(vifi_t vifi, struct vif_count *retval);
 extern int	k_get_sg_cnt		(int socket, uint32_t source, uint32_t group, struct sg_count *retval);
 
 /* main.c */
-extern int	register_input_handler	(int fd, ihfunc_t func);
+extern int	register_input_handler	(int fd, ihfunc_t func, int flags);
+extern int	deregister_input_handler(int fd);
 extern int      daemon_restart          (char *buf, size_t len);
 extern int      daemon_kill             (char *buf, size_t len);
 
@@ -546,6 +716,7 @@ extern int      daemon_kill             (char *buf, size_t len);
 extern void	init_pim_mrt		(void);
 extern mrtentry_t *find_route		(uint32_t source, uint32_t group, uint16_t flags, char create);
 extern grpentry_t *find_group		(uint32_t group);
+extern mrtentry_t *find_sg_route		(grpentry_t *grp, uint32_t source);
 extern srcentry_t *find_source		(uint32_t source);
 extern void	delete_mrtentry		(mrtentry_t *mrtentry_ptr);
 extern void	delete_srcentry		(srcentry_t *srcentry_ptr);
@@ -554,10 +725,16 @@ extern void	delete_mrtentry_all_kernel_cache (mrtentry_t *mrtentry_ptr);
 extern void	delete_single_kernel_cache (mrtentry_t *mrtentry_ptr, kernel_cache_t *kernel_cache_ptr);
 extern void	delete_single_kernel_cache_addr (mrtentry_t *mrtentry_ptr, uint32_t source, uint32_t group);
 extern void	add_kernel_cache	(mrtentry_t *mrtentry_ptr, uint32_t source, uint32_t group, uint16_t flags);
+extern kernel_cache_t *find_kernel_cache	(uint32_t source, uint32_t group, mrtentry_t **found);
+extern uint32_t	mrt_sum			(uint32_t sum, const void *data, size_t len);
+extern uint64_t	mrt_gen			(mrtentry_t *mrt);
+extern void	mrt_tomb		(mrtentry_t *mrt);
 /* pim.c */
 extern void	init_pim		(void);
 extern void	send_pim		(char *buf, uint32_t src, uint32_t dst, int type, size_t len);
+extern void	send_pim_batch		(char *buf[], size_t len[], int num, uint32_t src, uint32_t dst, int type);
 extern void	send_pim_unicast	(char *buf, int mtu, uint32_t src, uint32_t dst, int type, size_t len);
+extern int	send_pim_register_iov	(char *pkt, size_t len, uint32_t src, uint32_t dst);
 
 /* pim_proto.c */
 extern int	receive_pim_hello	(uint32_t src, uint32_t dst, char *msg, size_t len);
@@ -567,11 +744,16 @@ extern int	receive_pim_register	(uint32_t src, uint32_t dst, char *msg, size_t l
 extern int	send_pim_null_register	(mrtentry_t *r);
 extern int	receive_pim_register_stop (uint32_t src, uint32_t dst, char *msg, size_t len);
 extern int	send_pim_register	(char *pkt);
+extern void	register_forget		(mrtentry_t *mrt);
+extern void	jp_forget		(mrtentry_t *mrt);
+extern void	register_rate		(regstate_t *reg, uint32_t *pps, uint64_t *bps);
+extern int	parse_pim_join_prune	(char *msg, size_t len, jp_message_t *jp);
 extern int	receive_pim_join_prune	(uint32_t src, uint32_t dst, char *msg, size_t len);
 extern int	join_or_prune		(mrtentry_t *mrtentry_ptr, pim_nbr_entry_t *upstream_router);
 extern int	receive_pim_assert	(uint32_t src, uint32_t dst, char *msg, size_t len);
 extern int	send_pim_assert		(uint32_t source, uint32_t group, vifi_t vifi, mrtentry_t *mrtentry_ptr);
 extern void     send_pim_join           (pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags, uint16_t holdtime);
+extern void     send_pim_prune          (pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags, uint16_t holdtime);
 extern int	send_periodic_pim_join_prune (vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t holdtime);
 extern int	add_jp_entry		(pim_nbr_entry_t *pim_nbr, uint16_t holdtime, uint32_t group, uint8_t grp_msklen,
                                          uint32_t source, uint8_t src_msklen,  uint16_t addr_flags, uint8_t join_prune);
@@ -584,24 +766,31 @@ extern void	send_pim_bootstrap	(void);
 /* route.c */
 extern void	init_route		(void);
 extern int	set_incoming		(srcentry_t *srcentry_ptr, int srctype);
+extern void	rpf_changed		(uint32_t address);
 extern vifi_t	get_iif			(uint32_t source);
 extern pim_nbr_entry_t *find_pim_nbr	(uint32_t source);
 extern int	add_sg_oif		(mrtentry_t *mrtentry_ptr, vifi_t vifi, uint16_t holdtime, int update_holdtime);
 extern void	add_leaf		(vifi_t vifi, uint32_t source, uint32_t group);
 extern void	delete_leaf		(vifi_t vifi, uint32_t source, uint32_t group);
 extern int	change_interfaces	(mrtentry_t *mrtentry_ptr,  vifi_t new_iif,
-                                         uint8_t *new_joined_oifs_, uint8_t *new_pruned_oifs,
-                                         uint8_t *new_leaves_, uint8_t *new_asserted_oifs, uint16_t flags);
-extern void	calc_oifs		(mrtentry_t *mrtentry_ptr, uint8_t *oifs_ptr);
-extern void	process_kernel_call	(void);
+                                         vifset_t new_joined_oifs_, vifset_t new_pruned_oifs,
+                                         vifset_t new_leaves_, vifset_t new_asserted_oifs, uint16_t flags);
+extern void	calc_oifs		(mrtentry_t *mrtentry_ptr, vifset_t oifs_ptr);
+extern void	process_kernel_call	(char *buf);
 extern int	delete_vif_from_mrt	(vifi_t vifi);
 extern mrtentry_t *switch_shortest_path	(uint32_t source, uint32_t group);
 extern void	age_routes		(void);
+extern void	mrt_schedule		(mrtentry_t *mrt, uint32_t when);
+extern void	mrt_unschedule		(mrtentry_t *mrt);
 
 /* routesock.c and netlink.c */
 extern int	init_routesock		(void);
 extern void     routesock_clean         (void);
 extern int	k_req_incoming		(uint32_t source, struct rpfctl *rpfp);
+extern int	k_route_notify		(void);
+extern void	k_rpf_age		(void);
+extern int	k_tunnel_add		(const char *ifname, uint32_t remote);
+extern void	k_tunnel_del		(int ifindex);
 extern int	routing_socket;
 
 /* rp.c */
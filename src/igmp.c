@@ -45,7 +45,7 @@
 /*
  * Exported variables.
  */
-char     *igmp_recv_buf;	/* input packet buffer               */
+struct rxring igmp_rx;		/* input packet buffers              */
 char     *igmp_send_buf;	/* output packet buffer              */
 int       igmp_socket;		/* socket for all network I/O        */
 in_addr_t allhosts_group;	/* allhosts  addr in net order       */
@@ -60,7 +60,7 @@ extern int curttl;
  * Local functions definitions.
  */
 static void igmp_read   (int sd);
-static void accept_igmp (int ifi, ssize_t recvlen);
+static void accept_igmp (int ifi, char *buf, ssize_t recvlen);
 
 
 /*
@@ -72,28 +72,29 @@ void init_igmp(void)
     char *router_alert;
     struct ip *ip;
 
-    if (!igmp_recv_buf)
-	igmp_recv_buf = malloc(RECV_BUF_SIZE);
-
     if (!igmp_send_buf)
 	igmp_send_buf = malloc(SEND_BUF_SIZE);
 
-    if (!igmp_recv_buf || !igmp_send_buf) {
+    if (!igmp_send_buf) {
 	logit(LOG_ERR, 0, "Ran out of memory in init_igmp()");
 	return;
     }
 
-    memset(igmp_recv_buf, 0, RECV_BUF_SIZE);
     memset(igmp_send_buf, 0, SEND_BUF_SIZE);
 
     igmp_socket = socket(AF_INET, SOCK_RAW, IPPROTO_IGMP);
     if (igmp_socket < 0) {
 	logit(LOG_ERR, errno, "Failed creating IGMP socket in init_igmp()");
-	free(igmp_recv_buf);
 	free(igmp_send_buf);
 	return;
     }
 
+    if (k_rx_init(igmp_socket, &igmp_rx)) {
+	logit(LOG_ERR, 0, "Ran out of memory in init_igmp()");
+	close(igmp_socket);
+	return;
+    }
+
     k_hdr_include(igmp_socket, TRUE);	/* include IP header when sending */
     k_set_pktinfo(igmp_socket, TRUE);	/* ifindex in aux data on receive */
     k_set_sndbuf(igmp_socket, SO_SEND_BUF_SIZE_MAX,
@@ -128,59 +129,27 @@ void init_igmp(void)
     allrouters_group = htonl(INADDR_ALLRTRS_GROUP);
     allreports_group = htonl(INADDR_ALLRPTS_GROUP);
 
-    if (register_input_handler(igmp_socket, igmp_read) < 0)
+    if (register_input_handler(igmp_socket, igmp_read, IH_LEVEL) < 0)
 	logit(LOG_ERR, 0, "Failed registering igmp_read() as an input handler in init_igmp()");
 }
 
 
-/* Read an IGMP message from igmp_socket */
+/* Read a batch of IGMP messages, and kernel upcalls, from igmp_socket */
 static void igmp_read(int sd)
 {
-    struct cmsghdr *cmsg;
-    struct msghdr msgh;
-    char cmbuf[0x100];
-    struct iovec iov;
-    int ifi = -1;
-    ssize_t len;
-
-    memset(&msgh, 0, sizeof(msgh));
-    iov.iov_base = igmp_recv_buf;
-    iov.iov_len = RECV_BUF_SIZE;
-    msgh.msg_control = cmbuf;
-    msgh.msg_controllen = sizeof(cmbuf);
-    msgh.msg_iov  = &iov;
-    msgh.msg_iovlen = 1;
-    msgh.msg_flags = 0;
-
-    while ((len = recvmsg(sd, &msgh, 0)) < 0) {
-	if (errno == EINTR)
-	    continue;		/* Received signal, retry syscall. */
-
-	logit(LOG_ERR, errno, "Failed recvfrom() in igmp_read()");
-	return;
-    }
-
-    for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg; cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
-#ifdef IP_PKTINFO
-	struct in_pktinfo *ipi = (struct in_pktinfo *)CMSG_DATA(cmsg);
-	char tmp[IF_NAMESIZE + 1] = { 0 };
-
-	if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_PKTINFO)
-	    continue;
-
-	ifi = ipi->ipi_ifindex;
-	break;
-#endif
-    }
+    int i, num;
 
-    accept_igmp(ifi, len);
+    /* Any remaining packets are read on the next turn of the main loop */
+    num = k_recv_batch(sd, &igmp_rx);
+    for (i = 0; i < num; i++)
+	accept_igmp(igmp_rx.msg[i].ifindex, igmp_rx.msg[i].buf, igmp_rx.msg[i].len);
 }
 
 /*
  * Process a newly received IGMP packet that is sitting in the input
  * packet buffer.
  */
-static void accept_igmp(int ifi, ssize_t recvlen)
+static void accept_igmp(int ifi, char *buf, ssize_t recvlen)
 {
     int ipdatalen, iphdrlen, igmpdatalen;
     uint32_t src, dst, group;
@@ -193,7 +162,7 @@ static void accept_igmp(int ifi, ssize_t recvlen)
 	return;
     }
 
-    ip  = (struct ip *)igmp_recv_buf;
+    ip  = (struct ip *)buf;
     src = ip->ip_src.s_addr;
     dst = ip->ip_dst.s_addr;
 
@@ -205,7 +174,7 @@ static void accept_igmp(int ifi, ssize_t recvlen)
 		inet_fmt(src, s1, sizeof(s1)), inet_fmt(dst, s2, sizeof(s2)));
 	else
 #endif
-	    process_kernel_call();
+	    process_kernel_call(buf);
 	return;
     }
 
@@ -218,7 +187,7 @@ static void accept_igmp(int ifi, ssize_t recvlen)
 	return;
     }
 
-    igmp	= (struct igmp *)(igmp_recv_buf + iphdrlen);
+    igmp	= (struct igmp *)(buf + iphdrlen);
     group       = igmp->igmp_group.s_addr;
     igmpdatalen = ipdatalen - IGMP_MINLEN;
 
@@ -265,7 +234,7 @@ static void accept_igmp(int ifi, ssize_t recvlen)
 		      igmpdatalen, IGMP_V3_GROUP_RECORD_MIN_SIZE);
 		return;
 	    }
-	    accept_membership_report(ifi, src, dst, (struct igmpv3_report *)(igmp_recv_buf + iphdrlen), recvlen - iphdrlen);
+	    accept_membership_report(ifi, src, dst, (struct igmpv3_report *)(buf + iphdrlen), recvlen - iphdrlen);
 	    return;
 
 	case IGMP_DVMRP:
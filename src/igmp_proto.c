@@ -62,11 +62,383 @@ static void send_query   (struct uvif *v, uint32_t group, int interval);
 static void SendQuery    (void *arg);
 static int SetQueryTimer (struct listaddr *g, vifi_t vifi, int to_expire, int q_time, int q_len);
 static uint32_t igmp_group_membership_timeout(void);
+static void delete_membership(vifi_t vifi, struct listaddr *group, uint32_t source);
 
 /* The querier timeout depends on the configured query interval */
 uint32_t igmp_query_interval  = IGMP_QUERY_INTERVAL;
 uint32_t igmp_querier_timeout = IGMP_OTHER_QUERIER_PRESENT_INTERVAL;
 
+struct leavestats leave_stats;
+
+#define IGMP_HASH_MIN	16
+
+/* Groups, their SSM sources and fast-leave hosts */
+static struct pool listaddr_pool;
+
+static struct listaddr *listaddr_alloc(uint32_t addr)
+{
+    struct listaddr *al;
+
+    pool_init(&listaddr_pool, "listaddr", sizeof(struct listaddr));
+    al = pool_alloc(&listaddr_pool);
+    if (!al) {
+	logit(LOG_WARNING, 0, "Ran out of memory in %s()", __func__);
+	return NULL;
+    }
+    al->al_addr = addr;
+
+    return al;
+}
+
+/* Monotonic time in milliseconds, for leave latency */
+static int64_t leave_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Account the time from a leave until the membership, and leaf, is gone */
+static void leave_latency(int64_t since)
+{
+    static const int64_t limit[LEAVE_BUCKETS - 1] = {
+	1, 10, 100, 1000, 2000, 5000, 10000
+    };
+    int64_t ms = leave_ms() - since;
+    int i;
+
+    for (i = 0; i < LEAVE_BUCKETS - 1; i++) {
+	if (ms < limit[i])
+	    break;
+    }
+    leave_stats.latency[i]++;
+}
+
+/*
+ * Fast-leave host tracking, each group, or SSM source, on a vif with
+ * VIFF_FAST_LEAVE keeps the hosts that have reported it in an array
+ * sorted by address, like the SSM sources.  A host that has not
+ * reported within the membership timeout no longer counts, those are
+ * weeded out when the array is full, and when the last one leaves.
+ */
+static int lookup_host(struct listaddr *al, uint32_t host, uint32_t *pos)
+{
+    uint32_t lo = 0, hi = al->al_nhosts;
+
+    while (lo < hi) {
+	uint32_t mid = lo + (hi - lo) / 2;
+	uint32_t addr = ntohl(al->al_hosts[mid].lh_addr);
+
+	if (addr == ntohl(host)) {
+	    *pos = mid;
+	    return TRUE;
+	}
+
+	if (addr < ntohl(host))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    *pos = lo;
+
+    return FALSE;
+}
+
+static int host_stale(struct listhost *h, time_t now)
+{
+    return now - h->lh_time >= (time_t)igmp_group_membership_timeout();
+}
+
+/* Drop the hosts that have stopped reporting, keeps the order */
+static void host_expire(struct listaddr *al, time_t now)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < al->al_nhosts; i++) {
+	if (!host_stale(&al->al_hosts[i], now))
+	    al->al_hosts[num++] = al->al_hosts[i];
+    }
+    al->al_nhosts = num;
+}
+
+static void host_report(struct listaddr *al, uint32_t host)
+{
+    time_t now = time(NULL);
+    uint32_t pos;
+
+    if (!lookup_host(al, host, &pos)) {
+	if (al->al_nhosts == al->al_maxhosts) {
+	    host_expire(al, now);
+
+	    /* Grow unless that freed up at least half, amortized O(1) */
+	    if (al->al_nhosts >= al->al_maxhosts / 2) {
+		struct listhost *arr;
+		uint32_t max = al->al_maxhosts ? al->al_maxhosts * 2 : 4;
+
+		arr = realloc(al->al_hosts, max * sizeof(struct listhost));
+		if (!arr) {
+		    logit(LOG_WARNING, 0, "Ran out of memory in %s()", __func__);
+		    return;
+		}
+		al->al_hosts    = arr;
+		al->al_maxhosts = max;
+	    }
+	    lookup_host(al, host, &pos);
+	}
+
+	memmove(&al->al_hosts[pos + 1], &al->al_hosts[pos],
+		(al->al_nhosts - pos) * sizeof(struct listhost));
+	al->al_hosts[pos].lh_addr = host;
+	al->al_nhosts++;
+    }
+
+    al->al_hosts[pos].lh_time = now;
+}
+
+/*
+ * Remove a host that left, returns -1 if it was not tracked, otherwise
+ * the number of hosts still tracked, zero if none of them is reporting.
+ */
+static int host_leave(struct listaddr *al, uint32_t host)
+{
+    time_t now = time(NULL);
+    uint32_t pos, i;
+
+    if (!lookup_host(al, host, &pos))
+	return -1;
+
+    al->al_nhosts--;
+    memmove(&al->al_hosts[pos], &al->al_hosts[pos + 1],
+	    (al->al_nhosts - pos) * sizeof(struct listhost));
+
+    /* Usually the first one is still reporting */
+    for (i = 0; i < al->al_nhosts; i++) {
+	if (!host_stale(&al->al_hosts[i], now))
+	    return al->al_nhosts;
+    }
+    al->al_nhosts = 0;
+
+    return 0;
+}
+
+static void flush_hosts(struct listaddr *al)
+{
+    free(al->al_hosts);
+    al->al_hosts    = NULL;
+    al->al_nhosts   = 0;
+    al->al_maxhosts = 0;
+}
+
+/* Free a group, or source, with its hosts and source array */
+static void listaddr_free(struct listaddr *al)
+{
+    flush_hosts(al);
+    free(al->al_sources);
+    pool_free(&listaddr_pool, al);
+}
+
+/*
+ * Group membership on each vif is indexed by a hash table, like the
+ * routing table in mrt.c, it starts small and doubles when the load
+ * factor exceeds one.  The uv_groups list, in no particular order, is
+ * for walking all groups.  The SSM sources of a group are kept in an
+ * array sorted by address, most groups have only a few.
+ */
+static struct listaddr *lookup_group(struct uvif *v, uint32_t group)
+{
+    struct listaddr *g;
+
+    if (!v->uv_grphash)
+	return NULL;
+
+    for (g = v->uv_grphash[addr_hash(group) & (v->uv_grphash_size - 1)]; g; g = g->al_hnext) {
+	if (g->al_addr == group)
+	    return g;
+    }
+
+    return NULL;
+}
+
+static void link_group(struct uvif *v, struct listaddr *g)
+{
+    uint32_t i;
+
+    if (v->uv_ngroups >= v->uv_grphash_size) {
+	struct listaddr **tbl, *node, *next;
+	uint32_t size;
+
+	size = v->uv_grphash_size ? v->uv_grphash_size * 2 : IGMP_HASH_MIN;
+	tbl = calloc(size, sizeof(struct listaddr *));
+	if (!tbl) {
+	    logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
+	    return;
+	}
+
+	for (i = 0; i < v->uv_grphash_size; i++) {
+	    for (node = v->uv_grphash[i]; node; node = next) {
+		next = node->al_hnext;
+		node->al_hnext = tbl[addr_hash(node->al_addr) & (size - 1)];
+		tbl[addr_hash(node->al_addr) & (size - 1)] = node;
+	    }
+	}
+
+	free(v->uv_grphash);
+	v->uv_grphash      = tbl;
+	v->uv_grphash_size = size;
+    }
+
+    i = addr_hash(g->al_addr) & (v->uv_grphash_size - 1);
+    g->al_hnext = v->uv_grphash[i];
+    v->uv_grphash[i] = g;
+
+    g->al_prev = NULL;
+    g->al_next = v->uv_groups;
+    if (g->al_next)
+	g->al_next->al_prev = g;
+    v->uv_groups = g;
+    v->uv_ngroups++;
+
+    /* Members of SSM groups join per source, see add_source() */
+    if (!IN_PIM_SSM_RANGE(g->al_addr))
+	ipc_igmp_event(IPC_EV_ADD, v - uvifs, g->al_addr, INADDR_ANY_N);
+}
+
+static void unlink_group(struct uvif *v, struct listaddr *g)
+{
+    struct listaddr **pp;
+
+    if (g->al_prev)
+	g->al_prev->al_next = g->al_next;
+    else
+	v->uv_groups = g->al_next;
+    if (g->al_next)
+	g->al_next->al_prev = g->al_prev;
+
+    for (pp = &v->uv_grphash[addr_hash(g->al_addr) & (v->uv_grphash_size - 1)]; *pp; pp = &(*pp)->al_hnext) {
+	if (*pp == g) {
+	    *pp = g->al_hnext;
+	    break;
+	}
+    }
+    v->uv_ngroups--;
+
+    if (!IN_PIM_SSM_RANGE(g->al_addr))
+	ipc_igmp_event(IPC_EV_DEL, v - uvifs, g->al_addr, INADDR_ANY_N);
+}
+
+/*
+ * Binary search for an SSM source, returns TRUE if found.  Either way
+ * @pos is set to its index, or where it should be inserted.
+ */
+static int lookup_source(struct listaddr *g, uint32_t source, uint32_t *pos)
+{
+    uint32_t lo = 0, hi = g->al_nsources;
+
+    while (lo < hi) {
+	uint32_t mid = lo + (hi - lo) / 2;
+	uint32_t addr = ntohl(g->al_sources[mid]->al_addr);
+
+	if (addr == ntohl(source)) {
+	    *pos = mid;
+	    return TRUE;
+	}
+
+	if (addr < ntohl(source))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    *pos = lo;
+
+    return FALSE;
+}
+
+static struct listaddr *add_source(vifi_t vifi, struct listaddr *g, uint32_t source)
+{
+    struct listaddr *s;
+    uint32_t pos;
+
+    if (lookup_source(g, source, &pos))
+	return g->al_sources[pos];
+
+    if (g->al_nsources == g->al_maxsources) {
+	struct listaddr **arr;
+	uint32_t max = g->al_maxsources ? g->al_maxsources * 2 : 4;
+
+	arr = realloc(g->al_sources, max * sizeof(struct listaddr *));
+	if (!arr) {
+	    logit(LOG_WARNING, 0, "Ran out of memory in %s()", __func__);
+	    return NULL;
+	}
+	g->al_sources    = arr;
+	g->al_maxsources = max;
+    }
+
+    s = listaddr_alloc(source);
+    if (!s)
+	return NULL;
+
+    memmove(&g->al_sources[pos + 1], &g->al_sources[pos],
+	    (g->al_nsources - pos) * sizeof(struct listaddr *));
+    g->al_sources[pos] = s;
+    g->al_nsources++;
+    ipc_igmp_event(IPC_EV_ADD, vifi, g->al_addr, source);
+
+    return s;
+}
+
+/* Remove a source from its group, the caller frees it */
+static struct listaddr *unlink_source(vifi_t vifi, struct listaddr *g, uint32_t pos)
+{
+    struct listaddr *s = g->al_sources[pos];
+
+    g->al_nsources--;
+    memmove(&g->al_sources[pos], &g->al_sources[pos + 1],
+	    (g->al_nsources - pos) * sizeof(struct listaddr *));
+    ipc_igmp_event(IPC_EV_DEL, vifi, g->al_addr, s->al_addr);
+
+    return s;
+}
+
+/*
+ * Discard all group membership on a vif, the kernel state is cleaned
+ * up by the caller.
+ */
+void flush_groups(struct uvif *v)
+{
+    struct listaddr *g;
+    uint32_t i;
+
+    while ((g = v->uv_groups)) {
+	v->uv_groups = g->al_next;
+
+	for (i = 0; i < g->al_nsources; i++) {
+	    if (g->al_sources[i]->al_versiontimer)
+		timer_clear(g->al_sources[i]->al_versiontimer);
+	    ipc_igmp_event(IPC_EV_DEL, v - uvifs, g->al_addr, g->al_sources[i]->al_addr);
+	    listaddr_free(g->al_sources[i]);
+	}
+	if (!IN_PIM_SSM_RANGE(g->al_addr))
+	    ipc_igmp_event(IPC_EV_DEL, v - uvifs, g->al_addr, INADDR_ANY_N);
+
+	/* Clear timers, preventing possible memory double free */
+	if (g->al_timerid)
+	    timer_clear(g->al_timerid);
+	if (g->al_versiontimer)
+	    timer_clear(g->al_versiontimer);
+	if (g->al_query)
+	    timer_clear(g->al_query);
+	listaddr_free(g);
+    }
+
+    free(v->uv_grphash);
+    v->uv_grphash      = NULL;
+    v->uv_grphash_size = 0;
+    v->uv_ngroups      = 0;
+}
+
 
 /*
  * Send group membership queries on that interface if I am querier.
@@ -251,21 +623,19 @@ void accept_membership_query(int ifi, uint32_t src, uint32_t dst, uint32_t group
 		  inet_fmt(group, s2, sizeof(s2)), inet_fmt(src, s1, sizeof(s1)), vifi, tmo);
 	}
 
-	for (g = v->uv_groups; g != NULL; g = g->al_next) {
-	    if (group == g->al_addr && g->al_query == 0) {
-		/* setup a timeout to remove the group membership */
-		if (g->al_timerid)
-		    g->al_timerid = DeleteTimer(g->al_timerid);
-
-		g->al_timer = IGMP_LAST_MEMBER_QUERY_COUNT * tmo / IGMP_TIMER_SCALE;
-		/* use al_query to record our presence in last-member state */
-		g->al_query = -1;
-		g->al_timerid = SetTimer(vifi, g, 0);
-		IF_DEBUG(DEBUG_IGMP) {
-		    logit(LOG_DEBUG, 0, "Timer for grp %s on vif %d set to %u",
-			  inet_fmt(group, s2, sizeof(s2)), vifi, g->al_timer);
-		}
-		break;
+	g = lookup_group(v, group);
+	if (g && g->al_query == 0) {
+	    /* setup a timeout to remove the group membership */
+	    if (g->al_timerid)
+		g->al_timerid = DeleteTimer(g->al_timerid);
+
+	    g->al_timer = IGMP_LAST_MEMBER_QUERY_COUNT * tmo / IGMP_TIMER_SCALE;
+	    /* use al_query to record our presence in last-member state */
+	    g->al_query = -1;
+	    g->al_timerid = SetTimer(vifi, g, 0);
+	    IF_DEBUG(DEBUG_IGMP) {
+		logit(LOG_DEBUG, 0, "Timer for grp %s on vif %d set to %u",
+		      inet_fmt(group, s2, sizeof(s2)), vifi, g->al_timer);
 	    }
 	}
     }
@@ -311,90 +681,67 @@ void accept_group_report(int ifi, uint32_t igmp_src, uint32_t ssm_src, uint32_t
     /*
      * Look for the group in our group list; if found, reset its timer.
      */
-    for (g = v->uv_groups; g != NULL; g = g->al_next) {
-	if (group == g->al_addr) {
-	    int old_report = 0;
-
-	    if (igmp_report_type == IGMP_V1_MEMBERSHIP_REPORT) {
-		g->al_old = DVMRP_OLD_AGE_THRESHOLD;
-		old_report = 1;
+    g = lookup_group(v, group);
+    if (g) {
+	int old_report = 0;
 
-		if (g->al_pv > 1) {
-		    IF_DEBUG(DEBUG_IGMP)
-			logit(LOG_DEBUG, 0, "Change IGMP compatibility mode to v1 for group %s", s3);
-		    g->al_pv = 1;
-		}
-	    } else if (igmp_report_type == IGMP_V2_MEMBERSHIP_REPORT) {
-		old_report = 1;
+	if (igmp_report_type == IGMP_V1_MEMBERSHIP_REPORT) {
+	    g->al_old = DVMRP_OLD_AGE_THRESHOLD;
+	    old_report = 1;
 
-		if (g->al_pv > 2) {
-		    IF_DEBUG(DEBUG_IGMP)
-			logit(LOG_DEBUG, 0, "Change IGMP compatibility mode to v2 for group %s", s3);
-		    g->al_pv = 2;
-		}
+	    if (g->al_pv > 1) {
+		IF_DEBUG(DEBUG_IGMP)
+		    logit(LOG_DEBUG, 0, "Change IGMP compatibility mode to v1 for group %s", s3);
+		g->al_pv = 1;
 	    }
+	} else if (igmp_report_type == IGMP_V2_MEMBERSHIP_REPORT) {
+	    old_report = 1;
 
-	    g->al_reporter = igmp_src;
+	    if (g->al_pv > 2) {
+		IF_DEBUG(DEBUG_IGMP)
+		    logit(LOG_DEBUG, 0, "Change IGMP compatibility mode to v2 for group %s", s3);
+		g->al_pv = 2;
+	    }
+	}
 
-	    /** delete old timers, set a timer for expiration **/
-	    g->al_timer = igmp_group_membership_timeout();
-	    if (g->al_query)
-		g->al_query = DeleteTimer(g->al_query);
+	g->al_reporter = igmp_src;
+	g->al_leave    = 0;
 
-	    if (g->al_timerid)
-		g->al_timerid = DeleteTimer(g->al_timerid);
+	/** delete old timers, set a timer for expiration **/
+	g->al_timer = igmp_group_membership_timeout();
+	if (g->al_query)
+	    g->al_query = DeleteTimer(g->al_query);
 
-	    g->al_timerid = SetTimer(vifi, g, ssm_src);
+	if (g->al_timerid)
+	    g->al_timerid = DeleteTimer(g->al_timerid);
 
-	    /* Reset timer for switching version back every time an older version report is received */
-	    if (g->al_pv < 3 && old_report) {
-		if (g->al_versiontimer)
-			g->al_versiontimer = DeleteTimer(g->al_versiontimer);
+	g->al_timerid = SetTimer(vifi, g, ssm_src);
 
-		g->al_versiontimer = SetVerTimer(vifi, g);
-	    }
+	/* Reset timer for switching version back every time an older version report is received */
+	if (g->al_pv < 3 && old_report) {
+	    if (g->al_versiontimer)
+		    g->al_versiontimer = DeleteTimer(g->al_versiontimer);
 
-	    /* Find source */
-	    if (IN_PIM_SSM_RANGE(group)) {
-		for (s = g->al_sources; s; s = s->al_next) {
-		    IF_DEBUG(DEBUG_IGMP)
-			logit(LOG_DEBUG, 0, "%s(): Seek source %s, curr=%s", __func__,
-			      inet_fmt(ssm_src, s1, sizeof(s1)),
-			      inet_fmt(s->al_addr, s2, sizeof(s2)));
-		    if (ssm_src == s->al_addr) {
-			IF_DEBUG(DEBUG_IGMP)
-			    logit(LOG_DEBUG, 0, "%s(): Source found", __func__);
-			break;
-		    }
-		}
-		if (!s) {
-		    /* Add new source */
-		    s = calloc(1, sizeof(struct listaddr));
-		    if (!s) {
-			logit(LOG_ERR, errno, "%s(): Ran out of memory", __func__);
-			return;
-		    }
-		    s->al_addr = ssm_src;
-		    s->al_next = g->al_sources;
-		    g->al_sources = s;
+	    g->al_versiontimer = SetVerTimer(vifi, g);
+	}
 
-		    IF_DEBUG(DEBUG_IGMP)
-			logit(LOG_DEBUG, 0, "%s(): Source %s added to g:%p", __func__, s2, g);
-		}
-	    }
+	/* Find source, or add new source */
+	if (IN_PIM_SSM_RANGE(group)) {
+	    s = add_source(vifi, g, ssm_src);
+	    if (!s)
+		return;
+	}
 
-	    /* TODO: might need to add a check if I am the forwarder??? */
-	    /* if (v->uv_flags & VIFF_DR) */
-	    if (IN_PIM_SSM_RANGE(group)) {
-		IF_DEBUG(DEBUG_IGMP)
-		    logit(LOG_INFO, 0, "Add leaf (%s,%s)", s1, s3);
-		add_leaf(vifi, ssm_src, group);
-	    } else {
-		IF_DEBUG(DEBUG_IGMP)
-		    logit(LOG_INFO, 0, "Add leaf (*,%s)", s3);
-		add_leaf(vifi, INADDR_ANY_N, group);
-	    }
-	    break;
+	/* TODO: might need to add a check if I am the forwarder??? */
+	/* if (v->uv_flags & VIFF_DR) */
+	if (IN_PIM_SSM_RANGE(group)) {
+	    IF_DEBUG(DEBUG_IGMP)
+		logit(LOG_INFO, 0, "Add leaf (%s,%s)", s1, s3);
+	    add_leaf(vifi, ssm_src, group);
+	} else {
+	    IF_DEBUG(DEBUG_IGMP)
+		logit(LOG_INFO, 0, "Add leaf (*,%s)", s3);
+	    add_leaf(vifi, INADDR_ANY_N, group);
 	}
     }
 
@@ -402,13 +749,10 @@ void accept_group_report(int ifi, uint32_t igmp_src, uint32_t ssm_src, uint32_t
      * If not found, add it to the list and update kernel cache.
      */
     if (!g) {
-	g = calloc(1, sizeof(struct listaddr));
-	if (!g) {
-	    logit(LOG_ERR, errno, "%s(): Ran out of memory", __func__);
+	g = listaddr_alloc(group);
+	if (!g)
 	    return;
-	}
 
-	g->al_addr = group;
 	if (igmp_report_type == IGMP_V1_MEMBERSHIP_REPORT) {
 	    g->al_old = DVMRP_OLD_AGE_THRESHOLD;
 	    IF_DEBUG(DEBUG_IGMP)
@@ -424,14 +768,11 @@ void accept_group_report(int ifi, uint32_t igmp_src, uint32_t ssm_src, uint32_t
 
 	/* Add new source */
 	if (IN_PIM_SSM_RANGE(group)) {
-	    s = calloc(1, sizeof(struct listaddr));
+	    s = add_source(vifi, g, ssm_src);
 	    if (!s) {
-		logit(LOG_ERR, errno, "%s(): Ran out of memory", __func__);
+		listaddr_free(g);
 		return;
 	    }
-	    s->al_addr = ssm_src;
-	    s->al_next = g->al_sources;
-	    g->al_sources = s;
 	    IF_DEBUG(DEBUG_IGMP)
 		logit(LOG_DEBUG, 0, "%s(): Source %s added to new g:%p", __func__, s2, g);
 	}
@@ -446,8 +787,7 @@ void accept_group_report(int ifi, uint32_t igmp_src, uint32_t ssm_src, uint32_t
 	if (g->al_pv < 3)
 	    g->al_versiontimer = SetVerTimer(vifi, g);
 
-	g->al_next      = v->uv_groups;
-	v->uv_groups    = g;
+	link_group(v, g);
 	time(&g->al_ctime);
 
 	/* TODO: might need to add a check if I am the forwarder??? */
@@ -462,10 +802,54 @@ void accept_group_report(int ifi, uint32_t igmp_src, uint32_t ssm_src, uint32_t
 	    add_leaf(vifi, INADDR_ANY_N, group);
 	}
     }
+
+    if ((v->uv_flags & VIFF_FAST_LEAVE) && igmp_report_type == IGMP_V3_MEMBERSHIP_REPORT)
+	host_report(s ? s : g, igmp_src);
 }
 
+/*
+ * Fast-leave, when the last tracked IGMPv3 host leaves a group, or
+ * source, the membership is deleted at once and the upstream pruned.
+ * Returns FALSE if the host was not tracked, for regular processing.
+ */
+static int fast_leave(vifi_t vifi, struct listaddr *g, uint32_t src, uint32_t dst)
+{
+    struct listaddr *al = g;
+    int64_t now = leave_ms();
+    uint32_t pos;
+    int left;
+
+    if (IN_PIM_SSM_RANGE(g->al_addr)) {
+	if (!dst || !lookup_source(g, dst, &pos))
+	    return FALSE;
+	al = g->al_sources[pos];
+    }
+
+    left = host_leave(al, src);
+    if (left < 0)
+	return FALSE;
+
+    if (left > 0) {
+	IF_DEBUG(DEBUG_IGMP)
+	    logit(LOG_DEBUG, 0, "%s(): %d hosts still joined %s", __func__, left,
+		  inet_fmt(g->al_addr, s1, sizeof(s1)));
+	leave_stats.tracked++;
+	return TRUE;
+    }
+
+    /* Group is freed, unless other SSM sources remain */
+    if (al == g || g->al_nsources == 1) {
+	if (g->al_timerid)
+	    g->al_timerid = DeleteTimer(g->al_timerid);
+    }
+
+    leave_stats.fast++;
+    al->al_leave = now;
+    delete_membership(vifi, g, IN_PIM_SSM_RANGE(g->al_addr) ? dst : INADDR_ANY_N);
+
+    return TRUE;
+}
 
-/* TODO: send PIM prune message if the last member? */
 void accept_leave_message(int ifi, uint32_t src, uint32_t dst, uint32_t group)
 {
     vifi_t vifi;
@@ -503,54 +887,56 @@ void accept_leave_message(int ifi, uint32_t src, uint32_t dst, uint32_t group)
      * Look for the group in our group list in order to set up a short-timeout
      * query.
      */
-    for (g = v->uv_groups; g; g = g->al_next) {
+    g = lookup_group(v, group);
+    if (g) {
 	int datalen;
 	int code;
 
-	if (group == g->al_addr) {
-	    IF_DEBUG(DEBUG_IGMP)
-		logit(LOG_DEBUG, 0, "%s(): old=%d query=%d", __func__, g->al_old, g->al_query);
+	IF_DEBUG(DEBUG_IGMP)
+	    logit(LOG_DEBUG, 0, "%s(): old=%d query=%d", __func__, g->al_old, g->al_query);
 
-	    /* Ignore the leave message if there are old hosts present */
-	    if (g->al_old)
-		return;
+	/* Ignore the leave message if there are old hosts present */
+	if (g->al_old)
+	    return;
 
-	    /* still waiting for a reply to a query, ignore the leave */
-	    if (g->al_query)
-		return;
+	if ((v->uv_flags & VIFF_FAST_LEAVE) && g->al_pv == 3 && fast_leave(vifi, g, src, dst))
+	    return;
 
-	    /*
-	     * Remove source.  Ignore leave if there are more sources
-	     * left.  When processing TO_IN({}), remove all sources.
-	     */
-	    if (IN_PIM_SSM_RANGE(g->al_addr)) {
-		struct listaddr *curr, *prev = NULL;
-		int removed = 0;
-
-		for (curr = g->al_sources; curr; prev = curr, curr = curr->al_next) {
-		    if (dst && dst != curr->al_addr)
-			continue;
-
-		    if (!prev)
-			g->al_sources = curr->al_next; /* Remove from beginning */
-		    else
-			prev->al_next = curr->al_next;
-
-		    /* Stop any switch_version() timer */
-		    timer_clear(curr->al_versiontimer);
-		    free(curr);
-		    removed = 1;
-		    break;
-		}
+	/* still waiting for a reply to a query, ignore the leave */
+	if (g->al_query)
+	    return;
+
+	/*
+	 * Remove source.  Ignore leave if there are more sources
+	 * left.  When processing TO_IN({}), remove all sources.
+	 */
+	if (IN_PIM_SSM_RANGE(g->al_addr)) {
+	    struct listaddr *curr = NULL;
+	    uint32_t pos = 0;
+
+	    if (!dst && g->al_nsources)
+		curr = unlink_source(vifi, g, 0);
+	    else if (dst && lookup_source(g, dst, &pos))
+		curr = unlink_source(vifi, g, pos);
+
+	    if (curr) {
+		uint32_t source = curr->al_addr;
+
+		/* Stop any switch_version() timer */
+		timer_clear(curr->al_versiontimer);
+		listaddr_free(curr);
 
 		/* still sources left, don't remove group */
-		if (removed && g->al_sources)
+		if (g->al_nsources) {
+		    delete_leaf(vifi, source, g->al_addr);
 		    return;
+		}
 	    }
+	}
 
-	    /** delete old timer set a timer for expiration **/
-	    if (g->al_timerid)
-		g->al_timerid = DeleteTimer(g->al_timerid);
+	/** delete old timer set a timer for expiration **/
+	if (g->al_timerid)
+	    g->al_timerid = DeleteTimer(g->al_timerid);
 
 #if IGMP_LAST_MEMBER_QUERY_COUNT != 2
 /*
@@ -559,34 +945,34 @@ void accept_leave_message(int ifi, uint32_t src, uint32_t dst, uint32_t group)
 */
 #endif
 
-	    /* IGMPv2 and v3 */
-	    code = IGMP_LAST_MEMBER_QUERY_INTERVAL * IGMP_TIMER_SCALE;
-
-	    /* Use lowest IGMP version */
-	    if (v->uv_flags & VIFF_IGMPV2 || g->al_pv <= 2) {
-		datalen = 0;
-	    } else if (v->uv_flags & VIFF_IGMPV1 || g->al_pv == 1) {
-		datalen = 0;
-		code = 0;
-	    } else {
-		datalen = 4;
-	    }
+	/* IGMPv2 and v3 */
+	code = IGMP_LAST_MEMBER_QUERY_INTERVAL * IGMP_TIMER_SCALE;
 
-	    /** send a group specific querry **/
-	    if (v->uv_flags & VIFF_QUERIER) {
-		IF_DEBUG(DEBUG_IGMP)
-		    logit(LOG_DEBUG, 0, "%s(): Sending IGMP v%s query (al_pv=%d)",
-			  __func__, datalen == 4 ? "3" : "2", g->al_pv);
+	/* Use lowest IGMP version */
+	if (v->uv_flags & VIFF_IGMPV2 || g->al_pv <= 2) {
+	    datalen = 0;
+	} else if (v->uv_flags & VIFF_IGMPV1 || g->al_pv == 1) {
+	    datalen = 0;
+	    code = 0;
+	} else {
+	    datalen = 4;
+	}
 
-		send_igmp(igmp_send_buf, v->uv_lcl_addr, g->al_addr,
-			  IGMP_MEMBERSHIP_QUERY, code, g->al_addr, datalen);
-	    }
+	/** send a group specific querry **/
+	if (v->uv_flags & VIFF_QUERIER) {
+	    IF_DEBUG(DEBUG_IGMP)
+		logit(LOG_DEBUG, 0, "%s(): Sending IGMP v%s query (al_pv=%d)",
+		      __func__, datalen == 4 ? "3" : "2", g->al_pv);
 
-	    g->al_timer = IGMP_LAST_MEMBER_QUERY_INTERVAL * (IGMP_LAST_MEMBER_QUERY_COUNT + 1);
-	    g->al_query = SetQueryTimer(g, vifi, IGMP_LAST_MEMBER_QUERY_INTERVAL, code, datalen);
-	    g->al_timerid = SetTimer(vifi, g, dst);
-	    break;
+	    send_igmp(igmp_send_buf, v->uv_lcl_addr, g->al_addr,
+		      IGMP_MEMBERSHIP_QUERY, code, g->al_addr, datalen);
 	}
+
+	if (!g->al_leave)
+	    g->al_leave = leave_ms();
+	g->al_timer = IGMP_LAST_MEMBER_QUERY_INTERVAL * (IGMP_LAST_MEMBER_QUERY_COUNT + 1);
+	g->al_query = SetQueryTimer(g, vifi, IGMP_LAST_MEMBER_QUERY_INTERVAL, code, datalen);
+	g->al_timerid = SetTimer(vifi, g, dst);
     }
 }
 
@@ -754,58 +1140,41 @@ static uint32_t igmp_group_membership_timeout(void)
 }
 
 /*
- * Time out record of a group membership on a vif
+ * Delete a group membership, or an SSM source of it, on a vif
  */
-static void DelVif(void *arg)
+static void delete_membership(vifi_t vifi, struct listaddr *group, uint32_t source)
 {
-    struct listaddr **anp;
-    struct listaddr *group, *g;
     struct uvif *v;
-    vifi_t vifi;
-    cbk_t *cbk;
-
-    cbk = (cbk_t *)arg;
-    if (!arg)
-	return;
-
-    group = cbk->g;
-    vifi = cbk->vifi;
-    if (vifi >= MAXVIFS)
-	return;
+    int64_t since = 0;
 
     v = &uvifs[vifi];
 
     if (IN_PIM_SSM_RANGE(group->al_addr)) {
-	struct listaddr *curr, *prev = NULL;
+	struct listaddr *curr;
+	uint32_t pos;
 
-	for (curr = group->al_sources; curr; prev = curr, curr = curr->al_next) {
-	    inet_fmt(cbk->source, s1, sizeof(s1));
-	    inet_fmt(curr->al_addr, s2, sizeof(s2));
-	    IF_DEBUG(DEBUG_IGMP)
-		logit(LOG_DEBUG, 0, "DelVif: Seek source %s, curr=%s (%p)", s1, s2, curr);
+	IF_DEBUG(DEBUG_IGMP)
+	    logit(LOG_DEBUG, 0, "DelVif: Seek source %s", inet_fmt(source, s1, sizeof(s1)));
 
-	    if (curr->al_addr == cbk->source) {
-		if (!prev)
-		    group->al_sources = curr->al_next; /* Remove from beginning */
-		else
-		    prev->al_next = curr->al_next;
+	if (lookup_source(group, source, &pos)) {
+	    curr = unlink_source(vifi, group, pos);
 
-		/* Stop any switch_version() timer */
-		timer_clear(curr->al_versiontimer);
+	    /* Stop any switch_version() timer */
+	    timer_clear(curr->al_versiontimer);
 
-		free(curr);
-		break;
-	    }
+	    since = curr->al_leave;
+	    listaddr_free(curr);
 	}
 
 	IF_DEBUG(DEBUG_IGMP)
-	    logit(LOG_DEBUG, 0, "DelVif: %s sources left", group->al_sources ? "Still" : "No");
-	if (group->al_sources) {
+	    logit(LOG_DEBUG, 0, "DelVif: %s sources left", group->al_nsources ? "Still" : "No");
+	if (group->al_nsources) {
 	    IF_DEBUG(DEBUG_IGMP)
 		logit(LOG_DEBUG, 0, "DelVif: Not last source, g->al_sources --> %s",
-		      inet_fmt(group->al_sources->al_addr, s1, sizeof(s1)));
-	    delete_leaf(vifi, cbk->source, group->al_addr);
-	    free(cbk);
+		      inet_fmt(group->al_sources[0]->al_addr, s1, sizeof(s1)));
+	    delete_leaf(vifi, source, group->al_addr);
+	    if (since)
+		leave_latency(since);
 
 	    return;    /* This was not last source for this interface */
 	}
@@ -823,28 +1192,40 @@ static void DelVif(void *arg)
 
     if (IN_PIM_SSM_RANGE(group->al_addr)) {
 	inet_fmt(group->al_addr, s1, sizeof(s1));
-	inet_fmt(cbk->source, s2, sizeof(s2));
+	inet_fmt(source, s2, sizeof(s2));
 	IF_DEBUG(DEBUG_IGMP)
 	    logit(LOG_DEBUG, 0, "SSM range, source specific delete");
 
 	/* delete (S,G) entry */
 	IF_DEBUG(DEBUG_IGMP)
 	    logit(LOG_DEBUG, 0, "DelVif: vif:%d(%s), (S=%s,G=%s)", vifi, v->uv_name, s2, s1);
-	delete_leaf(vifi, cbk->source, group->al_addr);
+	delete_leaf(vifi, source, group->al_addr);
     } else {
 	delete_leaf(vifi, INADDR_ANY_N, group->al_addr);
     }
 
-    anp = &v->uv_groups;
-    while ((g = *anp)) {
-	if (g == group) {
-	    *anp = g->al_next;
-	    free(g->al_sources);
-	    free(g);
-	} else {
-	    anp = &g->al_next;
-	}
-    }
+    if (!since)
+	since = group->al_leave;
+    if (since)
+	leave_latency(since);
+
+    unlink_group(v, group);
+    listaddr_free(group);
+}
+
+/*
+ * Time out record of a group membership on a vif
+ */
+static void DelVif(void *arg)
+{
+    cbk_t *cbk;
+
+    cbk = (cbk_t *)arg;
+    if (!arg)
+	return;
+
+    if (cbk->vifi < MAXVIFS)
+	delete_membership(cbk->vifi, cbk->g, cbk->source);
 
     free(cbk);
 }
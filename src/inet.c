@@ -140,7 +140,7 @@ uint32_t inet_parse(char *s, int n)
 
 
 /*
- * inet_cksum extracted from:
+ * inet_cksum originally extracted from:
  *			P I N G . C
  *
  * Author -
@@ -156,41 +156,119 @@ uint32_t inet_parse(char *s, int n)
  *
  * Checksum routine for Internet Protocol family headers (C Version)
  *
+ * Since the one's complement sum is the same modulo 0xffff, it can be
+ * done on 32 bit words in a 64 bit accumulator, the carries collect in
+ * the top half and are folded back in at the end.  Four words at a time
+ * for the independent additions.  Any alignment, and byte order, since
+ * the words are summed the way they are stored, see RFC 1071.
  */
 int inet_cksum(uint16_t *addr, u_int len)
 {
-        int sum = 0;
-        int nleft = (int)len;
-        uint16_t *w = addr;
+        const uint8_t *p = (const uint8_t *)addr;
+        uint64_t sum = 0;
+        uint32_t w[4];
         uint16_t answer = 0;
 
         /*
-         *  Our algorithm is simple, using a 32 bit accumulator (sum),
-         *  we add sequential 16 bit words to it, and at the end, fold
-         *  back all the carry bits from the top 16 bits into the lower
-         *  16 bits.
+         * Short headers, e.g. IGMP or IP, are quicker summed 16 bits at
+         * a time, like the original, they never carry out of 32 bits
          */
-        while (nleft > 1)  {
-                sum += *w++;
-                nleft -= 2;
+        if (len < 32) {
+                uint32_t sum16 = 0;
+
+                while (len > 1) {
+                        memcpy(&answer, p, sizeof(answer));
+                        sum16 += answer;
+                        p     += sizeof(answer);
+                        len   -= sizeof(answer);
+                }
+                if (len == 1) {
+                        answer = 0;
+                        *(uint8_t *)(&answer) = *p;
+                        sum16 += answer;
+                }
+
+                sum16 = (sum16 >> 16) + (sum16 & 0xffff);
+                sum16 += (sum16 >> 16);
+                answer = ~sum16;
+
+                return answer;
+        }
+
+        while (len >= sizeof(w)) {
+                memcpy(w, p, sizeof(w));
+                sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+                p   += sizeof(w);
+                len -= sizeof(w);
+        }
+
+        while (len >= sizeof(w[0])) {
+                memcpy(w, p, sizeof(w[0]));
+                sum += w[0];
+                p   += sizeof(w[0]);
+                len -= sizeof(w[0]);
+        }
+
+        if (len >= sizeof(answer)) {
+                memcpy(&answer, p, sizeof(answer));
+                sum += answer;
+                p   += sizeof(answer);
+                len -= sizeof(answer);
         }
 
         /* mop up an odd byte, if necessary */
-        if (nleft == 1) {
-                *(uint8_t *) (&answer) = *(uint8_t *)w ;
+        if (len == 1) {
+                answer = 0;
+                *(uint8_t *)(&answer) = *p;
                 sum += answer;
         }
 
         /*
-         * add back carry outs from top 16 bits to low 16 bits
+         * add back carry outs from top 48 bits to low 16 bits
          */
-        sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
-        sum += (sum >> 16);			/* add carry */
+        sum = (sum >> 32) + (sum & 0xffffffff);
+        sum = (sum >> 32) + (sum & 0xffffffff);
+        sum = (sum >> 16) + (sum & 0xffff);
+        sum = (sum >> 16) + (sum & 0xffff);
         answer = ~sum;				/* truncate to 16 bits */
 
         return answer;
 }
 
+/*
+ * Incremental checksum update, RFC 1624, for when a 16 bit field in a
+ * checksummed header changes from @old to @new.  All in the same byte
+ * order as stored in the header, i.e., network byte order.
+ *
+ *     HC' = ~(~HC + ~m + m')
+ */
+uint16_t inet_cksum_update(uint16_t cksum, uint16_t old, uint16_t new)
+{
+        uint32_t sum;
+
+        sum  = (uint16_t)~cksum + (uint16_t)~old + new;
+        sum  = (sum >> 16) + (sum & 0xffff);
+        sum += (sum >> 16);
+
+        return ~sum;
+}
+
+/*
+ * Same as inet_cksum_update() for a 32 bit field, e.g., an address.
+ */
+uint16_t inet_cksum_update32(uint16_t cksum, uint32_t old, uint32_t new)
+{
+        uint32_t sum;
+
+        sum  = (uint16_t)~cksum;
+        sum += (uint16_t)~(old >> 16) + (uint16_t)~(old & 0xffff);
+        sum += (new >> 16) + (new & 0xffff);
+        sum  = (sum >> 16) + (sum & 0xffff);
+        sum += (sum >> 16);
+
+        return ~sum;
+}
+
 /*
  * Called by following netname() to create a mask specified network address.
  */
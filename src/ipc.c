@@ -45,16 +45,250 @@
 
 #define ENABLED(v) (v ? "Enabled" : "Disabled")
 
+#define IPC_SLICE	(32 * 1024)	/* Render about this much per slice */
+#define IPC_SLICE_CHECK	64		/* Routes visited between clock checks */
+
+#define IPC_CLIENTS	16		/* Served at once, the rest wait in the backlog */
+#define IPC_BACKLOG	16		/* Connections not yet accepted */
+#define IPC_CMDLEN	768		/* Longest command line */
+
+#define IPC_SUBSCRIBERS	8		/* Clients streaming events at once */
+#define IPC_EVENTS	2048		/* Queued per subscriber, then dropped */
+#define IPC_EVENT_BATCH	256		/* Rendered per slice */
+
+/*
+ * Largest binary record, a route: up to 1024 bytes of fixed fields and
+ * strings, five interface bitmaps and a 16-bit timer per interface.
+ */
+#define IPC_RECLEN	(1024 + 5 * (1 + (MAXVIFS + 7) / 8) + 2 * (1 + MAXVIFS))
+#if IPC_RECLEN > 0xffff
+#error "MAXVIFS too large for the 16-bit length of binary IPC records"
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Return values of resumable show functions, or -1 on error */
+#define SHOW_DONE	0
+#define SHOW_MORE	1
+
+/* Output formats, structured ones are described in doc/README-ipc.md */
+enum {
+	FMT_TEXT = 0,
+	FMT_JSON,
+	FMT_BINARY
+};
+
+#define IPC_BINARY_VERSION 1
+
+/* Binary record types, the ones from 16 and up are table entries */
+enum {
+	REC_HEADER = 1,
+	REC_TABLE,
+	REC_END,
+	REC_INTERFACE = 16,
+	REC_NEIGHBOR,
+	REC_ROUTE,
+	REC_DELETED,
+	REC_NEGATIVE,
+	REC_RP,
+	REC_CRP,
+	REC_REGISTER,
+	REC_IGMP_IFACE,
+	REC_IGMP_GROUP,
+	REC_COUNTER,
+	REC_POOL,
+	REC_STATUS,
+	REC_EVENT,
+	REC_MAX
+};
+
+/* Stages of show_pim_mrt() */
+enum {
+	MRT_HEAD = 0,
+	MRT_GROUPS,
+	MRT_RP,
+	MRT_NEGATIVE,
+	MRT_TOTALS
+};
+
+struct ipc_filter {
+	uint32_t group;		/* Group prefix, with group_mask */
+	uint32_t group_mask;
+	uint32_t source;	/* Only this source, or any */
+	u_int    limit;		/* Max entries, or all */
+	u_int    page;		/* Page of limit entries, from 1 */
+};
+
+struct ipc_conn;
+
+/* A table in structured output, see show_tables() */
+struct ipc_table {
+	const char *name;
+	int         id;		/* REC_* of the entries */
+	int       (*show)(FILE *, struct ipc_conn *);
+	int         flags;
+};
+
+#define TBL_LARGE	0x01	/* Resumable, rendered straight to the client */
+#define TBL_DELTA	0x02	/* Only in incremental replies */
+
+/* Where a resumable show function left off, by address */
+struct ipc_cursor {
+	int       open;		/* Table started, see table_large() */
+	int       stage;	/* Of show_pim_mrt() */
+	int       started;
+	uint32_t  group;
+	uint32_t  source;
+	vifi_t    vifi;		/* Of show_igmp_groups() */
+	int       wc;		/* (*,G) of group done */
+	u_int     count;	/* Matching entries, shown or skipped */
+
+	/* Totals of the entries shown */
+	uint32_t  last;
+	u_int     groups;
+	u_int     mirrors;
+	u_int     negative;
+};
+
+/*
+ * A reply being sent.  Output is rendered into memory, a slice at a
+ * time, and sent from the event loop while the socket is writable.
+ * Resumable show functions keep their place in the routing table by
+ * address, not by pointer, so routes may come and go between slices.
+ */
+struct ipc_conn {
+	int       sd;
+	int     (*show)(FILE *);			/* One-shot */
+	int     (*render)(FILE *, struct ipc_conn *);	/* Resumable */
+	const char *msg;	/* Short reply, or error, instead */
+	int       detail;
+	int       done;
+	int       framed;	/* Length before each slice, see ipc_render() */
+
+	char     *buf;		/* Rendered slice */
+	size_t    len;
+	size_t    pos;		/* Sent so far */
+
+	struct ipc_filter filter;
+
+	int       part;		/* Of show_pim() and show_tables() */
+	struct ipc_cursor cur;
+
+	int       format;	/* FMT_TEXT, FMT_JSON or FMT_BINARY */
+	uint64_t  since;	/* Only what changed after this generation */
+	uint64_t  gen;		/* Generation at the start of the reply */
+	int       reset;	/* Since too old, a full reply instead */
+	const struct ipc_table *tables;
+
+	/* Structured output, see obj_begin() */
+	int       nrec;		/* Records in the current table */
+	int       nfield;	/* Fields in the current record */
+	uint32_t  sum;		/* Of the stable fields, see table_small() */
+	uint8_t   rec[IPC_RECLEN];	/* Binary record being built */
+	size_t    reclen;
+	int       overflow;	/* Record did not fit in rec[], dropped */
+};
+
+/* Connection states, a free slot is zero */
+enum {
+	CL_FREE = 0,
+	CL_READ,		/* Waiting for the next command */
+	CL_WRITE		/* Sending the reply */
+};
+
+/*
+ * A connected client.  Commands are read, one line at a time, and the
+ * reply to each is sent before the next is read.  Then the connection
+ * is closed, unless the client has asked to keep it, see ipc_next().
+ */
+struct ipc_client {
+	struct ipc_conn conn;	/* Socket and the reply being sent */
+	int       state;	/* CL_* */
+	int       keep;		/* Persistent, replies are framed */
+	int       eof;		/* Client is done sending */
+	uint32_t  active;	/* virtual_time of the last read or write */
+	size_t    cmdlen;
+	char      cmd[IPC_CMDLEN];	/* Read, not yet run */
+	char      msg[IPC_CMDLEN];	/* Short reply, see ipc_wrap() */
+};
+
 static struct sockaddr_un sun;
 static int ipc_socket = -1;
 static int detail = 0;
 
+static struct ipc_client clients[IPC_CLIENTS];
+static int nclients;
+
+static struct {
+	uint64_t connections;	/* Accepted, in total */
+	uint64_t timeouts;	/* Closed by ipc_age() */
+	uint64_t slice_max;	/* Longest slice rendered, usec */
+} cl_stats;
+
+/* When the slice being rendered started, see slice_done() */
+static struct timespec slice_start;
+
+/* Event classes a subscriber asks for, see ipc_subscribe() */
+enum {
+	EV_ROUTE    = 0x01,
+	EV_NEIGHBOR = 0x02,
+	EV_RP       = 0x04,
+	EV_IGMP     = 0x08,
+	EV_ALL      = 0x0f,
+	EV_DROPPED  = 0x10	/* Not asked for, always sent */
+};
+
+/* A change, queued for a subscriber until its socket is writable */
+struct ipc_event {
+	uint64_t  seq;		/* Per subscriber, gaps are dropped events */
+	uint64_t  count;	/* Of EV_DROPPED, events lost */
+	uint8_t   class;	/* EV_* */
+	uint8_t   op;		/* IPC_EV_* */
+	uint8_t   masklen;	/* Of an RP group prefix */
+	uint8_t   priority;	/* ... and the RP priority */
+	uint16_t  flags;	/* Route type, MRTF_WC, MRTF_SG or MRTF_PMBR */
+	vifi_t    vifi;		/* Interface, or incoming of a route */
+	uint32_t  source;
+	uint32_t  group;
+	uint32_t  address;	/* Neighbor, RP, or upstream of a route */
+	vifset_t  oifs;
+};
+
+/*
+ * A subscribed client.  Events are queued in a bounded ring, so a slow
+ * client cannot make the daemon grow.  When it is full new events are
+ * dropped, counted, and reported to the client when there is room.
+ */
+struct ipc_sub {
+	struct ipc_conn conn;	/* Socket, format and output buffer */
+	int       classes;	/* EV_* asked for */
+	int       writing;	/* Events queued, waiting for writable */
+	struct ipc_event *queue;/* Ring of IPC_EVENTS, NULL if unused */
+	u_int     head;		/* Oldest queued event */
+	u_int     count;
+	uint64_t  seq;		/* Of the newest event, queued or dropped */
+	uint64_t  lost;		/* Dropped, not yet reported */
+};
+
+static struct ipc_sub subs[IPC_SUBSCRIBERS];
+static int nsubs;
+
+static struct {
+	uint64_t subscribers;	/* Accepted, in total */
+	uint64_t events;	/* Queued, for all subscribers */
+	uint64_t dropped;
+} ev_stats;
+
 enum {
 	IPC_ERR = -1,
 	IPC_OK  = 0,
 	IPC_HELP,
 	IPC_VERSION,
 	IPC_STATUS,
+	IPC_STATS,
+	IPC_MEMORY,
 	IPC_RESTART,
 	IPC_DEBUG,
 	IPC_LOGLEVEL,
@@ -68,7 +302,10 @@ enum {
 	IPC_PIM_ROUTE,
 	IPC_PIM_RP,
 	IPC_PIM_CRP,
-	IPC_PIM_DUMP
+	IPC_PIM_REGISTER,
+	IPC_PIM_DUMP,
+	IPC_SUBSCRIBE,
+	IPC_KEEPALIVE
 };
 
 struct ipcmd {
@@ -84,16 +321,21 @@ struct ipcmd {
 	{ IPC_RESTART,    "restart", NULL, "Restart and reload .conf file, like SIGHUP"},
 	{ IPC_VERSION,    "version", NULL, "Show daemon version" },
 	{ IPC_STATUS,     "show status", NULL, "Show router status" },
+	{ IPC_STATS,      "show stats", NULL, "Show packet and kernel statistics" },
+	{ IPC_MEMORY,     "show memory", NULL, "Show memory pool usage" },
 //	{ IPC_IGMP_GRP,   "show igmp groups", NULL, "Show IGMP group memberships" },
 //	{ IPC_IGMP_IFACE, "show igmp interface", NULL, "Show IGMP interface status" },
 	{ IPC_IGMP,       "show igmp", NULL, "Show interfaces and group memberships" },
 	{ IPC_PIM_IFACE,  "show interface", NULL, "Show router interface table" },
-	{ IPC_PIM_ROUTE,  "show mrt", "[detail]", "Show multicast routing table" },
+	{ IPC_PIM_ROUTE,  "show mrt", "[detail] [group ADDR[/LEN]] [source ADDR] [limit N] [page N]", "Show multicast routing table" },
 	{ IPC_PIM_NEIGH,  "show neighbor", NULL, "Show router neighbor table" },
 	{ IPC_PIM_RP,     "show rp", NULL, "Show Rendezvous-Point (RP) set" },
 	{ IPC_PIM_CRP,    "show crp", NULL, "Show candidate Rendezvous-Point (CRP) set" },
+	{ IPC_PIM_REGISTER, "show register", "[group ADDR[/LEN]] [source ADDR] [limit N] [page N]", "Show (S,G) Registers sent to the RP" },
 	{ IPC_PIM,        "show pim", "[detail]", "Show interfaces, neighbors and routes (default)"},
 	{ IPC_PIM_DUMP,   "show compat", "[detail]", "Show router status, compat mode" },
+	{ IPC_SUBSCRIBE,  "subscribe", "[routes] [neighbors] [rp] [igmp]", "Stream changes as they happen" },
+	{ IPC_KEEPALIVE,  "keepalive", NULL, NULL }, /* hidden, for scripts */
 	{ IPC_PIM,        "show", NULL, NULL }, /* hidden default */
 };
 
@@ -169,22 +411,12 @@ static void check_detail(char *cmd, size_t len)
 		detail = 0;
 }
 
-static int ipc_read(int sd, char *cmd, ssize_t len)
+/* Look up command line @cmd, leaving only its arguments in it */
+static int ipc_parse(char *cmd)
 {
-	while ((len = read(sd, cmd, len - 1)) == -1) {
-		switch (errno) {
-		case EAGAIN:
-		case EINTR:
-			continue;
-		default:
-			break;
-		}
-		return IPC_ERR;
-	}
-	if (len == 0)
-		return IPC_OK;
+	if (!cmd[strspn(cmd, " \t\r\n")])
+		return IPC_OK;	/* Empty line */
 
-	cmd[len] = 0;
 //	logit(LOG_DEBUG, 0, "IPC cmd: '%s'", cmd);
 
 	for (size_t i = 0; i < NELEMS(cmds); i++) {
@@ -201,70 +433,367 @@ static int ipc_read(int sd, char *cmd, ssize_t len)
 	return IPC_ERR;
 }
 
-static int ipc_write(int sd, char *msg, size_t sz)
+static int ipc_close(int sd)
 {
-	ssize_t len;
+	return shutdown(sd, SHUT_RDWR) ||
+		close(sd);
+}
+
+/*
+ * Parse [detail] [json | binary] [since GEN] [group ADDR[/LEN]] [source ADDR]
+ * [limit N] [page N], only the output format is checked unless @strict
+ */
+static int ipc_filter(char *args, struct ipc_conn *c, int strict)
+{
+	struct ipc_filter *f = &c->filter;
+	const char *errstr;
+	char *arg, *val, *ptr;
+	int len;
+
+	for (arg = strtok_r(args, " \t", &ptr); arg; arg = strtok_r(NULL, " \t", &ptr)) {
+		if (!strcasecmp(arg, "detail")) {
+			c->detail = 1;
+			continue;
+		}
+		if (!strcasecmp(arg, "json")) {
+			c->format = FMT_JSON;
+			continue;
+		}
+		if (!strcasecmp(arg, "binary")) {
+			c->format = FMT_BINARY;
+			continue;
+		}
+		if (!strcasecmp(arg, "since")) {
+			val = strtok_r(NULL, " \t", &ptr);
+			if (!val)
+				goto fail;
+
+			c->since = strtonum(val, 0, LLONG_MAX, &errstr);
+			if (errstr)
+				goto fail;
+			continue;
+		}
+		if (!strict)
+			continue;	/* Not a filtered command, as before */
+
+		val = strtok_r(NULL, " \t", &ptr);
+		if (!val)
+			goto fail;
+
+		if (!strcasecmp(arg, "group")) {
+			len = 32;
+			arg = strchr(val, '/');
+			if (arg) {
+				*arg++ = 0;
+				len = strtonum(arg, 4, 32, &errstr);
+				if (errstr)
+					goto fail;
+			}
+
+			f->group = inet_parse(val, 4);
+			if (!IN_MULTICAST(ntohl(f->group)))
+				goto fail;
+
+			MASKLEN_TO_MASK(len, f->group_mask);
+			f->group &= f->group_mask;
+		} else if (!strcasecmp(arg, "source")) {
+			f->source = inet_parse(val, 4);
+			if (f->source == INADDR_ANY || f->source == 0xffffffff)
+				goto fail;
+		} else if (!strcasecmp(arg, "limit")) {
+			f->limit = strtonum(val, 1, INT_MAX, &errstr);
+			if (errstr)
+				goto fail;
+		} else if (!strcasecmp(arg, "page")) {
+			f->page = strtonum(val, 1, INT_MAX, &errstr);
+			if (errstr)
+				goto fail;
+		} else
+			goto fail;
+	}
+
+	if (f->page && !f->limit)
+		goto fail;
+	if (c->since && c->format == FMT_TEXT)
+		goto fail;
 
-//	logit(LOG_DEBUG, 0, "IPC rpl: '%s'", msg);
+	return 0;
+fail:
+	errno = EINVAL;
+	return IPC_ERR;
+}
+
+/* Send what is rendered, until done or the socket is full */
+static int ipc_flush(struct ipc_conn *c)
+{
+	ssize_t len;
 
-	while ((len = write(sd, msg, sz))) {
-		if (-1 == len) {
+	while (c->pos < c->len) {
+		len = send(c->sd, c->buf + c->pos, c->len - c->pos, MSG_NOSIGNAL);
+		if (len == -1) {
 			switch (errno) {
 			case EINTR:
-			case EAGAIN:
 				continue;
+			case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+			case EWOULDBLOCK:
+#endif
+				return 0;
+			case EPIPE:
+				logit(LOG_INFO, 0, "Client closed connection");
+				return IPC_ERR;
 			default:
 				break;
 			}
+
+			logit(LOG_WARNING, errno, "Failed communicating with client");
+			return IPC_ERR;
 		}
-		break;
+
+		c->pos += len;
+	}
+
+	return 0;
+}
+
+/* Time spent on the slice being rendered, in usec */
+static uint64_t slice_usec(void)
+{
+	struct timespec ts;
+	int64_t usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	usec = (int64_t)(ts.tv_sec - slice_start.tv_sec) * 1000000 +
+		(ts.tv_nsec - slice_start.tv_nsec) / 1000;
+
+	return usec > 0 ? (uint64_t)usec : 0;
+}
+
+/*
+ * Render the next slice into memory, replacing the one sent.  On a kept
+ * connection each slice is preceded by its length, a 32-bit number in
+ * network byte order, and the reply ends with a length of zero.
+ */
+static int ipc_render(struct ipc_conn *c)
+{
+	uint32_t hdr = 0;
+	uint64_t usec;
+	long len = 0;
+	FILE *fp;
+	int rc;
+
+	free(c->buf);
+	c->buf = NULL;
+	c->len = c->pos = 0;
+
+	fp = open_memstream(&c->buf, &c->len);
+	if (!fp) {
+		logit(LOG_WARNING, errno, "Failed allocating IPC buffer");
+		return IPC_ERR;
+	}
+
+	if (c->framed)
+		fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &slice_start);
+	detail = c->detail;
+	if (c->msg) {
+		fputs(c->msg, fp);
+		rc = SHOW_DONE;
+	} else if (c->render)
+		rc = c->render(fp, c);
+	else
+		rc = c->show(fp) ? IPC_ERR : SHOW_DONE;
+
+	usec = slice_usec();
+	if (usec > cl_stats.slice_max)
+		cl_stats.slice_max = usec;
+
+	if (c->framed) {
+		len = ftell(fp) - sizeof(hdr);
+		if (rc == SHOW_DONE)
+			fwrite(&hdr, sizeof(hdr), 1, fp);
 	}
+	fclose(fp);
 
-	if (len != (ssize_t)sz)
+	if (rc < 0)
 		return IPC_ERR;
+	if (rc == SHOW_DONE)
+		c->done = 1;
+
+	if (len > 0) {
+		hdr = htonl(len);
+		memcpy(c->buf, &hdr, sizeof(hdr));
+	} else if (c->framed)
+		c->pos = sizeof(hdr);	/* Nothing in this slice, skip its length */
 
 	return 0;
 }
 
-static int ipc_close(int sd)
+static void ipc_accept(int sd);
+static void ipc_input(int sd);
+static void ipc_output(int sd);
+static void ipc_next(struct ipc_client *cl);
+
+static void ipc_listen(void)
 {
-	return shutdown(sd, SHUT_RDWR) ||
-		close(sd);
+	if (ipc_socket < 0)
+		return;
+
+	deregister_input_handler(ipc_socket);
+	if (register_input_handler(ipc_socket, ipc_accept, IH_LEVEL) < 0)
+		logit(LOG_ERR, 0, "Failed registering IPC handler");
 }
 
-static int ipc_send(int sd, char *buf, size_t len, FILE *fp)
+static struct ipc_client *client_find(int sd)
 {
-	while (fgets(buf, len, fp)) {
-		if (!ipc_write(sd, buf, strlen(buf)))
-			continue;
+	for (size_t i = 0; i < NELEMS(clients); i++) {
+		if (clients[i].state != CL_FREE && clients[i].conn.sd == sd)
+			return &clients[i];
+	}
 
-		logit(LOG_WARNING, errno, "Failed communicating with client");
+	return NULL;
+}
+
+/* Free the slot of @cl, its socket is closed, or handed over */
+static void client_release(struct ipc_client *cl)
+{
+	free(cl->conn.buf);
+	memset(cl, 0, sizeof(*cl));
+
+	/* Was full, accept again, see ipc_accept() */
+	if (nclients-- == IPC_CLIENTS)
+		ipc_listen();
+}
+
+static void client_close(struct ipc_client *cl)
+{
+	deregister_input_handler(cl->conn.sd);
+	ipc_close(cl->conn.sd);
+	client_release(cl);
+}
+
+/* Wait for the next command, or for the socket to be writable to send a reply */
+static int client_wait(struct ipc_client *cl, int state)
+{
+	deregister_input_handler(cl->conn.sd);
+	if (register_input_handler(cl->conn.sd, state == CL_WRITE ? ipc_output : ipc_input,
+				   state == CL_WRITE ? IH_WRITE : IH_LEVEL) < 0)
 		return IPC_ERR;
+	cl->state = state;
+
+	return 0;
+}
+
+/* Start a new reply to @cl, replacing the last one */
+static struct ipc_conn *ipc_reply(struct ipc_client *cl)
+{
+	struct ipc_conn *c = &cl->conn;
+	int sd = c->sd;
+
+	free(c->buf);
+	memset(c, 0, sizeof(*c));
+	c->sd     = sd;
+	c->framed = cl->keep;
+
+	return c;
+}
+
+/* Reply sent, close the connection, or read the next command on a kept one */
+static void ipc_done(struct ipc_client *cl)
+{
+	ipc_reply(cl);
+
+	if (!cl->keep || client_wait(cl, CL_READ)) {
+		client_close(cl);
+		return;
 	}
 
-	return ipc_close(sd);
+	ipc_next(cl);
 }
 
-static void ipc_show(int sd, int (*cb)(FILE *), char *buf, size_t len)
+/*
+ * Called while the client socket is writable.  Renders at most one
+ * slice per call, the rest of the daemon, and the other clients, run
+ * between slices.
+ */
+static void ipc_output(int sd)
 {
-	FILE *fp;
+	struct ipc_client *cl = client_find(sd);
+	struct ipc_conn *c;
 
-	fp = tempfile();
-	if (!fp) {
-		logit(LOG_WARNING, errno, "Failed opening temporary file");
+	if (!cl)
 		return;
+
+	c = &cl->conn;
+	cl->active = virtual_time;
+	if (ipc_flush(c))
+		goto fail;
+	if (c->pos < c->len)
+		return;		/* Wait for the client to catch up */
+
+	if (!c->done) {
+		if (ipc_render(c) || ipc_flush(c))
+			goto fail;
 	}
 
-	if (cb(fp))
+	if (!c->done || c->pos < c->len)
 		return;
 
-	rewind(fp);
-	ipc_send(sd, buf, len, fp);
-	fclose(fp);
+	ipc_done(cl);
+	return;
+fail:
+	client_close(cl);
+}
+
+static int show_tables(FILE *fp, struct ipc_conn *c);
+
+/*
+ * Reply to @cl with output from the one-shot @show or the resumable
+ * @render, with any filter in @args when @filtered, sent when the socket
+ * is writable.  For 'json' or 'binary' in @args the @tables are sent
+ * instead.
+ */
+static int ipc_stream(struct ipc_client *cl, int (*show)(FILE *), int (*render)(FILE *, struct ipc_conn *),
+		      int filtered, const struct ipc_table *tables, char *args)
+{
+	struct ipc_conn *c = ipc_reply(cl);
+
+	c->show   = show;
+	c->render = render;
+	c->detail = detail;
+	if (args && ipc_filter(args, c, filtered))
+		return IPC_ERR;
+
+	if (c->format != FMT_TEXT) {
+		if (!tables) {
+			errno = EINVAL;
+			return IPC_ERR;
+		}
+		c->tables = tables;
+		c->render = show_tables;
+	}
+
+	return IPC_OK;
+}
+
+static int ipc_show(struct ipc_client *cl, int (*cb)(FILE *), const struct ipc_table *tables, char *args)
+{
+	return ipc_stream(cl, cb, NULL, 0, tables, args);
+}
+
+/* Resumable, but not filtered, output */
+static int ipc_resume(struct ipc_client *cl, int (*cb)(FILE *, struct ipc_conn *),
+		      const struct ipc_table *tables, char *args)
+{
+	return ipc_stream(cl, NULL, cb, 0, tables, args);
 }
 
-static int ipc_err(int sd, char *buf, size_t len)
+static int ipc_err(struct ipc_client *cl)
 {
+	char *buf = cl->msg;
+	size_t len = sizeof(cl->msg);
+
 	switch (errno) {
 	case EBADMSG:
 		snprintf(buf, len, "No such command, see 'help' for available commands.");
@@ -274,21 +803,30 @@ static int ipc_err(int sd, char *buf, size_t len)
 		snprintf(buf, len, "Invalid argument.");
 		break;
 
+	case EBUSY:
+		snprintf(buf, len, "Too many subscribers.");
+		break;
+
 	default:
 		snprintf(buf, len, "Unknown error: %s", strerror(errno));
 		break;
 	}
 
-	return ipc_write(sd, buf, strlen(buf));
+	ipc_reply(cl)->msg = buf;
+
+	return IPC_OK;
 }
 
 /* wrap simple functions that don't use >768 bytes for I/O */
-static int ipc_wrap(int sd, int (*cb)(char *, size_t), char *buf, size_t len)
+static int ipc_wrap(struct ipc_client *cl, int (*cb)(char *, size_t), char *cmd)
 {
-	if (cb(buf, len))
+	strlcpy(cl->msg, cmd, sizeof(cl->msg));
+	if (cb(cl->msg, sizeof(cl->msg)))
 		return IPC_ERR;
 
-	return ipc_write(sd, buf, strlen(buf));
+	ipc_reply(cl)->msg = cl->msg;
+
+	return IPC_OK;
 }
 
 static char *get_dr_prio(pim_nbr_entry_t *n)
@@ -330,6 +868,8 @@ static int show_neighbor(FILE *fp, struct uvif *uv, pim_nbr_entry_t *n)
 		if (uv->uv_pim_neighbor_dr == n)
 			snprintf(tmp, sizeof(tmp), "DR");
 	}
+	if (n->tbit)
+		strlcat(tmp, tmp[0] ? ",T" : "T", sizeof(tmp));
 
 	fprintf(fp, "%-16s  %-15s  %4s  %-4s  %-28s\n",
 		uv->uv_name,
@@ -482,6 +1022,24 @@ static int show_crp(FILE *fp)
 	return 0;
 }
 
+/* Route flags, in the order shown */
+static const struct {
+	uint16_t    flag;
+	const char *name;
+} mrt_flags[] = {
+	{ MRTF_SPT,          "SPT"      },
+	{ MRTF_WC,           "WC"       },
+	{ MRTF_RP,           "RP"       },
+	{ MRTF_REGISTER,     "REG"      },
+	{ MRTF_IIF_REGISTER, "IIF_REG"  },
+	{ MRTF_NULL_OIF,     "NULL_OIF" },
+	{ MRTF_KERNEL_CACHE, "CACHE"    },
+	{ MRTF_ASSERTED,     "ASSERTED" },
+	{ MRTF_REG_SUPP,     "REG_SUPP" },
+	{ MRTF_SG,           "SG"       },
+	{ MRTF_PMBR,         "PMBR"     },
+};
+
 static void dump_route(FILE *fp, mrtentry_t *r)
 {
 	char asserted_oifs[MAXVIFS+1];
@@ -514,17 +1072,10 @@ static void dump_route(FILE *fp, mrtentry_t *r)
 	incoming_iif[r->incoming] = 'I';
 
 	/* TODO: don't need some of the flags */
-	if (r->flags & MRTF_SPT)	  fprintf(fp, " SPT");
-	if (r->flags & MRTF_WC)	          fprintf(fp, " WC");
-	if (r->flags & MRTF_RP)	          fprintf(fp, " RP");
-	if (r->flags & MRTF_REGISTER)     fprintf(fp, " REG");
-	if (r->flags & MRTF_IIF_REGISTER) fprintf(fp, " IIF_REG");
-	if (r->flags & MRTF_NULL_OIF)     fprintf(fp, " NULL_OIF");
-	if (r->flags & MRTF_KERNEL_CACHE) fprintf(fp, " CACHE");
-	if (r->flags & MRTF_ASSERTED)     fprintf(fp, " ASSERTED");
-	if (r->flags & MRTF_REG_SUPP)     fprintf(fp, " REG_SUPP");
-	if (r->flags & MRTF_SG)	          fprintf(fp, " SG");
-	if (r->flags & MRTF_PMBR)	  fprintf(fp, " PMBR");
+	for (size_t i = 0; i < NELEMS(mrt_flags); i++) {
+		if (r->flags & mrt_flags[i].flag)
+			fprintf(fp, " %s", mrt_flags[i].name);
+	}
 	fprintf(fp, "\n");
 
 	if (!detail)
@@ -540,77 +1091,161 @@ static void dump_route(FILE *fp, mrtentry_t *r)
 	fprintf(fp, "\nTIMERS       :  Entry    JP    RS  Assert  VIFS:");
 	for (vifi = 0; vifi < numvifs; vifi++)
 		fprintf(fp, "  %d", vifi);
-	fprintf(fp, "\n                %5d  %4d  %4d  %6d       ",
-		r->entry_timer, r->jp_timer, r->rs_timer, r->assert_timer);
+	fprintf(fp, "\n                %5u  %4u  %4u  %6u       ",
+		MRT_TIMER_LEFT(r->entry_timer), MRT_TIMER_LEFT(r->jp_timer),
+		MRT_TIMER_LEFT(r->rs_timer), MRT_TIMER_LEFT(r->assert_timer));
 	for (vifi = 0; vifi < numvifs; vifi++)
-		fprintf(fp, " %2d", r->vif_timers[vifi]);
+		fprintf(fp, " %2u", MRT_TIMER_LEFT(r->vif_timers[vifi]));
 	fprintf(fp, "\n");
 }
 
-/* PIM Multicast Routing Table */
-static int show_pim_mrt(FILE *fp)
+/*
+ * Next route after the cursor, in group and source address order with
+ * the (*,G) first, that matches the filter.  NULL when there are no more.
+ */
+static mrtentry_t *next_route(struct ipc_conn *c, grpentry_t **gp)
 {
-	u_int number_of_cache_mirrors = 0;
-	u_int number_of_groups = 0;
-	kernel_cache_t *kc;
-	grpentry_t *g;
+	struct ipc_filter *f = &c->filter;
+	uint32_t src = ntohl(c->cur.source);
+	grpentry_t *g = NULL;
 	mrtentry_t *r;
-	cand_rp_t *rp;
 
-	fprintf(fp, "Multicast Routing Table_\n");
-	if (!detail)
-		fprintf(fp, "Source            Group            RP Address       Flags =\n");
+	if (c->cur.started)
+		g = find_group(c->cur.group);
+	if (!g) {
+		/* First call, or the group is gone: start from the one after */
+		uint32_t addr = c->cur.started ? ntohl(c->cur.group) + 1 : ntohl(f->group);
+
+		/* TODO: remove the dummy 0.0.0.0 group (first in the chain) */
+		for (g = grplist->next; g; g = g->next) {
+			if (ntohl(g->group) >= addr)
+				break;
+		}
 
-	/* TODO: remove the dummy 0.0.0.0 group (first in the chain) */
-	for (g = grplist->next; g; g = g->next) {
-		number_of_groups++;
+		c->cur.started = 1;
+		c->cur.wc = 0;
+		src = 0;
+	}
 
-		r = g->grp_route;
-		if (r) {
-			if (r->flags & MRTF_KERNEL_CACHE) {
-				for (kc = r->kernel_cache; kc; kc = kc->next)
-					number_of_cache_mirrors++;
-			}
+	for (; g; g = g->next, c->cur.wc = 0, src = 0) {
+		if ((g->group & f->group_mask) != f->group)
+			break;	/* Past the group prefix */
 
-			if (detail)
-				fprintf(fp, "\nSource            Group            RP Address       Flags =\n");
-			fprintf(fp, "%-15s   %-15s  %-15s ",
-				"ANY",
-				inet_fmt(g->group, s1, sizeof(s1)),
-				IN_PIM_SSM_RANGE(g->group)
-				? "SSM"
-				: (g->active_rp_grp
-				   ? inet_fmt(g->rpaddr, s2, sizeof(s2))
-				   : "NULL"));
+		*gp = g;
+		c->cur.group = g->group;
 
-			dump_route(fp, r);
+		if (!c->cur.wc && !f->source && g->grp_route) {
+			c->cur.wc = 1;
+			c->cur.source = INADDR_ANY;
+			return g->grp_route;
 		}
 
 		for (r = g->mrtlink; r; r = r->grpnext) {
-			if (r->flags & MRTF_KERNEL_CACHE)
-				number_of_cache_mirrors++;
-
-			if (detail)
-				fprintf(fp, "\nSource            Group            RP Address       Flags =\n");
-			fprintf(fp, "%-15s   %-15s  %-15s ",
-				inet_fmt(r->source->address, s1, sizeof(s1)),
-				inet_fmt(g->group, s2, sizeof(s2)),
-				IN_PIM_SSM_RANGE(g->group)
-				? "SSM"
-				: (g->active_rp_grp
-				   ? inet_fmt(g->rpaddr, s3, sizeof(s3))
-				   : "NULL"));
+			if (ntohl(r->source->address) <= src)
+				continue;
+			if (f->source && r->source->address != f->source)
+				continue;
 
-			dump_route(fp, r);
+			c->cur.wc = 1;
+			c->cur.source = r->source->address;
+			return r;
 		}
 	}
 
-	for (rp = cand_rp_list; rp; rp = rp->next) {
-		r = rp->rpentry->mrtlink;
-		if (r) {
+	return NULL;
+}
+
+/*
+ * Slice full, or its time, ipc-budget, is up: yield to the event loop.
+ * The clock is checked every IPC_SLICE_CHECK routes visited, filtered
+ * out or not.
+ */
+static int slice_done(FILE *fp, int *visited)
+{
+	if (ftell(fp) >= IPC_SLICE)
+		return 1;
+	if (++(*visited) % IPC_SLICE_CHECK)
+		return 0;
+
+	return slice_usec() >= (uint64_t)ipc_budget * 1000;
+}
+
+static void show_route(FILE *fp, struct ipc_conn *c, grpentry_t *g, mrtentry_t *r)
+{
+	kernel_cache_t *kc;
+
+	if (g->group != c->cur.last) {
+		c->cur.last = g->group;
+		c->cur.groups++;
+	}
+
+	if (r->flags & MRTF_KERNEL_CACHE) {
+		if (r == g->grp_route) {
+			for (kc = r->kernel_cache; kc; kc = kc->next)
+				c->cur.mirrors++;
+		} else
+			c->cur.mirrors++;
+	}
+
+	if (detail)
+		fprintf(fp, "\nSource            Group            RP Address       Flags =\n");
+	fprintf(fp, "%-15s   %-15s  %-15s ",
+		r == g->grp_route
+		? "ANY"
+		: inet_fmt(r->source->address, s1, sizeof(s1)),
+		inet_fmt(g->group, s2, sizeof(s2)),
+		IN_PIM_SSM_RANGE(g->group)
+		? "SSM"
+		: (g->active_rp_grp
+		   ? inet_fmt(g->rpaddr, s3, sizeof(s3))
+		   : "NULL"));
+
+	dump_route(fp, r);
+}
+
+/* PIM Multicast Routing Table, the (*,*,RP) and negative cache only when unfiltered */
+static int show_pim_mrt(FILE *fp, struct ipc_conn *c)
+{
+	struct ipc_filter *f = &c->filter;
+	u_int skip = f->page ? (f->page - 1) * f->limit : 0;
+	int all = !f->group_mask && !f->source && !f->limit;
+	kernel_cache_t *kc;
+	int visited = 0;
+	grpentry_t *g;
+	mrtentry_t *r;
+	cand_rp_t *rp;
+
+	switch (c->cur.stage) {
+	case MRT_HEAD:
+		fprintf(fp, "Multicast Routing Table_\n");
+		if (!detail)
+			fprintf(fp, "Source            Group            RP Address       Flags =\n");
+		c->cur.stage++;
+		/* fallthrough */
+
+	case MRT_GROUPS:
+		while (!f->limit || c->cur.count < skip + f->limit) {
+			r = next_route(c, &g);
+			if (!r)
+				break;
+
+			if (c->cur.count++ >= skip)
+				show_route(fp, c, g, r);
+			if (slice_done(fp, &visited))
+				return SHOW_MORE;
+		}
+		c->cur.stage++;
+		/* fallthrough */
+
+	case MRT_RP:
+		for (rp = cand_rp_list; all && rp; rp = rp->next) {
+			r = rp->rpentry->mrtlink;
+			if (!r)
+				continue;
+
 			if (r->flags & MRTF_KERNEL_CACHE) {
 				for (kc = r->kernel_cache; kc; kc = kc->next)
-					number_of_cache_mirrors++;
+					c->cur.mirrors++;
 			}
 
 			if (detail)
@@ -622,27 +1257,100 @@ static int show_pim_mrt(FILE *fp)
 
 			dump_route(fp, r);
 		}
-	}
+		c->cur.stage++;
+		/* fallthrough */
+
+	case MRT_NEGATIVE:
+		if (all && negative_cache) {
+			fprintf(fp, "\nNegative Cache Entries_\n");
+			fprintf(fp, "Source            Group            Expires =\n");
+			for (kc = negative_cache; kc; kc = kc->next) {
+				c->cur.negative++;
+				fprintf(fp, "%-15s   %-15s  %7u\n",
+					inet_fmt(kc->source, s1, sizeof(s1)),
+					inet_fmt(kc->group, s2, sizeof(s2)),
+					MRT_TIMER_LEFT(kc->expires));
+			}
+		}
+		c->cur.stage++;
+		/* fallthrough */
 
-	fprintf(fp, "\nNumber of Groups        : %u\n", number_of_groups);
-	fprintf(fp, "Number of Cache MIRRORs : %u\n", number_of_cache_mirrors);
+	case MRT_TOTALS:
+		fprintf(fp, "\nNumber of Groups        : %u\n", c->cur.groups);
+		fprintf(fp, "Number of Cache MIRRORs : %u\n", c->cur.mirrors);
+		fprintf(fp, "Number of Negative MFCs : %u\n", c->cur.negative);
+		break;
+	}
 
-	return 0;
+	return SHOW_DONE;
 }
 
-static int show_pim(FILE *fp)
+static int show_register(FILE *fp, struct ipc_conn *c)
 {
-	return  show_interfaces (fp) ||
-		show_neighbors  (fp) ||
-		show_pim_mrt    (fp) ||
-		show_crp        (fp) ||
-		show_rp         (fp);
-}
+	struct ipc_filter *f = &c->filter;
+	u_int skip = f->page ? (f->page - 1) * f->limit : 0;
+	int visited = 0;
+	regstate_t *reg;
+	grpentry_t *g;
+	mrtentry_t *r;
+	uint64_t bps;
+	uint32_t pps;
 
-static int show_status(FILE *fp)
-{
-	char buf[10];
-	int len;
+	if (!c->cur.stage++) {
+		fprintf(fp, "PIM Register Table_\n");
+		fprintf(fp, "Source            Group            RP Address        Packets       Bytes   Suppressed     pps        bps =\n");
+	}
+
+	while (!f->limit || c->cur.count < skip + f->limit) {
+		r = next_route(c, &g);
+		if (!r)
+			break;
+
+		reg = r->reg;
+		if (reg && r != g->grp_route && c->cur.count++ >= skip) {
+			register_rate(reg, &pps, &bps);
+			fprintf(fp, "%-15s   %-15s  %-15s  %8" PRIu64 "  %10" PRIu64 "  %11" PRIu64 "  %6u  %9" PRIu64 "\n",
+				inet_fmt(r->source->address, s1, sizeof(s1)),
+				inet_fmt(g->group, s2, sizeof(s2)),
+				inet_fmt(reg->reg_dst, s3, sizeof(s3)),
+				reg->pkts, reg->bytes, reg->suppressed, pps, bps);
+		}
+
+		if (slice_done(fp, &visited))
+			return SHOW_MORE;
+	}
+
+	return SHOW_DONE;
+}
+
+static int show_pim(FILE *fp, struct ipc_conn *c)
+{
+	switch (c->part) {
+	case 0:
+		if (show_interfaces(fp) || show_neighbors(fp))
+			return -1;
+		c->part++;
+		/* fallthrough */
+
+	case 1:
+		if (show_pim_mrt(fp, c))
+			return SHOW_MORE;
+		c->part++;
+		/* fallthrough */
+
+	default:
+		if (show_crp(fp) || show_rp(fp))
+			return -1;
+		break;
+	}
+
+	return SHOW_DONE;
+}
+
+static int show_status(FILE *fp)
+{
+	char buf[10];
+	int len;
 
 	fprintf(fp, "PIM Daemon Status=\n");
 
@@ -689,18 +1397,182 @@ static int show_status(FILE *fp)
 	return 0;
 }
 
-static int show_igmp_groups(FILE *fp)
+static void show_rxstats(FILE *fp, const char *name, struct rxstats *st)
+{
+	fprintf(fp, "%s socket\n", name);
+	fprintf(fp, "    Packets          : %" PRIu64 "\n", st->packets);
+	fprintf(fp, "    Batches          : %" PRIu64 "\n", st->calls);
+	fprintf(fp, "    Average batch    : %.1f\n", st->calls ? (double)st->packets / st->calls : 0.0);
+	fprintf(fp, "    Largest batch    : %u\n", st->max_batch);
+	fprintf(fp, "    Batch sizes      : 1:%" PRIu64 " 2-3:%" PRIu64 " 4-7:%" PRIu64
+		" 8-15:%" PRIu64 " 16-31:%" PRIu64 " %d:%" PRIu64 "\n",
+		st->batch[0], st->batch[1], st->batch[2], st->batch[3], st->batch[4],
+		IH_BATCH, st->batch[5]);
+	fprintf(fp, "    Oversized        : %" PRIu64 "\n", st->oversized);
+	fprintf(fp, "    Truncated        : %" PRIu64 "\n", st->truncated);
+	fprintf(fp, "    Socket overflow  : %u\n", st->overflow);
+}
+
+static int show_stats(FILE *fp)
+{
+	fprintf(fp, "PIM Daemon Statistics=\n");
+
+	show_rxstats(fp, "IGMP", &igmp_rx.stats);
+	show_rxstats(fp, "PIM", &pim_rx.stats);
+
+	fprintf(fp, "RPF lookups\n");
+	fprintf(fp, "    Route tracking   : %s\n", ENABLED(k_route_notify()));
+	fprintf(fp, "    Cache hits       : %" PRIu64 "\n", rpf_stats.hits);
+	fprintf(fp, "    Kernel lookups   : %" PRIu64 "\n", rpf_stats.misses);
+	fprintf(fp, "    Async lookups    : %" PRIu64 "\n", rpf_stats.async);
+	fprintf(fp, "    Route changes    : %" PRIu64 "\n", rpf_stats.notifications);
+	fprintf(fp, "    RPF changes      : %" PRIu64 "\n", rpf_stats.changes);
+	fprintf(fp, "    Replies lost     : %" PRIu64 "\n", rpf_stats.lost);
+	fprintf(fp, "    Cache evictions  : %" PRIu64 "\n", rpf_stats.evicted);
+
+	fprintf(fp, "Cache miss upcalls\n");
+	fprintf(fp, "    Received         : %" PRIu64 "\n", upcall_stats.misses);
+	fprintf(fp, "    Rate limited     : %" PRIu64 "\n", upcall_stats.limited);
+	fprintf(fp, "    Negative MFCs    : %" PRIu64 "\n", upcall_stats.negative);
+	fprintf(fp, "    Expired          : %" PRIu64 "\n", upcall_stats.expired);
+	fprintf(fp, "    Flushed          : %" PRIu64 "\n", upcall_stats.flushed);
+
+	fprintf(fp, "Register encapsulation\n");
+	fprintf(fp, "    Cache hits       : %" PRIu64 "\n", reg_stats.hits);
+	fprintf(fp, "    Cache misses     : %" PRIu64 "\n", reg_stats.misses);
+	fprintf(fp, "    Sent             : %" PRIu64 "\n", reg_stats.sent);
+	fprintf(fp, "    Fragmented       : %" PRIu64 "\n", reg_stats.copied);
+	fprintf(fp, "    Send failures    : %" PRIu64 "\n", reg_stats.failed);
+	fprintf(fp, "    Suppressed       : %" PRIu64 "\n", reg_stats.suppressed);
+	fprintf(fp, "    Kernel tunnels   : %" PRIu64 "\n", reg_stats.tunnels);
+
+	fprintf(fp, "Register decapsulation\n");
+	fprintf(fp, "    Cache hits       : %" PRIu64 "\n", reg_stats.decap_hits);
+	fprintf(fp, "    Cache misses     : %" PRIu64 "\n", reg_stats.decap_misses);
+
+	fprintf(fp, "Join/Prune messages\n");
+	fprintf(fp, "    Entries          : %" PRIu64 "\n", jp_stats.entries);
+	fprintf(fp, "    Duplicates       : %" PRIu64 "\n", jp_stats.duplicates);
+	fprintf(fp, "    Sent             : %" PRIu64 "\n", jp_stats.messages);
+	fprintf(fp, "    Batches          : %" PRIu64 "\n", jp_stats.batches);
+	fprintf(fp, "    Split groups     : %" PRIu64 "\n", jp_stats.split);
+	fprintf(fp, "    Received         : %" PRIu64 "\n", jp_stats.received);
+	fprintf(fp, "    Received entries : %" PRIu64 "\n", jp_stats.rx_entries);
+	fprintf(fp, "    Malformed        : %" PRIu64 "\n", jp_stats.malformed);
+	fprintf(fp, "    Suppressed       : %" PRIu64 "\n", jp_stats.suppressed);
+	fprintf(fp, "    Overrides        : %" PRIu64 "\n", jp_stats.overrides);
+	fprintf(fp, "    Fast prunes      : %" PRIu64 "\n", jp_stats.fast_prunes);
+	fprintf(fp, "    Prunes tracked   : %" PRIu64 "\n", jp_stats.tracked);
+
+	fprintf(fp, "IGMP leaves\n");
+	fprintf(fp, "    Fast leaves      : %" PRIu64 "\n", leave_stats.fast);
+	fprintf(fp, "    Hosts remaining  : %" PRIu64 "\n", leave_stats.tracked);
+	fprintf(fp, "    Leave to prune   : <1ms:%" PRIu64 " <10ms:%" PRIu64 " <100ms:%" PRIu64
+		" <1s:%" PRIu64 " <2s:%" PRIu64 " <5s:%" PRIu64 " <10s:%" PRIu64 " more:%" PRIu64 "\n",
+		leave_stats.latency[0], leave_stats.latency[1], leave_stats.latency[2],
+		leave_stats.latency[3], leave_stats.latency[4], leave_stats.latency[5],
+		leave_stats.latency[6], leave_stats.latency[7]);
+
+	fprintf(fp, "Kernel MFC updates\n");
+	fprintf(fp, "    Requests         : %" PRIu64 "\n", mfc_stats.requests);
+	fprintf(fp, "    Syscalls         : %" PRIu64 "\n", mfc_stats.syscalls);
+	fprintf(fp, "    Coalesced        : %" PRIu64 "\n", mfc_stats.coalesced);
+	fprintf(fp, "    Flushes          : %" PRIu64 "\n", mfc_stats.flushes);
+	fprintf(fp, "    Largest flush    : %u\n", mfc_stats.max_batch);
+	fprintf(fp, "    After RP change  : %" PRIu64 "\n", mfc_stats.rp_changes);
+	fprintf(fp, "    Saved at RP chg  : %" PRIu64 "\n", mfc_stats.rp_saved);
+
+	fprintf(fp, "IPC clients\n");
+	fprintf(fp, "    Connected        : %d\n", nclients);
+	fprintf(fp, "    Accepted         : %" PRIu64 "\n", cl_stats.connections);
+	fprintf(fp, "    Timed out        : %" PRIu64 "\n", cl_stats.timeouts);
+	fprintf(fp, "    Longest slice    : %" PRIu64 " usec\n", cl_stats.slice_max);
+
+	fprintf(fp, "IPC subscribers\n");
+	fprintf(fp, "    Connected        : %d\n", nsubs);
+	fprintf(fp, "    Accepted         : %" PRIu64 "\n", ev_stats.subscribers);
+	fprintf(fp, "    Events queued    : %" PRIu64 "\n", ev_stats.events);
+	fprintf(fp, "    Events dropped   : %" PRIu64 "\n", ev_stats.dropped);
+
+	return 0;
+}
+
+static int show_memory(FILE *fp)
+{
+	size_t total = 0;
+	struct pool *p;
+
+	fprintf(fp, "Memory Pools_\n");
+	fprintf(fp, "Pool            Size  Slabs   In Use     Free     Peak   Allocs  Failed=\n");
+	for (p = pools; p; p = p->next) {
+		fprintf(fp, "%-14s %5zu  %5zu  %7zu  %7zu  %7zu  %7" PRIu64 "  %6" PRIu64 "\n",
+			p->name, p->size, p->slabs, p->inuse,
+			p->slabs * p->per_slab - p->inuse, p->peak,
+			p->allocs, p->failed);
+		total += p->slabs * POOL_SLAB_SIZE;
+	}
+	fprintf(fp, "\nTotal slab memory       : %zu kiB\n", total / 1024);
+
+	return 0;
+}
+
+static int group_cmp(const void *a, const void *b)
+{
+	uint32_t ga = ntohl((*(struct listaddr *const *)a)->al_addr);
+	uint32_t gb = ntohl((*(struct listaddr *const *)b)->al_addr);
+
+	return ga < gb ? -1 : ga > gb;
+}
+
+/*
+ * Groups are hashed, list them in address order, in *@groups, only the
+ * ones after @after, in host byte order, to resume a listing.
+ */
+static int sort_groups(struct uvif *uv, struct listaddr ***groups, uint32_t after)
+{
+	struct listaddr *group, **tmp;
+	uint32_t num = 0;
+
+	tmp = realloc(*groups, uv->uv_ngroups * sizeof(*tmp));
+	if (!tmp)
+		return -1;
+	*groups = tmp;
+
+	for (group = uv->uv_groups; group && num < uv->uv_ngroups; group = group->al_next) {
+		if (ntohl(group->al_addr) > after)
+			tmp[num++] = group;
+	}
+	qsort(tmp, num, sizeof(*tmp), group_cmp);
+
+	return num;
+}
+
+/* Resumes after the last group shown, in c->cur.vifi */
+static int show_igmp_groups(FILE *fp, struct ipc_conn *c)
 {
-	struct listaddr *group, *source;
+	struct listaddr *group, **groups = NULL;
+	int i, num, visited = 0, rc = SHOW_DONE;
 	struct uvif *uv;
-	vifi_t vifi;
+	uint32_t j;
 
-	fprintf(fp, "IGMP Group Membership Table_\n");
-	fprintf(fp, "Interface         Group            Source           Last Reported    Timeout=\n");
-	for (vifi = 0, uv = uvifs; vifi < numvifs; vifi++, uv++) {
-		for (group = uv->uv_groups; group; group = group->al_next) {
+	if (!c->cur.stage++) {
+		fprintf(fp, "IGMP Group Membership Table_\n");
+		fprintf(fp, "Interface         Group            Source           Last Reported    Timeout=\n");
+	}
+
+	for (; c->cur.vifi < numvifs; c->cur.vifi++, c->cur.started = 0) {
+		uv = &uvifs[c->cur.vifi];
+		if (!uv->uv_ngroups)
+			continue;
+
+		num = sort_groups(uv, &groups, c->cur.started ? ntohl(c->cur.group) : 0);
+		if (num < 0)
+			break;
+
+		for (i = 0; i < num; i++) {
 			char pre[40], post[40];
 
+			group = groups[i];
 			snprintf(pre, sizeof(pre), "%-16s  %-15s  ",
 				 uv->uv_name, inet_fmt(group->al_addr, s1, sizeof(s1)));
 
@@ -708,23 +1580,28 @@ static int show_igmp_groups(FILE *fp)
 				 inet_fmt(group->al_reporter, s1, sizeof(s1)),
 				 group->al_timer);
 
-			if (!group->al_sources) {
+			if (!group->al_nsources)
 				fprintf(fp, "%s%-15s  %s\n", pre, "ANY", post);
-				continue;
+			for (j = 0; j < group->al_nsources; j++)
+				fprintf(fp, "%s%-15s  %s\n", pre,
+					inet_fmt(group->al_sources[j]->al_addr, s1, sizeof(s1)), post);
+
+			c->cur.started = 1;
+			c->cur.group = group->al_addr;
+			if (slice_done(fp, &visited)) {
+				rc = SHOW_MORE;
+				goto done;
 			}
-
-			for (source = group->al_sources; source; source = source->al_next)
-				fprintf(fp, "%s%-15s  %s\n",
-					pre, inet_fmt(source->al_addr, s1, sizeof(s1)), post);
 		}
 	}
+done:
+	free(groups);
 
-	return 0;
+	return rc;
 }
 
 static int show_igmp_iface(FILE *fp)
 {
-	struct listaddr *group;
 	struct uvif *uv;
 	vifi_t vifi;
 
@@ -748,8 +1625,7 @@ static int show_igmp_iface(FILE *fp)
 			snprintf(timeout, sizeof(timeout), "%u", igmp_querier_timeout - uv->uv_querier->al_timer);
 		}
 
-		for (group = uv->uv_groups; group; group = group->al_next)
-			num++;
+		num = uv->uv_ngroups;
 
 		if (uv->uv_flags & VIFF_IGMPV1)
 			version = 1;
@@ -765,24 +1641,57 @@ static int show_igmp_iface(FILE *fp)
 	return 0;
 }
 
-static int show_igmp(FILE *fp)
+static int show_igmp(FILE *fp, struct ipc_conn *c)
 {
-	int rc = 0;
-
-	rc += show_igmp_iface(fp);
-	rc += show_igmp_groups(fp);
+	if (!c->part++ && show_igmp_iface(fp))
+		return -1;
 
-	return rc;
+	return show_igmp_groups(fp, c);
 }
 
-static int show_dump(FILE *fp)
+/* The 'show compat' dump, as dump_pim_mrt() but resumable */
+static int show_dump(FILE *fp, struct ipc_conn *c)
 {
-	dump_vifs(fp, detail);
-	dump_ssm(fp, detail);
-	dump_pim_mrt(fp, detail);
-	dump_rp_set(fp, detail);
+	int visited = 0;
+	grpentry_t *g;
+	mrtentry_t *r;
+	cand_rp_t *rp;
 
-	return 0;
+	switch (c->cur.stage) {
+	case MRT_HEAD:
+		dump_vifs(fp, detail);
+		dump_ssm(fp, detail);
+		if (detail)
+			fprintf(fp, "\nMulticast Routing Table");
+		c->cur.stage++;
+		/* fallthrough */
+
+	case MRT_GROUPS:
+		while ((r = next_route(c, &g))) {
+			if (g->group != c->cur.last) {
+				c->cur.last = g->group;
+				c->cur.groups++;
+			}
+			c->cur.mirrors += dump_mrt_entry(fp, g, r);
+			if (slice_done(fp, &visited))
+				return SHOW_MORE;
+		}
+		c->cur.stage++;
+		/* fallthrough */
+
+	default:
+		for (rp = cand_rp_list; rp; rp = rp->next) {
+			r = rp->rpentry->mrtlink;
+			if (r)
+				c->cur.mirrors += dump_mrt_entry(fp, NULL, r);
+		}
+		fprintf(fp, "Number of Groups: %u\n", c->cur.groups);
+		fprintf(fp, "Number of Cache MIRRORs: %u\n", c->cur.mirrors);
+		dump_rp_set(fp, detail);
+		break;
+	}
+
+	return SHOW_DONE;
 }
 
 static int show_version(FILE *fp)
@@ -837,190 +1746,1767 @@ static int ipc_loglevel(char *buf, size_t len)
 
 	logit(LOG_NOTICE, 0, "Setting new log level %s", log_lvl2str(rc));
 	loglevel = rc;
+	setlogmask(LOG_UPTO(loglevel));
 
 	return 0;
 }
 
-static void ipc_help(int sd, char *buf, size_t len)
+static int show_help(FILE *fp)
 {
-	FILE *fp;
-
-	fp = tempfile();
-	if (!fp) {
-		int sz;
-
-		sz = snprintf(buf, len, "Cannot create tempfile: %s", strerror(errno));
-		if (write(sd, buf, sz) != sz)
-			logit(LOG_INFO, errno, "Client closed connection");
-		return;
-	}
-
 	for (size_t i = 0; i < NELEMS(cmds); i++) {
 		struct ipcmd *c = &cmds[i];
-		char tmp[50];
+		char tmp[100];
+
+		if (c->op == IPC_KEEPALIVE)
+			continue;	/* Not for pimctl */
 
 		snprintf(tmp, sizeof(tmp), "%s%s%s", c->cmd, c->arg ? " " : "", c->arg ?: "");
 		fprintf(fp, "%s\t%s\n", tmp, c->help ? c->help : "");
 	}
-	rewind(fp);
 
-	while (fgets(buf, len, fp)) {
-		if (!ipc_write(sd, buf, strlen(buf)))
-			continue;
+	return 0;
+}
+
+/*
+ * Structured output, JSON or binary records, see doc/README-ipc.md
+ *
+ * Every table has a generation, the routes one per entry, see mrt_gen(),
+ * the small tables one for the whole table, bumped when the stable part
+ * of it, not the timers or uptime, is rendered different from the last
+ * time.  A client that sends 'since GEN' gets only what changed after
+ * that generation, and the routes deleted since.
+ */
+static struct {
+	uint32_t sum;
+	uint64_t gen;
+} tblgen[REC_MAX];
 
-		logit(LOG_WARNING, errno, "Failed communicating with client");
+static void put_raw(struct ipc_conn *c, const void *data, size_t len)
+{
+	if (c->reclen + len > sizeof(c->rec)) {
+		c->overflow = 1;
+		return;
 	}
 
-	fclose(fp);
+	memcpy(&c->rec[c->reclen], data, len);
+	c->reclen += len;
 }
 
-static void ipc_handle(int sd)
+/* The same for both formats, or generations change with the format */
+static void sum_add(struct ipc_conn *c, const void *data, size_t len)
 {
-	char cmd[768] = { 0 };
-	ssize_t len;
-	int client;
-	int rc = 0;
+	c->sum = mrt_sum(c->sum, data, len);
+}
+
+static void put_key(FILE *fp, struct ipc_conn *c, const char *name)
+{
+	fprintf(fp, "%s\"%s\":", c->nfield++ ? "," : "", name);
+}
 
-	client = accept(sd, NULL, NULL);
-	if (client < 0)
+/* Numbers are @width bytes in network byte order in binary records */
+static void put_num(FILE *fp, struct ipc_conn *c, const char *name, uint64_t val, int width, int stable)
+{
+	uint8_t byte;
+
+	if (stable)
+		sum_add(c, &val, sizeof(val));
+
+	if (c->format == FMT_JSON) {
+		put_key(fp, c, name);
+		fprintf(fp, "%" PRIu64, val);
 		return;
+	}
 
-	switch (ipc_read(client, cmd, sizeof(cmd))) {
-	case IPC_HELP:
-		ipc_help(client, cmd, sizeof(cmd));
-		break;
+	while (width--) {
+		byte = val >> (width * 8);
+		put_raw(c, &byte, 1);
+	}
+}
 
-	case IPC_DEBUG:
-		rc = ipc_wrap(client, ipc_debug, cmd, sizeof(cmd));
-		break;
+static void put_u8(FILE *fp, struct ipc_conn *c, const char *name, uint8_t val)
+{
+	put_num(fp, c, name, val, 1, 1);
+}
 
-	case IPC_LOGLEVEL:
-		rc = ipc_wrap(client, ipc_loglevel, cmd, sizeof(cmd));
-		break;
+static void put_u16(FILE *fp, struct ipc_conn *c, const char *name, uint16_t val)
+{
+	put_num(fp, c, name, val, 2, 1);
+}
 
-	case IPC_KILL:
-		rc = ipc_wrap(client, daemon_kill, cmd, sizeof(cmd));
-		break;
+static void put_u32(FILE *fp, struct ipc_conn *c, const char *name, uint32_t val)
+{
+	put_num(fp, c, name, val, 4, 1);
+}
 
-	case IPC_RESTART:
-		rc = ipc_wrap(client, daemon_restart, cmd, sizeof(cmd));
-		break;
+static void put_u64(FILE *fp, struct ipc_conn *c, const char *name, uint64_t val)
+{
+	put_num(fp, c, name, val, 8, 1);
+}
 
-	case IPC_VERSION:
-		ipc_show(client, show_version, cmd, sizeof(cmd));
-		break;
+/* Seconds left, or counting up, not part of the table generation */
+static void put_timer(FILE *fp, struct ipc_conn *c, const char *name, uint32_t val)
+{
+	put_num(fp, c, name, val, 4, 0);
+}
 
-	case IPC_IGMP_GRP:
-		ipc_show(client, show_igmp_groups, cmd, sizeof(cmd));
-		break;
+static void put_bool(FILE *fp, struct ipc_conn *c, const char *name, int val)
+{
+	val = !!val;
+	sum_add(c, &val, sizeof(val));
 
-	case IPC_IGMP_IFACE:
-		ipc_show(client, show_igmp_iface, cmd, sizeof(cmd));
-		break;
+	if (c->format == FMT_JSON) {
+		put_key(fp, c, name);
+		fputs(val ? "true" : "false", fp);
+		return;
+	}
 
-	case IPC_IGMP:
-		ipc_show(client, show_igmp, cmd, sizeof(cmd));
-		break;
+	put_num(fp, c, name, val, 1, 0);
+}
 
-	case IPC_PIM_IFACE:
-		ipc_show(client, show_interfaces, cmd, sizeof(cmd));
-		break;
+static void put_addr(FILE *fp, struct ipc_conn *c, const char *name, uint32_t addr)
+{
+	sum_add(c, &addr, sizeof(addr));
 
-	case IPC_PIM_NEIGH:
-		ipc_show(client, show_neighbors, cmd, sizeof(cmd));
-		break;
+	if (c->format == FMT_JSON) {
+		put_key(fp, c, name);
+		fprintf(fp, "\"%s\"", inet_fmt(addr, s1, sizeof(s1)));
+		return;
+	}
 
-	case IPC_PIM_ROUTE:
-		ipc_show(client, show_pim_mrt, cmd, sizeof(cmd));
-		break;
+	put_raw(c, &addr, sizeof(addr));
+}
 
-	case IPC_PIM_RP:
-		ipc_show(client, show_rp, cmd, sizeof(cmd));
-		break;
+/* Length of the valid UTF-8 sequence at @s, or 0 */
+static size_t utf8_len(const unsigned char *s)
+{
+	size_t len;
+	uint32_t cp;
 
-	case IPC_PIM_CRP:
-		ipc_show(client, show_crp, cmd, sizeof(cmd));
-		break;
+	if (s[0] < 0x80)
+		return 1;
+	if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+		len = 2;
+		cp  = s[0] & 0x1f;
+	} else if ((s[0] & 0xf0) == 0xe0) {
+		len = 3;
+		cp  = s[0] & 0x0f;
+	} else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+		len = 4;
+		cp  = s[0] & 0x07;
+	} else {
+		return 0;
+	}
 
-	case IPC_PIM:
-		ipc_show(client, show_pim, cmd, sizeof(cmd));
-		break;
+	/* Stops at the terminating NUL too */
+	for (size_t i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		cp = cp << 6 | (s[i] & 0x3f);
+	}
 
-	case IPC_STATUS:
-		ipc_show(client, show_status, cmd, sizeof(cmd));
-		break;
+	/* Overlong, surrogate, or past U+10FFFF */
+	if ((len == 3 && cp < 0x800) || (cp >= 0xd800 && cp <= 0xdfff) ||
+	    (len == 4 && (cp < 0x10000 || cp > 0x10ffff)))
+		return 0;
 
-	case IPC_PIM_DUMP:
-		ipc_show(client, show_dump, cmd, sizeof(cmd));
-		break;
+	return len;
+}
 
-	case IPC_OK:
-		/* client ping, ignore */
-		break;
+/*
+ * Length byte and at most 255 bytes in binary records.  In JSON bytes
+ * that are not valid UTF-8, e.g., of an interface name, are replaced
+ * with U+FFFD.
+ */
+static void put_str(FILE *fp, struct ipc_conn *c, const char *name, const char *str)
+{
+	size_t len = strlen(str), n;
+	uint8_t byte;
+
+	sum_add(c, str, len);
+
+	if (c->format == FMT_JSON) {
+		put_key(fp, c, name);
+		fputc('"', fp);
+		for (; *str; str += n) {
+			n = utf8_len((const unsigned char *)str);
+			if (!n) {
+				fputs("\\ufffd", fp);
+				n = 1;
+			} else if (*str == '"' || *str == '\\')
+				fprintf(fp, "\\%c", *str);
+			else if ((unsigned char)*str < 0x20)
+				fprintf(fp, "\\u%04x", *str);
+			else
+				fwrite(str, n, 1, fp);
+		}
+		fputc('"', fp);
+		return;
+	}
 
-	case IPC_ERR:
-		logit(LOG_WARNING, errno, "Failed reading command from client");
-		rc = IPC_ERR;
-		break;
+	byte = MIN(len, 255);
+	put_raw(c, &byte, 1);
+	put_raw(c, str, byte);
+}
 
-	default:
-		logit(LOG_WARNING, 0, "Invalid IPC command: %s", cmd);
-		break;
+/* Route flags, names in JSON, the MRTF_* bits in binary records */
+static void put_flags(FILE *fp, struct ipc_conn *c, const char *name, uint16_t flags)
+{
+	int num = 0;
+
+	sum_add(c, &flags, sizeof(flags));
+
+	if (c->format != FMT_JSON) {
+		put_num(fp, c, name, flags, 2, 0);
+		return;
 	}
 
-	if (rc == IPC_ERR)
-		ipc_err(sd, cmd, sizeof(cmd));
+	put_key(fp, c, name);
+	fputc('[', fp);
+	for (size_t i = 0; i < NELEMS(mrt_flags); i++) {
+		if (flags & mrt_flags[i].flag)
+			fprintf(fp, "%s\"%s\"", num++ ? "," : "", mrt_flags[i].name);
+	}
+	fputc(']', fp);
+}
+
+/* Interface index, null in JSON and 0xffff in binary records for none */
+static void put_vif(FILE *fp, struct ipc_conn *c, const char *name, vifi_t vifi)
+{
+	sum_add(c, &vifi, sizeof(vifi));
 
-	ipc_close(client);
+	if (c->format != FMT_JSON) {
+		put_num(fp, c, name, vifi < numvifs ? vifi : 0xffff, 2, 0);
+		return;
+	}
+
+	put_key(fp, c, name);
+	if (vifi < numvifs)
+		fprintf(fp, "%u", vifi);
+	else
+		fputs("null", fp);
 }
 
+/* Set of interfaces, an array of indexes or a length byte and bitmap */
+static void put_vifs(FILE *fp, struct ipc_conn *c, const char *name, vifset_t set)
+{
+	uint8_t byte, len = (numvifs + 7) / 8;
+	vifi_t vifi;
+	int num = 0;
 
-void ipc_init(char *sockfile)
+	sum_add(c, set, sizeof(vifset_t));
+
+	if (c->format == FMT_JSON) {
+		put_key(fp, c, name);
+		fputc('[', fp);
+		for (vifi = 0; vifi < numvifs; vifi++) {
+			if (PIMD_VIFM_ISSET(vifi, set))
+				fprintf(fp, "%s%u", num++ ? "," : "", vifi);
+		}
+		fputc(']', fp);
+		return;
+	}
+
+	put_raw(c, &len, 1);
+	for (int i = 0; i < len; i++) {
+		byte = 0;
+		for (int bit = 0; bit < 8; bit++) {
+			vifi = i * 8 + bit;
+			if (vifi < numvifs && PIMD_VIFM_ISSET(vifi, set))
+				byte |= 1 << bit;
+		}
+		put_raw(c, &byte, 1);
+	}
+}
+
+/* Per interface timers of a route, a count and 16-bit values in binary */
+static void put_timers(FILE *fp, struct ipc_conn *c, const char *name, uint32_t *timers)
 {
-	socklen_t len;
-	int sd;
+	vifi_t vifi;
 
-	sd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sd < 0) {
-		logit(LOG_ERR, errno, "Failed creating IPC socket");
+	if (c->format == FMT_JSON) {
+		put_key(fp, c, name);
+		fputc('[', fp);
+		for (vifi = 0; vifi < numvifs; vifi++)
+			fprintf(fp, "%s%u", vifi ? "," : "", MRT_TIMER_LEFT(timers[vifi]));
+		fputc(']', fp);
 		return;
 	}
 
-	/* Portable SOCK_NONBLOCK replacement, ignore any error. */
-	(void)fcntl(sd, F_SETFD, fcntl(sd, F_GETFD) | O_NONBLOCK);
+	put_num(fp, c, name, numvifs, 2, 0);
+	for (vifi = 0; vifi < numvifs; vifi++)
+		put_num(fp, c, name, MIN(MRT_TIMER_LEFT(timers[vifi]), 0xffff), 2, 0);
+}
 
-#ifdef HAVE_SOCKADDR_UN_SUN_LEN
-	sun.sun_len = 0;	/* <- correct length is set by the OS */
-#endif
-	sun.sun_family = AF_UNIX;
-	if (sockfile)
-		strlcpy(sun.sun_path, sockfile, sizeof(sun.sun_path));
-	else
-		snprintf(sun.sun_path, sizeof(sun.sun_path), _PATH_PIMD_SOCK, ident);
+/* Start a JSON object, one per line, or a binary record of @type */
+static void obj_begin(FILE *fp, struct ipc_conn *c, int type)
+{
+	c->nfield = 0;
 
-	unlink(sun.sun_path);
-	logit(LOG_DEBUG, 0, "Binding IPC socket to %s", sun.sun_path);
+	if (c->format == FMT_JSON) {
+		fputs(c->nrec++ ? ",\n{" : "\n{", fp);
+		return;
+	}
 
-	len = offsetof(struct sockaddr_un, sun_path) + strlen(sun.sun_path);
-	if (bind(sd, (struct sockaddr *)&sun, len) < 0 || listen(sd, 1)) {
-		logit(LOG_WARNING, errno, "Failed binding IPC socket, client disabled");
-		close(sd);
+	c->nrec++;
+	c->rec[2] = type;
+	c->reclen = 3;
+	c->overflow = 0;
+}
+
+/* Binary records start with their length, including the three byte header */
+static void obj_end(FILE *fp, struct ipc_conn *c)
+{
+	if (c->format == FMT_JSON) {
+		fputc('}', fp);
 		return;
 	}
 
-	if (register_input_handler(sd, ipc_handle) < 0)
-		logit(LOG_ERR, 0, "Failed registering IPC handler");
+	/* Cannot happen, see IPC_RECLEN, but never send a truncated record */
+	if (c->overflow) {
+		logit(LOG_WARNING, 0, "IPC record type %u too large, dropped", c->rec[2]);
+		return;
+	}
 
-	ipc_socket = sd;
+	c->rec[0] = c->reclen >> 8;
+	c->rec[1] = c->reclen & 0xff;
+	fwrite(c->rec, c->reclen, 1, fp);
 }
 
-void ipc_exit(void)
+static void table_begin(FILE *fp, struct ipc_conn *c, const struct ipc_table *t)
 {
-	if (ipc_socket > -1)
-		close(ipc_socket);
+	if (c->format == FMT_JSON) {
+		fprintf(fp, ",\n\"%s\": [", t->name);
+	} else {
+		obj_begin(fp, c, REC_TABLE);
+		put_u8(fp, c, "table", t->id);
+		obj_end(fp, c);
+	}
 
-	unlink(sun.sun_path);
-	ipc_socket = -1;
+	c->nrec = 0;
+}
+
+static void table_end(FILE *fp, struct ipc_conn *c)
+{
+	if (c->format == FMT_JSON)
+		fputs(c->nrec ? "\n]" : "]", fp);
+}
+
+static const char *route_type(uint16_t flags)
+{
+	if (flags & MRTF_PMBR)
+		return "rp";
+	if (flags & MRTF_WC)
+		return "wc";
+
+	return "sg";
+}
+
+static void put_route(FILE *fp, struct ipc_conn *c, mrtentry_t *r)
+{
+	uint32_t source = INADDR_ANY_N, group = INADDR_ANY_N, rp = INADDR_ANY_N;
+
+	if (r->flags & MRTF_PMBR) {
+		source = r->source->address;
+		rp     = source;
+	} else {
+		group = r->group->group;
+		if (!(r->flags & MRTF_WC))
+			source = r->source->address;
+		if (!IN_PIM_SSM_RANGE(group) && r->group->active_rp_grp)
+			rp = r->group->rpaddr;
+	}
+
+	obj_begin(fp, c, REC_ROUTE);
+	put_str(fp, c, "type", route_type(r->flags));
+	put_addr(fp, c, "source", source);
+	put_addr(fp, c, "group", group);
+	put_addr(fp, c, "rp", rp);
+	put_u64(fp, c, "gen", r->gen);
+	put_flags(fp, c, "flags", r->flags);
+	put_vif(fp, c, "iif", r->incoming);
+	put_addr(fp, c, "upstream", r->upstream ? r->upstream->address : INADDR_ANY_N);
+	put_vifs(fp, c, "oifs", r->oifs);
+	put_vifs(fp, c, "joined", r->joined_oifs);
+	put_vifs(fp, c, "pruned", r->pruned_oifs);
+	put_vifs(fp, c, "leaves", r->leaves);
+	put_vifs(fp, c, "asserted", r->asserted_oifs);
+	put_timer(fp, c, "entry_timer", MRT_TIMER_LEFT(r->entry_timer));
+	put_timer(fp, c, "jp_timer", MRT_TIMER_LEFT(r->jp_timer));
+	put_timer(fp, c, "rs_timer", MRT_TIMER_LEFT(r->rs_timer));
+	put_timer(fp, c, "assert_timer", MRT_TIMER_LEFT(r->assert_timer));
+	put_timers(fp, c, "vif_timers", r->vif_timers);
+	obj_end(fp, c);
+}
+
+static int tbl_interfaces(FILE *fp, struct ipc_conn *c)
+{
+	pim_nbr_entry_t *n, *dr;
+	struct uvif *uv;
+	vifi_t vifi;
+	int num;
+
+	for (vifi = 0, uv = uvifs; vifi < numvifs; vifi++, uv++) {
+		if (uv->uv_flags & VIFF_REGISTER)
+			continue;
+
+		num = 0;
+		for (n = uv->uv_pim_neighbors; n; n = n->next)
+			num++;
+
+		dr = uv->uv_pim_neighbor_dr;
+		obj_begin(fp, c, REC_INTERFACE);
+		put_u16(fp, c, "index", vifi);
+		put_str(fp, c, "name", uv->uv_name);
+		put_str(fp, c, "state", ifstate(uv));
+		put_addr(fp, c, "address", uv->uv_lcl_addr);
+		put_addr(fp, c, "subnet", uv->uv_subnet);
+		put_addr(fp, c, "netmask", uv->uv_subnetmask);
+		put_u32(fp, c, "priority", uv->uv_dr_prio);
+		put_u16(fp, c, "hello_interval", pim_timer_hello_interval);
+		put_u16(fp, c, "neighbors", num);
+		put_bool(fp, c, "is_dr", uv->uv_flags & VIFF_DR);
+		if (uv->uv_flags & VIFF_DR) {
+			put_addr(fp, c, "dr", uv->uv_lcl_addr);
+			put_u32(fp, c, "dr_priority", uv->uv_dr_prio);
+		} else {
+			put_addr(fp, c, "dr", dr ? dr->address : INADDR_ANY_N);
+			put_u32(fp, c, "dr_priority", dr && dr->dr_prio_present ? dr->dr_prio : 0);
+		}
+		obj_end(fp, c);
+	}
+
+	return 0;
+}
+
+static int tbl_neighbors(FILE *fp, struct ipc_conn *c)
+{
+	time_t now = time(NULL);
+	pim_nbr_entry_t *n;
+	struct uvif *uv;
+	vifi_t vifi;
+
+	for (vifi = 0, uv = uvifs; vifi < numvifs; vifi++, uv++) {
+		for (n = uv->uv_pim_neighbors; n; n = n->next) {
+			obj_begin(fp, c, REC_NEIGHBOR);
+			put_str(fp, c, "interface", uv->uv_name);
+			put_u16(fp, c, "index", vifi);
+			put_addr(fp, c, "address", n->address);
+			put_u32(fp, c, "priority", n->dr_prio);
+			put_bool(fp, c, "priority_present", n->dr_prio_present);
+			put_bool(fp, c, "dr", uv->uv_pim_neighbor_dr == n);
+			put_bool(fp, c, "tracking", n->tbit);
+			put_u32(fp, c, "genid", n->genid);
+			put_timer(fp, c, "uptime", now - n->uptime);
+			put_timer(fp, c, "expires", n->timer);
+			obj_end(fp, c);
+		}
+	}
+
+	return 0;
+}
+
+/* Routes removed since the client last asked, apply before the routes */
+static int tbl_deleted(FILE *fp, struct ipc_conn *c)
+{
+	struct ipc_filter *f = &c->filter;
+	struct mrt_tomb *tomb;
+	uint64_t i;
+
+	i = mrt_ntombs > MRT_TOMBS ? mrt_ntombs - MRT_TOMBS : 0;
+	for (; i < mrt_ntombs; i++) {
+		tomb = &mrt_tombs[i % MRT_TOMBS];
+		if (tomb->gen <= c->since)
+			continue;
+		if (tomb->flags & MRTF_PMBR) {
+			if (f->group_mask || f->source)
+				continue;
+		} else if ((tomb->group & f->group_mask) != f->group)
+			continue;
+		if (f->source && tomb->source != f->source)
+			continue;
+
+		obj_begin(fp, c, REC_DELETED);
+		put_str(fp, c, "type", route_type(tomb->flags));
+		put_addr(fp, c, "source", tomb->source);
+		put_addr(fp, c, "group", tomb->group);
+		put_u64(fp, c, "gen", tomb->gen);
+		obj_end(fp, c);
+	}
+
+	return SHOW_DONE;
+}
+
+/* Like show_pim_mrt(), with only the routes changed since the client asked */
+static int tbl_routes(FILE *fp, struct ipc_conn *c)
+{
+	struct ipc_filter *f = &c->filter;
+	u_int skip = f->page ? (f->page - 1) * f->limit : 0;
+	int all = !f->group_mask && !f->source && !f->limit;
+	int visited = 0;
+	grpentry_t *g;
+	mrtentry_t *r;
+	cand_rp_t *rp;
+
+	switch (c->cur.stage) {
+	case MRT_HEAD:
+		c->cur.stage = MRT_GROUPS;
+		/* fallthrough */
+
+	case MRT_GROUPS:
+		while (!f->limit || c->cur.count < skip + f->limit) {
+			r = next_route(c, &g);
+			if (!r)
+				break;
+
+			if (c->cur.count++ >= skip && mrt_gen(r) > c->since)
+				put_route(fp, c, r);
+			if (slice_done(fp, &visited))
+				return SHOW_MORE;
+		}
+		c->cur.stage++;
+		/* fallthrough */
+
+	default:
+		for (rp = cand_rp_list; all && rp; rp = rp->next) {
+			r = rp->rpentry->mrtlink;
+			if (r && mrt_gen(r) > c->since)
+				put_route(fp, c, r);
+		}
+		break;
+	}
+
+	return SHOW_DONE;
+}
+
+static int tbl_negative(FILE *fp, struct ipc_conn *c)
+{
+	kernel_cache_t *kc;
+
+	for (kc = negative_cache; kc; kc = kc->next) {
+		obj_begin(fp, c, REC_NEGATIVE);
+		put_addr(fp, c, "source", kc->source);
+		put_addr(fp, c, "group", kc->group);
+		put_timer(fp, c, "expires", MRT_TIMER_LEFT(kc->expires));
+		obj_end(fp, c);
+	}
+
+	return 0;
+}
+
+static int tbl_rp(FILE *fp, struct ipc_conn *c)
+{
+	struct rp_grp_entry *rp_grp;
+	grp_mask_t *grp;
+	int len;
+
+	for (grp = grp_mask_list; grp; grp = grp->next) {
+		MASK_TO_MASKLEN(grp->group_mask, len);
+
+		for (rp_grp = grp->grp_rp_next; rp_grp; rp_grp = rp_grp->grp_rp_next) {
+			int forever = rp_grp->holdtime == PIM_HELLO_HOLDTIME_FOREVER;
+
+			obj_begin(fp, c, REC_RP);
+			put_addr(fp, c, "group", grp->group_addr);
+			put_u8(fp, c, "masklen", len);
+			put_addr(fp, c, "rp", rp_grp->rp->rpentry->address);
+			put_u8(fp, c, "priority", rp_grp->priority);
+			put_bool(fp, c, "static", forever);
+			put_timer(fp, c, "holdtime", forever ? 0 : rp_grp->holdtime);
+			obj_end(fp, c);
+		}
+	}
+
+	return 0;
+}
+
+static int tbl_crp(FILE *fp, struct ipc_conn *c)
+{
+	struct cand_rp *rp;
+	int len;
+
+	for (rp = cand_rp_list; rp; rp = rp->next) {
+		struct rp_grp_entry *rp_grp = rp->rp_grp_next;
+		struct grp_mask *grp = rp_grp->group;
+		int forever = rp_grp->holdtime == PIM_HELLO_HOLDTIME_FOREVER;
+
+		MASK_TO_MASKLEN(grp->group_mask, len);
+		obj_begin(fp, c, REC_CRP);
+		put_addr(fp, c, "group", grp->group_addr);
+		put_u8(fp, c, "masklen", len);
+		put_addr(fp, c, "rp", rp->rpentry->address);
+		put_u8(fp, c, "priority", rp_grp->priority);
+		put_u16(fp, c, "holdtime", rp->rpentry->adv_holdtime);
+		put_bool(fp, c, "static", forever);
+		put_timer(fp, c, "expires", forever ? 0 : rp_grp->holdtime);
+		obj_end(fp, c);
+	}
+
+	return 0;
+}
+
+static int tbl_registers(FILE *fp, struct ipc_conn *c)
+{
+	struct ipc_filter *f = &c->filter;
+	u_int skip = f->page ? (f->page - 1) * f->limit : 0;
+	int visited = 0;
+	regstate_t *reg;
+	grpentry_t *g;
+	mrtentry_t *r;
+	uint64_t bps;
+	uint32_t pps;
+
+	while (!f->limit || c->cur.count < skip + f->limit) {
+		r = next_route(c, &g);
+		if (!r)
+			break;
+
+		reg = r->reg;
+		if (reg && r != g->grp_route && c->cur.count++ >= skip) {
+			register_rate(reg, &pps, &bps);
+			obj_begin(fp, c, REC_REGISTER);
+			put_addr(fp, c, "source", r->source->address);
+			put_addr(fp, c, "group", g->group);
+			put_addr(fp, c, "rp", reg->reg_dst);
+			put_u64(fp, c, "packets", reg->pkts);
+			put_u64(fp, c, "bytes", reg->bytes);
+			put_u64(fp, c, "suppressed", reg->suppressed);
+			put_u32(fp, c, "pps", pps);
+			put_u64(fp, c, "bps", bps);
+			obj_end(fp, c);
+		}
+
+		if (slice_done(fp, &visited))
+			return SHOW_MORE;
+	}
+
+	return SHOW_DONE;
+}
+
+static int tbl_igmp_ifaces(FILE *fp, struct ipc_conn *c)
+{
+	struct uvif *uv;
+	vifi_t vifi;
+	int version;
+
+	for (vifi = 0, uv = uvifs; vifi < numvifs; vifi++, uv++) {
+		if (uv->uv_flags & VIFF_REGISTER)
+			continue;
+
+		if (uv->uv_flags & VIFF_IGMPV1)
+			version = 1;
+		else if (uv->uv_flags & VIFF_IGMPV2)
+			version = 2;
+		else
+			version = 3;
+
+		obj_begin(fp, c, REC_IGMP_IFACE);
+		put_str(fp, c, "interface", uv->uv_name);
+		put_u16(fp, c, "index", vifi);
+		put_str(fp, c, "state", ifstate(uv));
+		put_bool(fp, c, "querier_local", !uv->uv_querier);
+		put_addr(fp, c, "querier", uv->uv_querier ? uv->uv_querier->al_addr : uv->uv_lcl_addr);
+		put_timer(fp, c, "querier_timeout", uv->uv_querier ? igmp_querier_timeout - uv->uv_querier->al_timer : 0);
+		put_u8(fp, c, "version", version);
+		put_u32(fp, c, "groups", uv->uv_ngroups);
+		obj_end(fp, c);
+	}
+
+	return 0;
+}
+
+static void put_member(FILE *fp, struct ipc_conn *c, struct uvif *uv, vifi_t vifi,
+		       struct listaddr *group, uint32_t source)
+{
+	obj_begin(fp, c, REC_IGMP_GROUP);
+	put_str(fp, c, "interface", uv->uv_name);
+	put_u16(fp, c, "index", vifi);
+	put_addr(fp, c, "group", group->al_addr);
+	put_addr(fp, c, "source", source);
+	put_addr(fp, c, "reporter", group->al_reporter);
+	put_timer(fp, c, "timeout", group->al_timer);
+	obj_end(fp, c);
+}
+
+/* Like show_igmp_groups(), one record per source, or ANY */
+static int tbl_igmp_groups(FILE *fp, struct ipc_conn *c)
+{
+	struct listaddr *group, **groups = NULL;
+	struct uvif *uv;
+	vifi_t vifi;
+	int i, num;
+	uint32_t j;
+
+	for (vifi = 0, uv = uvifs; vifi < numvifs; vifi++, uv++) {
+		if (!uv->uv_ngroups)
+			continue;
+
+		num = sort_groups(uv, &groups, 0);
+		if (num < 0)
+			break;
+
+		for (i = 0; i < num; i++) {
+			group = groups[i];
+			if (!group->al_nsources)
+				put_member(fp, c, uv, vifi, group, INADDR_ANY_N);
+			for (j = 0; j < group->al_nsources; j++)
+				put_member(fp, c, uv, vifi, group, group->al_sources[j]->al_addr);
+		}
+	}
+	free(groups);
+
+	return 0;
+}
+
+static void put_counter(FILE *fp, struct ipc_conn *c, const char *name, uint64_t val)
+{
+	obj_begin(fp, c, REC_COUNTER);
+	put_str(fp, c, "name", name);
+	put_u64(fp, c, "value", val);
+	obj_end(fp, c);
+}
+
+static void put_rxstats(FILE *fp, struct ipc_conn *c, const char *name, struct rxstats *st)
+{
+	static const char *batch[] = { "1", "2_3", "4_7", "8_15", "16_31", "32" };
+	char buf[40];
+
+	snprintf(buf, sizeof(buf), "%s.packets", name);
+	put_counter(fp, c, buf, st->packets);
+	snprintf(buf, sizeof(buf), "%s.batches", name);
+	put_counter(fp, c, buf, st->calls);
+	snprintf(buf, sizeof(buf), "%s.max_batch", name);
+	put_counter(fp, c, buf, st->max_batch);
+	for (size_t i = 0; i < NELEMS(batch); i++) {
+		snprintf(buf, sizeof(buf), "%s.batch_%s", name, batch[i]);
+		put_counter(fp, c, buf, st->batch[i]);
+	}
+	snprintf(buf, sizeof(buf), "%s.oversized", name);
+	put_counter(fp, c, buf, st->oversized);
+	snprintf(buf, sizeof(buf), "%s.truncated", name);
+	put_counter(fp, c, buf, st->truncated);
+	snprintf(buf, sizeof(buf), "%s.overflow", name);
+	put_counter(fp, c, buf, st->overflow);
+}
+
+/* Everything in show_stats(), as name and value */
+static int tbl_counters(FILE *fp, struct ipc_conn *c)
+{
+	static const char *latency[] = { "1ms", "10ms", "100ms", "1s", "2s", "5s", "10s", "more" };
+	char buf[40];
+
+	put_rxstats(fp, c, "igmp", &igmp_rx.stats);
+	put_rxstats(fp, c, "pim", &pim_rx.stats);
+
+	put_counter(fp, c, "rpf.tracking", k_route_notify());
+	put_counter(fp, c, "rpf.hits", rpf_stats.hits);
+	put_counter(fp, c, "rpf.misses", rpf_stats.misses);
+	put_counter(fp, c, "rpf.async", rpf_stats.async);
+	put_counter(fp, c, "rpf.notifications", rpf_stats.notifications);
+	put_counter(fp, c, "rpf.changes", rpf_stats.changes);
+	put_counter(fp, c, "rpf.lost", rpf_stats.lost);
+	put_counter(fp, c, "rpf.evicted", rpf_stats.evicted);
+
+	put_counter(fp, c, "upcall.misses", upcall_stats.misses);
+	put_counter(fp, c, "upcall.limited", upcall_stats.limited);
+	put_counter(fp, c, "upcall.negative", upcall_stats.negative);
+	put_counter(fp, c, "upcall.expired", upcall_stats.expired);
+	put_counter(fp, c, "upcall.flushed", upcall_stats.flushed);
+
+	put_counter(fp, c, "register.hits", reg_stats.hits);
+	put_counter(fp, c, "register.misses", reg_stats.misses);
+	put_counter(fp, c, "register.sent", reg_stats.sent);
+	put_counter(fp, c, "register.fragmented", reg_stats.copied);
+	put_counter(fp, c, "register.failed", reg_stats.failed);
+	put_counter(fp, c, "register.suppressed", reg_stats.suppressed);
+	put_counter(fp, c, "register.tunnels", reg_stats.tunnels);
+	put_counter(fp, c, "register.decap_hits", reg_stats.decap_hits);
+	put_counter(fp, c, "register.decap_misses", reg_stats.decap_misses);
+
+	put_counter(fp, c, "jp.entries", jp_stats.entries);
+	put_counter(fp, c, "jp.duplicates", jp_stats.duplicates);
+	put_counter(fp, c, "jp.sent", jp_stats.messages);
+	put_counter(fp, c, "jp.batches", jp_stats.batches);
+	put_counter(fp, c, "jp.split", jp_stats.split);
+	put_counter(fp, c, "jp.received", jp_stats.received);
+	put_counter(fp, c, "jp.rx_entries", jp_stats.rx_entries);
+	put_counter(fp, c, "jp.malformed", jp_stats.malformed);
+	put_counter(fp, c, "jp.suppressed", jp_stats.suppressed);
+	put_counter(fp, c, "jp.overrides", jp_stats.overrides);
+	put_counter(fp, c, "jp.fast_prunes", jp_stats.fast_prunes);
+	put_counter(fp, c, "jp.tracked", jp_stats.tracked);
+
+	put_counter(fp, c, "leave.fast", leave_stats.fast);
+	put_counter(fp, c, "leave.tracked", leave_stats.tracked);
+	for (size_t i = 0; i < NELEMS(latency); i++) {
+		snprintf(buf, sizeof(buf), "leave.latency_%s", latency[i]);
+		put_counter(fp, c, buf, leave_stats.latency[i]);
+	}
+
+	put_counter(fp, c, "mfc.requests", mfc_stats.requests);
+	put_counter(fp, c, "mfc.syscalls", mfc_stats.syscalls);
+	put_counter(fp, c, "mfc.coalesced", mfc_stats.coalesced);
+	put_counter(fp, c, "mfc.flushes", mfc_stats.flushes);
+	put_counter(fp, c, "mfc.max_batch", mfc_stats.max_batch);
+	put_counter(fp, c, "mfc.rp_changes", mfc_stats.rp_changes);
+	put_counter(fp, c, "mfc.rp_saved", mfc_stats.rp_saved);
+
+	put_counter(fp, c, "ipc.clients", nclients);
+	put_counter(fp, c, "ipc.connections", cl_stats.connections);
+	put_counter(fp, c, "ipc.timeouts", cl_stats.timeouts);
+	put_counter(fp, c, "ipc.slice_max_us", cl_stats.slice_max);
+	put_counter(fp, c, "ipc.subscribers", nsubs);
+	put_counter(fp, c, "ipc.accepted", ev_stats.subscribers);
+	put_counter(fp, c, "ipc.events", ev_stats.events);
+	put_counter(fp, c, "ipc.dropped", ev_stats.dropped);
+
+	return 0;
+}
+
+static int tbl_pools(FILE *fp, struct ipc_conn *c)
+{
+	struct pool *p;
+
+	for (p = pools; p; p = p->next) {
+		obj_begin(fp, c, REC_POOL);
+		put_str(fp, c, "name", p->name);
+		put_u32(fp, c, "size", p->size);
+		put_u32(fp, c, "slabs", p->slabs);
+		put_u32(fp, c, "inuse", p->inuse);
+		put_u32(fp, c, "free", p->slabs * p->per_slab - p->inuse);
+		put_u32(fp, c, "peak", p->peak);
+		put_u64(fp, c, "allocs", p->allocs);
+		put_u64(fp, c, "failed", p->failed);
+		obj_end(fp, c);
+	}
+
+	return 0;
+}
+
+static int tbl_status(FILE *fp, struct ipc_conn *c)
+{
+	static const char *spt[] = { "rate", "packets", "infinity" };
+	int len;
+
+	obj_begin(fp, c, REC_STATUS);
+	put_addr(fp, c, "bsr", curr_bsr_address);
+	put_u8(fp, c, "bsr_priority", curr_bsr_priority);
+	MASK_TO_MASKLEN(curr_bsr_hash_mask, len);
+	put_u8(fp, c, "bsr_hash_masklen", len);
+	put_timer(fp, c, "bsr_expires", pim_bootstrap_timer);
+	put_bool(fp, c, "cand_bsr", cand_bsr_flag);
+	put_addr(fp, c, "cand_bsr_address", my_bsr_address);
+	put_u8(fp, c, "cand_bsr_priority", my_bsr_priority);
+	put_bool(fp, c, "cand_rp", cand_rp_flag);
+	put_addr(fp, c, "cand_rp_address", my_cand_rp_address);
+	put_u8(fp, c, "cand_rp_priority", my_cand_rp_priority);
+	put_u16(fp, c, "cand_rp_holdtime", my_cand_rp_holdtime);
+	put_u16(fp, c, "jp_interval", PIM_JOIN_PRUNE_PERIOD);
+	put_u16(fp, c, "hello_interval", pim_timer_hello_interval);
+	put_u16(fp, c, "hello_holdtime", pim_timer_hello_holdtime);
+	put_u32(fp, c, "igmp_query_interval", igmp_query_interval);
+	put_u32(fp, c, "igmp_querier_timeout", igmp_querier_timeout);
+	put_str(fp, c, "spt_mode", spt[spt_threshold.mode]);
+	put_u32(fp, c, "spt_bytes", spt_threshold.bytes);
+	put_u32(fp, c, "spt_packets", spt_threshold.packets);
+	put_u32(fp, c, "spt_interval", spt_threshold.interval);
+	obj_end(fp, c);
+
+	return 0;
+}
+
+#define T_INTERFACES	 { "interfaces",      REC_INTERFACE,  tbl_interfaces,  0 }
+#define T_NEIGHBORS	 { "neighbors",       REC_NEIGHBOR,   tbl_neighbors,   0 }
+#define T_DELETED	 { "deleted",         REC_DELETED,    tbl_deleted,     TBL_LARGE | TBL_DELTA }
+#define T_ROUTES	 { "routes",          REC_ROUTE,      tbl_routes,      TBL_LARGE }
+#define T_NEGATIVE	 { "negative",        REC_NEGATIVE,   tbl_negative,    0 }
+#define T_RP		 { "rp",              REC_RP,         tbl_rp,          0 }
+#define T_CRP		 { "crp",             REC_CRP,        tbl_crp,         0 }
+#define T_REGISTERS	 { "registers",       REC_REGISTER,   tbl_registers,   TBL_LARGE }
+#define T_IGMP_IFACES	 { "igmp_interfaces", REC_IGMP_IFACE, tbl_igmp_ifaces, 0 }
+#define T_IGMP_GROUPS	 { "igmp_groups",     REC_IGMP_GROUP, tbl_igmp_groups, 0 }
+#define T_COUNTERS	 { "counters",        REC_COUNTER,    tbl_counters,    0 }
+#define T_POOLS		 { "pools",           REC_POOL,       tbl_pools,       0 }
+#define T_STATUS	 { "status",          REC_STATUS,     tbl_status,      0 }
+#define T_END		 { NULL, 0, NULL, 0 }
+
+static const struct ipc_table pim_tables[]       = { T_INTERFACES, T_NEIGHBORS, T_DELETED, T_ROUTES,
+						     T_NEGATIVE, T_CRP, T_RP, T_END };
+static const struct ipc_table mrt_tables[]       = { T_DELETED, T_ROUTES, T_NEGATIVE, T_END };
+static const struct ipc_table iface_tables[]     = { T_INTERFACES, T_END };
+static const struct ipc_table neighbor_tables[]  = { T_NEIGHBORS, T_END };
+static const struct ipc_table rp_tables[]        = { T_RP, T_END };
+static const struct ipc_table crp_tables[]       = { T_CRP, T_END };
+static const struct ipc_table register_tables[]  = { T_REGISTERS, T_END };
+static const struct ipc_table igmp_tables[]      = { T_IGMP_IFACES, T_IGMP_GROUPS, T_END };
+static const struct ipc_table igmp_grp_tables[]  = { T_IGMP_GROUPS, T_END };
+static const struct ipc_table igmp_if_tables[]   = { T_IGMP_IFACES, T_END };
+static const struct ipc_table stats_tables[]     = { T_COUNTERS, T_END };
+static const struct ipc_table memory_tables[]    = { T_POOLS, T_END };
+static const struct ipc_table status_tables[]    = { T_STATUS, T_END };
+
+/*
+ * Small tables are rendered aside to see if they changed, the whole
+ * table is left out of incremental replies if not.
+ */
+static int table_small(FILE *fp, struct ipc_conn *c, const struct ipc_table *t)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *tmp;
+	int nrec;
+
+	tmp = open_memstream(&buf, &len);
+	if (!tmp)
+		return -1;
+
+	c->nrec = 0;
+	c->sum  = MRT_SUM_INIT;
+	if (t->show(tmp, c)) {
+		fclose(tmp);
+		free(buf);
+		return -1;
+	}
+	fclose(tmp);
+
+	if (!tblgen[t->id].gen || c->sum != tblgen[t->id].sum) {
+		tblgen[t->id].sum = c->sum;
+		tblgen[t->id].gen = ++mrt_generation;
+	}
+
+	if (!c->since || tblgen[t->id].gen > c->since) {
+		nrec = c->nrec;
+		table_begin(fp, c, t);
+		fwrite(buf, len, 1, fp);
+		c->nrec = nrec;
+		table_end(fp, c);
+	}
+	free(buf);
+
+	return 0;
+}
+
+/* Large tables are rendered straight to the client, a slice at a time */
+static int table_large(FILE *fp, struct ipc_conn *c, const struct ipc_table *t)
+{
+	int rc;
+
+	if (!c->cur.open) {
+		table_begin(fp, c, t);
+		c->cur.open = 1;
+	}
+
+	rc = t->show(fp, c);
+	if (rc != SHOW_DONE)
+		return rc;
+
+	table_end(fp, c);
+	memset(&c->cur, 0, sizeof(c->cur));
+
+	return SHOW_DONE;
+}
+
+static void doc_begin(FILE *fp, struct ipc_conn *c)
+{
+	/* Too old, or from before a restart, start over */
+	c->reset = c->since && (c->since > mrt_generation || c->since < mrt_tomb_lost);
+	if (c->reset)
+		c->since = 0;
+	c->gen = mrt_generation;
+
+	if (c->format == FMT_JSON) {
+		fputc('{', fp);
+		c->nfield = 0;
+	} else
+		obj_begin(fp, c, REC_HEADER);
+
+	put_u8(fp, c, "version", IPC_BINARY_VERSION);
+	put_u64(fp, c, "epoch", mrt_epoch);
+	put_u64(fp, c, "gen", c->gen);
+	put_u64(fp, c, "since", c->since);
+	put_bool(fp, c, "reset", c->reset);
+
+	if (c->format != FMT_JSON)
+		obj_end(fp, c);
+}
+
+static void doc_end(FILE *fp, struct ipc_conn *c)
+{
+	if (c->format == FMT_JSON) {
+		fputs("\n}\n", fp);
+		return;
+	}
+
+	obj_begin(fp, c, REC_END);
+	obj_end(fp, c);
+}
+
+/* Resumable render of the tables of a command, in JSON or binary */
+static int show_tables(FILE *fp, struct ipc_conn *c)
+{
+	const struct ipc_table *t;
+	int rc;
+
+	if (!c->part) {
+		doc_begin(fp, c);
+		c->part = 1;
+	}
+
+	for (t = &c->tables[c->part - 1]; t->name; t++, c->part++) {
+		if ((t->flags & TBL_DELTA) && !c->since)
+			continue;
+
+		if (t->flags & TBL_LARGE) {
+			rc = table_large(fp, c, t);
+			if (rc != SHOW_DONE)
+				return rc;
+		} else if (table_small(fp, c, t))
+			return -1;
+	}
+
+	doc_end(fp, c);
+
+	return SHOW_DONE;
+}
+
+/*
+ * Change events, see doc/README-ipc.md.  The routing code calls the
+ * ipc_*_event() hooks, which return at once without subscribers.
+ */
+static const struct {
+	int         class;
+	const char *name;	/* Argument to subscribe */
+	const char *op[4];	/* By IPC_EV_* */
+} ev_names[] = {
+	{ EV_ROUTE,    "routes",    { NULL, "route-add",   "route-del",     "route-change" } },
+	{ EV_NEIGHBOR, "neighbors", { NULL, "neighbor-up", "neighbor-down", NULL } },
+	{ EV_RP,       "rp",        { NULL, "rp-add",      "rp-del",        NULL } },
+	{ EV_IGMP,     "igmp",      { NULL, "igmp-join",   "igmp-leave",    NULL } },
+	{ EV_DROPPED,  NULL,        { NULL, "dropped",     NULL,            NULL } },
+};
+
+static void sub_input(int sd);
+static void sub_output(int sd);
+
+static struct ipc_sub *sub_find(int sd)
+{
+	for (size_t i = 0; i < NELEMS(subs); i++) {
+		if (subs[i].queue && subs[i].conn.sd == sd)
+			return &subs[i];
+	}
+
+	return NULL;
+}
+
+static void sub_close(struct ipc_sub *s)
+{
+	deregister_input_handler(s->conn.sd);
+	ipc_close(s->conn.sd);
+	free(s->conn.buf);
+	free(s->queue);
+	memset(s, 0, sizeof(*s));
+	s->conn.sd = -1;
+	nsubs--;
+}
+
+/* Wait for the socket to be writable while events are queued, otherwise for the client to hang up */
+static int sub_wait(struct ipc_sub *s, int writing)
+{
+	deregister_input_handler(s->conn.sd);
+	if (register_input_handler(s->conn.sd, writing ? sub_output : sub_input,
+				   writing ? IH_WRITE : IH_LEVEL) < 0)
+		return IPC_ERR;
+	s->writing = writing;
+
+	return 0;
+}
+
+static struct ipc_event *sub_push(struct ipc_sub *s)
+{
+	return &s->queue[(s->head + s->count++) % IPC_EVENTS];
+}
+
+/* Tell the client how many events it lost, before any newer event */
+static void sub_dropped(struct ipc_sub *s, uint64_t seq)
+{
+	struct ipc_event *e = sub_push(s);
+
+	memset(e, 0, sizeof(*e));
+	e->seq   = seq;
+	e->class = EV_DROPPED;
+	e->op    = IPC_EV_ADD;
+	e->vifi  = NO_VIF;
+	e->count = s->lost;
+	s->lost  = 0;
+}
+
+static void ipc_event(struct ipc_event *ev)
+{
+	struct ipc_event *e;
+
+	for (size_t i = 0; i < NELEMS(subs); i++) {
+		struct ipc_sub *s = &subs[i];
+
+		if (!s->queue || !(s->classes & ev->class))
+			continue;
+
+		s->seq++;
+		if (s->count + (s->lost ? 2 : 1) > IPC_EVENTS) {
+			s->lost++;
+			ev_stats.dropped++;
+			continue;
+		}
+		if (s->lost)
+			sub_dropped(s, s->seq - 1);
+
+		e = sub_push(s);
+		*e = *ev;
+		e->seq = s->seq;
+		ev_stats.events++;
+
+		if (!s->writing && sub_wait(s, 1))
+			sub_close(s);
+	}
+}
+
+void ipc_route_event(int op, mrtentry_t *mrt)
+{
+	struct ipc_event ev;
+
+	if (!nsubs)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.class  = EV_ROUTE;
+	ev.op     = op;
+	ev.flags  = mrt->flags & (MRTF_WC | MRTF_SG | MRTF_PMBR);
+	ev.vifi   = NO_VIF;
+	ev.source = mrt->gen_source;
+	ev.group  = mrt->gen_group;
+	if (op == IPC_EV_CHANGE) {
+		ev.vifi    = mrt->incoming;
+		ev.address = mrt->upstream ? mrt->upstream->address : INADDR_ANY_N;
+		PIMD_VIFM_COPY(mrt->oifs, ev.oifs);
+	}
+
+	ipc_event(&ev);
+}
+
+void ipc_nbr_event(int op, pim_nbr_entry_t *nbr)
+{
+	struct ipc_event ev;
+
+	if (!nsubs)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.class   = EV_NEIGHBOR;
+	ev.op      = op;
+	ev.vifi    = nbr->vifi;
+	ev.address = nbr->address;
+
+	ipc_event(&ev);
+}
+
+void ipc_rp_event(int op, rp_grp_entry_t *entry)
+{
+	struct ipc_event ev;
+
+	if (!nsubs)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.class    = EV_RP;
+	ev.op       = op;
+	ev.vifi     = NO_VIF;
+	ev.group    = entry->group->group_addr;
+	MASK_TO_MASKLEN(entry->group->group_mask, ev.masklen);
+	ev.address  = entry->rp->rpentry->address;
+	ev.priority = entry->priority;
+
+	ipc_event(&ev);
+}
+
+void ipc_igmp_event(int op, vifi_t vifi, uint32_t group, uint32_t source)
+{
+	struct ipc_event ev;
+
+	if (!nsubs)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.class  = EV_IGMP;
+	ev.op     = op;
+	ev.vifi   = vifi;
+	ev.group  = group;
+	ev.source = source;
+
+	ipc_event(&ev);
+}
+
+static const char *ev_vif(vifi_t vifi)
+{
+	return vifi < numvifs ? uvifs[vifi].uv_name : "-";
+}
+
+static void text_event(FILE *fp, struct ipc_event *e, const char *name)
+{
+	vifi_t vifi;
+	int num = 0;
+
+	fprintf(fp, "%" PRIu64 " %s", e->seq, name);
+	switch (e->class) {
+	case EV_ROUTE:
+		fprintf(fp, " %s %s %s", route_type(e->flags),
+			inet_fmt(e->source, s1, sizeof(s1)), inet_fmt(e->group, s2, sizeof(s2)));
+		if (e->op != IPC_EV_CHANGE)
+			break;
+
+		fprintf(fp, " iif %s upstream %s oifs", ev_vif(e->vifi),
+			inet_fmt(e->address, s1, sizeof(s1)));
+		for (vifi = 0; vifi < numvifs; vifi++) {
+			if (PIMD_VIFM_ISSET(vifi, e->oifs))
+				fprintf(fp, "%c%s", num++ ? ',' : ' ', uvifs[vifi].uv_name);
+		}
+		if (!num)
+			fputs(" -", fp);
+		break;
+
+	case EV_NEIGHBOR:
+		fprintf(fp, " %s %s", ev_vif(e->vifi), inet_fmt(e->address, s1, sizeof(s1)));
+		break;
+
+	case EV_RP:
+		fprintf(fp, " %s/%u %s priority %u", inet_fmt(e->group, s1, sizeof(s1)),
+			e->masklen, inet_fmt(e->address, s2, sizeof(s2)), e->priority);
+		break;
+
+	case EV_IGMP:
+		fprintf(fp, " %s %s", ev_vif(e->vifi), inet_fmt(e->group, s1, sizeof(s1)));
+		if (e->source != INADDR_ANY_N)
+			fprintf(fp, " source %s", inet_fmt(e->source, s1, sizeof(s1)));
+		break;
+
+	case EV_DROPPED:
+		fprintf(fp, " %" PRIu64, e->count);
+		break;
+	}
+	fputc('\n', fp);
+}
+
+/* One line per event, or record, not a table in a document */
+static void put_event(FILE *fp, struct ipc_conn *c, struct ipc_event *e)
+{
+	const char *name = "";
+
+	for (size_t i = 0; i < NELEMS(ev_names); i++) {
+		if (ev_names[i].class == e->class && ev_names[i].op[e->op])
+			name = ev_names[i].op[e->op];
+	}
+
+	if (c->format == FMT_TEXT) {
+		text_event(fp, e, name);
+		return;
+	}
+
+	if (c->format == FMT_JSON) {
+		c->nfield = 0;
+		fputc('{', fp);
+	} else
+		obj_begin(fp, c, REC_EVENT);
+
+	put_u64(fp, c, "seq", e->seq);
+	put_str(fp, c, "event", name);
+	put_str(fp, c, "type", e->class == EV_ROUTE ? route_type(e->flags) : "");
+	put_vif(fp, c, "vif", e->vifi);
+	put_addr(fp, c, "source", e->source);
+	put_addr(fp, c, "group", e->group);
+	put_addr(fp, c, "address", e->address);
+	put_u8(fp, c, "masklen", e->masklen);
+	put_u8(fp, c, "priority", e->priority);
+	put_vifs(fp, c, "oifs", e->oifs);
+	put_u64(fp, c, "count", e->count);
+	obj_end(fp, c);
+
+	if (c->format == FMT_JSON)
+		fputc('\n', fp);
+}
+
+/* Render a batch of queued events, replacing the ones sent */
+static int sub_render(struct ipc_sub *s)
+{
+	struct ipc_conn *c = &s->conn;
+	FILE *fp;
+
+	free(c->buf);
+	c->buf = NULL;
+	c->len = c->pos = 0;
+
+	fp = open_memstream(&c->buf, &c->len);
+	if (!fp) {
+		logit(LOG_WARNING, errno, "Failed allocating IPC buffer");
+		return IPC_ERR;
+	}
+
+	for (int i = 0; s->count && i < IPC_EVENT_BATCH; i++) {
+		put_event(fp, c, &s->queue[s->head]);
+		s->head = (s->head + 1) % IPC_EVENTS;
+		s->count--;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/* Called while the subscriber socket is writable and events are queued */
+static void sub_output(int sd)
+{
+	struct ipc_sub *s = sub_find(sd);
+	struct ipc_conn *c;
+
+	if (!s)
+		return;
+
+	c = &s->conn;
+	if (ipc_flush(c))
+		goto fail;
+	if (c->pos < c->len)
+		return;		/* Wait for the client to catch up */
+
+	if (!s->count && s->lost)
+		sub_dropped(s, s->seq);
+	if (!s->count) {
+		if (sub_wait(s, 0))
+			goto fail;
+		return;
+	}
+
+	if (sub_render(s) || ipc_flush(c))
+		goto fail;
+	return;
+fail:
+	sub_close(s);
+}
+
+/* Subscribers have nothing more to say, only hang up */
+static void sub_input(int sd)
+{
+	struct ipc_sub *s = sub_find(sd);
+	char buf[64];
+	ssize_t len;
+
+	if (!s)
+		return;
+
+	len = read(sd, buf, sizeof(buf));
+	if (len > 0 || (len == -1 && (errno == EAGAIN || errno == EINTR)))
+		return;
+
+	sub_close(s);
+}
+
+/*
+ * Keep client @sd for events of the classes in @args, all by default,
+ * in text, or 'json' or 'binary', until it hangs up.  The client slot
+ * is freed, subscribers have slots of their own.
+ */
+static int ipc_subscribe(int sd, char *args)
+{
+	struct ipc_sub *s = NULL;
+	char *arg, *ptr;
+	int classes = 0;
+	int format = FMT_TEXT;
+	size_t i;
+
+	for (arg = strtok_r(args, " \t", &ptr); arg; arg = strtok_r(NULL, " \t", &ptr)) {
+		if (!strcasecmp(arg, "json")) {
+			format = FMT_JSON;
+			continue;
+		}
+		if (!strcasecmp(arg, "binary")) {
+			format = FMT_BINARY;
+			continue;
+		}
+
+		for (i = 0; i < NELEMS(ev_names); i++) {
+			if (ev_names[i].name && !strcasecmp(arg, ev_names[i].name))
+				break;
+		}
+		if (i == NELEMS(ev_names)) {
+			errno = EINVAL;
+			return IPC_ERR;
+		}
+		classes |= ev_names[i].class;
+	}
+
+	for (i = 0; i < NELEMS(subs); i++) {
+		if (!subs[i].queue) {
+			s = &subs[i];
+			break;
+		}
+	}
+	if (!s) {
+		errno = EBUSY;
+		return IPC_ERR;
+	}
+
+	/* Portable SOCK_NONBLOCK replacement */
+	if (fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) < 0)
+		return IPC_ERR;
+
+	memset(s, 0, sizeof(*s));
+	s->queue = calloc(IPC_EVENTS, sizeof(struct ipc_event));
+	if (!s->queue)
+		return IPC_ERR;
+
+	s->conn.sd     = sd;
+	s->conn.format = format;
+	s->classes     = classes ? classes : EV_ALL;
+
+	if (sub_wait(s, 0)) {
+		free(s->queue);
+		s->queue = NULL;
+		errno = ENOMEM;
+		return IPC_ERR;
+	}
+	ev_stats.subscribers++;
+	nsubs++;
+
+	return IPC_OK;
+}
+
+/*
+ * Run command line @cmd from @cl.  Returns 0 when the reply, if any, is
+ * on its way, or -1 when the client is closed, or handed over.
+ */
+static int ipc_command(struct ipc_client *cl, char *cmd)
+{
+	int rc = 0;
+
+	switch (ipc_parse(cmd)) {
+	case IPC_HELP:
+		rc = ipc_show(cl, show_help, NULL, cmd);
+		break;
+
+	case IPC_DEBUG:
+		rc = ipc_wrap(cl, ipc_debug, cmd);
+		break;
+
+	case IPC_LOGLEVEL:
+		rc = ipc_wrap(cl, ipc_loglevel, cmd);
+		break;
+
+	case IPC_KILL:
+		rc = ipc_wrap(cl, daemon_kill, cmd);
+		break;
+
+	case IPC_RESTART:
+		/* Disconnects all clients, this one too */
+		client_close(cl);
+		daemon_restart(cmd, IPC_CMDLEN);
+		return -1;
+
+	case IPC_VERSION:
+		rc = ipc_show(cl, show_version, NULL, cmd);
+		break;
+
+	case IPC_IGMP_GRP:
+		rc = ipc_resume(cl, show_igmp_groups, igmp_grp_tables, cmd);
+		break;
+
+	case IPC_IGMP_IFACE:
+		rc = ipc_show(cl, show_igmp_iface, igmp_if_tables, cmd);
+		break;
+
+	case IPC_IGMP:
+		rc = ipc_resume(cl, show_igmp, igmp_tables, cmd);
+		break;
+
+	case IPC_PIM_IFACE:
+		rc = ipc_show(cl, show_interfaces, iface_tables, cmd);
+		break;
+
+	case IPC_PIM_NEIGH:
+		rc = ipc_show(cl, show_neighbors, neighbor_tables, cmd);
+		break;
+
+	case IPC_PIM_ROUTE:
+		rc = ipc_stream(cl, NULL, show_pim_mrt, 1, mrt_tables, cmd);
+		break;
+
+	case IPC_PIM_RP:
+		rc = ipc_show(cl, show_rp, rp_tables, cmd);
+		break;
+
+	case IPC_PIM_CRP:
+		rc = ipc_show(cl, show_crp, crp_tables, cmd);
+		break;
+
+	case IPC_PIM:
+		rc = ipc_stream(cl, NULL, show_pim, 1, pim_tables, cmd);
+		break;
+
+	case IPC_STATUS:
+		rc = ipc_show(cl, show_status, status_tables, cmd);
+		break;
+
+	case IPC_STATS:
+		rc = ipc_show(cl, show_stats, stats_tables, cmd);
+		break;
+
+	case IPC_MEMORY:
+		rc = ipc_show(cl, show_memory, memory_tables, cmd);
+		break;
+
+	case IPC_PIM_REGISTER:
+		rc = ipc_stream(cl, NULL, show_register, 1, register_tables, cmd);
+		break;
+
+	case IPC_PIM_DUMP:
+		rc = ipc_resume(cl, show_dump, NULL, cmd);
+		break;
+
+	case IPC_SUBSCRIBE:
+		rc = ipc_subscribe(cl->conn.sd, cmd);
+		if (rc == IPC_OK) {
+			client_release(cl);
+			return -1;
+		}
+		break;
+
+	case IPC_KEEPALIVE:
+		cl->keep = 1;
+		cl->msg[0] = 0;
+		ipc_reply(cl)->msg = cl->msg;	/* Empty, only the end */
+		break;
+
+	case IPC_OK:
+		/* client ping, ignore */
+		break;
+
+	case IPC_ERR:
+		logit(LOG_WARNING, errno, "Failed reading command from client");
+		rc = IPC_ERR;
+		break;
+
+	default:
+		logit(LOG_WARNING, 0, "Invalid IPC command: %s", cmd);
+		break;
+	}
+
+	if (rc == IPC_ERR)
+		ipc_err(cl);
+
+	if (!cl->conn.msg && !cl->conn.show && !cl->conn.render) {
+		if (cl->keep)
+			return 0;	/* Nothing to reply, next command */
+
+		client_close(cl);
+		return -1;
+	}
+
+	if (client_wait(cl, CL_WRITE)) {
+		client_close(cl);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Run the next command read from @cl, if any.  Commands end with a
+ * newline, except the only one of a client that does not keep the
+ * connection, as sent by pimctl.  The client hanging up is not read
+ * until the commands it sent before are replied to.
+ */
+static void ipc_next(struct ipc_client *cl)
+{
+	char cmd[IPC_CMDLEN];
+	size_t len;
+	char *nl;
+
+	while (cl->state == CL_READ) {
+		nl = memchr(cl->cmd, '\n', cl->cmdlen);
+		if (nl)
+			len = nl - cl->cmd + 1;
+		else if (cl->cmdlen && (!cl->keep || cl->eof || cl->cmdlen == sizeof(cl->cmd) - 1))
+			len = cl->cmdlen;
+		else {
+			if (cl->eof)
+				client_close(cl);
+			return;
+		}
+
+		memcpy(cmd, cl->cmd, len);
+		cmd[len] = 0;
+		cl->cmdlen -= len;
+		memmove(cl->cmd, cl->cmd + len, cl->cmdlen);
+
+		if (ipc_command(cl, cmd))
+			return;
+	}
+}
+
+/* Called while the client socket is readable, waiting for a command */
+static void ipc_input(int sd)
+{
+	struct ipc_client *cl = client_find(sd);
+	ssize_t len;
+
+	if (!cl)
+		return;
+
+	len = read(sd, cl->cmd + cl->cmdlen, sizeof(cl->cmd) - 1 - cl->cmdlen);
+	if (len == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+
+		logit(LOG_WARNING, errno, "Failed reading command from client");
+		client_close(cl);
+		return;
+	}
+
+	if (!len)
+		cl->eof = 1;
+	cl->cmdlen += len;
+	cl->active  = virtual_time;
+
+	ipc_next(cl);
+}
+
+/*
+ * Accept all waiting clients there is room for.  When all slots are
+ * taken the listening socket is paused, the rest wait in its backlog
+ * until a slot is freed, see client_release().
+ */
+static void ipc_accept(int sd)
+{
+	struct ipc_client *cl;
+	int client;
+
+	while (nclients < IPC_CLIENTS) {
+		client = accept(sd, NULL, NULL);
+		if (client < 0)
+			break;
+
+		/* Portable SOCK_NONBLOCK replacement */
+		if (fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK) < 0) {
+			close(client);
+			continue;
+		}
+
+		for (cl = clients; cl->state != CL_FREE; cl++)
+			;
+		cl->conn.sd = client;
+		cl->active  = virtual_time;
+		if (client_wait(cl, CL_READ)) {
+			close(client);
+			memset(cl, 0, sizeof(*cl));
+			break;
+		}
+
+		nclients++;
+		cl_stats.connections++;
+
+		/* Clients send their command right after connecting */
+		ipc_input(client);
+	}
+
+	if (nclients == IPC_CLIENTS)
+		deregister_input_handler(sd);
+}
+
+/*
+ * Called every TIMER_INTERVAL, closes connections idle, or stuck with
+ * a client not reading its reply, for longer than ipc-timeout.  While
+ * all slots are taken the listening socket is paused, so also with the
+ * timeout disabled the least recently active client is closed, if it
+ * has not been active since the last call, to let the others in.
+ * Subscribers are not timed out, they lose events instead.
+ */
+void ipc_age(void)
+{
+	struct ipc_client *oldest = NULL;
+
+	for (size_t i = 0; i < NELEMS(clients); i++) {
+		struct ipc_client *cl = &clients[i];
+
+		if (cl->state == CL_FREE)
+			continue;
+
+		if (!ipc_timeout || virtual_time - cl->active < ipc_timeout) {
+			if (!oldest || cl->active < oldest->active)
+				oldest = cl;
+			continue;
+		}
+
+		logit(LOG_INFO, 0, "IPC client timed out");
+		cl_stats.timeouts++;
+		client_close(cl);
+	}
+
+	if (nclients == IPC_CLIENTS && oldest && virtual_time - oldest->active >= TIMER_INTERVAL) {
+		logit(LOG_INFO, 0, "IPC clients waiting, closing the least active");
+		cl_stats.timeouts++;
+		client_close(oldest);
+	}
+}
+
+void ipc_init(char *sockfile)
+{
+	socklen_t len;
+	int sd;
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd < 0) {
+		logit(LOG_ERR, errno, "Failed creating IPC socket");
+		return;
+	}
+
+	/* Portable SOCK_NONBLOCK replacement, ignore any error. */
+	(void)fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+
+#ifdef HAVE_SOCKADDR_UN_SUN_LEN
+	sun.sun_len = 0;	/* <- correct length is set by the OS */
+#endif
+	sun.sun_family = AF_UNIX;
+	if (sockfile)
+		strlcpy(sun.sun_path, sockfile, sizeof(sun.sun_path));
+	else
+		snprintf(sun.sun_path, sizeof(sun.sun_path), _PATH_PIMD_SOCK, ident);
+
+	unlink(sun.sun_path);
+	logit(LOG_DEBUG, 0, "Binding IPC socket to %s", sun.sun_path);
+
+	len = offsetof(struct sockaddr_un, sun_path) + strlen(sun.sun_path);
+	if (bind(sd, (struct sockaddr *)&sun, len) < 0 || listen(sd, IPC_BACKLOG)) {
+		logit(LOG_WARNING, errno, "Failed binding IPC socket, client disabled");
+		close(sd);
+		return;
+	}
+
+	ipc_socket = sd;
+	ipc_listen();
+}
+
+void ipc_exit(void)
+{
+	if (ipc_socket > -1) {
+		deregister_input_handler(ipc_socket);
+		close(ipc_socket);
+	}
+
+	unlink(sun.sun_path);
+	ipc_socket = -1;
+
+	for (size_t i = 0; i < NELEMS(clients); i++) {
+		if (clients[i].state != CL_FREE)
+			client_close(&clients[i]);
+	}
+
+	for (size_t i = 0; i < NELEMS(subs); i++) {
+		if (subs[i].queue)
+			sub_close(&subs[i]);
+	}
 }
 
 /**
@@ -84,6 +84,9 @@ void k_init_pim(int socket)
 
     if (setsockopt(socket, IPPROTO_IP, MRT_PIM, (char *)&v, sizeof(int)) < 0)
 	logit(LOG_ERR, errno, "Cannot set PIM flag in kernel");
+
+    if (register_kernel_encap)
+	k_regtun_init(socket);
 }
 
 
@@ -100,6 +103,8 @@ void k_stop_pim(int socket)
 
     if (setsockopt(socket, IPPROTO_IP, MRT_DONE, (char *)NULL, 0) < 0)
 	logit(LOG_ERR, errno, "Cannot disable multicast routing in kernel");
+
+    k_regtun_exit();
 }
 
 
@@ -219,6 +224,164 @@ void k_set_pktinfo(int socket, int val)
 }
 
 
+/*
+ * Allocate the slots of a receive ring and, on Linux, ask the kernel
+ * to report the number of packets dropped due to a full socket buffer.
+ */
+int k_rx_init(int socket, struct rxring *rx)
+{
+#ifdef SO_RXQ_OVFL
+    int val = 1;
+
+    if (setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &val, sizeof(val)) < 0)
+	logit(LOG_WARNING, errno, "Failed enabling SO_RXQ_OVFL on socket %d", socket);
+#endif
+
+    if (!rx->mem) {
+	int i;
+
+	/*
+	 * Only the pages a datagram is written to are ever touched, so
+	 * the tails for jumbo frames cost address space, not memory.
+	 */
+	rx->mem = malloc(IH_BATCH * RX_SLOT_MAX);
+	if (!rx->mem)
+	    return -1;
+
+	for (i = 0; i < IH_BATCH; i++)
+	    rx->slot[i] = rx->mem + i * RX_SLOT_MAX;
+    }
+
+    return 0;
+}
+
+void k_rx_exit(struct rxring *rx)
+{
+    free(rx->mem);
+    memset(rx, 0, sizeof(*rx));
+}
+
+static void rx_stats(struct rxstats *st, int num)
+{
+    int bucket = 0;
+
+    while (bucket < (int)NELEMS(st->batch) - 1 && (2 << bucket) <= num)
+	bucket++;
+
+    st->calls++;
+    st->packets += num;
+    st->batch[bucket]++;
+    if ((uint32_t)num > st->max_batch)
+	st->max_batch = num;
+}
+
+/*
+ * Read up to IH_BATCH packets from a non-blocking read of @socket into
+ * @rx, using a single recvmmsg() where available.  Returns the number
+ * of packets in rx->msg[], truncated packets are counted and skipped.
+ *
+ * Each slot has room for a datagram of IP_MAXPACKET beyond its first
+ * RX_SLOT_SIZE bytes, so a WHOLEPKT upcall or a register from a jumbo
+ * frame link is kept whole.  Such packets are counted as oversized.
+ */
+int k_recv_batch(int socket, struct rxring *rx)
+{
+    char cmbuf[IH_BATCH][128];
+    struct iovec iov[IH_BATCH];
+    struct msghdr *msgh;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgv[IH_BATCH];
+#else
+    struct msghdr msgv[IH_BATCH];
+#endif
+    int i, num, valid = 0;
+
+    memset(msgv, 0, sizeof(msgv));
+    for (i = 0; i < IH_BATCH; i++) {
+#ifdef HAVE_RECVMMSG
+	msgh = &msgv[i].msg_hdr;
+#else
+	msgh = &msgv[i];
+#endif
+	iov[i].iov_base      = rx->slot[i];
+	iov[i].iov_len       = RX_SLOT_MAX;
+	msgh->msg_iov        = &iov[i];
+	msgh->msg_iovlen     = 1;
+	msgh->msg_control    = cmbuf[i];
+	msgh->msg_controllen = sizeof(cmbuf[i]);
+    }
+
+#ifdef HAVE_RECVMMSG
+    while ((num = recvmmsg(socket, msgv, IH_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+	if (errno == EINTR)
+	    continue;		/* Received signal, retry syscall. */
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    logit(LOG_WARNING, errno, "Failed recvmmsg() on socket %d", socket);
+	return 0;
+    }
+#else
+    num = 0;
+    while (num < IH_BATCH) {
+	ssize_t len = recvmsg(socket, &msgv[num], MSG_DONTWAIT);
+
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;	/* Received signal, retry syscall. */
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		logit(LOG_WARNING, errno, "Failed recvmsg() on socket %d", socket);
+	    break;
+	}
+	rx->msg[num++].len = len;
+    }
+#endif
+
+    for (i = 0; i < num; i++) {
+	struct cmsghdr *cmsg;
+	ssize_t len;
+	int ifindex = -1;
+
+#ifdef HAVE_RECVMMSG
+	msgh = &msgv[i].msg_hdr;
+	len  = msgv[i].msg_len;
+#else
+	msgh = &msgv[i];
+	len  = rx->msg[i].len;
+#endif
+	if (msgh->msg_flags & MSG_TRUNC) {
+	    rx->stats.truncated++;
+	    continue;
+	}
+
+	if (len > RX_SLOT_SIZE)
+	    rx->stats.oversized++;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh); cmsg; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+#ifdef IP_PKTINFO
+	    if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_PKTINFO) {
+		struct in_pktinfo *ipi = (struct in_pktinfo *)CMSG_DATA(cmsg);
+
+		ifindex = ipi->ipi_ifindex;
+	    }
+#endif
+#ifdef SO_RXQ_OVFL
+	    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+		memcpy(&rx->stats.overflow, CMSG_DATA(cmsg), sizeof(uint32_t));
+#endif
+	}
+
+	rx->msg[valid].buf     = rx->slot[i];
+	rx->msg[valid].len     = len;
+	rx->msg[valid].ifindex = ifindex;
+	valid++;
+    }
+
+    if (num > 0)
+	rx_stats(&rx->stats, num);
+
+    return valid;
+}
+
+
 /*
  * Set the default TTL for the multicast packets outgoing from this
  * socket.
@@ -353,6 +516,8 @@ void k_leave(int socket, uint32_t grp, struct uvif *v)
     }
 }
 
+static int regtun_owns(vifi_t vifi);
+
 /*
  * Fill struct vifctl using corresponding fields from struct uvif.
  */
@@ -385,6 +550,12 @@ void k_add_vif(int socket, vifi_t vifi, struct uvif *v)
 {
     struct vifctl vc;
 
+    if (regtun_owns(vifi)) {
+	logit(LOG_WARNING, 0, "VIF %d for iface %s is a register tunnel, not adding",
+	      vifi, v->uv_name);
+	return;
+    }
+
     vc.vifc_vifi = vifi;
     uvif_to_vifctl(&vc, v);
     if (setsockopt(socket, IPPROTO_IP, MRT_ADD_VIF, (char *)&vc, sizeof(vc)) < 0)
@@ -424,80 +595,428 @@ void k_del_vif(int socket, vifi_t vifi, struct uvif *v __attribute__((unused)))
 
 
 /*
- * Delete all MFC entries for particular routing entry from the kernel.
+ * Kernel register encapsulation, 'register-encap kernel'.  Instead of
+ * the register vif, which sends every packet up to us for a PIM
+ * Register, the (S,G) entries of a DR forward to an IP-in-IP tunnel
+ * to the RP.  At the RP the packets arrive on tunl0, the catch-all
+ * ipip device, which is handled as if it was the register vif.
+ *
+ * The tunnels are vifs only the kernel knows about, taken from the top
+ * of the kernel vif range, above numvifs, so they never clash with the
+ * uvifs[].  k_add_vif() refuses any uvif that would land on one.
  */
-int k_del_mfc(int socket, uint32_t source, uint32_t group)
+#define REGTUN_MAX	8
+#define KERN_MAXVIFS	(MIN(MAXVIFS, sizeof(((struct mfcctl *)0)->mfcc_ttls)))
+
+struct regtun {
+    uint32_t	rp;
+    int		ifindex;
+    vifi_t	vifi;
+    char	name[IFNAMSIZ];
+};
+
+static struct regtun regtun[REGTUN_MAX];
+static struct regtun regtun_decap;	/* tunl0, at the RP */
+static int	     regtun_num;
+static int	     regtun_socket = -1;
+static int	     regtun_failed;	/* Cannot create tunnels, use pimreg */
+static vifi_t	     regtun_next;	/* Next free kernel only vif */
+
+static int regtun_vif_add(struct regtun *t)
 {
-    struct mfcctl mc;
+#ifdef VIFF_USE_IFINDEX
+    struct vifctl vc;
 
-    memset(&mc, 0, sizeof(mc));
-    mc.mfcc_origin.s_addr   = source;
-    mc.mfcc_mcastgrp.s_addr = group;
+    if (regtun_next < numvifs || regtun_next >= KERN_MAXVIFS) {
+	logit(LOG_WARNING, 0, "No free kernel vif for tunnel %s", t->name);
+	return -1;
+    }
 
-    if (setsockopt(socket, IPPROTO_IP, MRT_DEL_MFC, (char *)&mc, sizeof(mc)) < 0) {
-	logit(LOG_WARNING, errno, "Failed removing MFC entry src %s, grp %s",
-	      inet_fmt(mc.mfcc_origin.s_addr, s1, sizeof(s1)),
-	      inet_fmt(mc.mfcc_mcastgrp.s_addr, s2, sizeof(s2)));
+    memset(&vc, 0, sizeof(vc));
+    vc.vifc_vifi          = regtun_next;
+    vc.vifc_flags         = VIFF_USE_IFINDEX;
+    vc.vifc_lcl_ifindex   = t->ifindex;
+    vc.vifc_threshold     = 1;
+    if (setsockopt(regtun_socket, IPPROTO_IP, MRT_ADD_VIF, (char *)&vc, sizeof(vc)) < 0) {
+	logit(LOG_WARNING, errno, "Failed adding VIF %d (MRT_ADD_VIF) for tunnel %s",
+	      regtun_next, t->name);
+	return -1;
+    }
 
-	return FALSE;
+    t->vifi = regtun_next--;
+
+    return 0;
+#else
+    (void)t;
+    return -1;
+#endif
+}
+
+/* Set up tunl0, to receive the encapsulated packets when we are the RP */
+void k_regtun_init(int socket)
+{
+    regtun_socket = socket;
+    regtun_next   = KERN_MAXVIFS - 1;
+    regtun_failed = 0;
+
+    strlcpy(regtun_decap.name, "tunl0", sizeof(regtun_decap.name));
+    regtun_decap.ifindex = k_tunnel_add(regtun_decap.name, INADDR_ANY);
+    if (regtun_decap.ifindex <= 0 || regtun_vif_add(&regtun_decap)) {
+	logit(LOG_WARNING, errno, "Cannot set up kernel register encapsulation, using PIM Register");
+	regtun_decap.ifindex = 0;
+	register_kernel_encap = FALSE;
+	return;
+    }
+
+    logit(LOG_INFO, 0, "Kernel register encapsulation enabled, decapsulating on %s, vif %d",
+	  regtun_decap.name, regtun_decap.vifi);
+}
+
+/* Remove the tunnels to the RPs, MRT_DONE has already removed the vifs */
+void k_regtun_exit(void)
+{
+    int i;
+
+    for (i = 0; i < regtun_num; i++)
+	k_tunnel_del(regtun[i].ifindex);
+
+    memset(regtun, 0, sizeof(regtun));
+    memset(&regtun_decap, 0, sizeof(regtun_decap));
+    regtun_num = 0;
+    reg_stats.tunnels = 0;
+    regtun_socket = -1;
+}
+
+/* The tunnel vif to @rp, created on demand, or NO_VIF */
+static vifi_t regtun_vif(uint32_t rp)
+{
+    struct regtun *t;
+    int i;
+
+    if (regtun_failed || rp == INADDR_ANY_N)
+	return NO_VIF;
+
+    for (i = 0; i < regtun_num; i++) {
+	if (regtun[i].rp == rp)
+	    return regtun[i].vifi;
     }
 
-    logit(LOG_INFO, 0, "Removed MFC entry src %s, grp %s",
-	inet_fmt(mc.mfcc_origin.s_addr, s1, sizeof(s1)),
-	inet_fmt(mc.mfcc_mcastgrp.s_addr, s2, sizeof(s2)));
+    if (regtun_num == REGTUN_MAX)
+	return NO_VIF;
+
+    t = &regtun[regtun_num];
+    snprintf(t->name, sizeof(t->name), "pimtun%d", regtun_num);
+    t->ifindex = k_tunnel_add(t->name, rp);
+    if (t->ifindex <= 0) {
+	logit(LOG_WARNING, errno, "Failed creating tunnel %s to RP %s, using PIM Register",
+	      t->name, inet_fmt(rp, s1, sizeof(s1)));
+	regtun_failed = 1;
+	return NO_VIF;
+    }
+
+    if (regtun_vif_add(t)) {
+	k_tunnel_del(t->ifindex);
+	regtun_failed = 1;
+	return NO_VIF;
+    }
+
+    t->rp = rp;
+    regtun_num++;
+    reg_stats.tunnels = regtun_num;
+
+    logit(LOG_INFO, 0, "Encapsulating registers to RP %s in kernel, tunnel %s vif %d",
+	  inet_fmt(rp, s1, sizeof(s1)), t->name, t->vifi);
+
+    return t->vifi;
+}
+
+/*
+ * Called on upcalls.  The (S,G) of an upcall on tunl0 arrives
+ * decapsulated, the caller records that in its kernel cache entry,
+ * for k_chg_mfc().
+ */
+int k_regtun_input(vifi_t vifi)
+{
+    return regtun_decap.ifindex && vifi == regtun_decap.vifi;
+}
+
+/* Is @vifi taken by a kernel only tunnel vif */
+static int regtun_owns(vifi_t vifi)
+{
+    return regtun_socket != -1 && vifi > regtun_next && vifi < KERN_MAXVIFS;
+}
+
+/* Name of a vif, also of the kernel only tunnel vifs, for logging */
+static const char *regtun_name(vifi_t vifi)
+{
+    int i;
+
+    if (vifi < numvifs)
+	return uvifs[vifi].uv_name;
+
+    if (regtun_decap.ifindex && vifi == regtun_decap.vifi)
+	return regtun_decap.name;
+
+    for (i = 0; i < regtun_num; i++) {
+	if (regtun[i].vifi == vifi)
+	    return regtun[i].name;
+    }
+
+    return "?";
+}
+
+
+/*
+ * Kernel MFC updates are not issued right away.  k_chg_mfc() and
+ * k_del_mfc() record the latest wanted state of each (S,G) in a dirty
+ * set, which k_mfc_flush() writes to the kernel before the main loop
+ * goes back to sleep.  Repeated updates of an entry in one turn of the
+ * loop, e.g. first via its (*,G) and then its (S,G) when the RP moves,
+ * cost only one syscall.
+ */
+#define MFC_HASH_SIZE 1024
+
+struct mfc_op {
+    struct mfc_op *hnext;	/* Hash chain                 */
+    struct mfc_op *next;	/* In order of first update   */
+    int		   socket;
+    int		   cmd;		/* MRT_ADD_MFC or MRT_DEL_MFC */
+    struct mfcctl  mc;
+};
+
+struct mfcstats mfc_stats;
+
+static struct mfc_op  *mfc_hash[MFC_HASH_SIZE];
+static struct mfc_op  *mfc_head;
+static struct mfc_op **mfc_tail = &mfc_head;
+static struct mfc_op  *mfc_free;
+static uint32_t	       mfc_requests;	/* Since last flush */
+static int	       mfc_rp_changed;
+
+static uint32_t mfc_hash_fn(uint32_t source, uint32_t group)
+{
+    return ((source ^ group) * 2654435761u) >> 22; /* 10 bits */
+}
+
+static struct mfc_op *mfc_find(uint32_t source, uint32_t group)
+{
+    struct mfc_op *op;
+
+    for (op = mfc_hash[mfc_hash_fn(source, group)]; op; op = op->hnext) {
+	if (op->mc.mfcc_origin.s_addr == source && op->mc.mfcc_mcastgrp.s_addr == group)
+	    return op;
+    }
+
+    return NULL;
+}
+
+/* Find, or add, the pending update of (S,G), the caller sets the new state */
+static struct mfc_op *mfc_get(int socket, uint32_t source, uint32_t group)
+{
+    struct mfc_op *op;
+    uint32_t hash;
+
+    mfc_stats.requests++;
+    mfc_requests++;
+
+    op = mfc_find(source, group);
+    if (!op) {
+	if (mfc_free) {
+	    op = mfc_free;
+	    mfc_free = op->next;
+	} else {
+	    op = malloc(sizeof(*op));
+	    if (!op) {
+		logit(LOG_ERR, 0, "Ran out of memory in mfc_get()");
+		return NULL;
+	    }
+	}
+
+	hash = mfc_hash_fn(source, group);
+	op->hnext = mfc_hash[hash];
+	mfc_hash[hash] = op;
+	op->next = NULL;
+	*mfc_tail = op;
+	mfc_tail = &op->next;
+    }
+
+    memset(&op->mc, 0, sizeof(op->mc));
+    op->mc.mfcc_origin.s_addr   = source;
+    op->mc.mfcc_mcastgrp.s_addr = group;
+    op->socket = socket;
+
+    return op;
+}
+
+/* Names of the outbound interfaces, only for logging */
+static char *mfc_oifs(struct mfcctl *mc, char *buf, size_t len)
+{
+    vifi_t vifi;
+
+    buf[0] = 0;
+    for (vifi = 0; vifi < KERN_MAXVIFS; vifi++) {
+	if (!mc->mfcc_ttls[vifi])
+	    continue;
+
+	if (buf[0] != 0)
+	    strlcat(buf, ", ", len);
+	strlcat(buf, regtun_name(vifi), len);
+    }
+
+    return buf;
+}
+
+static void mfc_apply(struct mfc_op *op)
+{
+    char output[MAXVIFS * (IFNAMSIZ + 2)];
+    struct mfcctl *mc = &op->mc;
+
+    if (op->cmd == MRT_DEL_MFC) {
+	if (setsockopt(op->socket, IPPROTO_IP, MRT_DEL_MFC, (char *)mc, sizeof(*mc)) < 0) {
+	    logit(LOG_WARNING, errno, "Failed removing MFC entry src %s, grp %s",
+		  inet_fmt(mc->mfcc_origin.s_addr, s1, sizeof(s1)),
+		  inet_fmt(mc->mfcc_mcastgrp.s_addr, s2, sizeof(s2)));
+	    return;
+	}
+
+	logit(LOG_INFO, 0, "Removed MFC entry src %s, grp %s",
+	      inet_fmt(mc->mfcc_origin.s_addr, s1, sizeof(s1)),
+	      inet_fmt(mc->mfcc_mcastgrp.s_addr, s2, sizeof(s2)));
+	return;
+    }
+
+    if (setsockopt(op->socket, IPPROTO_IP, MRT_ADD_MFC, (char *)mc, sizeof(*mc)) < 0) {
+	logit(LOG_WARNING, errno, "Failed adding MFC entry src %s grp %s from %s to %s",
+	      inet_fmt(mc->mfcc_origin.s_addr, s1, sizeof(s1)),
+	      inet_fmt(mc->mfcc_mcastgrp.s_addr, s2, sizeof(s2)),
+	      regtun_name(mc->mfcc_parent), mfc_oifs(mc, output, sizeof(output)));
+	return;
+    }
+
+    logit(LOG_INFO, 0, "Added kernel MFC entry src %s grp %s from %s to %s",
+	  inet_fmt(mc->mfcc_origin.s_addr, s1, sizeof(s1)),
+	  inet_fmt(mc->mfcc_mcastgrp.s_addr, s2, sizeof(s2)),
+	  regtun_name(mc->mfcc_parent), mfc_oifs(mc, output, sizeof(output)));
+}
+
+/*
+ * Write all pending MFC updates to the kernel, in the order the
+ * entries were first touched.
+ */
+void k_mfc_flush(void)
+{
+    struct mfc_op *op, *next;
+    uint32_t num = 0;
+
+    for (op = mfc_head; op; op = next) {
+	next = op->next;
+
+	mfc_apply(op);
+	mfc_hash[mfc_hash_fn(op->mc.mfcc_origin.s_addr, op->mc.mfcc_mcastgrp.s_addr)] = NULL;
+	op->next = mfc_free;
+	mfc_free = op;
+	num++;
+    }
+    mfc_head = NULL;
+    mfc_tail = &mfc_head;
+
+    if (num) {
+	mfc_stats.syscalls  += num;
+	mfc_stats.coalesced += mfc_requests - num;
+	mfc_stats.flushes++;
+	if (num > mfc_stats.max_batch)
+	    mfc_stats.max_batch = num;
+	if (mfc_rp_changed) {
+	    mfc_stats.rp_changes++;
+	    mfc_stats.rp_saved += mfc_requests - num;
+	}
+
+	IF_DEBUG(DEBUG_MFC)
+	    logit(LOG_DEBUG, 0, "Flushed %u MFC updates, %u coalesced", num, mfc_requests - num);
+    }
+
+    mfc_requests   = 0;
+    mfc_rp_changed = 0;
+}
+
+/*
+ * Called when the RP of some groups, or the route to it, changes.  For
+ * the statistics only, to tell how much the coalescing saves then.
+ */
+void k_mfc_rp_change(void)
+{
+    mfc_rp_changed = 1;
+}
+
+/*
+ * Delete all MFC entries for particular routing entry from the kernel.
+ * Only queued, see k_mfc_flush().
+ */
+int k_del_mfc(int socket, uint32_t source, uint32_t group)
+{
+    struct mfc_op *op;
+
+    op = mfc_get(socket, source, group);
+    if (!op)
+	return FALSE;
+
+    op->cmd = MRT_DEL_MFC;
 
     return TRUE;
 }
 
 
 /*
- * Install/modify a MFC entry in the kernel
+ * Install/modify a MFC entry in the kernel.  Only queued, see
+ * k_mfc_flush().
  */
-int k_chg_mfc(int socket, uint32_t source, uint32_t group, vifi_t iif, uint8_t *oifs, uint32_t rp_addr __attribute__((unused)))
+int k_chg_mfc(int socket, uint32_t source, uint32_t group, vifi_t iif, vifset_t oifs, uint32_t rp_addr)
 {
-    char           input[IFNAMSIZ], output[MAXVIFS * (IFNAMSIZ + 2)] = "";
     vifi_t	   vifi;
     struct uvif   *v;
-    struct mfcctl  mc;
+    struct mfc_op *op;
+    struct mfcctl *mc;
+
+    op = mfc_get(socket, source, group);
+    if (!op)
+	return FALSE;
 
-    memset(&mc, 0, sizeof(mc));
-    mc.mfcc_origin.s_addr    = source;
-    mc.mfcc_mcastgrp.s_addr  = group;
-    mc.mfcc_parent	     = iif;
+    op->cmd = MRT_ADD_MFC;
+    mc = &op->mc;
+    mc->mfcc_parent = iif;
     /*
      * draft-ietf-pim-sm-v2-new-05.txt section 4.2 mentions iif is removed
      * at the packet forwarding phase
      */
-    PIMD_VIFM_CLR(mc.mfcc_parent, oifs);
+    PIMD_VIFM_CLR(mc->mfcc_parent, oifs);
 
     for (vifi = 0, v = uvifs; vifi < numvifs; vifi++, v++) {
-	if (PIMD_VIFM_ISSET(vifi, oifs)) {
-	    mc.mfcc_ttls[vifi] = v->uv_threshold;
-	    if (output[0] != 0)
-		strlcat(output, ", ", sizeof(output));
-	    strlcat(output, v->uv_name, sizeof(output));
-	} else {
-	    mc.mfcc_ttls[vifi] = 0;
-	}
+	if (PIMD_VIFM_ISSET(vifi, oifs))
+	    mc->mfcc_ttls[vifi] = v->uv_threshold;
     }
-    strlcpy(input, uvifs[iif].uv_name, sizeof(input));
 
-#ifdef PIM_REG_KERNEL_ENCAP
-    mc.mfcc_rp_addr.s_addr = rp_addr;
-#endif
-    if (setsockopt(socket, IPPROTO_IP, MRT_ADD_MFC, (char *)&mc, sizeof(mc)) < 0) {
-	logit(LOG_WARNING, errno, "Failed adding MFC entry src %s grp %s from %s to %s",
-	      inet_fmt(mc.mfcc_origin.s_addr, s1, sizeof(s1)),
-	      inet_fmt(mc.mfcc_mcastgrp.s_addr, s2, sizeof(s2)),
-	      input, output);
+    if (register_kernel_encap) {
+	/* DR: encapsulate in the tunnel to the RP, not via pimreg */
+	if (mc->mfcc_ttls[PIMREG_VIF]) {
+	    vifi = regtun_vif(rp_addr);
+	    if (vifi != NO_VIF) {
+		mc->mfcc_ttls[PIMREG_VIF] = 0;
+		mc->mfcc_ttls[vifi] = 1;
+	    }
+	}
 
-	return FALSE;
+	/* RP: accept what the DR encapsulated */
+	if (iif == PIMREG_VIF && regtun_decap.ifindex) {
+	    kernel_cache_t *kc = find_kernel_cache(source, group, NULL);
+
+	    if (kc && kc->decap)
+		mc->mfcc_parent = regtun_decap.vifi;
+	}
     }
 
-    logit(LOG_INFO, 0, "Added kernel MFC entry src %s grp %s from %s to %s",
-	  inet_fmt(mc.mfcc_origin.s_addr, s1, sizeof(s1)),
-	  inet_fmt(mc.mfcc_mcastgrp.s_addr, s2, sizeof(s2)),
-	  input, output);
+#ifdef PIM_REG_KERNEL_ENCAP
+    mc->mfcc_rp_addr.s_addr = rp_addr;
+#endif
 
     return TRUE;
 }
@@ -541,6 +1060,10 @@ int k_get_sg_cnt(int socket, uint32_t source, uint32_t group, struct sg_count *r
 {
     struct sioc_sg_req sgreq;
 
+    /* The kernel must know about the entry first */
+    if (mfc_find(source, group))
+	k_mfc_flush();
+
     memset(&sgreq, 0, sizeof(sgreq));
     sgreq.src.s_addr = source;
     sgreq.grp.s_addr = group;
@@ -44,6 +44,12 @@
 #include <err.h>
 #include <getopt.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+# include <sys/timerfd.h>
+#endif
 
 char versionstring[100];
 int do_vifs       = 1;
@@ -62,12 +68,22 @@ static int sighandled = 0;
 #define GOT_SIGHUP      0x02
 #define GOT_SIGALRM     0x10
 
-#define NHANDLERS       5
+#define NHANDLERS       48	/* Sockets, and IPC clients and subscribers */
 static struct ihandler {
-    int fd;			/* File descriptor               */
-    ihfunc_t func;		/* Function to call with &fd_set */
+    int fd;			/* File descriptor, -1 when free  */
+    int flags;			/* IH_LEVEL, IH_EDGE, IH_WRITE    */
+    uint32_t gen;		/* Of the registration, see below */
+    ihfunc_t func;		/* Function to call when ready    */
 } ihandlers[NHANDLERS];
-static int nhandlers = 0;
+static int nhandlers = 0;	/* High water mark in ihandlers[] */
+static uint32_t ihandler_gen;	/* Last generation handed out     */
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+static int timer_fd = -1;
+#endif
 
 /*
  * Forward declarations.
@@ -75,23 +91,248 @@ static int nhandlers = 0;
 static void            handle_signals(int);
 static int             check_signals (void);
 static void            timer         (void *);
-static struct timeval *timeout       (int);
+static void            route_timer   (void *);
+static int             timeout       (void);
 static void            cleanup       (void);
 static void            restart       (int);
 static void            resetlogging  (void *);
 static void            add_static_rp (void);
 
-int register_input_handler(int fd, ihfunc_t func)
+/*
+ * Register @func to be called when @fd is readable.  With IH_LEVEL the
+ * handler is called as long as there is data to read, so it may read
+ * only a batch at a time.  With IH_EDGE it is called once per arrival,
+ * on Linux, and must drain @fd until EAGAIN.  With IH_WRITE it is
+ * instead called, level triggered, while @fd is writable.  To change
+ * the flags of an @fd, deregister it first.
+ */
+int register_input_handler(int fd, ihfunc_t func, int flags)
 {
-    if (nhandlers >= NHANDLERS)
-	return -1;
+    struct ihandler *ih = NULL;
+    int i;
+
+    for (i = 0; i < nhandlers; i++) {
+	if (ihandlers[i].fd == -1) {
+	    ih = &ihandlers[i];
+	    break;
+	}
+    }
+
+    if (!ih) {
+	if (nhandlers >= NHANDLERS)
+	    return -1;
+	ih = &ihandlers[nhandlers++];
+    }
+
+    /*
+     * A handler may deregister an fd and register another, or the same
+     * with other flags, while events for the old registration are still
+     * to be dispatched.  The generation tells them apart.
+     */
+    ih->gen = ++ihandler_gen;
 
-    ihandlers[nhandlers].fd = fd;
-    ihandlers[nhandlers++].func = func;
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd != -1) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = (flags & IH_WRITE) ? EPOLLOUT : EPOLLIN;
+	if (flags & IH_EDGE)
+	    ev.events |= EPOLLET;
+	ev.data.u64 = (uint64_t)ih->gen << 32 | (uint32_t)(ih - ihandlers);
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+	    return -1;
+    }
+#endif
+
+    ih->fd    = fd;
+    ih->flags = flags;
+    ih->func  = func;
 
     return 0;
 }
 
+/* Stop calling the input handler for @fd, call before close() */
+int deregister_input_handler(int fd)
+{
+    int i;
+
+    for (i = 0; i < nhandlers; i++) {
+	if (ihandlers[i].fd != fd)
+	    continue;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd != -1)
+	    (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	ihandlers[i].fd = -1;
+	while (nhandlers > 0 && ihandlers[nhandlers - 1].fd == -1)
+	    nhandlers--;
+
+	return 0;
+    }
+
+    return -1;
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+/* The timer queue is aged at the top of the main loop, only ack here */
+static void timer_fd_read(int fd)
+{
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+	logit(LOG_WARNING, errno, "Failed reading timerfd");
+}
+#endif
+
+static void event_init(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+	logit(LOG_WARNING, errno, "Failed creating epoll instance, using select()");
+	return;
+    }
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+	logit(LOG_WARNING, errno, "Failed creating timerfd");
+	return;
+    }
+
+    if (register_input_handler(timer_fd, timer_fd_read, IH_EDGE) < 0) {
+	close(timer_fd);
+	timer_fd = -1;
+    }
+#endif
+}
+
+static void event_exit(void)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    if (timer_fd != -1) {
+	deregister_input_handler(timer_fd);
+	close(timer_fd);
+	timer_fd = -1;
+    }
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd != -1) {
+	close(epoll_fd);
+	epoll_fd = -1;
+    }
+#endif
+}
+
+static void event_select(int msec)
+{
+    struct timeval tv, *tvp = NULL;
+    uint32_t gen[NHANDLERS];
+    fd_set fds, wfds;
+    int i, n, num, nfds = 0;
+
+    FD_ZERO(&fds);
+    FD_ZERO(&wfds);
+    num = nhandlers;
+    for (i = 0; i < num; i++) {
+	gen[i] = ihandlers[i].gen;
+	if (ihandlers[i].fd == -1)
+	    continue;
+
+	FD_SET(ihandlers[i].fd, (ihandlers[i].flags & IH_WRITE) ? &wfds : &fds);
+	if (ihandlers[i].fd >= nfds)
+	    nfds = ihandlers[i].fd + 1;
+    }
+
+    if (msec != -1) {
+	tv.tv_sec  = msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+	tvp = &tv;
+    }
+
+    n = select(nfds, &fds, &wfds, NULL, tvp);
+    if (n < 0) {
+	if (errno != EINTR) /* SIGALRM is expected */
+	    logit(LOG_WARNING, errno, "select failed");
+	return;
+    }
+
+    for (i = 0; n > 0 && i < num && i < nhandlers; i++) {
+	int fd = ihandlers[i].fd;
+
+	/* Skip slots deregistered, or reused, by an earlier handler */
+	if (fd == -1 || ihandlers[i].gen != gen[i])
+	    continue;
+
+	if (FD_ISSET(fd, &fds) || FD_ISSET(fd, &wfds)) {
+	    ihandlers[i].func(fd);
+	    n--;
+	}
+    }
+}
+
+/*
+ * Wait for input, or at most @msec (-1: forever) for the next timer,
+ * and call the input handlers.
+ */
+static void event_wait(int msec)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[NHANDLERS];
+    int i, n;
+
+    if (epoll_fd == -1) {
+	event_select(msec);
+	return;
+    }
+
+#ifdef HAVE_SYS_TIMERFD_H
+    if (timer_fd != -1) {
+	struct itimerspec its;
+
+	/* Absolute expiry, a zero it_value would disarm the timer */
+	memset(&its, 0, sizeof(its));
+	if (msec != -1) {
+	    clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+	    its.it_value.tv_sec  += msec / 1000;
+	    its.it_value.tv_nsec += (msec % 1000) * 1000000;
+	    if (its.it_value.tv_nsec >= 1000000000) {
+		its.it_value.tv_sec++;
+		its.it_value.tv_nsec -= 1000000000;
+	    }
+	}
+
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+	    logit(LOG_WARNING, errno, "Failed arming timerfd");
+	else
+	    msec = -1;
+    }
+#endif
+
+    n = epoll_wait(epoll_fd, events, NELEMS(events), msec);
+    if (n < 0) {
+	if (errno != EINTR) /* SIGALRM is expected */
+	    logit(LOG_WARNING, errno, "epoll_wait failed");
+	return;
+    }
+
+    for (i = 0; i < n; i++) {
+	struct ihandler *ih = &ihandlers[events[i].data.u64 & 0xffffffff];
+
+	/* Deregistered, or the slot reused, by an earlier handler */
+	if (ih->fd == -1 || ih->gen != events[i].data.u64 >> 32)
+	    continue;
+
+	ih->func(ih->fd);
+    }
+#else
+    event_select(msec);
+#endif
+}
+
 static void do_randomize(void)
 {
 #define rol32(data,shift) ((data) >> (shift)) | ((data) << (32 - (shift)))
@@ -233,9 +474,8 @@ static char *progname(char *arg0)
 int main(int argc, char *argv[])
 {
     int foreground = 0, do_syslog = 1;
-    int nfds, fd, n = -1, i, ch, rc;
+    int fd, i, ch, rc;
     int startup_delay = 0;
-    fd_set fds;
     struct sigaction sa;
     struct option long_options[] = {
 	{ "config",        1, 0, 'f' },
@@ -398,6 +638,7 @@ int main(int argc, char *argv[])
     do_randomize();
 
     timer_init();
+    event_init();
     init_igmp();
     init_pim();
     init_routesock();
@@ -433,6 +674,7 @@ int main(int argc, char *argv[])
 
     /* schedule first timer interrupt */
     timer_set(TIMER_INTERVAL, timer, NULL);
+    timer_set(ROUTE_INTERVAL, route_timer, NULL);
 
     /* Open channel to pimctl */
     ipc_init(sock_file);
@@ -448,24 +690,9 @@ int main(int argc, char *argv[])
 	if (check_signals())
 	    break;
 
-	FD_ZERO(&fds);
-	for (i = 0, nfds = 0; i < nhandlers; i++) {
-	    FD_SET(ihandlers[i].fd, &fds);
-	    if (ihandlers[i].fd >= nfds)
-		nfds = ihandlers[i].fd + 1;
-	}
-
-	n = select(nfds, &fds, NULL, NULL, timeout(n));
-	if (n < 0) {
-	    if (errno != EINTR) /* SIGALRM is expected */
-		logit(LOG_WARNING, errno, "select failed");
-	    continue;
-	}
-
-	for (i = 0; n > 0 && i < nhandlers; i++) {
-	    if (FD_ISSET(ihandlers[i].fd, &fds))
-		ihandlers[i].func(ihandlers[i].fd);
-	}
+	/* All MFC updates from the previous round, in one go */
+	k_mfc_flush();
+	event_wait(timeout());
     }
 
     logit(LOG_NOTICE, 0, "%s exiting.", versionstring);
@@ -500,80 +727,47 @@ uint32_t virtual_time = 0;
 static void timer(void *i __attribute__((unused)))
 {
     age_vifs();		/* Timeout neighbors and groups         */
-    age_routes();	/* Timeout routing entries              */
     age_misc();		/* Timeout the rest (Cand-RP list, etc) */
+    ipc_age();		/* Timeout idle and stuck IPC clients   */
+    k_rpf_age();	/* Ask again for lost RPF lookups       */
 
     virtual_time += TIMER_INTERVAL;
     timer_set(TIMER_INTERVAL, timer, NULL);
 }
 
+/*
+ * Routing entries are aged separately, at a finer granularity, only
+ * the entries with a timer expiring are visited at each tick.
+ */
+static void route_timer(void *i __attribute__((unused)))
+{
+    age_routes();	/* Timeout routing entries              */
+    timer_set(ROUTE_INTERVAL, route_timer, NULL);
+}
+
 /*
  * Handle timeout queue.
  *
- * If select() + packet processing took more than 1 second,
- * or if there is a timeout pending, age the timeout queue.
- *
- * If not, collect usec in difftime to make sure that the
- * time doesn't drift too badly.
- *
- * If the timeout handlers took more than 1 second,
- * age the timeout queue again.  XXX This introduces the
- * potential for infinite loops!
+ * Age the timeout queue with the time passed since last call, with
+ * millisecond precision, on the monotonic clock so NTP steps and other
+ * wall clock changes do not affect the timers.  Return the time until
+ * the next timer is due, in milliseconds, or -1 if no timer is set.
  */
-static struct timeval *timeout(int n)
+static int timeout(void)
 {
-    static struct timeval tv, difftime, curtime, lasttime;
-    static int init = 1, secs = 0;
-    struct timeval *result = NULL;
-
-    /* Age queue */
-    do {
-	/*
-	 * If select() timed out, then there's no other
-	 * activity to account for and we don't need to
-	 * call gettimeofday.
-	 */
-	if (n == 0) {
-	    curtime.tv_sec = lasttime.tv_sec + secs;
-	    curtime.tv_usec = lasttime.tv_usec;
-	    n = -1; /* don't do this next time through the loop */
-	} else {
-	    gettimeofday(&curtime, NULL);
-	    if (init) {
-		init = 0;	/* First time only */
-		lasttime = curtime;
-		difftime.tv_usec = 0;
-	    }
-	}
+    static int64_t lasttime = -1;
+    struct timespec ts;
+    int64_t curtime;
 
-	difftime.tv_sec = curtime.tv_sec - lasttime.tv_sec;
-	difftime.tv_usec += curtime.tv_usec - lasttime.tv_usec;
-	while (difftime.tv_usec >= 1000000) {
-	    difftime.tv_sec++;
-	    difftime.tv_usec -= 1000000;
-	}
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    curtime = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (lasttime == -1)
+	lasttime = curtime;	/* First time only */
 
-	if (difftime.tv_usec < 0) {
-	    difftime.tv_sec--;
-	    difftime.tv_usec += 1000000;
-	}
-	lasttime = curtime;
-
-	if (secs == 0 || difftime.tv_sec > 0)
-	    timer_age_queue(difftime.tv_sec);
+    timer_age_queue_ms(curtime - lasttime);
+    lasttime = curtime;
 
-	secs = -1;
-    } while (difftime.tv_sec > 0);
-
-    /* Next timer to wait for */
-    secs = timer_next_delay();
-    if (secs != -1) {
-	result = &tv;
-	tv.tv_sec  = secs;
-	tv.tv_usec = 0;
-    }
-
-    return result;
+    return timer_next_delay_ms();
 }
 
 /*
@@ -653,14 +847,12 @@ static void cleanup(void)
     if (cand_rp_adv_message.buffer)
 	free(cand_rp_adv_message.buffer);
 
-    if (pim_recv_buf)
-	free(pim_recv_buf);
+    k_rx_exit(&pim_rx);
 
     if (pim_send_buf)
 	free(pim_send_buf);
 
-    if (igmp_recv_buf)
-	free(igmp_recv_buf);
+    k_rx_exit(&igmp_rx);
 
     if (igmp_send_buf)
 	free(igmp_send_buf);
@@ -675,6 +867,7 @@ static void cleanup(void)
 	free(pid_file);
 
     ipc_exit();
+    event_exit();
 }
 
 
@@ -773,11 +966,13 @@ static void restart(int signo)
     */
     del_static_rp();
     timer_exit();
+    k_mfc_flush();
     stop_all_vifs();
     k_stop_pim(igmp_socket);
     ipc_exit();
-	
-    nhandlers = 0;
+
+    deregister_input_handler(igmp_socket);
+    deregister_input_handler(pim_socket);
     close(igmp_socket);
     close(pim_socket);
 
@@ -816,6 +1011,7 @@ static void restart(int signo)
 
     /* schedule timer interrupts */
     timer_set(TIMER_INTERVAL, timer, NULL);
+    timer_set(ROUTE_INTERVAL, route_timer, NULL);
 }
 
 int daemon_restart(char *buf, size_t len)
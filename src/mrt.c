@@ -38,6 +38,16 @@
 srcentry_t		*srclist;
 grpentry_t		*grplist;
 
+/* Slab pools for the routing table objects */
+struct pool		srcentry_pool;
+struct pool		grpentry_pool;
+struct pool		mrtentry_pool;
+struct pool		kernel_cache_pool;
+
+/* Vif timers in the tail of each routing entry, see mrt_size_vifs() */
+static vifi_t		mrt_vifs;
+#define MRT_SIZE(vifs)	(sizeof(mrtentry_t) + (vifs) * (sizeof(uint32_t) + sizeof(uint16_t)))
+
 /*
  * Local functions definition
  */
@@ -56,9 +66,283 @@ static mrtentry_t *create_mrtentry   (srcentry_t *, grpentry_t *, uint16_t);
 
 static void	   move_kernel_cache (mrtentry_t *, uint16_t);
 
+/*
+ * Hash indexes for source, group and (S,G) lookups.  The ordered
+ * srclist, grplist and mrtlink chains remain the authoritative
+ * structure, everyone else walks them in address order, the hash
+ * tables only make it cheap to find an existing entry.  Each table
+ * starts small and doubles when the load factor exceeds one.
+ */
+#define MRT_HASH_MIN	64
+
+static srcentry_t **srchash;
+static uint32_t     srchash_size;
+static uint32_t     srchash_count;
+
+static grpentry_t **grphash;
+static uint32_t     grphash_size;
+static uint32_t     grphash_count;
+
+static mrtentry_t **sghash;
+static uint32_t     sghash_size;
+static uint32_t     sghash_count;
+
+/* Insertion hints, most entries are created in ascending order */
+static srcentry_t  *srclist_hint;
+static grpentry_t  *grplist_hint;
+
+/*
+ * Generations for incremental snapshots, see mrt_gen().  The epoch
+ * changes when the routing table is rebuilt, the generations restart.
+ */
+uint64_t            mrt_generation;
+uint64_t            mrt_tomb_lost;	/* Newest tombstone overwritten */
+time_t              mrt_epoch;
+struct mrt_tomb     mrt_tombs[MRT_TOMBS];
+uint64_t            mrt_ntombs;		/* Total, mrt_tombs[] is a ring */
+
+static inline uint32_t sg_hash(uint32_t source, uint32_t group)
+{
+    return addr_hash(source ^ addr_hash(group));
+}
+
+/* Return new table size if it needs to grow, otherwise zero */
+static uint32_t mrt_hash_grow(uint32_t size, uint32_t count)
+{
+    if (size && count < size)
+	return 0;
+
+    return size ? size * 2 : MRT_HASH_MIN;
+}
+
+static void srchash_insert(srcentry_t *src)
+{
+    uint32_t size, i;
+
+    size = mrt_hash_grow(srchash_size, srchash_count);
+    if (size) {
+	srcentry_t **tbl, *node, *next;
+
+	tbl = calloc(size, sizeof(srcentry_t *));
+	if (!tbl) {
+	    logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
+	    return;
+	}
+
+	for (i = 0; i < srchash_size; i++) {
+	    for (node = srchash[i]; node; node = next) {
+		next = node->hnext;
+		node->hnext = tbl[addr_hash(node->address) & (size - 1)];
+		tbl[addr_hash(node->address) & (size - 1)] = node;
+	    }
+	}
+
+	free(srchash);
+	srchash      = tbl;
+	srchash_size = size;
+    }
+
+    i = addr_hash(src->address) & (srchash_size - 1);
+    src->hnext = srchash[i];
+    srchash[i] = src;
+    srchash_count++;
+}
+
+static void srchash_remove(srcentry_t *src)
+{
+    srcentry_t **pp;
+
+    if (src == srclist_hint)
+	srclist_hint = NULL;
+
+    if (!srchash)
+	return;
+
+    for (pp = &srchash[addr_hash(src->address) & (srchash_size - 1)]; *pp; pp = &(*pp)->hnext) {
+	if (*pp == src) {
+	    *pp = src->hnext;
+	    srchash_count--;
+	    break;
+	}
+    }
+}
+
+static srcentry_t *srchash_lookup(uint32_t source)
+{
+    srcentry_t *node;
+
+    if (!srchash)
+	return NULL;
+
+    for (node = srchash[addr_hash(source) & (srchash_size - 1)]; node; node = node->hnext) {
+	if (node->address == source)
+	    return node;
+    }
+
+    return NULL;
+}
+
+static void grphash_insert(grpentry_t *grp)
+{
+    uint32_t size, i;
+
+    size = mrt_hash_grow(grphash_size, grphash_count);
+    if (size) {
+	grpentry_t **tbl, *node, *next;
+
+	tbl = calloc(size, sizeof(grpentry_t *));
+	if (!tbl) {
+	    logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
+	    return;
+	}
+
+	for (i = 0; i < grphash_size; i++) {
+	    for (node = grphash[i]; node; node = next) {
+		next = node->hnext;
+		node->hnext = tbl[addr_hash(node->group) & (size - 1)];
+		tbl[addr_hash(node->group) & (size - 1)] = node;
+	    }
+	}
+
+	free(grphash);
+	grphash      = tbl;
+	grphash_size = size;
+    }
+
+    i = addr_hash(grp->group) & (grphash_size - 1);
+    grp->hnext = grphash[i];
+    grphash[i] = grp;
+    grphash_count++;
+}
+
+static void grphash_remove(grpentry_t *grp)
+{
+    grpentry_t **pp;
+
+    if (grp == grplist_hint)
+	grplist_hint = NULL;
+
+    if (!grphash)
+	return;
+
+    for (pp = &grphash[addr_hash(grp->group) & (grphash_size - 1)]; *pp; pp = &(*pp)->hnext) {
+	if (*pp == grp) {
+	    *pp = grp->hnext;
+	    grphash_count--;
+	    break;
+	}
+    }
+}
+
+static grpentry_t *grphash_lookup(uint32_t group)
+{
+    grpentry_t *node;
+
+    if (!grphash)
+	return NULL;
+
+    for (node = grphash[addr_hash(group) & (grphash_size - 1)]; node; node = node->hnext) {
+	if (node->group == group)
+	    return node;
+    }
+
+    return NULL;
+}
+
+static void sghash_insert(mrtentry_t *mrt)
+{
+    uint32_t size, i;
+
+    size = mrt_hash_grow(sghash_size, sghash_count);
+    if (size) {
+	mrtentry_t **tbl, *node, *next;
+
+	tbl = calloc(size, sizeof(mrtentry_t *));
+	if (!tbl) {
+	    logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
+	    return;
+	}
+
+	for (i = 0; i < sghash_size; i++) {
+	    for (node = sghash[i]; node; node = next) {
+		uint32_t j = sg_hash(node->source->address, node->group->group) & (size - 1);
+
+		next = node->hnext;
+		node->hnext = tbl[j];
+		tbl[j] = node;
+	    }
+	}
+
+	free(sghash);
+	sghash      = tbl;
+	sghash_size = size;
+    }
+
+    i = sg_hash(mrt->source->address, mrt->group->group) & (sghash_size - 1);
+    mrt->hnext = sghash[i];
+    sghash[i]  = mrt;
+    sghash_count++;
+}
+
+static void sghash_remove(mrtentry_t *mrt)
+{
+    mrtentry_t **pp;
+    uint32_t i;
+
+    if (!sghash || !(mrt->flags & MRTF_SG))
+	return;
+
+    i = sg_hash(mrt->source->address, mrt->group->group) & (sghash_size - 1);
+    for (pp = &sghash[i]; *pp; pp = &(*pp)->hnext) {
+	if (*pp == mrt) {
+	    *pp = mrt->hnext;
+	    sghash_count--;
+	    break;
+	}
+    }
+}
+
+static mrtentry_t *sghash_lookup(uint32_t source, uint32_t group)
+{
+    mrtentry_t *node;
+
+    if (!sghash)
+	return NULL;
+
+    for (node = sghash[sg_hash(source, group) & (sghash_size - 1)]; node; node = node->hnext) {
+	if (node->source->address == source && node->group->group == group)
+	    return node;
+    }
+
+    return NULL;
+}
+
+static void mrt_hash_clear(void)
+{
+    free(srchash);
+    free(grphash);
+    free(sghash);
+
+    srchash = NULL;
+    grphash = NULL;
+    sghash  = NULL;
+    srchash_size = srchash_count = 0;
+    grphash_size = grphash_count = 0;
+    sghash_size  = sghash_count  = 0;
+    srclist_hint = NULL;
+    grplist_hint = NULL;
+}
+
 
 void init_pim_mrt(void)
 {
+    pool_init(&srcentry_pool,     "srcentry",     sizeof(srcentry_t));
+    pool_init(&grpentry_pool,     "grpentry",     sizeof(grpentry_t));
+    pool_init(&mrtentry_pool,     "mrtentry",     sizeof(mrtentry_t));
+    pool_init(&kernel_cache_pool, "kernel_cache", sizeof(kernel_cache_t));
+
+    decap_gen++;
+
     /* Free the routing table before re-initializing it */
     if (srclist != NULL)
 	free(srclist);
@@ -70,6 +354,11 @@ void init_pim_mrt(void)
 
 	free(grplist);
     }
+    mrt_hash_clear();
+
+    /* Incremental snapshots must start over, see mrt_gen() */
+    mrt_tomb_lost = mrt_generation;
+    mrt_epoch     = time(NULL);
 
     /* Initialize the source list */
     /* The first entry has address 'INADDR_ANY' and is not used */
@@ -123,6 +412,24 @@ grpentry_t *find_group(uint32_t group)
 }
 
 
+/*
+ * Exact (S,G) lookup in an already known group, for callers handling
+ * many sources of the same group, e.g. a Join/Prune group record.
+ */
+mrtentry_t *find_sg_route(grpentry_t *grp, uint32_t source)
+{
+    mrtentry_t *mrt;
+
+    if (!grp)
+	return NULL;
+
+    if (search_grpmrtlink(grp, source, &mrt) == TRUE)
+	return mrt;
+
+    return NULL;
+}
+
+
 srcentry_t *find_source(uint32_t source)
 {
     srcentry_t *src;
@@ -407,12 +714,14 @@ void delete_srcentry(srcentry_t *src)
     src->prev->next =  src->next;
     if (src->next)
 	src->next->prev = src->prev;
+    srchash_remove(src);
 
     for (node = src->mrtlink; node; node = next) {
 	next = node->srcnext;
 	if (node->flags & MRTF_KERNEL_CACHE)
 	    /* Delete the kernel cache first */
 	    delete_mrtentry_all_kernel_cache(node);
+	sghash_remove(node);
 
 	if (node->grpprev) {
 	    node->grpprev->grpnext = node->grpnext;
@@ -429,7 +738,7 @@ void delete_srcentry(srcentry_t *src)
 	FREE_MRTENTRY(node);
     }
 
-    free(src);
+    pool_free(&srcentry_pool, src);
 }
 
 
@@ -445,6 +754,7 @@ void delete_grpentry(grpentry_t *grp)
     grp->prev->next = grp->next;
     if (grp->next)
 	grp->next->prev = grp->prev;
+    grphash_remove(grp);
 
     if (grp->grp_route) {
 	if (grp->grp_route->flags & MRTF_KERNEL_CACHE)
@@ -468,6 +778,7 @@ void delete_grpentry(grpentry_t *grp)
 	if (node->flags & MRTF_KERNEL_CACHE)
 	    /* Delete the kernel cache first */
 	    delete_mrtentry_all_kernel_cache(node);
+	sghash_remove(node);
 
 	if (node->srcprev) {
 	    node->srcprev->srcnext = node->srcnext;
@@ -485,7 +796,7 @@ void delete_grpentry(grpentry_t *grp)
 	FREE_MRTENTRY(node);
     }
 
-    free(grp);
+    pool_free(&grpentry_pool, grp);
 }
 
 
@@ -512,6 +823,7 @@ void delete_mrtentry(mrtentry_t *mrt)
 	mrt->source->mrtlink = NULL;
     } else if (mrt->flags & MRTF_SG) {
 	/* (S,G) mrtentry */
+	sghash_remove(mrt);
 
 	/* Delete from the grpentry MRT chain */
 	if (mrt->grpprev) {
@@ -567,7 +879,19 @@ static int search_srclist(uint32_t source, srcentry_t **found)
     srcentry_t *prev, *node;
     uint32_t source_h = ntohl(source);
 
-    for (prev = srclist, node = prev->next; node; prev = node, node = node->next) {
+    node = srchash_lookup(source);
+    if (node) {
+	*found = node;
+	return TRUE;
+    }
+
+    /* Not found, locate the insertion point.  Start from the most
+     * recently created entry if it sorts before us. */
+    prev = srclist;
+    if (srclist_hint && ntohl(srclist_hint->address) < source_h)
+	prev = srclist_hint;
+
+    for (node = prev->next; node; prev = node, node = node->next) {
 	/* The srclist is ordered with the smallest addresses first.
 	 * The first entry is not used. */
 	if (ntohl(node->address) < source_h)
@@ -591,7 +915,19 @@ static int search_grplist(uint32_t group, grpentry_t **found)
     grpentry_t *prev, *node;
     uint32_t group_h = ntohl(group);
 
-    for (prev = grplist, node = prev->next; node; prev = node, node = node->next) {
+    node = grphash_lookup(group);
+    if (node) {
+	*found = node;
+	return TRUE;
+    }
+
+    /* Not found, locate the insertion point.  Start from the most
+     * recently created entry if it sorts before us. */
+    prev = grplist;
+    if (grplist_hint && ntohl(grplist_hint->group) < group_h)
+	prev = grplist_hint;
+
+    for (node = prev->next; node; prev = node, node = node->next) {
 	/* The grplist is ordered with the smallest address first.
 	 * The first entry is not used. */
 	if (ntohl(node->group) < group_h)
@@ -618,7 +954,7 @@ static srcentry_t *create_srcentry(uint32_t source)
     if (search_srclist(source, &prev) == TRUE)
 	return prev;
 
-    node = calloc(1, sizeof(srcentry_t));
+    node = pool_alloc(&srcentry_pool);
     if (!node) {
 	logit(LOG_WARNING, 0, "Memory allocation error for srcentry %s",
 	      inet_fmt(source, s1, sizeof(s1)));
@@ -629,7 +965,7 @@ static srcentry_t *create_srcentry(uint32_t source)
     /* Free the memory if there is error getting the iif and
      * the next hop (upstream) router. */
     if (set_incoming(node, PIM_IIF_SOURCE) == FALSE) {
-	free(node);
+	pool_free(&srcentry_pool, node);
 	return NULL;
     }
 
@@ -640,6 +976,8 @@ static srcentry_t *create_srcentry(uint32_t source)
     node->prev    = prev;
     if (node->next)
 	node->next->prev = node;
+    srchash_insert(node);
+    srclist_hint  = node;
 
     IF_DEBUG(DEBUG_MFC) {
 	logit(LOG_DEBUG, 0, "create source entry, source %s",
@@ -660,7 +998,7 @@ static grpentry_t *create_grpentry(uint32_t group)
     if (search_grplist(group, &prev) == TRUE)
 	return prev;
 
-    node = calloc(1, sizeof(grpentry_t));
+    node = pool_alloc(&grpentry_pool);
     if (!node) {
 	logit(LOG_WARNING, 0, "Memory allocation error for grpentry %s",
 	      inet_fmt(group, s1, sizeof(s1)));
@@ -687,6 +1025,8 @@ static grpentry_t *create_grpentry(uint32_t group)
     node->prev		= prev;
     if (node->next)
 	node->next->prev = node;
+    grphash_insert(node);
+    grplist_hint	= node;
 
     IF_DEBUG(DEBUG_MFC) {
 	logit(LOG_DEBUG, 0, "create group entry, group %s", inet_fmt(group, s1, sizeof(s1)));
@@ -707,6 +1047,12 @@ static int search_srcmrtlink(srcentry_t *src, uint32_t group, mrtentry_t **found
     mrtentry_t *prev = NULL;
     uint32_t group_h = ntohl(group);
 
+    node = sghash_lookup(src->address, group);
+    if (node) {
+	*found = node;
+	return TRUE;
+    }
+
     for (node = src->mrtlink; node; prev = node, node = node->srcnext) {
 	/* The entries are ordered with the smaller group address first.
 	 * The addresses are in network order. */
@@ -738,6 +1084,12 @@ static int search_grpmrtlink(grpentry_t *grp, uint32_t source, mrtentry_t **foun
     mrtentry_t *prev = NULL;
     uint32_t source_h = ntohl(source);
 
+    node = sghash_lookup(source, grp->group);
+    if (node) {
+	*found = node;
+	return TRUE;
+    }
+
     for (node = grp->mrtlink; node; prev = node, node = node->grpnext) {
 	/* The entries are ordered with the smaller source address first.
 	 * The addresses are in network order. */
@@ -796,13 +1148,47 @@ static void insert_grpmrtlink(mrtentry_t *node, mrtentry_t *prev, grpentry_t *gr
 }
 
 
+/*
+ * Size the routing entries for the vif timers.  With SAVE_MEMORY only
+ * for the configured vifs, otherwise for all interfaces, so one that
+ * gets an address later fits too.  The vifs are known only after
+ * init_vifs(), which runs after init_pim_mrt(), so this is done at the
+ * first allocation after (re)start, when the old table is gone.
+ */
+static int mrt_size_vifs(void)
+{
+    vifi_t vifs;
+
+#ifdef SAVE_MEMORY
+    vifs = numvifs;
+#else
+    vifs = MAX(numvifs, total_interfaces);
+#endif /* SAVE_MEMORY */
+    if (vifs == mrt_vifs)
+	return 0;
+
+    if (pool_resize(&mrtentry_pool, MRT_SIZE(vifs))) {
+	/* Old entries still around, fine as long as the new vifs fit */
+	if (vifs < mrt_vifs)
+	    return 0;
+
+	logit(LOG_ERR, 0, "Cannot make room for %u vifs in routing entries still in use", vifs);
+	return -1;
+    }
+    mrt_vifs = vifs;
+
+    return 0;
+}
+
 static mrtentry_t *alloc_mrtentry(srcentry_t *src, grpentry_t *grp)
 {
     mrtentry_t *mrt;
-    uint16_t i, *timer;
-    uint8_t  vif_numbers;
+    uint16_t i;
 
-    mrt = calloc(1, sizeof(mrtentry_t));
+    if (mrt_size_vifs())
+	return NULL;
+
+    mrt = pool_alloc(&mrtentry_pool);
     if (!mrt) {
 	logit(LOG_WARNING, 0, "alloc_mrtentry(): out of memory");
 	return NULL;
@@ -814,6 +1200,8 @@ static mrtentry_t *alloc_mrtentry(srcentry_t *src, grpentry_t *grp)
      */
     mrt->source  = src;
     mrt->group   = grp;
+    mrt->gen_source = src ? src->address : INADDR_ANY_N;
+    mrt->gen_group  = grp ? grp->group   : INADDR_ANY_N;
     mrt->incoming = NO_VIF;
     PIMD_VIFM_CLRALL(mrt->joined_oifs);
     PIMD_VIFM_CLRALL(mrt->leaves);
@@ -828,35 +1216,13 @@ static mrtentry_t *alloc_mrtentry(srcentry_t *src, grpentry_t *grp)
     mrt->rsrr_cache = NULL;
 #endif /* RSRR */
 
-    /* XXX: TODO: if we are short in memory, we can reserve as few as possible
-     * space for vif timers (per group and/or routing entry), but then everytime
-     * when a new interfaces is configured, the router will be restarted and
-     * will delete the whole routing table. The "memory is cheap" solution is
-     * to reserve timer space for all potential vifs in advance and then no
-     * need to delete the routing table and disturb the forwarding.
-     */
-#ifdef SAVE_MEMORY
-    mrt->vif_timers	    = calloc(1, sizeof(uint16_t) * numvifs);
-    mrt->vif_deletion_delay = calloc(1, sizeof(uint16_t) * numvifs);
-    vif_numbers = numvifs;
-#else
-    mrt->vif_timers	    = calloc(1, sizeof(uint16_t) * total_interfaces);
-    mrt->vif_deletion_delay = calloc(1, sizeof(uint16_t) * total_interfaces);
-    vif_numbers = total_interfaces;
-#endif /* SAVE_MEMORY */
-    if (!mrt->vif_timers || !mrt->vif_deletion_delay) {
-	logit(LOG_WARNING, 0, "alloc_mrtentry(): out of memory");
-	FREE_MRTENTRY(mrt);
-	return NULL;
+    /* The vif timers, followed by the deletion delays, see MRT_SIZE() */
+    mrt->vif_deletion_delay = (uint16_t *)&mrt->vif_timers[mrt_vifs];
+    for (i = 0; i < mrt_vifs; i++) {
+	RESET_TIMER(mrt->vif_timers[i]);
+	RESET_TIMER(mrt->vif_deletion_delay[i]);
     }
 
-    /* Reset the timers */
-    for (i = 0, timer = mrt->vif_timers; i < vif_numbers; i++, timer++)
-	RESET_TIMER(*timer);
-
-    for (i = 0, timer = mrt->vif_deletion_delay; i < vif_numbers; i++, timer++)
-	RESET_TIMER(*timer);
-
     mrt->flags = MRTF_NEW;
     RESET_TIMER(mrt->entry_timer);
     RESET_TIMER(mrt->jp_timer);
@@ -865,6 +1231,12 @@ static mrtentry_t *alloc_mrtentry(srcentry_t *src, grpentry_t *grp)
     RESET_TIMER(mrt->assert_rate_timer);
     mrt->kernel_cache = NULL;
 
+    /* A more specific entry may now match registers, see pim_proto.c */
+    decap_gen++;
+
+    /* Let age_routes() have a first look at the next tick */
+    mrt_schedule(mrt, route_clock);
+
     return mrt;
 }
 
@@ -905,6 +1277,8 @@ static mrtentry_t *create_mrtentry(srcentry_t *src, grpentry_t *grp, uint16_t fl
 	insert_grpmrtlink(node, grp_insert, grp);
 	insert_srcmrtlink(node, src_insert, src);
 	node->flags |= MRTF_SG;
+	sghash_insert(node);
+	ipc_route_event(IPC_EV_ADD, node);
 
 	return node;
     }
@@ -920,6 +1294,7 @@ static mrtentry_t *create_mrtentry(srcentry_t *src, grpentry_t *grp, uint16_t fl
 
 	grp->grp_route = node;
 	node->flags |= (MRTF_WC | MRTF_RP);
+	ipc_route_event(IPC_EV_ADD, node);
 
 	return node;
     }
@@ -935,6 +1310,7 @@ static mrtentry_t *create_mrtentry(srcentry_t *src, grpentry_t *grp, uint16_t fl
 
 	src->mrtlink = node;
 	node->flags |= (MRTF_PMBR | MRTF_RP);
+	ipc_route_event(IPC_EV_ADD, node);
 
 	return node;
     }
@@ -961,9 +1337,10 @@ void delete_mrtentry_all_kernel_cache(mrtentry_t *mrt)
 
 	logit(LOG_DEBUG, 0, "delete_mrtentry_all_kernel_cache: SG");
 	k_del_mfc(igmp_socket, prev->source, prev->group);
-	free(prev);
+	pool_free(&kernel_cache_pool, prev);
     }
     mrt->kernel_cache = NULL;
+    decap_gen++;
 
     /* turn off the cache flag(s) */
     mrt->flags &= ~(MRTF_KERNEL_CACHE | MRTF_MFC_CLONE_SG);
@@ -994,7 +1371,8 @@ void delete_single_kernel_cache(mrtentry_t *mrt, kernel_cache_t *node)
 
     logit(LOG_DEBUG, 0, "delete_single_kernel_cache: SG");
     k_del_mfc(igmp_socket, node->source, node->group);
-    free(node);
+    pool_free(&kernel_cache_pool, node);
+    decap_gen++;
 }
 
 
@@ -1048,7 +1426,8 @@ void delete_single_kernel_cache_addr(mrtentry_t *mrt, uint32_t source, uint32_t
 
     logit(LOG_DEBUG, 0, "delete_single_kernel_cache_addr: SG");
     k_del_mfc(igmp_socket, node->source, node->group);
-    free(node);
+    pool_free(&kernel_cache_pool, node);
+    decap_gen++;
 }
 
 
@@ -1074,7 +1453,7 @@ void add_kernel_cache(mrtentry_t *mrt, uint32_t source, uint32_t group, uint16_t
 	if (mrt->flags & MRTF_KERNEL_CACHE)
 	    return;
 
-	node = calloc(1, sizeof(kernel_cache_t));
+	node = pool_alloc(&kernel_cache_pool);
 	if (!node) {
 	    logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
 	    return;
@@ -1087,6 +1466,8 @@ void add_kernel_cache(mrtentry_t *mrt, uint32_t source, uint32_t group, uint16_t
 	node->sg_count.pktcnt = 0;
 	node->sg_count.bytecnt = 0;
 	node->sg_count.wrong_if = 0;
+	node->keepalive = 0;
+	node->decap = 0;
 	mrt->kernel_cache = node;
 	mrt->flags |= MRTF_KERNEL_CACHE;
 
@@ -1112,7 +1493,7 @@ void add_kernel_cache(mrtentry_t *mrt, uint32_t source, uint32_t group, uint16_t
     }
 
     /* The new entry must be placed between prev and next */
-    node = calloc(1, sizeof(kernel_cache_t));
+    node = pool_alloc(&kernel_cache_pool);
     if (!node) {
 	logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
 	return;
@@ -1134,10 +1515,72 @@ void add_kernel_cache(mrtentry_t *mrt, uint32_t source, uint32_t group, uint16_t
     node->sg_count.pktcnt   = 0;
     node->sg_count.bytecnt  = 0;
     node->sg_count.wrong_if = 0;
+    node->keepalive = 0;
+    node->decap     = 0;
 
     mrt->flags |= MRTF_KERNEL_CACHE;
 }
 
+/* The kernel cache entry of (source, group) in the sorted list of @mrt */
+static kernel_cache_t *kernel_cache_lookup(mrtentry_t *mrt, uint32_t source, uint32_t group)
+{
+    kernel_cache_t *node;
+    uint32_t source_h = ntohl(source);
+    uint32_t group_h  = ntohl(group);
+
+    if (!mrt || !(mrt->flags & MRTF_KERNEL_CACHE))
+	return NULL;
+
+    for (node = mrt->kernel_cache; node; node = node->next) {
+	if (ntohl(node->group) < group_h)
+	    continue;
+	if (ntohl(node->group) > group_h)
+	    break;
+	if (ntohl(node->source) < source_h)
+	    continue;
+	if (ntohl(node->source) > source_h)
+	    break;
+
+	return node;
+    }
+
+    return NULL;
+}
+
+/*
+ * Find the kernel cache entry of (source, group), on the (S,G), (*,G)
+ * or (*,*,RP) entry holding it, which is returned in @found.
+ */
+kernel_cache_t *find_kernel_cache(uint32_t source, uint32_t group, mrtentry_t **found)
+{
+    kernel_cache_t *node;
+    mrtentry_t *mrt[3] = { NULL, NULL, NULL };
+    grpentry_t *grp;
+    rpentry_t *rp;
+    size_t i;
+
+    grp = find_group(group);
+    if (grp) {
+	mrt[0] = find_sg_route(grp, source);
+	mrt[1] = grp->grp_route;
+    }
+
+    rp = rp_match(group);
+    if (rp)
+	mrt[2] = rp->mrtlink;
+
+    for (i = 0; i < NELEMS(mrt); i++) {
+	node = kernel_cache_lookup(mrt[i], source, group);
+	if (node) {
+	    if (found)
+		*found = mrt[i];
+	    return node;
+	}
+    }
+
+    return NULL;
+}
+
 /*
  * Bring the kernel cache "UP": from the (*,*,RP) to (*,G) or (S,G)
  */
@@ -1306,7 +1749,7 @@ static void move_kernel_cache(mrtentry_t *mrt, uint16_t flags)
 		mrtentry_rp->flags &= ~(MRTF_KERNEL_CACHE | MRTF_MFC_CLONE_SG);
 
 	    if (mrt->kernel_cache)
-		free(mrt->kernel_cache);
+		pool_free(&kernel_cache_pool, mrt->kernel_cache);
 
 	    mrt->flags	      |= MRTF_KERNEL_CACHE;
 	    mrt->kernel_cache  = node;
@@ -1317,6 +1760,66 @@ static void move_kernel_cache(mrtentry_t *mrt, uint16_t flags)
     }
 }
 
+/* FNV-1a, start with MRT_SUM_INIT, for what is shown in snapshots */
+uint32_t mrt_sum(uint32_t sum, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--) {
+	sum ^= *p++;
+	sum *= 16777619;
+    }
+
+    return sum;
+}
+
+/*
+ * Generation of @mrt for incremental snapshots.  A route gets the next
+ * generation the first time it is looked at after a change, so nothing
+ * needs to be done where routes change.  A collector that last saw
+ * generation N gets all routes with a later one, and the tombstones of
+ * those removed since, see mrt_tomb().
+ */
+uint64_t mrt_gen(mrtentry_t *mrt)
+{
+    uint32_t addr, sum = MRT_SUM_INIT;
+
+    sum = mrt_sum(sum, &mrt->flags, sizeof(mrt->flags));
+    sum = mrt_sum(sum, &mrt->incoming, sizeof(mrt->incoming));
+    sum = mrt_sum(sum, mrt->oifs, sizeof(mrt->oifs));
+    sum = mrt_sum(sum, mrt->joined_oifs, sizeof(mrt->joined_oifs));
+    sum = mrt_sum(sum, mrt->pruned_oifs, sizeof(mrt->pruned_oifs));
+    sum = mrt_sum(sum, mrt->asserted_oifs, sizeof(mrt->asserted_oifs));
+    sum = mrt_sum(sum, mrt->leaves, sizeof(mrt->leaves));
+    addr = mrt->upstream ? mrt->upstream->address : INADDR_ANY_N;
+    sum = mrt_sum(sum, &addr, sizeof(addr));
+    addr = mrt->group ? mrt->group->rpaddr : INADDR_ANY_N;
+    sum = mrt_sum(sum, &addr, sizeof(addr));
+    sum |= 1;			/* Never zero, new routes always differ */
+
+    if (sum != mrt->gen_sum) {
+	mrt->gen_sum    = sum;
+	mrt->gen        = ++mrt_generation;
+    }
+
+    return mrt->gen;
+}
+
+/* Route handed out in a snapshot is being removed, see FREE_MRTENTRY() */
+void mrt_tomb(mrtentry_t *mrt)
+{
+    struct mrt_tomb *tomb = &mrt_tombs[mrt_ntombs++ % MRT_TOMBS];
+
+    /* Collectors older than this one must start over */
+    if (tomb->gen)
+	mrt_tomb_lost = tomb->gen;
+
+    tomb->source = mrt->gen_source;
+    tomb->group  = mrt->gen_group;
+    tomb->flags  = mrt->flags & (MRTF_WC | MRTF_SG | MRTF_PMBR);
+    tomb->gen    = ++mrt_generation;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -59,51 +59,93 @@
 	       numvifs * sizeof((from)->vif_deletion_delay[0]));	\
     } while (0)
 
+/*
+ * The routing entry timers hold the absolute route_clock deadline, in
+ * seconds, or zero when not running.  A timer that is not running is
+ * considered expired, same as the old count-down timers.  Setting a
+ * timer (re)schedules the entry for aging, see age_routes().
+ */
+#define MRT_TIMER_LEFT(timer)						\
+    ((timer) > route_clock ? (timer) - route_clock : 0)
+#define MRT_TIMEOUT(timer)	((timer) <= route_clock)
+#define MRT_SET_TIMER(mrt, timer, value)				\
+    do {								\
+	(timer) = route_clock + (value);				\
+	mrt_schedule((mrt), (timer));					\
+    } while (0)
+#define MRT_FIRE_TIMER(mrt, timer) MRT_SET_TIMER(mrt, timer, 0)
+
 #define FREE_MRTENTRY(mrtentry_ptr)				\
     do {							\
 	kernel_cache_t *curr;					\
 	kernel_cache_t *next;					\
 								\
-	if ((mrtentry_ptr)->vif_timers)				\
-	    free((mrtentry_ptr)->vif_timers);			\
-	if ((mrtentry_ptr)->vif_deletion_delay)			\
-	    free((mrtentry_ptr)->vif_deletion_delay);		\
+	mrt_unschedule(mrtentry_ptr);				\
+	if ((mrtentry_ptr)->reg)				\
+	    register_forget(mrtentry_ptr);			\
+	if ((mrtentry_ptr)->track)				\
+	    jp_forget(mrtentry_ptr);				\
+	if ((mrtentry_ptr)->gen)				\
+	    mrt_tomb(mrtentry_ptr);				\
+	ipc_route_event(IPC_EV_DEL, mrtentry_ptr);		\
+	decap_gen++;						\
 	curr = (mrtentry_ptr)->kernel_cache;			\
 	while (curr) {						\
 	    next = curr->next;					\
-	    free(curr);						\
+	    pool_free(&kernel_cache_pool, curr);		\
 	    curr = next;					\
 	}							\
-	free(mrtentry_ptr);					\
+	pool_free(&mrtentry_pool, mrtentry_ptr);		\
     } while (0)
 
 
 /*
- * The complicated structure used by the more complicated Join/Prune
- * message building
+ * Join/Prune entries queued for an upstream neighbor.  They are sorted
+ * and packed into as few messages as the MTU allows when sent, see
+ * pack_and_send_jp_message().
  */
-typedef struct build_jp_message_ {
-    struct build_jp_message_ *next; /* Used to chain the free entries       */
-    uint8_t *jp_message;       /* The Join/Prune message                     */
-    uint32_t jp_message_size;  /* Size of the Join/Prune message (in bytes)  */
+typedef struct {
+    uint32_t group;
+    uint32_t source;
     uint16_t holdtime;	      /* Join/Prune message holdtime field	    */
-    uint32_t curr_group;	      /* Current group address			    */
-    uint8_t  curr_group_msklen;/* Current group masklen			    */
-    uint8_t *join_list;	      /* The working area for the join addresses    */
-    uint32_t join_list_size;   /* The size of the join_list (in bytes)       */
-    uint16_t join_addr_number; /* Number of the join addresses in join_list  */
-    uint8_t *prune_list;       /* The working area for the prune addresses   */
-    uint32_t prune_list_size;  /* The size of the prune_list (in bytes)      */
-    uint16_t prune_addr_number;/* Number of the prune addresses in prune_list*/
-    uint8_t *rp_list_join;     /* The working area for RP join addresses     */
-    uint32_t rp_list_join_size;/* The size of the rp_list_join (in bytes)    */
-    uint16_t rp_list_join_number;/* Number of RP addresses in rp_list_join   */
-    uint8_t *rp_list_prune;     /* The working area for RP prune addresses   */
-    uint32_t rp_list_prune_size;/* The size of the rp_list_prune (in bytes)  */
-    uint16_t rp_list_prune_number;/* Number of RP addresses in rp_list_prune */
-    uint8_t *num_groups_ptr;   /* Pointer to number_of_groups in jp_message  */
+    uint8_t  grp_msklen;
+    uint8_t  src_msklen;
+    uint8_t  flags;	      /* Encoded-Source flags, USADDR_*_BIT	    */
+    uint8_t  action;	      /* PIM_ACTION_JOIN or PIM_ACTION_PRUNE	    */
+} jp_entry_t;
+
+typedef struct build_jp_message_ {
+    jp_entry_t *entries;      /* The working area, kept between messages    */
+    size_t   num;	      /* Number of queued entries		    */
+    size_t   max;	      /* Size of the working area, in entries	    */
 } build_jp_message_t;
 
+/*
+ * A received Join/Prune message, decoded by parse_pim_join_prune().
+ * Each group record points at its sources in the entries array, the
+ * Joins first and then the Prunes, in message order.
+ */
+typedef struct {
+    uint32_t group;
+    uint8_t  masklen;
+    uint16_t num_j;	      /* Joined sources, at entries[first]	    */
+    uint16_t num_p;	      /* Pruned sources, after the joined ones	    */
+    uint16_t wc;	      /* Index of the first (*,G) Join, or num_j    */
+    size_t   first;
+} jp_group_t;
+
+typedef struct {
+    uint32_t    target;	      /* Upstream neighbor address		    */
+    uint32_t    sender;	      /* Downstream neighbor, set on receive	    */
+    uint16_t    holdtime;
+    uint8_t     num_groups;
+    uint8_t     star_star_rp; /* Number of (*,*,RP) group records	    */
+    jp_group_t  groups[UINT8_MAX];
+    jp_entry_t *entries;      /* All sources, kept between messages	    */
+    size_t      num;
+    size_t      max;
+} jp_message_t;
+
 
 typedef struct pim_nbr_entry {
     struct pim_nbr_entry *next;		  /* link to next neighbor	    */
@@ -112,6 +154,10 @@ typedef struct pim_nbr_entry {
     int8_t                dr_prio_present;/* If set, this neighbor has prio */
     uint32_t              dr_prio;	  /* DR priority: 1 (default)       */
     uint32_t              genid;	  /* Cached generation ID           */
+    int8_t                lan_delay_present; /* Sent the LAN Prune Delay   */
+    int8_t                tbit;		  /* ... with the T-bit set         */
+    uint16_t              prop_delay;	  /* ... propagation delay, msec    */
+    uint16_t              override_ivl;	  /* ... override interval, msec    */
     vifi_t		  vifi;		  /* which interface		    */
     uint16_t		  timer;	  /* for timing out neighbor	    */
     time_t		  uptime;	  /* time since first hello	    */
@@ -125,6 +171,7 @@ typedef struct pim_nbr_entry {
 typedef struct srcentry {
     struct srcentry	 *next;		/* link to next entry		    */
     struct srcentry	 *prev;		/* link to prev entry		    */
+    struct srcentry	 *hnext;	/* next in source hash bucket	    */
     uint32_t		  address;	/* source or RP address		    */
     struct mrtentry	 *mrtlink;	/* link to routing entries	    */
     vifi_t		  incoming;	/* incoming vif			    */
@@ -174,6 +221,7 @@ typedef struct rp_grp_entry {
 typedef struct grpentry {
     struct grpentry	*next;	       /* link to next entry		    */
     struct grpentry	*prev;	       /* link to prev entry		    */
+    struct grpentry	*hnext;	       /* next in group hash bucket	    */
     struct grpentry	*rpnext;       /* next grp for the same RP	    */
     struct grpentry	*rpprev;       /* prev grp for the same RP	    */
     uint32_t		 group;	       /* subnet group of multicasts	    */
@@ -188,14 +236,20 @@ typedef struct mrtentry {
     struct mrtentry	  *grpprev;	/* prev entry of same group	    */
     struct mrtentry	  *srcnext;	/* next entry of same source	    */
     struct mrtentry	  *srcprev;	/* prev entry of same source	    */
+    struct mrtentry	  *hnext;	/* next in (S,G) hash bucket	    */
+    struct mrtentry	  *agenext;	/* next entry due at same time	    */
+    struct mrtentry	  *ageprev;	/* prev entry due at same time	    */
+    struct mrtentry	 **agehead;	/* aging list we are on, or NULL    */
+    uint32_t		  agedue;	/* when age_routes() should visit   */
+    uint32_t		  aged;		/* last visited by age_routes()	    */
     struct grpentry	  *group;	/* pointer to group entry	    */
     struct srcentry	  *source;	/* pointer to source entry (or RP)  */
     vifi_t		  incoming;	/* the iif (either toward S or RP)  */
-    uint8_t		  oifs[MAXVIFS];		/* The current result oifs	    */
-    uint8_t		  joined_oifs[MAXVIFS];		/* The joined oifs (Join received)  */
-    uint8_t		  pruned_oifs[MAXVIFS]; 	/* The pruned oifs (Prune received) */
-    uint8_t		  asserted_oifs[MAXVIFS];	/* The asserted oifs (lost Assert)  */
-    uint8_t		  leaves[MAXVIFS];		/* Has directly connected members   */
+    vifset_t		  oifs;			/* The current result oifs	    */
+    vifset_t		  joined_oifs;		/* The joined oifs (Join received)  */
+    vifset_t		  pruned_oifs;		/* The pruned oifs (Prune received) */
+    vifset_t		  asserted_oifs;	/* The asserted oifs (lost Assert)  */
+    vifset_t		  leaves;		/* Has directly connected members   */
     struct pim_nbr_entry *upstream;	/* upstream router, needed because
 					 * of the asserts it may be different
 					 * than the source (or RP) upstream
@@ -204,22 +258,64 @@ typedef struct mrtentry {
     uint32_t		 metric;	/* Routing Metric for this entry    */
     uint32_t		 preference;	/* The metric preference value	    */
     uint32_t		 pmbr_addr;	/* The PMBR address (for interop)   */
-    uint16_t		*vif_timers;	/* vifs timer list		    */
-    uint16_t		*vif_deletion_delay; /* vifs deletion delay list    */
+    uint16_t		*vif_deletion_delay;	/* vifs deletion delay, in the tail */
     uint16_t		 flags;		/* The MRTF_* flags		    */
-    uint16_t		 entry_timer;	/* entry timer			    */
-    uint16_t		 jp_timer;	/* The Join/Prune timer		    */
-    uint16_t		 rs_timer;	/* Register-Suppression Timer	    */
-    u_int		 assert_timer;
+    uint32_t		 entry_timer;	/* entry timer			    */
+    uint32_t		 jp_timer;	/* The Join/Prune timer		    */
+    uint32_t		 rs_timer;	/* Register-Suppression Timer	    */
+    uint32_t		 assert_timer;
     u_int		 assert_rate_timer;
     struct kernel_cache *kernel_cache;	/* List of the kernel cache entries */
+    struct regstate	*reg;		/* Register state, when we are DR   */
+    struct jptrack	*track;		/* Joined LAN neighbors, see jp_track() */
+    uint64_t		 gen;		/* Snapshot generation, see mrt_gen() */
+    uint32_t		 gen_sum;	/* State at that generation	    */
+    uint32_t		 gen_source;	/* Key for tombstones and events, the */
+    uint32_t		 gen_group;	/* source and group may be gone by then */
 #ifdef RSRR
     struct rsrr_cache	*rsrr_cache;	/* Used to save RSRR requests for
 					 * route change notification. */
 #endif /* RSRR */
+    uint32_t		 vif_timers[];	/* vifs timer list, see mrt_vifs    */
 } mrtentry_t;
 
 
+/*
+ * A downstream router that has joined an entry on a LAN where all PIM
+ * routers do explicit tracking, i.e., set the T-bit in the LAN Prune
+ * Delay Hello option.  Lets a Prune from the last one joined take effect
+ * at once, and a Prune from any other be ignored, see jp_prune_oif().
+ */
+typedef struct jptrack {
+    struct jptrack	*next;
+    uint32_t		 address;	/* The downstream neighbor          */
+    vifi_t		 vifi;		/* ... and its LAN                  */
+    uint32_t		 expires;	/* route_clock, end of its holdtime */
+} jptrack_t;
+
+
+/*
+ * Register encapsulation state of an (S,G) we are the DR for.  Holds
+ * what send_pim_register() resolved the source and RP to, so the data
+ * path can skip those lookups, and the per (S,G) Register counters.
+ */
+typedef struct regstate {
+    struct mrtentry	*mrt;		/* The (S,G) entry                  */
+    uint32_t		 gen;		/* register_gen when resolved       */
+    uint32_t		 reg_src;	/* Our address on the source vif    */
+    uint32_t		 reg_dst;	/* The RP, Registers are sent to    */
+    vifi_t		 vifi;		/* The vif of the source            */
+    uint64_t		 pkts;		/* Registers sent                   */
+    uint64_t		 bytes;		/* ... bytes of data encapsulated   */
+    uint64_t		 suppressed;	/* Not sent, Register-Stop received */
+    uint32_t		 stamp;		/* route_clock of the counting below */
+    uint32_t		 sec_pkts;	/* Registers sent this second       */
+    uint32_t		 sec_bytes;
+    uint32_t		 pps;		/* ... and the second before        */
+    uint64_t		 bps;
+} regstate_t;
+
+
 /*
  * Used to get forwarded data related counts (number of packet, number of
  * bits, etc)
@@ -259,8 +355,25 @@ typedef struct kernel_cache {
     uint32_t		 source;
     uint32_t		 group;
     struct sg_count      sg_count; /* The (s,g) data retated counters (see above) */
+    uint32_t		 keepalive; /* Packet count, see regtun_active() */
+    uint32_t		 expires;  /* Negative cache entries, route_clock */
+    uint8_t		 decap;	   /* Arrives on tunl0, see k_chg_mfc() */
 } kernel_cache_t;
 
+/*
+ * Routes removed after having been handed out in a snapshot, for the
+ * incremental ones, see mrt_gen().  A ring, the oldest are overwritten.
+ */
+#define MRT_TOMBS	1024
+#define MRT_SUM_INIT	2166136261U	/* FNV-1a offset basis, see mrt_sum() */
+
+struct mrt_tomb {
+    uint32_t		 source;
+    uint32_t		 group;
+    uint16_t		 flags;		/* MRTF_WC, MRTF_SG or MRTF_PMBR    */
+    uint64_t		 gen;
+};
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -20,11 +20,76 @@
 
 #include <linux/rtnetlink.h>
 
+/*
+ * RPF cache, the result of an RTM_GETROUTE per source address.  It is
+ * kept up to date by listening to RTNLGRP_IPV4_ROUTE: a route change
+ * marks the cached entries in the changed prefix stale and queues an
+ * asynchronous lookup of all known sources and RPs in it.  Lookups are
+ * pipelined, up to RPF_INFLIGHT at a time, and when a result differs
+ * from what was cached rpf_changed() updates the affected entries.
+ * Lookups without a reply after RPF_TIMEOUT, or when the socket buffer
+ * overflowed, are sent again.
+ *
+ * The cache has room for twice the known sources, at least for
+ * RPF_CACHE_MAX entries.  When full, stale entries and those not used
+ * since the last pass of rpf_evict() make room, one at a time.
+ */
+#define RPF_HASH_MIN    4096	/* Doubles when the load factor exceeds one */
+#define RPF_CACHE_MAX   65536	/* Least number of entries before evicting */
+#define RPF_INFLIGHT    256	/* Max outstanding asynchronous lookups */
+#define RPF_TIMEOUT     10	/* Sec, then a reply is lost, ask again */
+#define RPF_PREFIX_MAX  64	/* Max changed prefixes, then assume all */
+#define RPF_WAIT        1	/* Sec, then our own reply is lost, ask again */
+#define RPF_RETRIES     3	/* Max times to ask, then give up */
+
+struct rpf_entry {
+    struct rpf_entry *next;
+    uint32_t	      source;
+    uint32_t	      rpfneighbor;
+    vifi_t	      iif;
+    uint8_t	      found;	/* Return value of the lookup */
+    uint8_t	      stale;	/* Route changed, look up again */
+    uint8_t	      queued;	/* Lookup queued or in flight   */
+    uint8_t	      used;	/* Since the last rpf_evict()   */
+};
+
+struct rpf_prefix {
+    uint32_t	      addr;
+    uint32_t	      mask;
+};
+
 int routing_socket = -1;
+static int notify_socket = -1;
 static uint32_t pid; /* pid_t, but /usr/include/linux/netlink.h says __u32 ... */
 static uint32_t seq;
 
+static struct rpf_entry **rpf_hash;
+static uint32_t rpf_hash_size;
+static uint32_t rpf_hand;	/* Next bucket for rpf_evict() */
+static size_t rpf_count;
+
+static struct rpf_prefix rpf_prefixes[RPF_PREFIX_MAX];
+static int rpf_nprefixes;
+static int rpf_all_changed;
+
+/* Sources waiting for an asynchronous lookup, and lookups in flight */
+static uint32_t *rpf_queue;
+static size_t rpf_queue_len, rpf_queue_max;
+static struct {
+    uint32_t seq;		/* 0 when the slot is free */
+    uint32_t source;
+    uint32_t sent;		/* virtual_time            */
+} rpf_inflight[RPF_INFLIGHT];
+static int rpf_ninflight;
+
+/* Sources with a changed RPF, for rpf_changed() */
+static uint32_t *rpf_changes;
+static size_t rpf_changes_len, rpf_changes_max;
+static int rpf_flush_pending;
+
 static int getmsg(struct rtmsg *rtm, int msglen, struct rpfctl *rpf);
+static void routesock_read(int sd);
+static void notify_read(int sd);
 
 static int addattr32(struct nlmsghdr *n, size_t maxlen, int type, uint32_t data)
 {
@@ -43,6 +108,30 @@ static int addattr32(struct nlmsghdr *n, size_t maxlen, int type, uint32_t data)
     return 0;
 }
 
+static struct rtattr *addattr_l(struct nlmsghdr *n, size_t maxlen, int type, const void *data, size_t alen)
+{
+    int len = RTA_LENGTH(alen);
+    struct rtattr *rta;
+
+    if (NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len) > maxlen)
+	return NULL;
+
+    rta = (struct rtattr *)(((char *)n) + NLMSG_ALIGN(n->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = len;
+    if (alen)
+	memcpy(RTA_DATA(rta), data, alen);
+    n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len);
+
+    return rta;
+}
+
+/* Close a nested attribute opened with addattr_l(n, maxlen, type, NULL, 0) */
+static void addattr_nest_end(struct nlmsghdr *n, struct rtattr *nest)
+{
+    nest->rta_len = (char *)n + NLMSG_ALIGN(n->nlmsg_len) - (char *)nest;
+}
+
 static int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len)
 {
     while (RTA_OK(rta, len)) {
@@ -62,6 +151,7 @@ int init_routesock(void)
 {
     socklen_t addr_len;
     struct sockaddr_nl local;
+    struct timeval tv;
 
     routing_socket = socket(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
     if (routing_socket < 0) {
@@ -96,46 +186,614 @@ int init_routesock(void)
     pid = local.nl_pid;
     seq = time(NULL);
 
+    /*
+     * While the socket is congested the kernel drops replies without
+     * reporting ENOBUFS again, never wait for good in k_req_incoming().
+     */
+    tv.tv_sec  = RPF_WAIT;
+    tv.tv_usec = 0;
+    if (setsockopt(routing_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+	logit(LOG_WARNING, errno, "Failed setting netlink receive timeout");
+
+    if (register_input_handler(routing_socket, routesock_read, IH_LEVEL) < 0)
+	logit(LOG_WARNING, 0, "Failed registering netlink input handler");
+
+    /* Route change notifications, without them fall back to polling */
+    notify_socket = socket(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (notify_socket < 0) {
+	logit(LOG_WARNING, errno, "Failed creating netlink notification socket");
+	return 0;
+    }
+
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_IPV4_ROUTE;
+    if (bind(notify_socket, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+	register_input_handler(notify_socket, notify_read, IH_LEVEL) < 0) {
+	logit(LOG_WARNING, errno, "Failed subscribing to route changes, polling");
+	close(notify_socket);
+	notify_socket = -1;
+    }
+
     return 0;
 }
 
+static void rpf_flush(void)
+{
+    struct rpf_entry *entry, *next;
+    uint32_t i;
+
+    for (i = 0; i < rpf_hash_size; i++) {
+	for (entry = rpf_hash[i]; entry; entry = next) {
+	    next = entry->next;
+	    free(entry);
+	}
+	rpf_hash[i] = NULL;
+    }
+    rpf_count = 0;
+}
+
 void routesock_clean(void)
 {
-    if (routing_socket > 0)
+    if (notify_socket >= 0) {
+	deregister_input_handler(notify_socket);
+	close(notify_socket);
+    }
+    notify_socket = -1;
+
+    if (routing_socket > 0) {
+	deregister_input_handler(routing_socket);
 	close(routing_socket);
+    }
     routing_socket = 0;
+
+    /* The vif indexes may change */
+    rpf_flush();
+    rpf_queue_len     = 0;
+    rpf_ninflight     = 0;
+    memset(rpf_inflight, 0, sizeof(rpf_inflight));
+    rpf_changes_len   = 0;
+    rpf_flush_pending = 0;	/* timer_exit() dropped rpf_flush_cb() */
+    rpf_nprefixes     = 0;
+    rpf_all_changed   = 0;
 }
 
-/* get the rpf neighbor info */
-int k_req_incoming(uint32_t source, struct rpfctl *rpf)
+/* TRUE if the kernel tells us about unicast route changes */
+int k_route_notify(void)
+{
+    return notify_socket != -1;
+}
+
+static uint32_t rpf_hash_fn(uint32_t source)
+{
+    return addr_hash(source) & (rpf_hash_size - 1);
+}
+
+static struct rpf_entry *rpf_find(uint32_t source)
+{
+    struct rpf_entry *entry;
+
+    if (!rpf_hash)
+	return NULL;
+
+    for (entry = rpf_hash[rpf_hash_fn(source)]; entry; entry = entry->next) {
+	if (entry->source == source)
+	    return entry;
+    }
+
+    return NULL;
+}
+
+static void rpf_to_entry(struct rpf_entry *entry, struct rpfctl *rpf, int found)
+{
+    entry->rpfneighbor = rpf->rpfneighbor.s_addr;
+    entry->iif         = rpf->iif;
+    entry->found       = found ? TRUE : FALSE;
+    entry->stale       = FALSE;
+    entry->used        = TRUE;
+}
+
+static int rpf_from_entry(struct rpf_entry *entry, struct rpfctl *rpf)
+{
+    rpf->source.s_addr      = entry->source;
+    rpf->rpfneighbor.s_addr = entry->rpfneighbor;
+    rpf->iif                = entry->iif;
+
+    return entry->found;
+}
+
+static int grow(uint32_t **array, size_t *max)
+{
+    size_t num = *max ? *max * 2 : 64;
+    uint32_t *ptr;
+
+    ptr = realloc(*array, num * sizeof(uint32_t));
+    if (!ptr)
+	return -1;
+
+    *array = ptr;
+    *max   = num;
+
+    return 0;
+}
+
+static void rpf_flush_cb(void *arg __attribute__((unused)))
+{
+    size_t i;
+
+    /* rpf_changed() may look up, and add, more changes, handled here too */
+    for (i = 0; i < rpf_changes_len; i++)
+	rpf_changed(rpf_changes[i]);
+
+    rpf_changes_len   = 0;
+    rpf_flush_pending = 0;
+}
+
+/* Remember a source with changed RPF, handled on the next turn of the main loop */
+static void rpf_change(uint32_t source)
+{
+    if (rpf_changes_len == rpf_changes_max && grow(&rpf_changes, &rpf_changes_max)) {
+	logit(LOG_ERR, 0, "Ran out of memory in rpf_change()");
+	return;
+    }
+    rpf_changes[rpf_changes_len++] = source;
+    rpf_stats.changes++;
+
+    if (!rpf_flush_pending) {
+	rpf_flush_pending = 1;
+	timer_set(0, rpf_flush_cb, NULL);
+    }
+}
+
+/* Room for all known sources, and RPs, with some to spare */
+static size_t rpf_cache_max(void)
+{
+    size_t max = 2 * srcentry_pool.inuse;
+
+    return max > RPF_CACHE_MAX ? max : RPF_CACHE_MAX;
+}
+
+/*
+ * Free one entry, the second chance algorithm: sweep the hash table
+ * from where the last call stopped, skip and clear entries used since
+ * the last pass, free the first stale or unused one.  Entries with a
+ * lookup queued or in flight stay, see rpf_queue_lookup().
+ */
+static void rpf_evict(void)
+{
+    struct rpf_entry **pp, *entry;
+    uint32_t n;
+
+    for (n = 0; n <= 2 * rpf_hash_size; n++) {
+	for (pp = &rpf_hash[rpf_hand]; (entry = *pp); pp = &entry->next) {
+	    if (entry->queued)
+		continue;
+
+	    if (entry->stale || !entry->used) {
+		*pp = entry->next;
+		free(entry);
+		rpf_count--;
+		rpf_stats.evicted++;
+		return;
+	    }
+	    entry->used = FALSE;
+	}
+
+	rpf_hand = (rpf_hand + 1) & (rpf_hash_size - 1);
+    }
+}
+
+/* Double the hash table, returns -1 if out of memory */
+static int rpf_grow(void)
+{
+    struct rpf_entry **tbl, *entry, *next;
+    uint32_t size, i;
+
+    size = rpf_hash_size ? rpf_hash_size * 2 : RPF_HASH_MIN;
+    tbl = calloc(size, sizeof(*tbl));
+    if (!tbl)
+	return -1;
+
+    for (i = 0; i < rpf_hash_size; i++) {
+	for (entry = rpf_hash[i]; entry; entry = next) {
+	    next = entry->next;
+	    entry->next = tbl[addr_hash(entry->source) & (size - 1)];
+	    tbl[addr_hash(entry->source) & (size - 1)] = entry;
+	}
+    }
+
+    free(rpf_hash);
+    rpf_hash      = tbl;
+    rpf_hash_size = size;
+    rpf_hand      = 0;
+
+    return 0;
+}
+
+/* Add a cache entry for @source, without a result yet */
+static struct rpf_entry *rpf_add(uint32_t source)
+{
+    struct rpf_entry *entry;
+
+    if (rpf_count >= rpf_cache_max())
+	rpf_evict();
+
+    if (rpf_count >= rpf_hash_size && rpf_grow() && !rpf_hash) {
+	logit(LOG_ERR, 0, "Ran out of memory in rpf_add()");
+	return NULL;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+	logit(LOG_ERR, 0, "Ran out of memory in rpf_add()");
+	return NULL;
+    }
+
+    entry->source = source;
+    entry->iif    = NO_VIF;
+    entry->stale  = TRUE;
+    entry->used   = TRUE;
+    entry->next   = rpf_hash[rpf_hash_fn(source)];
+    rpf_hash[rpf_hash_fn(source)] = entry;
+    rpf_count++;
+
+    return entry;
+}
+
+/* Update, or add, the cache entry and note if the result changed */
+static void rpf_update(uint32_t source, struct rpfctl *rpf, int found)
+{
+    struct rpf_entry *entry;
+
+    entry = rpf_find(source);
+    if (!entry) {
+	entry = rpf_add(source);
+	if (entry)
+	    rpf_to_entry(entry, rpf, found);
+	return;
+    }
+
+    if (entry->found != (found ? TRUE : FALSE) || entry->iif != rpf->iif ||
+	entry->rpfneighbor != rpf->rpfneighbor.s_addr)
+	rpf_change(source);
+
+    rpf_to_entry(entry, rpf, found);
+}
+
+static void rpf_request(struct nlmsghdr *n, size_t len, uint32_t source)
 {
-    int l, rlen;
-    char buf[512];
-    struct nlmsghdr *n = (struct nlmsghdr *)buf;
     struct rtmsg *r = NLMSG_DATA(n);
-    struct sockaddr_nl addr;
-    
-    rpf->source.s_addr      = source;
-    rpf->iif                = NO_VIF;     /* Initialize, will be changed in kernel */
-    rpf->rpfneighbor.s_addr = INADDR_ANY; /* Initialize */
-    
+
     n->nlmsg_type = RTM_GETROUTE;
     n->nlmsg_flags = NLM_F_REQUEST;
     n->nlmsg_len = NLMSG_LENGTH(sizeof(*r));
     n->nlmsg_pid = pid;
     n->nlmsg_seq = ++seq;
-    
+
     memset(r, 0, sizeof(*r));
     r->rtm_family = AF_INET;
     r->rtm_dst_len = 32;
-    addattr32(n, sizeof(buf), RTA_DST, rpf->source.s_addr);
+    addattr32(n, len, RTA_DST, source);
 #ifdef CONFIG_RTNL_OLD_IFINFO
     r->rtm_optlen = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
 #endif
+}
+
+/* Send queued lookups, without waiting for the replies */
+static void rpf_send(void)
+{
+    struct sockaddr_nl addr;
+    char buf[128];
+    struct nlmsghdr *n = (struct nlmsghdr *)buf;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    while (rpf_queue_len > 0 && rpf_ninflight < RPF_INFLIGHT) {
+	uint32_t source = rpf_queue[rpf_queue_len - 1];
+	int i;
+
+	rpf_request(n, sizeof(buf), source);
+	if (sendto(routing_socket, buf, n->nlmsg_len, MSG_DONTWAIT,
+		   (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		logit(LOG_WARNING, errno, "Error writing to netlink socket");
+	    break;
+	}
+
+	for (i = 0; i < RPF_INFLIGHT; i++) {
+	    if (rpf_inflight[i].seq)
+		continue;
+
+	    rpf_inflight[i].seq    = n->nlmsg_seq;
+	    rpf_inflight[i].source = source;
+	    rpf_inflight[i].sent   = virtual_time;
+	    break;
+	}
+	rpf_ninflight++;
+	rpf_queue_len--;
+	rpf_stats.async++;
+    }
+}
+
+/*
+ * Queue an asynchronous lookup of @source, unless one is already queued
+ * or in flight.  Sources not in the cache get an entry to track that,
+ * it is stale until the reply arrives.
+ */
+static void rpf_queue_lookup(uint32_t source)
+{
+    struct rpf_entry *entry;
+
+    entry = rpf_find(source);
+    if (!entry)
+	entry = rpf_add(source);
+    if (!entry)
+	return;
+
+    entry->stale = TRUE;
+    if (entry->queued)
+	return;
+
+    if (rpf_queue_len == rpf_queue_max && grow(&rpf_queue, &rpf_queue_max)) {
+	logit(LOG_ERR, 0, "Ran out of memory in rpf_queue_lookup()");
+	return;
+    }
+    rpf_queue[rpf_queue_len++] = source;
+    entry->queued = TRUE;
+}
+
+/* The lookup of @source is no longer queued or in flight */
+static void rpf_dequeued(uint32_t source)
+{
+    struct rpf_entry *entry;
+
+    entry = rpf_find(source);
+    if (entry)
+	entry->queued = FALSE;
+}
+
+/*
+ * Free the slot of a lookup in flight and queue it again, its reply is
+ * lost.  It is sent by the next rpf_send(), not here, k_req_incoming()
+ * and nl_talk() may be waiting for a reply with the current seq.
+ */
+static void rpf_lost(int i)
+{
+    rpf_dequeued(rpf_inflight[i].source);
+    rpf_queue_lookup(rpf_inflight[i].source);
+    rpf_inflight[i].seq = 0;
+    rpf_ninflight--;
+    rpf_stats.lost++;
+}
+
+/* The socket buffer overflowed, any of the replies in flight may be lost */
+static void rpf_lost_all(void)
+{
+    int i;
+
+    for (i = 0; i < RPF_INFLIGHT; i++) {
+	if (rpf_inflight[i].seq)
+	    rpf_lost(i);
+    }
+}
+
+/*
+ * Called periodically, ask again for lookups without a reply for too
+ * long.  Otherwise each lost reply would hold on to its slot for good.
+ */
+void k_rpf_age(void)
+{
+    int i;
+
+    for (i = 0; rpf_ninflight > 0 && i < RPF_INFLIGHT; i++) {
+	if (rpf_inflight[i].seq && virtual_time - rpf_inflight[i].sent >= RPF_TIMEOUT)
+	    rpf_lost(i);
+    }
+
+    if (routing_socket > 0)
+	rpf_send();
+}
+
+static int rpf_match(uint32_t addr)
+{
+    int i;
+
+    if (rpf_all_changed)
+	return TRUE;
+
+    for (i = 0; i < rpf_nprefixes; i++) {
+	if ((addr & rpf_prefixes[i].mask) == rpf_prefixes[i].addr)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Look up all sources and RPs in the changed prefixes again, and mark
+ * any other cached entries in them stale.
+ */
+static void rpf_invalidate(void)
+{
+    struct rpf_entry *entry;
+    cand_rp_t *cand_rp;
+    srcentry_t *src;
+    uint32_t i;
+
+    if (!rpf_nprefixes && !rpf_all_changed)
+	return;
+
+    for (src = srclist; src; src = src->next) {
+	if (src->address != INADDR_ANY_N && rpf_match(src->address))
+	    rpf_queue_lookup(src->address);
+    }
+
+    for (cand_rp = cand_rp_list; cand_rp; cand_rp = cand_rp->next) {
+	if (rpf_match(cand_rp->rpentry->address))
+	    rpf_queue_lookup(cand_rp->rpentry->address);
+    }
+
+    for (i = 0; i < rpf_hash_size; i++) {
+	for (entry = rpf_hash[i]; entry; entry = entry->next) {
+	    if (rpf_match(entry->source))
+		entry->stale = TRUE;
+	}
+    }
+
+    rpf_nprefixes   = 0;
+    rpf_all_changed = 0;
+
+    rpf_send();
+}
+
+/* Route change notification, collect the changed prefixes */
+static void notify_read(int sd)
+{
+    char buf[8192];
+    ssize_t len;
+    int i;
+
+    for (i = 0; i < IH_BATCH; i++) {
+	struct nlmsghdr *n;
+
+	len = recv(sd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == ENOBUFS) {
+		/* Lost notifications, look up everything again */
+		rpf_all_changed = 1;
+		continue;
+	    }
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		logit(LOG_WARNING, errno, "Error reading from netlink socket");
+	    break;
+	}
+
+	for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, (size_t)len); n = NLMSG_NEXT(n, len)) {
+	    struct rtattr *rta[RTA_MAX + 1];
+	    struct rtmsg *rtm;
+	    uint32_t addr = 0, mask;
+
+	    if (n->nlmsg_type != RTM_NEWROUTE && n->nlmsg_type != RTM_DELROUTE)
+		continue;
+
+	    rtm = NLMSG_DATA(n);
+	    if (rtm->rtm_family != AF_INET || (rtm->rtm_flags & RTM_F_CLONED))
+		continue;
+
+	    rpf_stats.notifications++;
+	    memset(rta, 0, sizeof(rta));
+	    parse_rtattr(rta, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(n));
+	    if (rta[RTA_DST])
+		memcpy(&addr, RTA_DATA(rta[RTA_DST]), sizeof(addr));
+
+	    mask = rtm->rtm_dst_len ? htonl(0xffffffff << (32 - rtm->rtm_dst_len)) : 0;
+	    if (rpf_nprefixes >= RPF_PREFIX_MAX || !mask) {
+		rpf_all_changed = 1;
+		continue;
+	    }
+
+	    rpf_prefixes[rpf_nprefixes].addr = addr & mask;
+	    rpf_prefixes[rpf_nprefixes].mask = mask;
+	    rpf_nprefixes++;
+	}
+    }
+
+    rpf_invalidate();
+}
+
+/* Handle a reply to an asynchronous lookup */
+static void rpf_reply(struct nlmsghdr *n, size_t len)
+{
+    struct rpfctl rpf;
+    uint32_t source;
+    int i, found = FALSE;
+
+    if (n->nlmsg_pid != pid)
+	return;
+
+    for (i = 0; i < RPF_INFLIGHT; i++) {
+	if (rpf_inflight[i].seq == n->nlmsg_seq)
+	    break;
+    }
+    if (i == RPF_INFLIGHT)
+	return;
+
+    source = rpf_inflight[i].source;
+    rpf_inflight[i].seq = 0;
+    rpf_ninflight--;
+    rpf_dequeued(source);
+
+    rpf.source.s_addr      = source;
+    rpf.iif                = NO_VIF;
+    rpf.rpfneighbor.s_addr = INADDR_ANY;
+    if (n->nlmsg_type == RTM_NEWROUTE)
+	found = getmsg(NLMSG_DATA(n), len - sizeof(*n), &rpf);
+
+    rpf_update(source, &rpf, found);
+}
+
+/* Replies to asynchronous lookups */
+static void routesock_read(int sd)
+{
+    char buf[4096];
+    ssize_t len;
+    int i;
+
+    for (i = 0; i < IH_BATCH; i++) {
+	struct nlmsghdr *n;
+
+	len = recv(sd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == ENOBUFS) {
+		rpf_lost_all();
+		continue;
+	    }
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		logit(LOG_WARNING, errno, "Error reading from netlink socket");
+	    break;
+	}
+
+	for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, (size_t)len); n = NLMSG_NEXT(n, len))
+	    rpf_reply(n, n->nlmsg_len);
+    }
+
+    rpf_send();
+}
+
+/* get the rpf neighbor info */
+int k_req_incoming(uint32_t source, struct rpfctl *rpf)
+{
+    int l, rlen, found, tries = 0;
+    char buf[512];
+    struct nlmsghdr *n = (struct nlmsghdr *)buf;
+    struct sockaddr_nl addr;
+    struct rpf_entry *entry;
+
+    rpf->source.s_addr      = source;
+    rpf->iif                = NO_VIF;     /* Initialize, will be changed in kernel */
+    rpf->rpfneighbor.s_addr = INADDR_ANY; /* Initialize */
+
+    entry = rpf_find(source);
+    if (entry && !entry->stale && notify_socket != -1) {
+	entry->used = TRUE;
+	rpf_stats.hits++;
+	return rpf_from_entry(entry, rpf);
+    }
+    rpf_stats.misses++;
+
+retry:
+    rpf_request(n, sizeof(buf), source);
     addr.nl_family = AF_NETLINK;
     addr.nl_groups = 0;
     addr.nl_pid = 0;
-    
+
     if (!IN_LINK_LOCAL_RANGE(rpf->source.s_addr)) {
 	IF_DEBUG(DEBUG_RPF)
 	    logit(LOG_DEBUG, 0, "k_req_incoming: ask path to %s", inet_fmt(rpf->source.s_addr, s1, sizeof(s1)));
@@ -154,19 +812,33 @@ int k_req_incoming(uint32_t source, struct rpfctl *rpf)
 	}
     } while (rlen < 0);
 
-    do {
+    /* Replies to asynchronous lookups may arrive before ours */
+    while (1) {
 	socklen_t alen = sizeof(addr);
 
 	l = recvfrom(routing_socket, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &alen);
 	if (l < 0) {
 	    if (errno == EINTR)
 		continue;	/* Received signal, retry syscall. */
+	    if (errno == ENOBUFS)
+		rpf_lost_all();	/* Ours may be lost as well */
+
+	    /* Lost, or timed out, see init_routesock() */
+	    if ((errno == ENOBUFS || errno == EAGAIN || errno == EWOULDBLOCK) &&
+		++tries < RPF_RETRIES)
+		goto retry;
 
 	    logit(LOG_WARNING, errno, "Error reading from netlink socket");
 	    return FALSE;
 	}
-    } while (n->nlmsg_seq != seq || n->nlmsg_pid != pid);
-    
+
+	if (n->nlmsg_seq == seq && n->nlmsg_pid == pid)
+	    break;
+
+	if (NLMSG_OK(n, (size_t)l))
+	    rpf_reply(n, l);
+    }
+
     if (n->nlmsg_type != RTM_NEWROUTE) {
 	errno = -(*(int*)NLMSG_DATA(n));
 
@@ -178,10 +850,160 @@ int k_req_incoming(uint32_t source, struct rpfctl *rpf)
 		      inet_fmt(rpf->source.s_addr, s1, sizeof(s1)));
 	}
 
+	rpf_update(source, rpf, FALSE);
 	return FALSE;
     }
 
-    return getmsg(NLMSG_DATA(n), l - sizeof(*n), rpf);
+    found = getmsg(NLMSG_DATA(n), l - sizeof(*n), rpf);
+    rpf_update(source, rpf, found);
+
+    return found;
+}
+
+/*
+ * Send a request and wait for the kernel to ACK it.  Replies to
+ * asynchronous RPF lookups arriving in the meantime are handled.
+ * Returns 0, or -1 and sets errno.
+ */
+static int nl_talk(struct nlmsghdr *n)
+{
+    struct sockaddr_nl addr;
+    char buf[1024];
+    ssize_t len;
+
+    n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    n->nlmsg_pid = pid;
+    n->nlmsg_seq = ++seq;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    while (sendto(routing_socket, n, n->nlmsg_len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	if (errno != EINTR)
+	    return -1;
+    }
+
+    while (1) {
+	struct nlmsghdr *r;
+
+	len = recv(routing_socket, buf, sizeof(buf), 0);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == ENOBUFS)
+		rpf_lost_all();	/* Ours may be lost as well */
+	    return -1;
+	}
+
+	for (r = (struct nlmsghdr *)buf; NLMSG_OK(r, (size_t)len); r = NLMSG_NEXT(r, len)) {
+	    if (r->nlmsg_seq != n->nlmsg_seq || r->nlmsg_pid != pid) {
+		rpf_reply(r, r->nlmsg_len);
+		continue;
+	    }
+
+	    if (r->nlmsg_type == NLMSG_ERROR) {
+		struct nlmsgerr *err = NLMSG_DATA(r);
+
+		if (!err->error)
+		    return 0;
+
+		errno = -err->error;
+		return -1;
+	    }
+	}
+    }
+}
+
+/*
+ * IP-in-IP tunnels for kernel register encapsulation, see kern.c.  The
+ * attributes are from <linux/if_tunnel.h>, which cannot be included
+ * together with <netinet/in.h>.
+ */
+#define IPTUN_REMOTE	3	/* IFLA_IPTUN_REMOTE   */
+#define IPTUN_TTL	4	/* IFLA_IPTUN_TTL      */
+#define IPTUN_PMTUDISC	10	/* IFLA_IPTUN_PMTUDISC */
+
+/* Bring up an existing interface, returns its ifindex or -1 */
+static int link_up(const char *ifname)
+{
+    char buf[256];
+    struct nlmsghdr *n = (struct nlmsghdr *)buf;
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+    memset(buf, 0, sizeof(buf));
+    n->nlmsg_type = RTM_NEWLINK;
+    n->nlmsg_len  = NLMSG_LENGTH(sizeof(*ifi));
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_flags  = IFF_UP;
+    ifi->ifi_change = IFF_UP;
+    addattr_l(n, sizeof(buf), IFLA_IFNAME, ifname, strlen(ifname) + 1);
+
+    if (nl_talk(n))
+	return -1;
+
+    return if_nametoindex(ifname);
+}
+
+/*
+ * Create, and bring up, the tunnel @ifname to @remote.  With @remote
+ * INADDR_ANY the catch-all tunl0 is brought up instead, creating any
+ * ipip device loads the driver which then sets up tunl0 itself.
+ * Returns the ifindex of the tunnel, or -1 and sets errno.
+ */
+int k_tunnel_add(const char *ifname, uint32_t remote)
+{
+    char buf[512];
+    struct nlmsghdr *n = (struct nlmsghdr *)buf;
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    struct rtattr *linkinfo, *data;
+    uint8_t ttl = MAXTTL, pmtudisc = 1;
+
+    memset(buf, 0, sizeof(buf));
+    n->nlmsg_type  = RTM_NEWLINK;
+    n->nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+    n->nlmsg_len   = NLMSG_LENGTH(sizeof(*ifi));
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_flags  = IFF_UP;
+    ifi->ifi_change = IFF_UP;
+
+    addattr_l(n, sizeof(buf), IFLA_IFNAME, ifname, strlen(ifname) + 1);
+    linkinfo = addattr_l(n, sizeof(buf), IFLA_LINKINFO, NULL, 0);
+    addattr_l(n, sizeof(buf), IFLA_INFO_KIND, "ipip", 4);
+    if (remote != INADDR_ANY) {
+	data = addattr_l(n, sizeof(buf), IFLA_INFO_DATA, NULL, 0);
+	addattr32(n, sizeof(buf), IPTUN_REMOTE, remote);
+	addattr_l(n, sizeof(buf), IPTUN_TTL, &ttl, sizeof(ttl));
+	addattr_l(n, sizeof(buf), IPTUN_PMTUDISC, &pmtudisc, sizeof(pmtudisc));
+	addattr_nest_end(n, data);
+    }
+    addattr_nest_end(n, linkinfo);
+
+    if (nl_talk(n)) {
+	if (errno != EEXIST)
+	    return -1;
+
+	/* Left behind by a previous run, or tunl0 */
+	return link_up(ifname);
+    }
+
+    return if_nametoindex(ifname);
+}
+
+/* Remove a tunnel created by k_tunnel_add() */
+void k_tunnel_del(int ifindex)
+{
+    char buf[128];
+    struct nlmsghdr *n = (struct nlmsghdr *)buf;
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+    memset(buf, 0, sizeof(buf));
+    n->nlmsg_type  = RTM_DELLINK;
+    n->nlmsg_len   = NLMSG_LENGTH(sizeof(*ifi));
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index  = ifindex;
+
+    if (nl_talk(n))
+	logit(LOG_WARNING, errno, "Failed removing tunnel, ifindex %d", ifindex);
 }
 
 static int getmsg(struct rtmsg *rtm, int msglen, struct rpfctl *rpf)
@@ -38,7 +38,7 @@
 /*
  * Exported variables.
  */
-char	*pim_recv_buf;		/* input packet buffer   */
+struct rxring pim_rx;		/* input packet buffers  */
 char	*pim_send_buf;		/* output packet buffer  */
 
 uint32_t	allpimrouters_group;	/* ALL_PIM_ROUTERS address in net order */
@@ -59,7 +59,7 @@ static uint16_t ip_id = 0;
  * Local function definitions.
  */
 static void pim_read   (int sd);
-static void accept_pim (ssize_t recvlen);
+static void accept_pim (char *buf, ssize_t recvlen);
 static int  send_frame (char *buf, size_t len, size_t frag, size_t mtu, struct sockaddr *dst, size_t salen);
 
 /*
@@ -86,19 +86,15 @@ void init_pim(void)
 
     allpimrouters_group = htonl(INADDR_ALL_PIM_ROUTERS);
 
-    if (!pim_recv_buf)
-	pim_recv_buf = malloc(RECV_BUF_SIZE);
-
     if (!pim_send_buf)
 	pim_send_buf = malloc(SEND_BUF_SIZE);
 
-    if (!pim_recv_buf || !pim_send_buf) {
+    if (!pim_send_buf || k_rx_init(pim_socket, &pim_rx)) {
 	logit(LOG_ERR, 0, "Ran out of memory in init_pim()");
 	close(pim_socket);
 	return;
     }
 
-    memset(pim_recv_buf, 0, RECV_BUF_SIZE);
     memset(pim_send_buf, 0, SEND_BUF_SIZE);
 
     /* One time setup in the buffers */
@@ -111,56 +107,34 @@ void init_pim(void)
     ip->ip_p     = IPPROTO_PIM;
     ip->ip_sum   = 0;	 /* let kernel fill in */
 
-    if (register_input_handler(pim_socket, pim_read) < 0)
+    if (register_input_handler(pim_socket, pim_read, IH_LEVEL) < 0)
 	logit(LOG_ERR, 0,  "Failed registering pim_read() as an input handler");
-
-    /* Clean-up the join-prune message pool before re-initializing it */
-    while ( build_jp_message_pool != NULL )
-    {
-	free(build_jp_message_pool->jp_message);
-	free(build_jp_message_pool->join_list);
-	free(build_jp_message_pool->prune_list);
-	free(build_jp_message_pool->rp_list_join);
-	free(build_jp_message_pool->rp_list_prune);
-
-	build_jp_message_t *bjpm = build_jp_message_pool;
-	build_jp_message_pool = build_jp_message_pool->next;
-
-	free(bjpm);
-    }
-
-    /* Initialize the building Join/Prune messages working area */
-    build_jp_message_pool = (build_jp_message_t *)NULL;
-    build_jp_message_pool_counter = 0;
 }
 
 
-/* Read a PIM message from the pim_socket */
+/* Read a batch of PIM messages from the pim_socket */
 static void pim_read(int sd)
 {
-    ssize_t len;
-    socklen_t dummy = 0;
     sigset_t block, oblock;
+    int i, num;
 
-    while ((len = recvfrom(sd, pim_recv_buf, RECV_BUF_SIZE, 0, NULL, &dummy)) < 0) {
-	if (errno == EINTR)
-	    continue;		/* Received signal, retry syscall. */
-
-	logit(LOG_ERR, errno, "Failed recvfrom() in pim_read()");
+    /* Any remaining packets are read on the next turn of the main loop */
+    num = k_recv_batch(sd, &pim_rx);
+    if (!num)
 	return;
-    }
 
     sigemptyset(&block);
     sigaddset(&block, SIGALRM);
     if (sigprocmask(SIG_BLOCK, &block, &oblock) < 0)
 	logit(LOG_ERR, errno, "sigprocmask");
 
-    accept_pim(len);
+    for (i = 0; i < num; i++)
+	accept_pim(pim_rx.msg[i].buf, pim_rx.msg[i].len);
 
     sigprocmask(SIG_SETMASK, &oblock, (sigset_t *)NULL);
 }
 
-static void accept_pim(ssize_t recvlen)
+static void accept_pim(char *buf, ssize_t recvlen)
 {
     uint32_t src, dst;
     struct ip *ip;
@@ -173,12 +147,12 @@ static void accept_pim(ssize_t recvlen)
 	return;
     }
 
-    ip		= (struct ip *)pim_recv_buf;
+    ip		= (struct ip *)buf;
     src		= ip->ip_src.s_addr;
     dst		= ip->ip_dst.s_addr;
     iphdrlen	= ip->ip_hl << 2;
 
-    pim		= (pim_header_t *)(pim_recv_buf + iphdrlen);
+    pim		= (pim_header_t *)(buf + iphdrlen);
     pimlen	= recvlen - iphdrlen;
 
     /* Sanity check packet length */
@@ -247,22 +221,25 @@ static void accept_pim(ssize_t recvlen)
 
 
 /*
- * Send a multicast PIM packet from src to dst, PIM message type = "type"
- * and data length (after the PIM header) = "len"
+ * Prepare the IP and PIM headers of a multicast PIM packet in buf, with
+ * data length (after the PIM header) = "len".  Returns the length of the
+ * whole packet.
  */
-void send_pim(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
+static int pim_mcast_hdr(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
 {
-    struct sockaddr_in sin;
     struct ip *ip;
     pim_header_t *pim;
     int sendlen = sizeof(struct ip) + sizeof(pim_header_t) + len;
-    int setloop = 0;
-    char source[20], dest[20];
 
-    /* Prepare the IP header */
+    /* Prepare the IP header, the whole of it since buf may be anywhere */
     ip                 = (struct ip *)buf;
+    ip->ip_v           = IPVERSION;
+    ip->ip_hl          = (sizeof(struct ip) >> 2);
+    ip->ip_tos         = 0;
     ip->ip_id	       = htons(++ip_id);
     ip->ip_off         = 0;
+    ip->ip_p           = IPPROTO_PIM;
+    ip->ip_sum         = 0;	/* let kernel fill in */
     ip->ip_src.s_addr  = src;
     ip->ip_dst.s_addr  = dst;
     ip->ip_ttl         = MAXTTL;            /* applies to unicast only */
@@ -271,6 +248,10 @@ void send_pim(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
 #else
     ip->ip_len         = htons(sendlen);
 #endif
+#ifdef RAW_OUTPUT_IS_RAW
+    if (IN_MULTICAST(ntohl(dst)))
+	ip->ip_ttl = curttl;
+#endif /* RAW_OUTPUT_IS_RAW */
 
     /* Prepare the PIM packet */
     pim		       = (pim_header_t *)(buf + sizeof(struct ip));
@@ -283,22 +264,69 @@ void send_pim(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
      * encapsulated packet from the checsum. */
     pim->pim_cksum     = inet_cksum((uint16_t *)pim, sizeof(pim_header_t) + len);
 
-    if (IN_MULTICAST(ntohl(dst))) {
-	k_set_if(pim_socket, src);
-	if ((dst == allhosts_group) ||
-	    (dst == allrouters_group) ||
-	    (dst == allpimrouters_group) ||
-	    (dst == allreports_group)) {
-	    setloop = 1;
-	    k_set_loop(pim_socket, TRUE);
-	}
-#ifdef RAW_OUTPUT_IS_RAW
-	ip->ip_ttl = curttl;
-    } else {
-	ip->ip_ttl = MAXTTL;
-#endif /* RAW_OUTPUT_IS_RAW */
+    return sendlen;
+}
+
+/* Outbound interface and loopback for a multicast send, returns setloop */
+static int pim_mcast_if(uint32_t src, uint32_t dst)
+{
+    if (!IN_MULTICAST(ntohl(dst)))
+	return 0;
+
+    k_set_if(pim_socket, src);
+    if ((dst == allhosts_group) ||
+	(dst == allrouters_group) ||
+	(dst == allpimrouters_group) ||
+	(dst == allreports_group)) {
+	k_set_loop(pim_socket, TRUE);
+	return 1;
     }
 
+    return 0;
+}
+
+/* Log, or act on, a failed send, except EINTR which callers retry */
+static void pim_send_error(uint32_t src, uint32_t dst)
+{
+    char source[20], dest[20];
+
+    switch (errno) {
+	case ENETDOWN:
+	case ENETUNREACH:
+	case ENODEV:
+	    check_vif_state();
+	    break;
+
+	case EPERM:
+	case EHOSTUNREACH:
+	    logit(LOG_WARNING, 0, "Not allowed to send PIM message from %s to %s, possibly firewall"
+#ifdef __linux__
+		  ", or SELinux policy violation,"
+#endif
+		  " related problem.",
+		  inet_fmt(src, source, sizeof(source)), inet_fmt(dst, dest, sizeof(dest)));
+	    break;
+
+	default:
+	    logit(LOG_WARNING, errno, "sendto from %s to %s",
+		  inet_fmt(src, source, sizeof(source)), inet_fmt(dst, dest, sizeof(dest)));
+	    break;
+    }
+}
+
+/*
+ * Send a multicast PIM packet from src to dst, PIM message type = "type"
+ * and data length (after the PIM header) = "len"
+ */
+void send_pim(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
+{
+    struct sockaddr_in sin;
+    int sendlen, setloop;
+    char source[20], dest[20];
+
+    sendlen = pim_mcast_hdr(buf, src, dst, type, len);
+    setloop = pim_mcast_if(src, dst);
+
     memset(&sin, 0, sizeof(sin));
     sin.sin_family = AF_INET;
     sin.sin_addr.s_addr = dst;
@@ -307,32 +335,10 @@ void send_pim(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
 #endif
 
     while (sendto(pim_socket, buf, sendlen, 0, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
-	switch (errno) {
-	    case EINTR:
-		continue; /* Received signal, retry syscall. */
-
-	    case ENETDOWN:
-	    case ENETUNREACH:
-	    case ENODEV:
-		check_vif_state();
-		break;
-
-	    case EPERM:
-	    case EHOSTUNREACH:
-		logit(LOG_WARNING, 0, "Not allowed to send PIM message from %s to %s, possibly firewall"
-#ifdef __linux__
-		      ", or SELinux policy violation,"
-#endif
-		      " related problem.",
-		      inet_fmt(src, source, sizeof(source)), inet_fmt(dst, dest, sizeof(dest)));
-		break;
-
-	    default:
-		logit(LOG_WARNING, errno, "sendto from %s to %s",
-		      inet_fmt(src, source, sizeof(source)), inet_fmt(dst, dest, sizeof(dest)));
-		break;
-	}
+	if (errno == EINTR)
+	    continue; /* Received signal, retry syscall. */
 
+	pim_send_error(src, dst);
 	if (setloop)
 	    k_set_loop(pim_socket, FALSE);
 
@@ -352,23 +358,94 @@ void send_pim(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
     }
 }
 
-
-/* TODO: This can be merged with the above procedure */
 /*
- * Send an unicast PIM packet from src to dst, PIM message type = "type"
- * and data length (after the PIM common header) = "len"
+ * Send num multicast PIM packets of the same type from src to dst in
+ * one go, with sendmmsg() where available.  Like send_pim(), each buf
+ * has room for the IP and PIM headers before the len bytes of data.
  */
-void send_pim_unicast(char *buf, int mtu, uint32_t src, uint32_t dst, int type, size_t len)
+void send_pim_batch(char *buf[], size_t len[], int num, uint32_t src, uint32_t dst, int type)
 {
     struct sockaddr_in sin;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgv[PIM_SEND_BATCH];
+#endif
+    struct iovec iov[PIM_SEND_BATCH];
+    int i, setloop;
+
+    if (num > PIM_SEND_BATCH)
+	num = PIM_SEND_BATCH;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = dst;
+#ifdef HAVE_SA_LEN
+    sin.sin_len = sizeof(sin);
+#endif
+
+    for (i = 0; i < num; i++) {
+	iov[i].iov_base = buf[i];
+	iov[i].iov_len  = pim_mcast_hdr(buf[i], src, dst, type, len[i]);
+#ifdef HAVE_SENDMMSG
+	memset(&msgv[i], 0, sizeof(msgv[i]));
+	msgv[i].msg_hdr.msg_name    = &sin;
+	msgv[i].msg_hdr.msg_namelen = sizeof(sin);
+	msgv[i].msg_hdr.msg_iov     = &iov[i];
+	msgv[i].msg_hdr.msg_iovlen  = 1;
+#endif
+    }
+
+    setloop = pim_mcast_if(src, dst);
+
+    i = 0;
+    while (i < num) {
+#ifdef HAVE_SENDMMSG
+	int sent = sendmmsg(pim_socket, &msgv[i], num - i, 0);
+#else
+	int sent = sendto(pim_socket, iov[i].iov_base, iov[i].iov_len, 0,
+			  (struct sockaddr *)&sin, sizeof(sin)) < 0 ? -1 : 1;
+#endif
+
+	if (sent < 0) {
+	    if (errno == EINTR)
+		continue; /* Received signal, retry syscall. */
+
+	    /* Skip the one failing, try the rest */
+	    pim_send_error(src, dst);
+	    sent = 1;
+	}
+	i += sent;
+    }
+
+    if (setloop)
+	k_set_loop(pim_socket, FALSE);
+
+    IF_DEBUG(DEBUG_PIM_DETAIL) {
+	IF_DEBUG(DEBUG_PIM) {
+	    char source[20], dest[20];
+
+	    logit(LOG_DEBUG, 0, "SENT %d x %s from %-15s to %s", num,
+		  packet_kind(IPPROTO_PIM, type, 0),
+		  inet_fmt(src, source, sizeof(source)), inet_fmt(dst, dest, sizeof(dest)));
+	}
+    }
+}
+
+
+/*
+ * Prepare the IP and PIM headers of an unicast PIM packet in buf, with
+ * data length (after the PIM common header) = "len".  Returns the
+ * length of the whole packet.
+ */
+static int pim_unicast_hdr(char *buf, uint32_t src, uint32_t dst, int type, size_t len)
+{
     struct ip *ip;
     pim_header_t *pim;
-    int result, sendlen = sizeof(struct ip) + sizeof(pim_header_t) + len;
-    char source[20], dest[20];
+    int sendlen = sizeof(struct ip) + sizeof(pim_header_t) + len;
 
-    /* Prepare the IP header */
+    /* Prepare the IP header, send_frame() may have left fragment flags */
     ip                 = (struct ip *)buf;
     ip->ip_id	       = htons(++ip_id);
+    ip->ip_off	       = 0;
     ip->ip_src.s_addr  = src;
     ip->ip_dst.s_addr  = dst;
     ip->ip_ttl         = MAXTTL; /* TODO: XXX: setup TTL from the inner mcast packet? */
@@ -394,6 +471,22 @@ void send_pim_unicast(char *buf, int mtu, uint32_t src, uint32_t dst, int type,
         pim->pim_cksum	= inet_cksum((uint16_t *)pim, sizeof(pim_header_t) + len);
     }
 
+    return sendlen;
+}
+
+/*
+ * Send an unicast PIM packet from src to dst, PIM message type = "type"
+ * and data length (after the PIM common header) = "len"
+ */
+void send_pim_unicast(char *buf, int mtu, uint32_t src, uint32_t dst, int type, size_t len)
+{
+    struct sockaddr_in sin;
+    struct ip *ip = (struct ip *)buf;
+    int result, sendlen;
+    char source[20], dest[20];
+
+    sendlen = pim_unicast_hdr(buf, src, dst, type, len);
+
     memset(&sin, 0, sizeof(sin));
     sin.sin_family = AF_INET;
     sin.sin_addr.s_addr = dst;
@@ -435,6 +528,70 @@ void send_pim_unicast(char *buf, int mtu, uint32_t src, uint32_t dst, int type,
 }
 
 
+/*
+ * Send a PIM Register for the data packet "pkt" of length "len", as
+ * received from the kernel in a WHOLEPKT upcall.  Only the Register
+ * headers are built, in pim_send_buf, the data packet is sent from
+ * where it is.  Returns -1 and sets errno on failure, with EMSGSIZE
+ * the caller must copy it to pim_send_buf for send_pim_unicast() to
+ * fragment.
+ */
+int send_pim_register_iov(char *pkt, size_t len, uint32_t src, uint32_t dst)
+{
+    struct sockaddr_in sin;
+    struct msghdr msg;
+    struct iovec iov[2];
+    pim_register_t *reg;
+    char source[20], dest[20];
+
+    reg = (pim_register_t *)(pim_send_buf + sizeof(struct ip) + sizeof(pim_header_t));
+    memset(reg, 0, sizeof(pim_register_t)); /* No flags set */
+    pim_unicast_hdr(pim_send_buf, src, dst, PIM_REGISTER, sizeof(pim_register_t) + len);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = dst;
+#ifdef HAVE_SA_LEN
+    sin.sin_len = sizeof(sin);
+#endif
+
+    iov[0].iov_base = pim_send_buf;
+    iov[0].iov_len  = sizeof(struct ip) + sizeof(pim_header_t) + sizeof(pim_register_t);
+    iov[1].iov_base = pkt;
+    iov[1].iov_len  = len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = &sin;
+    msg.msg_namelen = sizeof(sin);
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 2;
+
+    while (sendmsg(pim_socket, &msg, 0) < 0) {
+	switch (errno) {
+	    case EINTR:
+		continue; /* Received signal, retry syscall. */
+
+	    case EMSGSIZE:
+		return -1;
+
+	    case ENETDOWN:
+	    case ENETUNREACH:
+	    case ENODEV:
+		check_vif_state();
+		return -1;
+
+	    default:
+		logit(LOG_WARNING, errno, "sendmsg from %s to %s",
+		      inet_fmt(src, source, sizeof(source)),
+		      inet_fmt(dst, dest, sizeof(dest)));
+		return -1;
+	}
+    }
+
+    return 0;
+}
+
+
 #if 1
 /*
  * send unicast register frames
@@ -39,6 +39,10 @@ typedef struct {
     uint32_t  dr_prio;
     int8_t    dr_prio_present;
     uint32_t  genid;
+    int8_t    lan_delay_present;
+    int8_t    tbit;
+    uint16_t  prop_delay;
+    uint16_t  override_ivl;
 } pim_hello_opts_t;
 
 /*
@@ -47,12 +51,9 @@ typedef struct {
 static int restart_dr_election     (struct uvif *v);
 static int parse_pim_hello         (char *msg, size_t len, uint32_t src, pim_hello_opts_t *opts);
 static void cache_nbr_settings     (pim_nbr_entry_t *nbr, pim_hello_opts_t *opts);
+static void lan_prune_delay        (struct uvif *v);
 static int send_pim_register_stop  (uint32_t reg_src, uint32_t reg_dst, uint32_t inner_grp, uint32_t inner_source);
-static build_jp_message_t *get_jp_working_buff (void);
-static void return_jp_working_buff (pim_nbr_entry_t *pim_nbr);
-static void pack_jp_message_grp    (pim_nbr_entry_t *pim_nbr);
-static void pack_jp_message_rp     (pim_nbr_entry_t *pim_nbr);
-static void send_jp_message        (pim_nbr_entry_t *pim_nbr);
+static void free_jp_working_buff    (pim_nbr_entry_t *pim_nbr);
 static int compare_metrics         (uint32_t local_preference,
 				    uint32_t local_metric,
 				    uint32_t local_address,
@@ -60,9 +61,6 @@ static int compare_metrics         (uint32_t local_preference,
 				    uint32_t remote_metric,
 				    uint32_t remote_address);
 
-build_jp_message_t *build_jp_message_pool;
-int build_jp_message_pool_counter;
-
 /************************************************************************
  *                        PIM_HELLO
  ************************************************************************/
@@ -168,9 +166,6 @@ int receive_pim_hello(uint32_t src, uint32_t dst __attribute__((unused)), char *
     new_nbr->next             = nbr;
     new_nbr->prev             = prev_nbr;
 
-    /* Add PIM Hello options */
-    cache_nbr_settings(new_nbr, &opts);
-
     /* Add to linked list of neighbors */
     if (prev_nbr)
 	prev_nbr->next  = new_nbr;
@@ -180,6 +175,10 @@ int receive_pim_hello(uint32_t src, uint32_t dst __attribute__((unused)), char *
     if (new_nbr->next)
 	new_nbr->next->prev = new_nbr;
 
+    /* Add PIM Hello options */
+    cache_nbr_settings(new_nbr, &opts);
+    ipc_nbr_event(IPC_EV_ADD, new_nbr);
+
     v->uv_flags &= ~VIFF_NONBRS;
     v->uv_flags |= VIFF_PIM_NBR;
 
@@ -253,6 +252,7 @@ void delete_pim_nbr(pim_nbr_entry_t *nbr_delete)
 
     IF_DEBUG(DEBUG_PIM_HELLO)
 	logit(LOG_INFO, 0, "Deleting PIM neighbor %s", inet_fmt(nbr_delete->address, s1, sizeof(s1)));
+    ipc_nbr_event(IPC_EV_DEL, nbr_delete);
 
     v = &uvifs[nbr_delete->vifi];
 
@@ -269,10 +269,11 @@ void delete_pim_nbr(pim_nbr_entry_t *nbr_delete)
     if (v->uv_pim_neighbor_dr == nbr_delete )
 	v->uv_pim_neighbor_dr = NULL;
 
-    return_jp_working_buff(nbr_delete);
+    free_jp_working_buff(nbr_delete);
 
     /* That neighbor could've been the DR */
     restart_dr_election(v);
+    lan_prune_delay(v);
 
     /* Update the source entries */
     for (src = srclist; src; src = src_next) {
@@ -521,6 +522,17 @@ static int parse_pim_hello(char *msg, size_t len, uint32_t src, pim_hello_opts_t
 		    GET_HOSTSHORT(opts->holdtime, data);
 		break;
 
+	    case PIM_HELLO_LAN_PRUNE_DELAY:
+		result = validate_pim_opt(src, "LAN Prune Delay", PIM_HELLO_LAN_PRUNE_DELAY_LEN, opt_len);
+		if (TRUE == result) {
+		    opts->lan_delay_present = 1;
+		    GET_HOSTSHORT(opts->prop_delay, data);
+		    GET_HOSTSHORT(opts->override_ivl, data);
+		    opts->tbit = (opts->prop_delay & PIM_HELLO_LAN_PRUNE_DELAY_TBIT) != 0;
+		    opts->prop_delay &= ~PIM_HELLO_LAN_PRUNE_DELAY_TBIT;
+		}
+		break;
+
 	    case PIM_HELLO_DR_PRIO:
 		result = validate_pim_opt(src, "DR Priority", PIM_HELLO_DR_PRIO_LEN, opt_len);
 		if (TRUE == result) {
@@ -556,6 +568,53 @@ static void cache_nbr_settings(pim_nbr_entry_t *nbr, pim_hello_opts_t *opts)
     nbr->genid           = opts->genid;
     nbr->dr_prio         = opts->dr_prio;
     nbr->dr_prio_present = opts->dr_prio_present;
+    nbr->lan_delay_present = opts->lan_delay_present;
+    nbr->tbit            = opts->tbit;
+    nbr->prop_delay      = opts->prop_delay;
+    nbr->override_ivl    = opts->override_ivl;
+
+    lan_prune_delay(&uvifs[nbr->vifi]);
+}
+
+/*
+ * The LAN Prune Delay is in effect only if all neighbors on the LAN send
+ * the option, the largest propagation delay and override interval of
+ * them, and ours, is then used by all.  Join suppression is disabled and
+ * joins are tracked when all of them also set the T-bit.  RFC 4601, sec.
+ * 4.3.3.
+ */
+static void lan_prune_delay(struct uvif *v)
+{
+    pim_nbr_entry_t *nbr;
+    uint16_t prop_delay   = PIM_PROPAGATION_DELAY_DEFAULT;
+    uint16_t override_ivl = PIM_OVERRIDE_INTERVAL_DEFAULT;
+    int tracking = v->uv_pim_neighbors != NULL;
+
+    for (nbr = v->uv_pim_neighbors; nbr; nbr = nbr->next) {
+	if (!nbr->lan_delay_present)
+	    break;
+
+	if (!nbr->tbit)
+	    tracking = 0;
+	if (nbr->prop_delay > prop_delay)
+	    prop_delay = nbr->prop_delay;
+	if (nbr->override_ivl > override_ivl)
+	    override_ivl = nbr->override_ivl;
+    }
+
+    if (nbr) {
+	prop_delay   = PIM_PROPAGATION_DELAY_DEFAULT;
+	override_ivl = PIM_OVERRIDE_INTERVAL_DEFAULT;
+	tracking     = 0;
+    }
+
+    /* Joins from before are not tracked, see jp_tracking() */
+    if (tracking && !v->uv_tracking)
+	v->uv_tracking_since = route_clock;
+
+    v->uv_prop_delay   = prop_delay;
+    v->uv_override_ivl = override_ivl;
+    v->uv_tracking     = tracking;
 }
 
 int send_pim_hello(struct uvif *v, uint16_t holdtime)
@@ -573,6 +632,11 @@ int send_pim_hello(struct uvif *v, uint16_t holdtime)
     PUT_HOSTSHORT(PIM_HELLO_HOLDTIME_LEN, data);
     PUT_HOSTSHORT(holdtime, data);
 
+    PUT_HOSTSHORT(PIM_HELLO_LAN_PRUNE_DELAY, data);
+    PUT_HOSTSHORT(PIM_HELLO_LAN_PRUNE_DELAY_LEN, data);
+    PUT_HOSTSHORT(PIM_PROPAGATION_DELAY_DEFAULT | PIM_HELLO_LAN_PRUNE_DELAY_TBIT, data);
+    PUT_HOSTSHORT(PIM_OVERRIDE_INTERVAL_DEFAULT, data);
+
     PUT_HOSTSHORT(PIM_HELLO_DR_PRIO, data);
     PUT_HOSTSHORT(PIM_HELLO_DR_PRIO_LEN, data);
     PUT_HOSTLONG(v->uv_dr_prio, data);
@@ -592,6 +656,120 @@ int send_pim_hello(struct uvif *v, uint16_t holdtime)
 /************************************************************************
  *                        PIM_REGISTER
  ************************************************************************/
+/*
+ * On the RP, registers from a DR for the same (S,G) keep coming until
+ * the SPT is set up, or forever with 'spt-threshold infinity'.  Once a
+ * register has passed all checks, the routing entry it matched is kept
+ * in a cache keyed on (DR,S,G), so the following ones skip the lookups
+ * and the validation.  Entries are valid as long as no routing entry,
+ * or kernel cache entry, is created or deleted (decap_gen) and the RPs
+ * and local addresses are the same (register_gen).  What may change in
+ * a matched entry without those, its flags and oifs, is checked on
+ * every hit.
+ *
+ * The cache is set associative, new entries are inserted first in the
+ * set and the last one is evicted.
+ */
+#define DECAP_SETS		512
+#define DECAP_WAYS		4
+/* The DR and its sources usually share a prefix, mix them in one at a time */
+#define DECAP_MIX(h, v)		(((h) ^ (v)) * 2654435761u)
+#define DECAP_HASH(d, s, g)	(DECAP_MIX(DECAP_MIX(DECAP_MIX(0, d), s), g) >> 23)
+
+typedef struct {
+    uint32_t	dr;
+    uint32_t	rp;		/* Our address the DR registers to */
+    uint32_t	source;
+    uint32_t	group;
+    uint32_t	gen;		/* decap_gen when cached          */
+    uint32_t	rgen;		/* register_gen when cached       */
+    mrtentry_t *mrt;		/* (S,G) or (*,G) the DR hits     */
+    int		whole;		/* DR checksums the whole message */
+} decap_t;
+
+uint32_t	decap_gen;
+static decap_t	decap_cache[DECAP_SETS][DECAP_WAYS];
+
+static decap_t *decap_find(decap_t *set, uint32_t dr, uint32_t rp, uint32_t source, uint32_t group)
+{
+    int i;
+
+    for (i = 0; i < DECAP_WAYS; i++) {
+	decap_t *dc = &set[i];
+
+	if (dc->mrt && dc->gen == decap_gen && dc->rgen == register_gen && dc->dr == dr &&
+	    dc->rp == rp && dc->source == source && dc->group == group)
+	    return dc;
+    }
+
+    return NULL;
+}
+
+/*
+ * Verify the checksum, it should cover the header only but some older
+ * routers include the inner packet.  Try the variant the DR used the
+ * last time first, @whole.  Returns the variant used, or -1.
+ */
+static int decap_cksum(int whole, char *msg, size_t len)
+{
+    size_t hdrlen = sizeof(pim_header_t) + sizeof(pim_register_t);
+
+    if (whole) {
+	if (!inet_cksum((uint16_t *)msg, len))
+	    return 1;
+	if (!inet_cksum((uint16_t *)msg, hdrlen))
+	    return 0;
+    } else {
+	if (!inet_cksum((uint16_t *)msg, hdrlen))
+	    return 0;
+	if (!inet_cksum((uint16_t *)msg, len))
+	    return 1;
+    }
+
+    return -1;
+}
+
+static void decap_store(decap_t *set, uint32_t dr, uint32_t rp, uint32_t source, uint32_t group,
+			mrtentry_t *mrt, int whole)
+{
+    decap_t *dc = &set[0];
+
+    memmove(&set[1], &set[0], (DECAP_WAYS - 1) * sizeof(decap_t));
+    dc->dr     = dr;
+    dc->rp     = rp;
+    dc->source = source;
+    dc->group  = group;
+    dc->gen    = decap_gen;
+    dc->rgen   = register_gen;
+    dc->mrt    = mrt;
+    dc->whole  = whole;
+}
+
+/*
+ * A data register matching a cached entry, redo only the checks of
+ * the state that may have changed since.  Returns FALSE if the full
+ * processing is needed, e.g., to send a Register-Stop.
+ */
+static int decap_fast(decap_t *dc)
+{
+    mrtentry_t *mrt = dc->mrt;
+    vifset_t oifs;
+
+    calc_oifs(mrt, oifs);
+    if (mrt->flags & MRTF_SG) {
+	if (mrt->flags & MRTF_SPT)
+	    return FALSE;
+	if (PIMD_VIFM_ISEMPTY(oifs) && mrt->incoming == PIMREG_VIF)
+	    return FALSE;
+
+	MRT_SET_TIMER(mrt, mrt->entry_timer, PIM_DATA_TIMEOUT);
+	return TRUE;
+    }
+
+    /* (*,G), its kernel cache entry for (S,G) is already installed */
+    return !PIMD_VIFM_ISEMPTY(oifs);
+}
+
 /* TODO: XXX: IF THE BORDER BIT IS SET, THEN
  * FORWARD THE WHOLE PACKET FROM USER SPACE
  * AND AT THE SAME TIME IGNORE ANY CACHE_MISS
@@ -605,7 +783,9 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
     uint32_t is_border, is_null;
     mrtentry_t *mrtentry;
     mrtentry_t *mrtentry2;
-    uint8_t oifs[MAXVIFS];
+    vifset_t oifs;
+    decap_t *set, *dc;
+    int whole;
 
     /*
      * If instance specific multicast routing table is in use, check
@@ -642,6 +822,17 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 	return FALSE;
     }
 
+    /* Lookup register message flags */
+    reg = (pim_register_t *)(msg + sizeof(pim_header_t));
+    is_border = ntohl(reg->reg_flags) & PIM_REGISTER_BORDER_BIT;
+    is_null   = ntohl(reg->reg_flags) & PIM_REGISTER_NULL_REGISTER_BIT;
+
+    /* initialize the pointer to the encapsulated packet */
+    ip = (struct ip *)(msg + sizeof(pim_header_t) + sizeof(pim_register_t));
+
+    set = decap_cache[DECAP_HASH(reg_src, ip->ip_src.s_addr, ip->ip_dst.s_addr)];
+    dc  = decap_find(set, reg_src, reg_dst, ip->ip_src.s_addr, ip->ip_dst.s_addr);
+
     /*
      * XXX: For PIM_REGISTER the checksum does not include
      * the inner IP packet. However, some older routers might
@@ -649,8 +840,8 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
      * verify the checksum over the first 8 bytes, and if fails,
      * then over the whole Register
      */
-    if ((inet_cksum((uint16_t *)msg, sizeof(pim_header_t) + sizeof(pim_register_t)))
-	&& (inet_cksum((uint16_t *)msg, len))) {
+    whole = decap_cksum(dc ? dc->whole : set[0].whole, msg, len);
+    if (whole < 0) {
 	IF_DEBUG(DEBUG_PIM_REGISTER)
 	    logit(LOG_INFO, 0, "PIM REGISTER from DR %s: invalid PIM header checksum",
 		  inet_fmt(reg_src, s1, sizeof(s1)));
@@ -658,13 +849,11 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 	return FALSE;
     }
 
-    /* Lookup register message flags */
-    reg = (pim_register_t *)(msg + sizeof(pim_header_t));
-    is_border = ntohl(reg->reg_flags) & PIM_REGISTER_BORDER_BIT;
-    is_null   = ntohl(reg->reg_flags) & PIM_REGISTER_NULL_REGISTER_BIT;
-
-    /* initialize the pointer to the encapsulated packet */
-    ip = (struct ip *)(msg + sizeof(pim_header_t) + sizeof(pim_register_t));
+    if (dc && !is_null && !is_border && decap_fast(dc)) {
+	reg_stats.decap_hits++;
+	return TRUE;
+    }
+    reg_stats.decap_misses++;
 
     /* check the IP version (especially for the NULL register...see above) */
     if (ip->ip_v != IPVERSION && (! is_null)) {
@@ -710,7 +899,7 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
         if (!mrtentry || !(mrtentry->flags & MRTF_NEW))
            return TRUE;
 
-        SET_TIMER(mrtentry->entry_timer, PIM_DATA_TIMEOUT);
+        MRT_SET_TIMER(mrtentry, mrtentry->entry_timer, PIM_DATA_TIMEOUT);
         mrtentry->flags &= ~MRTF_NEW;
         change_interfaces(mrtentry,
                           mrtentry->incoming,
@@ -739,7 +928,7 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
     if (mrtentry->flags & MRTF_SG) {
 	/* (S,G) found */
 	/* TODO: check the timer again */
-	SET_TIMER(mrtentry->entry_timer, PIM_DATA_TIMEOUT); /* restart timer */
+	MRT_SET_TIMER(mrtentry, mrtentry->entry_timer, PIM_DATA_TIMEOUT); /* restart timer */
 	if (!(mrtentry->flags & MRTF_SPT)) { /* The SPT bit is not set */
 	    if (!is_null) {
 		calc_oifs(mrtentry, oifs);
@@ -774,6 +963,8 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 
 			return TRUE;
 		    }
+		} else {
+		    decap_store(set, reg_src, reg_dst, inner_src, inner_grp, mrtentry, whole);
 		}
 
 		return TRUE;
@@ -802,9 +993,9 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 		mrtentry2->pmbr_addr = reg_src;
 		/* Clear the SPT flag */
 		mrtentry2->flags &= ~(MRTF_SPT | MRTF_NEW);
-		SET_TIMER(mrtentry2->entry_timer, PIM_DATA_TIMEOUT);
+		MRT_SET_TIMER(mrtentry2, mrtentry2->entry_timer, PIM_DATA_TIMEOUT);
 		/* TODO: explicitly call the Join/Prune send function? */
-		FIRE_TIMER(mrtentry2->jp_timer); /* Send the Join immediately */
+		MRT_FIRE_TIMER(mrtentry2, mrtentry2->jp_timer); /* Send the Join immediately */
 		/* TODO: explicitly call this function?
 		   send_pim_join_prune(mrtentry2->upstream->vifi,
 		   mrtentry2->upstream,
@@ -848,6 +1039,9 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 			  mrtentry->incoming, mrtentry->oifs,
 			  mrtentry->group->rpaddr);
 
+		if (!is_border)
+		    decap_store(set, reg_src, reg_dst, inner_src, inner_grp, mrtentry, whole);
+
 		return TRUE;
 	    }
 	}
@@ -872,6 +1066,7 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 		mrtentry2->flags &= ~MRTF_NEW;
 		/* TODO: XXX: copy the timer from the (*,*,RP) entry? */
 		COPY_TIMER(mrtentry->entry_timer, mrtentry2->entry_timer);
+		mrt_schedule(mrtentry2, mrtentry2->entry_timer);
 	    }
 
 	    /* Install cache entry in the kernel */
@@ -901,49 +1096,119 @@ int receive_pim_register(uint32_t reg_src, uint32_t reg_dst, char *msg, size_t l
 }
 
 
-int send_pim_register(char *packet)
+/*
+ * The data path looks up the register state of an (S,G) in a direct
+ * mapped cache, instead of the source vif, the RP and the (S,G) entry
+ * for each packet.  An entry stays valid until register_gen is bumped,
+ * on vif or RP-Set changes, or the DR role or the RP of the group is
+ * lost in between.
+ */
+#define REG_CACHE_SIZE		1024
+#define REG_CACHE_HASH(s, g)	((((s) ^ (g)) * 2654435761u) >> 22)
+
+struct regstats reg_stats;
+struct pool	regstate_pool;
+uint32_t	register_gen;
+static regstate_t *reg_cache[REG_CACHE_SIZE];
+
+static int register_valid(regstate_t *reg, uint32_t source, uint32_t group)
+{
+    mrtentry_t *mrt;
+
+    if (!reg)
+	return FALSE;
+
+    mrt = reg->mrt;
+    if (mrt->source->address != source || mrt->group->group != group)
+	return FALSE;
+
+    if (reg->gen != register_gen || mrt->group->rpaddr != reg->reg_dst)
+	return FALSE;
+
+    return (uvifs[reg->vifi].uv_flags & VIFF_DR) != 0;
+}
+
+/* Called when the (S,G) entry is freed */
+void register_forget(mrtentry_t *mrt)
+{
+    regstate_t **slot;
+
+    slot = &reg_cache[REG_CACHE_HASH(mrt->source->address, mrt->group->group)];
+    if (*slot == mrt->reg)
+	*slot = NULL;
+
+    pool_free(&regstate_pool, mrt->reg);
+    mrt->reg = NULL;
+}
+
+/* Registers sent per second, and bits, during the last full second */
+void register_rate(regstate_t *reg, uint32_t *pps, uint64_t *bps)
+{
+    if (reg->stamp == route_clock) {
+	*pps = reg->pps;
+	*bps = reg->bps;
+    } else if (reg->stamp + 1 == route_clock) {
+	*pps = reg->sec_pkts;
+	*bps = (uint64_t)reg->sec_bytes * 8;
+    } else {
+	*pps = 0;
+	*bps = 0;
+    }
+}
+
+static void register_count(regstate_t *reg, size_t len)
+{
+    if (reg->stamp != route_clock) {
+	register_rate(reg, &reg->pps, &reg->bps);
+	reg->stamp     = route_clock;
+	reg->sec_pkts  = 0;
+	reg->sec_bytes = 0;
+    }
+
+    reg->sec_pkts++;
+    reg->sec_bytes += len;
+    reg->pkts++;
+    reg->bytes += len;
+}
+
+/*
+ * Slow path of send_pim_register(), check that we are the DR of the
+ * source and not the RP of the group, then create the (S,G) state and
+ * cache what we found.
+ */
+static mrtentry_t *register_resolve(uint32_t source, uint32_t group)
 {
-    struct ip  *ip;
-    uint32_t     source, group;
     vifi_t	vifi;
     rpentry_t  *rpentry;
     mrtentry_t *mrtentry;
     mrtentry_t *mrtentry2;
+    regstate_t *reg;
     uint32_t     reg_src, reg_dst;
-    int		reg_mtu, pktlen = 0;
-    char       *buf;
-
-    ip     = (struct ip *)packet;
-    source = ip->ip_src.s_addr;
-    group  = ip->ip_dst.s_addr;
-
-    if (IN_PIM_SSM_RANGE(group))
-	return FALSE; /* Group is in PIM-SSM range, don't send register. */
 
     if ((vifi = find_vif_direct_local(source, TRUE)) == NO_VIF)
-	return FALSE;
+	return NULL;
 
     if (!(uvifs[vifi].uv_flags & VIFF_DR))
-	return FALSE;		/* I am not the DR for that subnet */
+	return NULL;		/* I am not the DR for that subnet */
 
     rpentry = rp_match(group);
     if (!rpentry)
-	return FALSE;		/* No RP for this group */
+	return NULL;		/* No RP for this group */
 
     if (local_address(rpentry->address) != NO_VIF) {
 	/* TODO: XXX: not sure it is working! */
-	return FALSE;		/* I am the RP for this group */
+	return NULL;		/* I am the RP for this group */
     }
 
     mrtentry = find_route(source, group, MRTF_SG, CREATE);
     if (!mrtentry)
-	return FALSE;		/* Cannot create (S,G) state */
+	return NULL;		/* Cannot create (S,G) state */
+
+    reg_src = uvifs[vifi].uv_lcl_addr;
+    reg_dst = mrtentry->group->rpaddr;
 
     if (mrtentry->flags & MRTF_NEW) {
 	/* A new entry, log it */
-	reg_src = uvifs[vifi].uv_lcl_addr;
-	reg_dst = mrtentry->group->rpaddr;
-
 	IF_DEBUG(DEBUG_PIM_REGISTER)
 	    logit(LOG_INFO, 0, "Send PIM REGISTER: src %s dst %s, group %s",
 		  inet_fmt(reg_src, s1, sizeof(s1)), inet_fmt(reg_dst, s2, sizeof(s2)),
@@ -955,7 +1220,7 @@ int send_pim_register(char *packet)
 	if (!mrtentry2)
 	    mrtentry2 = mrtentry->group->active_rp_grp->rp->rpentry->mrtlink;
 	if (mrtentry2) {
-	    FIRE_TIMER(mrtentry2->jp_timer); /* Timeout the Join/Prune timer */
+	    MRT_FIRE_TIMER(mrtentry2, mrtentry2->jp_timer); /* Timeout the Join/Prune timer */
 	    /* TODO: explicitly call this function?
 	       send_pim_join_prune(mrtentry2->upstream->vifi,
 	       mrtentry2->upstream,
@@ -963,30 +1228,92 @@ int send_pim_register(char *packet)
 	    */
 	}
     }
+
+    reg = mrtentry->reg;
+    if (!reg) {
+	pool_init(&regstate_pool, "regstate", sizeof(regstate_t));
+	reg = pool_alloc(&regstate_pool);
+	if (!reg) {
+	    logit(LOG_WARNING, 0, "register_resolve(): out of memory");
+	    return NULL;
+	}
+	reg->mrt = mrtentry;
+	reg->stamp = route_clock;
+	mrtentry->reg = reg;
+    }
+
+    reg->gen     = register_gen;
+    reg->vifi    = vifi;
+    reg->reg_src = reg_src;
+    reg->reg_dst = reg_dst;
+    reg_cache[REG_CACHE_HASH(source, group)] = reg;
+
+    return mrtentry;
+}
+
+int send_pim_register(char *packet)
+{
+    struct ip  *ip;
+    uint32_t     source, group;
+    mrtentry_t *mrtentry;
+    regstate_t *reg;
+    int		pktlen;
+    char       *buf;
+
+    ip     = (struct ip *)packet;
+    source = ip->ip_src.s_addr;
+    group  = ip->ip_dst.s_addr;
+
+    if (IN_PIM_SSM_RANGE(group))
+	return FALSE; /* Group is in PIM-SSM range, don't send register. */
+
+    reg = reg_cache[REG_CACHE_HASH(source, group)];
+    if (register_valid(reg, source, group)) {
+	reg_stats.hits++;
+	mrtentry = reg->mrt;
+    } else {
+	reg_stats.misses++;
+	mrtentry = register_resolve(source, group);
+	if (!mrtentry)
+	    return FALSE;
+	reg = mrtentry->reg;
+    }
+
     /* Restart the (S,G) Entry-timer */
-    SET_TIMER(mrtentry->entry_timer, PIM_DATA_TIMEOUT);
+    MRT_SET_TIMER(mrtentry, mrtentry->entry_timer, PIM_DATA_TIMEOUT);
+
+    if (MRT_TIMER_LEFT(mrtentry->rs_timer)) {
+	/* The Register-Suppression Timer is running */
+	reg_stats.suppressed++;
+	reg->suppressed++;
+	return TRUE;
+    }
+
+    /*
+     * Encapsulate the data and send to the RP, straight from the
+     * upcall buffer.  Copy it only if it must be fragmented.
+     */
+    pktlen = ntohs(ip->ip_len);
+    if (send_pim_register_iov(packet, pktlen, reg->reg_src, reg->reg_dst)) {
+	if (errno != EMSGSIZE) {
+	    reg_stats.failed++;
+	    return FALSE;
+	}
 
-    IF_TIMER_NOT_SET(mrtentry->rs_timer) {
-	/* The Register-Suppression Timer is not running.
-	 * Encapsulate the data and send to the RP.
-	 */
 	buf = pim_send_buf + sizeof(struct ip) + sizeof(pim_header_t);
 	memset(buf, 0, sizeof(pim_register_t)); /* No flags set */
 	buf += sizeof(pim_register_t);
-
-	/* Copy the data packet at the back of the register packet */
-	pktlen = ntohs(ip->ip_len);
 	memcpy(buf, ip, pktlen);
 
-	pktlen += sizeof(pim_register_t); /* 'sizeof(struct ip) + sizeof(pim_header_t)' added by send_pim()  */
-	reg_mtu = uvifs[vifi].uv_mtu; /* XXX: Use PMTU to RP instead! */
-	reg_src = uvifs[vifi].uv_lcl_addr;
-	reg_dst = mrtentry->group->rpaddr;
-
-	send_pim_unicast(pim_send_buf, reg_mtu, reg_src, reg_dst, PIM_REGISTER, pktlen);
-
-	return TRUE;
+	/* 'sizeof(struct ip) + sizeof(pim_header_t)' added by send_pim()  */
+	/* XXX: Use PMTU to RP instead! */
+	send_pim_unicast(pim_send_buf, uvifs[reg->vifi].uv_mtu, reg->reg_src, reg->reg_dst,
+			 PIM_REGISTER, pktlen + sizeof(pim_register_t));
+	reg_stats.copied++;
+    } else {
+	reg_stats.sent++;
     }
+    register_count(reg, pktlen);
 
     return TRUE;
 }
@@ -994,6 +1321,7 @@ int send_pim_register(char *packet)
 
 int send_pim_null_register(mrtentry_t *mrtentry)
 {
+    static uint16_t null_sum;	/* Dummy header checksum, no addresses */
     struct ip *ip;
     pim_register_t *pim_register;
     int reg_mtu, pktlen;
@@ -1020,10 +1348,17 @@ int send_pim_null_register(mrtentry_t *mrtentry)
     ip->ip_p     = IPPROTO_UDP;			/* XXX: bogus */
     ip->ip_len   = htons(sizeof(struct ip));
     ip->ip_ttl   = MINTTL; /* TODO: XXX: check whether need to setup the ttl */
+    ip->ip_src.s_addr = INADDR_ANY_N;
+    ip->ip_dst.s_addr = INADDR_ANY_N;
+    ip->ip_sum   = 0;
+
+    /* Only the addresses differ between null registers, patch them in */
+    if (!null_sum)
+	null_sum = inet_cksum((uint16_t *)ip, sizeof(struct ip));
     ip->ip_src.s_addr = mrtentry->source->address;
     ip->ip_dst.s_addr = mrtentry->group->group;
-    ip->ip_sum   = 0;
-    ip->ip_sum   = inet_cksum((uint16_t *)ip, sizeof(struct ip));
+    ip->ip_sum   = inet_cksum_update32(null_sum, INADDR_ANY_N, ip->ip_src.s_addr);
+    ip->ip_sum   = inet_cksum_update32(ip->ip_sum, INADDR_ANY_N, ip->ip_dst.s_addr);
 
     /* include the dummy ip header */
     pktlen = sizeof(pim_register_t) + sizeof(struct ip);
@@ -1047,7 +1382,7 @@ int receive_pim_register_stop(uint32_t reg_src, uint32_t reg_dst, char *msg, siz
     pim_encod_uni_addr_t eusaddr;
     uint8_t *data;
     mrtentry_t *mrtentry;
-    uint8_t pruned_oifs[MAXVIFS];
+    vifset_t pruned_oifs;
 
     /* Checksum */
     if (inet_cksum((uint16_t *)msg, len))
@@ -1076,7 +1411,7 @@ int receive_pim_register_stop(uint32_t reg_src, uint32_t reg_dst, char *msg, siz
 	return FALSE;
 
     /* restart the Register-Suppression timer */
-    SET_TIMER(mrtentry->rs_timer, (0.5 * PIM_REGISTER_SUPPRESSION_TIMEOUT)
+    MRT_SET_TIMER(mrtentry, mrtentry->rs_timer, (0.5 * PIM_REGISTER_SUPPRESSION_TIMEOUT)
 	      + (RANDOM() % (PIM_REGISTER_SUPPRESSION_TIMEOUT + 1)));
     /* Prune the register_vif from the outgoing list */
     PIMD_VIFM_COPY(mrtentry->pruned_oifs, pruned_oifs);
@@ -1121,7 +1456,7 @@ send_pim_register_stop(uint32_t reg_src, uint32_t reg_dst, uint32_t inner_grp, u
  ************************************************************************/
 int join_or_prune(mrtentry_t *mrtentry, pim_nbr_entry_t *upstream_router)
 {
-    uint8_t entry_oifs[MAXVIFS];
+    vifset_t entry_oifs;
     mrtentry_t *mrtentry_grp;
 
     if (!mrtentry || !upstream_router)
@@ -1129,7 +1464,8 @@ int join_or_prune(mrtentry_t *mrtentry, pim_nbr_entry_t *upstream_router)
 
     calc_oifs(mrtentry, entry_oifs);
     if (mrtentry->flags & (MRTF_PMBR | MRTF_WC)) {
-	if (IN_PIM_SSM_RANGE(mrtentry->group->group)) {
+	/* (*,*,RP) entries have no group */
+	if (mrtentry->group && IN_PIM_SSM_RANGE(mrtentry->group->group)) {
 	    logit(LOG_DEBUG, 0, "No action for SSM (PMBR|WC)");
 	    return PIM_ACTION_NOTHING;
 	}
@@ -1213,9 +1549,17 @@ int join_or_prune(mrtentry_t *mrtentry, pim_nbr_entry_t *upstream_router)
 }
 
 /*
- * Log PIM Join/Prune message. Send log event for every join and prune separately.
- * Format of the Join/Prune message starting from dataptr is following:
-   ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ * Decode a Join/Prune message into @jp in a single pass.  Every length
+ * is checked against @len before anything is read, so a truncated or
+ * malformed message is rejected as a whole before any state is touched.
+ * Each source in the message becomes one (G,S,flags,J/P) entry, in
+ * message order, and each group record points at its run of entries.
+ * The format of the message after the PIM header is:
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |        Upstream Neighbor Address (Encoded-Unicast format)     |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |  Reserved     | Num groups    |          Holdtime             |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
    |         Multicast Group Address 1 (Encoded-Group format)      |
    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
    |   Number of Joined Sources    |   Number of Pruned Sources    |
@@ -1236,1018 +1580,899 @@ int join_or_prune(mrtentry_t *mrtentry, pim_nbr_entry_t *upstream_router)
    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
    |         Multicast Group Address m (Encoded-Group format)      |
    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |   Number of Joined Sources    |   Number of Pruned Sources    |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |        Joined Source Address 1 (Encoded-Source format)        |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |                             .                                 |
-   |                             .                                 |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |        Joined Source Address n (Encoded-Source format)        |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |        Pruned Source Address 1 (Encoded-Source format)        |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
    |                             .                                 |
-   |                             .                                 |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-   |        Pruned Source Address n (Encoded-Source format)        |
-   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * Returns TRUE, or FALSE if the message is malformed.
  */
-void log_pim_join_prune(uint32_t src, uint8_t *data_ptr, int num_groups, char* ifname)
-{
-    pim_encod_grp_addr_t encod_group;
-    pim_encod_src_addr_t encod_src;
-    uint32_t group, source;
-    uint16_t num_j_srcs;
-    uint16_t num_p_srcs;
-
-    /* Message validity check is done by caller */
-    while (num_groups--) {
-
-	GET_EGADDR(&encod_group, data_ptr);
-	GET_HOSTSHORT(num_j_srcs, data_ptr);
-	GET_HOSTSHORT(num_p_srcs, data_ptr);
-	group = encod_group.mcast_addr;
-
-	while (num_j_srcs--) {
-	    GET_ESADDR(&encod_src, data_ptr);
-	    source = encod_src.src_addr;
-	    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-		logit(LOG_INFO, 0, "Received PIM JOIN from %s to group %s for source %s on %s",
-		      inet_fmt(src, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)),
-		      inet_fmt(source, s3, sizeof(s3)), ifname);
-	}
-
-	while (num_p_srcs--) {
-	    GET_ESADDR(&encod_src, data_ptr);
-	    source = encod_src.src_addr;
-	    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-		logit(LOG_INFO, 0, "Received PIM PRUNE from %s to group %s for source %s on %s",
-		      inet_fmt(src, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)),
-		      inet_fmt(source, s3, sizeof(s3)), ifname);
-	}
-    }
-}
-
-/* TODO: when parsing, check if we go beyond message size */
-/* TODO: too long, simplify it! */
 #define PIM_JOIN_PRUNE_MINLEN (4 + PIM_ENCODE_UNI_ADDR_LEN + 4)
-int receive_pim_join_prune(uint32_t src, uint32_t dst __attribute__((unused)), char *msg, size_t len)
+int parse_pim_join_prune(char *msg, size_t len, jp_message_t *jp)
 {
-    vifi_t vifi;
-    struct uvif *v;
     pim_encod_uni_addr_t eutaddr;
     pim_encod_grp_addr_t egaddr;
     pim_encod_src_addr_t esaddr;
-    uint8_t *data;
-    uint8_t *data_start;
-    uint8_t *data_group_end;
-    uint8_t num_groups;
-    uint8_t num_groups_tmp;
-    int star_star_rp_found;
-    uint16_t holdtime;
-    uint16_t num_j_srcs;
-    uint16_t num_j_srcs_tmp;
-    uint16_t num_p_srcs;
-    uint32_t source;
-    uint32_t group;
-    uint32_t s_mask;
-    uint32_t g_mask;
-    uint8_t s_flags;
     uint8_t reserved __attribute__((unused));
-    rpentry_t *rpentry;
-    mrtentry_t *mrt;
-    mrtentry_t *mrt_srcs;
-    mrtentry_t *mrt_rp;
-    grpentry_t *grp;
-    uint16_t jp_value;
-    pim_nbr_entry_t *upstream_router;
-    int my_action;
-    int ignore_group;
-    rp_grp_entry_t *rp_grp;
-    uint8_t *data_group_j_start;
-    uint8_t *data_group_p_start;
-    uint32_t new_join;
-
-    if ((vifi = find_vif_direct(src)) == NO_VIF) {
-	/* Either a local vif or somehow received PIM_JOIN_PRUNE from
-	 * non-directly connected router. Ignore it.
-	 */
-	if (local_address(src) == NO_VIF) {
-	    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-		logit(LOG_INFO, 0, "Ignoring PIM_JOIN_PRUNE from non-neighbor router %s",
-		      inet_fmt(src, s1, sizeof(s1)));
-	}
-
-	return FALSE;
-    }
-
-    /* Checksum */
-    if (inet_cksum((uint16_t *)msg, len))
-	return FALSE;
-
-    v = &uvifs[vifi];
-    if (uvifs[vifi].uv_flags & (VIFF_DOWN | VIFF_DISABLED | VIFF_NONBRS | VIFF_REGISTER))
-	return FALSE;    /* Shoudn't come on this interface */
-
-    /* sanity check for the minimum length */
-    if (len < PIM_JOIN_PRUNE_MINLEN) {
-	IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-	    logit(LOG_NOTICE, 0, "Too short Join/Prune message (%zu bytes) from %s on %s",
-		  len, inet_fmt(src, s1, sizeof(s1)), v->uv_name);
+    uint8_t *data, *end;
+    uint16_t num_j_srcs, num_p_srcs, i;
+    jp_group_t *jpg;
+    jp_entry_t *entry;
+    size_t num;
 
+    if (len < PIM_JOIN_PRUNE_MINLEN)
 	return FALSE;
-    }
 
-    len -= PIM_JOIN_PRUNE_MINLEN;
     data = (uint8_t *)(msg + sizeof(pim_header_t));
+    end  = (uint8_t *)(msg + len);
 
-    /* Get the target address */
     GET_EUADDR(&eutaddr, data);
     GET_BYTE(reserved, data);
-    GET_BYTE(num_groups, data);
-    GET_HOSTSHORT(holdtime, data);
-
-    if (num_groups == 0) {
-	/* No indication for groups in the message */
-	IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-	    logit(LOG_NOTICE, 0, "No groups in Join/Prune message from %s on %s!",
-		  inet_fmt(src, s1, sizeof(s1)), v->uv_name);
+    GET_BYTE(jp->num_groups, data);
+    GET_HOSTSHORT(jp->holdtime, data);
+    if (eutaddr.addr_family != ADDRF_IPv4 || jp->num_groups == 0)
 	return FALSE;
-    }
 
-    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-	logit(LOG_INFO, 0, "Received PIM JOIN/PRUNE from %s on %s",
-	      inet_fmt(src, s1, sizeof(s1)), v->uv_name);
+    jp->target       = eutaddr.unicast_addr;
+    jp->star_star_rp = 0;
+    jp->num          = 0;
 
-    /* Sanity check for the message length through all the groups */
-    num_groups_tmp = num_groups;
-    data_start = data;
-    while (num_groups_tmp--) {
-        size_t srclen;
+    for (jpg = jp->groups; jpg < &jp->groups[jp->num_groups]; jpg++) {
+	if ((size_t)(end - data) < PIM_ENCODE_GRP_ADDR_LEN + 2 * sizeof(uint16_t))
+	    return FALSE;
 
-        /* group addr + #join + #src */
-        if (len < PIM_ENCODE_GRP_ADDR_LEN + sizeof(uint32_t)) {
-	    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-		logit(LOG_NOTICE, 0, "Join/Prune message from %s on %s is"
-		      " too short to contain enough data",
-		      inet_fmt(src, s1, sizeof(s1)), v->uv_name);
-            return FALSE;
-        }
+	GET_EGADDR(&egaddr, data);
+	GET_HOSTSHORT(num_j_srcs, data);
+	GET_HOSTSHORT(num_p_srcs, data);
+	if (egaddr.addr_family != ADDRF_IPv4)
+	    return FALSE;
+	if ((size_t)(end - data) / PIM_ENCODE_SRC_ADDR_LEN < (size_t)num_j_srcs + num_p_srcs)
+	    return FALSE;
 
-        len -= (PIM_ENCODE_GRP_ADDR_LEN + sizeof(uint32_t));
-        data += PIM_ENCODE_GRP_ADDR_LEN;
+	num = jp->num + num_j_srcs + num_p_srcs;
+	if (num > jp->max) {
+	    size_t max = MAX(num, 2 * jp->max);
 
-        /* joined source addresses and pruned source addresses */
-        GET_HOSTSHORT(num_j_srcs, data);
-        GET_HOSTSHORT(num_p_srcs, data);
-        srclen = (num_j_srcs + num_p_srcs) * PIM_ENCODE_SRC_ADDR_LEN;
-        if (len < srclen) {
-	    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-		logit(LOG_NOTICE, 0, "Join/Prune message from %s on %s is"
-		      " too short to contain enough data",
-		      inet_fmt(src, s1, sizeof(s1)), v->uv_name);
-            return FALSE;
-        }
-        len -= srclen;
-        data += srclen;
+	    entry = realloc(jp->entries, max * sizeof(jp_entry_t));
+	    if (!entry) {
+		logit(LOG_WARNING, 0, "Failed allocating Join/Prune receive buffer");
+		return FALSE;
+	    }
+	    jp->entries = entry;
+	    jp->max = max;
+	}
+
+	jpg->group   = egaddr.mcast_addr;
+	jpg->masklen = egaddr.masklen;
+	jpg->num_j   = num_j_srcs;
+	jpg->num_p   = num_p_srcs;
+	jpg->first   = jp->num;
+	jpg->wc      = num_j_srcs;
+	if (ntohl(jpg->group) == CLASSD_PREFIX && jpg->masklen == STAR_STAR_RP_MSKLEN)
+	    jp->star_star_rp++;
+
+	for (i = 0; i < num_j_srcs + num_p_srcs; i++) {
+	    GET_ESADDR(&esaddr, data);
+	    if (esaddr.addr_family != ADDRF_IPv4)
+		return FALSE;
+
+	    entry = &jp->entries[jp->num++];
+	    entry->group      = jpg->group;
+	    entry->source     = esaddr.src_addr;
+	    entry->holdtime   = jp->holdtime;
+	    entry->grp_msklen = jpg->masklen;
+	    entry->src_msklen = esaddr.masklen;
+	    entry->flags      = esaddr.flags;
+	    entry->action     = i < num_j_srcs ? PIM_ACTION_JOIN : PIM_ACTION_PRUNE;
+
+	    /* Remember the first (*,G) Join, it decides the fate of the group */
+	    if (i < jpg->wc && (entry->flags & USADDR_RP_BIT) && (entry->flags & USADDR_WC_BIT))
+		jpg->wc = i;
+	}
     }
-    data = data_start;
-    num_groups_tmp = num_groups;
 
-    /* Sanity check is done. Log the message */
-    log_pim_join_prune(src, data, num_groups, v->uv_name);
+    return TRUE;
+}
 
-    if (eutaddr.unicast_addr != v->uv_lcl_addr) {
-	/* if I am not the target of the join message */
-	/* Join/Prune suppression code. This either modifies the J/P timers
-	 * or triggers an overriding Join.
-	 */
-	/* Note that if we have (S,G) prune and (*,G) Join, we must send
-	 * them in the same message. We don't bother to modify both timers
-	 * here. The Join/Prune sending function will take care of that.
-	 */
-	upstream_router = find_pim_nbr(eutaddr.unicast_addr);
-	if (!upstream_router)
-	    return FALSE;   /* I have no such neighbor */
-
-	while (num_groups--) {
-	    GET_EGADDR(&egaddr, data);
-	    GET_HOSTSHORT(num_j_srcs, data);
-	    GET_HOSTSHORT(num_p_srcs, data);
-	    MASKLEN_TO_MASK(egaddr.masklen, g_mask);
-	    group = egaddr.mcast_addr;
-	    if (!IN_MULTICAST(ntohl(group))) {
-		data += (num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
-		continue; /* Ignore this group and jump to the next */
-	    }
+/*
+ * Log PIM Join/Prune message. Send log event for every join and prune separately.
+ */
+static void log_pim_join_prune(uint32_t src, jp_message_t *jp, char *ifname)
+{
+    size_t i;
 
-	    if ((ntohl(group) == CLASSD_PREFIX) && (egaddr.masklen == STAR_STAR_RP_MSKLEN)) {
-		/* (*,*,RP) Join suppression */
-
-		while (num_j_srcs--) {
-		    GET_ESADDR(&esaddr, data);
-		    source = esaddr.src_addr;
-		    if (!inet_valid_host(source))
-			continue;
-
-		    s_flags = esaddr.flags;
-		    MASKLEN_TO_MASK(esaddr.masklen, s_mask);
-		    if ((s_flags & USADDR_RP_BIT) && (s_flags & USADDR_WC_BIT)) {
-			/* This is the RP address. */
-			rpentry = rp_find(source);
-			if (!rpentry)
-			    continue; /* Don't have such RP. Ignore */
-
-			mrt_rp = rpentry->mrtlink;
-			my_action = join_or_prune(mrt_rp, upstream_router);
-			if (my_action != PIM_ACTION_JOIN)
-			    continue;
-
-			/* Check the holdtime */
-			/* TODO: XXX: TIMER implem. dependency! */
-			if (mrt_rp->jp_timer > holdtime)
-			    continue;
-
-			if ((mrt_rp->jp_timer == holdtime) && (ntohl(src) > ntohl(v->uv_lcl_addr)))
-			    continue;
-
-			/* Set the Join/Prune suppression timer for this
-			 * routing entry by increasing the current
-			 * Join/Prune timer.
-			 */
-			jp_value = PIM_JOIN_PRUNE_PERIOD + 0.5 * (RANDOM() % PIM_JOIN_PRUNE_PERIOD);
-			/* TODO: XXX: TIMER implem. dependency! */
-			if (mrt_rp->jp_timer < jp_value)
-			    SET_TIMER(mrt_rp->jp_timer, jp_value);
-		    }
-		} /* num_j_srcs */
-
-		while (num_p_srcs--) {
-		    /* TODO: XXX: Can we have (*,*,RP) prune message?
-		     * Not in the spec, but anyway, the code below
-		     * can handle them: either suppress
-		     * the local (*,*,RP) prunes or override the prunes by
-		     * sending (*,*,RP) and/or (*,G) and/or (S,G) Join.
-		     */
-		    GET_ESADDR(&esaddr, data);
-		    source = esaddr.src_addr;
-		    if (!inet_valid_host(source))
-			continue;
-
-		    s_flags = esaddr.flags;
-		    MASKLEN_TO_MASK(esaddr.masklen, s_mask);
-		    if ((s_flags & USADDR_RP_BIT) && (s_flags & USADDR_WC_BIT)) {
-			/* This is the RP address. */
-			rpentry = rp_find(source);
-			if (!rpentry)
-			    continue; /* Don't have such RP. Ignore */
-
-			mrt_rp = rpentry->mrtlink;
-			my_action = join_or_prune(mrt_rp, upstream_router);
-			if (my_action == PIM_ACTION_PRUNE) {
-			    /* TODO: XXX: TIMER implem. dependency! */
-			    if ((mrt_rp->jp_timer < holdtime)
-				|| ((mrt_rp->jp_timer == holdtime) &&
-				    (ntohl(src) > ntohl(v->uv_lcl_addr)))) {
-				/* Suppress the Prune */
-				jp_value = PIM_JOIN_PRUNE_PERIOD + 0.5 * (RANDOM() % PIM_JOIN_PRUNE_PERIOD);
-				if (mrt_rp->jp_timer < jp_value)
-				    SET_TIMER(mrt_rp->jp_timer, jp_value);
-			    }
-			} else if (my_action == PIM_ACTION_JOIN) {
-			    /* Override the Prune by scheduling a Join */
-			    jp_value = (RANDOM() % (int)(10 * PIM_RANDOM_DELAY_JOIN_TIMEOUT)) / 10;
-			    /* TODO: XXX: TIMER implem. dependency! */
-			    if (mrt_rp->jp_timer > jp_value)
-				SET_TIMER(mrt_rp->jp_timer, jp_value);
-			}
-
-			/* Check all (*,G) and (S,G) matching to this RP.
-			 * If my_action == JOIN, then send a Join and override
-			 * the (*,*,RP) Prune.
-			 */
-			for (grp = rpentry->cand_rp->rp_grp_next->grplink; grp; grp = grp->rpnext) {
-			    my_action = join_or_prune(grp->grp_route, upstream_router);
-			    if (my_action == PIM_ACTION_JOIN) {
-				jp_value = (RANDOM() % (int)(10 * PIM_RANDOM_DELAY_JOIN_TIMEOUT)) / 10;
-				/* TODO: XXX: TIMER implem. dependency! */
-				if (grp->grp_route->jp_timer > jp_value)
-				    SET_TIMER(grp->grp_route->jp_timer, jp_value);
-			    }
-			    for (mrt_srcs = grp->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext) {
-				my_action = join_or_prune(mrt_srcs, upstream_router);
-				if (my_action == PIM_ACTION_JOIN) {
-				    jp_value = (RANDOM() % (int)(10 * PIM_RANDOM_DELAY_JOIN_TIMEOUT)) / 10;
-				    /* TODO: XXX: TIMER implem. dependency! */
-				    if (mrt_srcs->jp_timer > jp_value)
-					SET_TIMER(mrt_srcs->jp_timer, jp_value);
-				}
-			    } /* For all (S,G) */
-			} /* For all (*,G) */
-		    }
-		} /* num_p_srcs */
-		continue;  /* This was (*,*,RP) suppression */
-	    }
+    for (i = 0; i < jp->num; i++) {
+	jp_entry_t *entry = &jp->entries[i];
 
-	    /* (*,G) or (S,G) suppression */
-	    /* TODO: XXX: currently, accumulated groups
-	     * (i.e. group_masklen < egaddress_lengt) are not
-	     * implemented. Just need to create a loop and apply the
-	     * procedure below for all groups matching the prefix.
-	     */
-	    while (num_j_srcs--) {
-		GET_ESADDR(&esaddr, data);
-		source = esaddr.src_addr;
-		if (!inet_valid_host(source))
-		    continue;
+	logit(LOG_INFO, 0, "Received PIM %s from %s to group %s for source %s on %s",
+	      entry->action == PIM_ACTION_JOIN ? "JOIN" : "PRUNE",
+	      inet_fmt(src, s1, sizeof(s1)), inet_fmt(entry->group, s2, sizeof(s2)),
+	      inet_fmt(entry->source, s3, sizeof(s3)), ifname);
+    }
+}
 
-		s_flags = esaddr.flags;
-		MASKLEN_TO_MASK(esaddr.masklen, s_mask);
+/*
+ * Another router on the LAN sent the same Join or Prune to our upstream
+ * router, defer our own periodic one.  As in the upstream (S,G) state
+ * machine of RFC 4601, sec. 4.5.7, "See Join(S,G) to RPF'(S,G)", the
+ * Join/Prune timer is increased to t_joinsuppress: a random 1.1 to 1.4
+ * Join/Prune periods, but not past the holdtime of the overheard message.
+ */
+static void jp_suppress(mrtentry_t *mrt, uint16_t holdtime)
+{
+    uint16_t jp_value = PIM_JOIN_PRUNE_PERIOD * (11 + RANDOM() % 4) / 10;
 
-		if ((s_flags & USADDR_RP_BIT) && (s_flags & USADDR_WC_BIT)) {
-		    /* (*,G) JOIN_REQUEST (toward the RP) */
-		    mrt = find_route(INADDR_ANY_N, group, MRTF_WC, DONT_CREATE);
-		    if (!mrt)
-			continue;
+    if (jp_value > holdtime)
+	jp_value = holdtime;
+
+    if (MRT_TIMER_LEFT(mrt->jp_timer) < jp_value) {
+	MRT_SET_TIMER(mrt, mrt->jp_timer, jp_value);
+	jp_stats.suppressed++;
+    }
+}
 
-		    my_action = join_or_prune(mrt, upstream_router);
-		    if (my_action != PIM_ACTION_JOIN)
-			continue;
+/*
+ * Schedule our Join after a random delay, to override a Prune upstream.
+ * The delay, t_override, is within the effective override interval of
+ * the LAN, the upstream router waits that plus the propagation delay
+ * before it acts on the Prune.
+ */
+static void jp_override(struct uvif *v, mrtentry_t *mrt)
+{
+    uint16_t jp_value = (RANDOM() % v->uv_override_ivl) / 1000;
 
-		    /* (*,G) Join suppresion */
-		    if (source != mrt->group->active_rp_grp->rp->rpentry->address)
-			continue;  /* The RP address doesn't match. Ignore. */
+    if (MRT_TIMER_LEFT(mrt->jp_timer) > jp_value) {
+	MRT_SET_TIMER(mrt, mrt->jp_timer, jp_value);
+	jp_stats.overrides++;
+    }
+}
 
-		    /* Check the holdtime */
-		    /* TODO: XXX: TIMER implem. dependency! */
-		    if (mrt->jp_timer > holdtime)
-			continue;
+/*
+ * An overheard Join to our upstream router, suppress our own Join.  Not
+ * when all routers on the LAN do explicit tracking, then the upstream
+ * router needs to hear from each of us.
+ */
+static void jp_suppress_join(struct uvif *v, mrtentry_t *mrt, pim_nbr_entry_t *upstream_router,
+			     uint16_t holdtime)
+{
+    if (v->uv_tracking)
+	return;
 
-		    if ((mrt->jp_timer == holdtime) && (ntohl(src) > ntohl(v->uv_lcl_addr)))
-			continue;
+    if (join_or_prune(mrt, upstream_router) != PIM_ACTION_JOIN)
+	return;
 
-		    continue;
-		} /* End of (*,G) Join suppression */
+    jp_suppress(mrt, holdtime);
+}
 
-		/* (S,G) Join suppresion */
-		mrt = find_route(source, group, MRTF_SG, DONT_CREATE);
-		if (!mrt)
-		    continue;
+/*
+ * Another router on the LAN sends a Prune for an entry we have, either
+ * suppress our own Prune or override theirs with a Join.
+ */
+static void jp_suppress_prune(mrtentry_t *mrt, pim_nbr_entry_t *upstream_router,
+			      uint16_t holdtime, uint32_t src, struct uvif *v)
+{
+    int my_action = join_or_prune(mrt, upstream_router);
 
-		my_action = join_or_prune(mrt, upstream_router);
-		if (my_action != PIM_ACTION_JOIN)
-		    continue;
+    if (my_action == PIM_ACTION_PRUNE) {
+	if ((MRT_TIMER_LEFT(mrt->jp_timer) < holdtime)
+	    || ((MRT_TIMER_LEFT(mrt->jp_timer) == holdtime)
+		&& (ntohl(src) > ntohl(v->uv_lcl_addr))))
+	    jp_suppress(mrt, holdtime);
+    } else if (my_action == PIM_ACTION_JOIN) {
+	jp_override(v, mrt);
+    }
+}
 
-		/* Check the holdtime */
-		/* TODO: XXX: TIMER implem. dependency! */
-		if (mrt->jp_timer > holdtime)
-		    continue;
+/*
+ * Join/Prune suppression for one group record of a message to another
+ * upstream router on the LAN.  This either modifies the J/P timers or
+ * triggers an overriding Join.
+ */
+static void jp_suppress_group(uint32_t src, struct uvif *v, pim_nbr_entry_t *upstream_router,
+			      jp_message_t *jp, jp_group_t *jpg)
+{
+    uint16_t holdtime = jp->holdtime;
+    rpentry_t *rpentry;
+    mrtentry_t *mrt, *mrt_srcs;
+    grpentry_t *grp;
+    jp_entry_t *entry, *end;
 
-		if ((mrt->jp_timer == holdtime) && (ntohl(src) > ntohl(v->uv_lcl_addr)))
-		    continue;
+    entry = &jp->entries[jpg->first];
+    end   = entry + jpg->num_j + jpg->num_p;
 
-		jp_value = PIM_JOIN_PRUNE_PERIOD + 0.5 * (RANDOM() % PIM_JOIN_PRUNE_PERIOD);
-		if (mrt->jp_timer < jp_value)
-		    SET_TIMER(mrt->jp_timer, jp_value);
+    if ((ntohl(jpg->group) == CLASSD_PREFIX) && (jpg->masklen == STAR_STAR_RP_MSKLEN)) {
+	/* (*,*,RP) Join suppression */
+	for (; entry < end; entry++) {
+	    if (!inet_valid_host(entry->source))
+		continue;
+	    if (!(entry->flags & USADDR_RP_BIT) || !(entry->flags & USADDR_WC_BIT))
 		continue;
-	    }
 
-	    /* Prunes suppression */
-	    while (num_p_srcs--) {
-		GET_ESADDR(&esaddr, data);
-		source = esaddr.src_addr;
-		if (!inet_valid_host(source))
-		    continue;
+	    /* This is the RP address. */
+	    rpentry = rp_find(entry->source);
+	    if (!rpentry)
+		continue; /* Don't have such RP. Ignore */
 
-		s_flags = esaddr.flags;
-		MASKLEN_TO_MASK(esaddr.masklen, s_mask);
-		if ((s_flags & USADDR_RP_BIT) && (s_flags & USADDR_WC_BIT)) {
-		    /* (*,G) prune suppression */
-		    rpentry = rp_match(group);
-		    if (!rpentry || (rpentry->address != source))
-			continue;  /* No such RP or it is different. Ignore */
-
-		    mrt = find_route(INADDR_ANY_N, group, MRTF_WC, DONT_CREATE);
-		    if (!mrt)
-			continue;
-
-		    my_action = join_or_prune(mrt, upstream_router);
-		    if (my_action == PIM_ACTION_PRUNE) {
-			/* TODO: XXX: TIMER implem. dependency! */
-			if ((mrt->jp_timer < holdtime)
-			    || ((mrt->jp_timer == holdtime)
-				&& (ntohl(src) > ntohl(v->uv_lcl_addr)))) {
-			    /* Suppress the Prune */
-			    jp_value = PIM_JOIN_PRUNE_PERIOD + 0.5 * (RANDOM() % PIM_JOIN_PRUNE_PERIOD);
-			    if (mrt->jp_timer < jp_value)
-				SET_TIMER(mrt->jp_timer, jp_value);
-			}
-		    }
-		    else if (my_action == PIM_ACTION_JOIN) {
-			/* Override the Prune by scheduling a Join */
-			jp_value = (RANDOM() % (int)(10 * PIM_RANDOM_DELAY_JOIN_TIMEOUT)) / 10;
-			/* TODO: XXX: TIMER implem. dependency! */
-			if (mrt->jp_timer > jp_value)
-			    SET_TIMER(mrt->jp_timer, jp_value);
-		    }
+	    mrt = rpentry->mrtlink;
+	    if (entry->action == PIM_ACTION_JOIN) {
+		jp_suppress_join(v, mrt, upstream_router, holdtime);
+		continue;
+	    }
 
-		    /* Check all (S,G) entries for this group.
-		     * If my_action == JOIN, then send the Join and override
-		     * the (*,G) Prune.
-		     */
-		    for (mrt_srcs = mrt->group->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext) {
-			my_action = join_or_prune(mrt_srcs, upstream_router);
-			if (my_action == PIM_ACTION_JOIN) {
-			    jp_value = (RANDOM() % (int)(10 * PIM_RANDOM_DELAY_JOIN_TIMEOUT)) / 10;
-			    /* TODO: XXX: TIMER implem. dependency! */
-			    if (mrt->jp_timer > jp_value)
-				SET_TIMER(mrt->jp_timer, jp_value);
-			}
-		    } /* For all (S,G) */
-		    continue;  /* End of (*,G) prune suppression */
-		}
+	    /* TODO: XXX: Can we have (*,*,RP) prune message?  Not in
+	     * the spec, but anyway, the code below can handle them:
+	     * either suppress the local (*,*,RP) prunes or override
+	     * the prunes by sending (*,*,RP) and/or (*,G) and/or (S,G)
+	     * Join.
+	     */
+	    jp_suppress_prune(mrt, upstream_router, holdtime, src, v);
 
-		/* (S,G) prune suppression */
-		mrt = find_route(source, group, MRTF_SG, DONT_CREATE);
-		if (!mrt)
-		    continue;
+	    /* Check all (*,G) and (S,G) matching to this RP.  If
+	     * my_action == JOIN, then send a Join and override the
+	     * (*,*,RP) Prune.
+	     */
+	    for (grp = rpentry->cand_rp->rp_grp_next->grplink; grp; grp = grp->rpnext) {
+		if (join_or_prune(grp->grp_route, upstream_router) == PIM_ACTION_JOIN)
+		    jp_override(v, grp->grp_route);
 
-		my_action = join_or_prune(mrt, upstream_router);
-		if (my_action == PIM_ACTION_PRUNE) {
-		    /* Suppress the (S,G) Prune */
-		    /* TODO: XXX: TIMER implem. dependency! */
-		    if ((mrt->jp_timer < holdtime)
-			|| ((mrt->jp_timer == holdtime)
-			    && (ntohl(src) > ntohl(v->uv_lcl_addr)))) {
-			jp_value = PIM_JOIN_PRUNE_PERIOD + 0.5 * (RANDOM() % PIM_JOIN_PRUNE_PERIOD);
-			if (mrt->jp_timer < jp_value)
-			    SET_TIMER(mrt->jp_timer, jp_value);
-		    }
-		}
-		else if (my_action == PIM_ACTION_JOIN) {
-		    /* Override the Prune by scheduling a Join */
-		    jp_value = (RANDOM() % (int)(10 * PIM_RANDOM_DELAY_JOIN_TIMEOUT)) / 10;
-		    /* TODO: XXX: TIMER implem. dependency! */
-		    if (mrt->jp_timer > jp_value)
-			SET_TIMER(mrt->jp_timer, jp_value);
+		for (mrt_srcs = grp->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext) {
+		    if (join_or_prune(mrt_srcs, upstream_router) == PIM_ACTION_JOIN)
+			jp_override(v, mrt_srcs);
 		}
-	    }  /* while (num_p_srcs--) */
-	}  /* while (num_groups--) */
-	return TRUE;
-    }   /* End of Join/Prune suppression code */
+	    }
+	}
 
-    /* I am the target of this join, so process the message */
+	return;
+    }
 
-    /* The spec says that if there is (*,G) Join, it has priority over
-     * old existing ~(S,G) prunes in the routing table.
-     * However, if the (*,G) Join and the ~(S,G) prune are in
-     * the same message, ~(S,G) has the priority. The spec doesn't say it,
-     * but I think the same is true for (*,*,RP) and ~(S,G) prunes.
-     *
-     * The code below do:
-     *  (1) Check the whole message for (*,*,RP) Joins.
-     *  (1.1) If found, clean all pruned_oifs for all (*,G) and all (S,G)
-     *        for each RP in the list, but do not update the kernel cache.
-     *        Then go back to the beginning of the message and start
-     *        processing for each group:
-     *  (2) Check for Prunes. If no prunes, process the Joins.
-     *  (3) If there are Prunes:
-     *  (3.1) Scan the Join part for existing (*,G) Join.
-     *  (3.1.1) If there is (*,G) Join, clear join interface from
-     *          the pruned_oifs for all (S,G), but DO NOT flush the
-     *          change to the kernel (by using change_interfaces()
-     *          for example)
-     *  (3.2) After the pruned_oifs are eventually cleared in (3.1.1),
-     *        process the Prune part of the message normally
-     *        (setting the prune_oifs and flashing the changes to the (kernel).
-     *  (3.3) After the Prune part is processed, process the Join part
-     *        normally (by applying any changes to the kernel)
-     *  (4) If there were (*,*,RP) Join/Prune, process them.
-     *
-     *   If the Join/Prune list is too long, it may result in long processing
-     *   overhead. The idea above is not to place any wrong info in the
-     *   kernel, because it may result in short-time existing traffic
-     *   forwarding on wrong interface.
-     *   Hopefully, in the future will find a better way to implement it.
+    /* (*,G) or (S,G) suppression */
+    /* TODO: XXX: currently, accumulated groups
+     * (i.e. group_masklen < egaddress_lengt) are not
+     * implemented. Just need to create a loop and apply the
+     * procedure below for all groups matching the prefix.
      */
-    num_groups_tmp = num_groups;
-    data_start = data;
-    star_star_rp_found = FALSE; /* Indicating whether we have (*,*,RP) join */
-    while (num_groups_tmp--) {
-	/* Search for (*,*,RP) Join */
-	GET_EGADDR(&egaddr, data);
-	GET_HOSTSHORT(num_j_srcs, data);
-	GET_HOSTSHORT(num_p_srcs, data);
-	group = egaddr.mcast_addr;
-	if ((ntohl(group) != CLASSD_PREFIX) || (egaddr.masklen != STAR_STAR_RP_MSKLEN)) {
-	    /* This is not (*,*,RP). Jump to the next group. */
-	    data += (num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
+    grp = find_group(jpg->group);
+    if (!grp)
+	return;
+
+    for (; entry < end; entry++) {
+	if (!inet_valid_host(entry->source))
 	    continue;
-	}
 
-	/* (*,*,RP) found. For each RP and each (*,G) and each (S,G) clear
-	 * the pruned oif, but do not update the kernel.
-	 */
-	star_star_rp_found = TRUE;
-	while (num_j_srcs--) {
-	    GET_ESADDR(&esaddr, data);
-	    rpentry = rp_find(esaddr.src_addr);
-	    if (!rpentry)
+	if ((entry->flags & USADDR_RP_BIT) && (entry->flags & USADDR_WC_BIT)) {
+	    mrt = grp->grp_route;
+	    if (!mrt)
 		continue;
 
-	    for (rp_grp = rpentry->cand_rp->rp_grp_next; rp_grp; rp_grp = rp_grp->rp_grp_next) {
-		for (grp = rp_grp->grplink; grp; grp = grp->rpnext) {
-		    if (grp->grp_route)
-			PIMD_VIFM_CLR(vifi, grp->grp_route->pruned_oifs);
-		    for (mrt = grp->mrtlink; mrt; mrt = mrt->grpnext)
-			PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
-		}
+	    if (entry->action == PIM_ACTION_JOIN) {
+		/* (*,G) Join suppresion */
+		jp_suppress_join(v, mrt, upstream_router, holdtime);
+		continue;
+	    }
+
+	    /* (*,G) prune suppression */
+	    rpentry = rp_match(jpg->group);
+	    if (!rpentry || (rpentry->address != entry->source))
+		continue;  /* No such RP or it is different. Ignore */
+
+	    jp_suppress_prune(mrt, upstream_router, holdtime, src, v);
+
+	    /* Check all (S,G) entries for this group.  If my_action ==
+	     * JOIN, then send the Join and override the (*,G) Prune.
+	     */
+	    for (mrt_srcs = grp->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext) {
+		if (join_or_prune(mrt_srcs, upstream_router) == PIM_ACTION_JOIN)
+		    jp_override(v, mrt_srcs);
 	    }
+	    continue;
+	}
+
+	mrt = find_sg_route(grp, entry->source);
+	if (!mrt)
+	    continue;
+
+	if (entry->action == PIM_ACTION_PRUNE) {
+	    /* (S,G) prune suppression */
+	    jp_suppress_prune(mrt, upstream_router, holdtime, src, v);
+	    continue;
 	}
-	data += (num_p_srcs) * sizeof(pim_encod_src_addr_t);
+
+	/* (S,G) Join suppresion */
+	jp_suppress_join(v, mrt, upstream_router, holdtime);
     }
+}
 
-    /*
-     * Start processing the groups. If this is (*,*,RP), skip it, but process
-     * it at the end.
-     */
-    data = data_start;
-    num_groups_tmp = num_groups;
-    while (num_groups_tmp--) {
-	GET_EGADDR(&egaddr, data);
-	GET_HOSTSHORT(num_j_srcs, data);
-	GET_HOSTSHORT(num_p_srcs, data);
-	group = egaddr.mcast_addr;
-	if (!IN_MULTICAST(ntohl(group))) {
-	    data += (num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
-	    continue;		/* Ignore this group and jump to the next one */
+static void jp_change_interfaces(mrtentry_t *mrt)
+{
+    change_interfaces(mrt,
+		      mrt->incoming,
+		      mrt->joined_oifs,
+		      mrt->pruned_oifs,
+		      mrt->leaves,
+		      mrt->asserted_oifs, 0);
+}
+
+struct pool	jptrack_pool;
+
+/*
+ * The joins on a LAN are known to be tracked when all routers on it
+ * have done explicit tracking for a Join/Prune holdtime, by then every
+ * Join from before has either been refreshed or timed out.
+ */
+static int jp_tracking(struct uvif *v)
+{
+    return v->uv_tracking && route_clock - v->uv_tracking_since >= PIM_JOIN_PRUNE_HOLDTIME;
+}
+
+/* Record, or refresh, a Join from the downstream router @address */
+static void jp_track(mrtentry_t *mrt, vifi_t vifi, uint32_t address, uint16_t holdtime)
+{
+    jptrack_t *jt;
+
+    for (jt = mrt->track; jt; jt = jt->next) {
+	if (jt->address == address && jt->vifi == vifi)
+	    break;
+    }
+
+    if (!jt) {
+	pool_init(&jptrack_pool, "jptrack", sizeof(jptrack_t));
+	jt = pool_alloc(&jptrack_pool);
+	if (!jt)
+	    return;	/* Prunes on this LAN fall back to the override interval */
+
+	jt->address = address;
+	jt->vifi    = vifi;
+	jt->next    = mrt->track;
+	mrt->track  = jt;
+    }
+
+    jt->expires = route_clock + holdtime;
+}
+
+/*
+ * Forget the Join of @address on @vifi, after a Prune, and any that have
+ * timed out.  Returns the number of downstream routers still joined.
+ */
+static int jp_untrack(mrtentry_t *mrt, vifi_t vifi, uint32_t address)
+{
+    jptrack_t *jt, **prev = &mrt->track;
+    int joined = 0;
+
+    while ((jt = *prev)) {
+	if ((jt->address == address && jt->vifi == vifi) || MRT_TIMEOUT(jt->expires)) {
+	    *prev = jt->next;
+	    pool_free(&jptrack_pool, jt);
+	    continue;
+	}
+
+	if (jt->vifi == vifi)
+	    joined++;
+	prev = &jt->next;
+    }
+
+    return joined;
+}
+
+/* Routing entry deleted, see FREE_MRTENTRY() */
+void jp_forget(mrtentry_t *mrt)
+{
+    jptrack_t *jt;
+
+    while ((jt = mrt->track)) {
+	mrt->track = jt->next;
+	pool_free(&jptrack_pool, jt);
+    }
+}
+
+/*
+ * Add @vifi to the joined oifs of @mrt and restart its timers.  Returns
+ * TRUE if the interface was not already joined.
+ */
+static int jp_join_oif(mrtentry_t *mrt, vifi_t vifi, jp_message_t *jp)
+{
+    int new_join = (PIMD_VIFM_ISSET(vifi, mrt->joined_oifs) == 0);
+    uint16_t holdtime = jp->holdtime;
+
+    if (uvifs[vifi].uv_tracking)
+	jp_track(mrt, vifi, jp->sender, holdtime);
+
+    PIMD_VIFM_SET(vifi, mrt->joined_oifs);
+    PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
+    PIMD_VIFM_CLR(vifi, mrt->asserted_oifs);
+    /* TODO: XXX: TIMER implem. dependency! */
+    if (MRT_TIMER_LEFT(mrt->vif_timers[vifi]) < holdtime) {
+	MRT_SET_TIMER(mrt, mrt->vif_timers[vifi], holdtime);
+	mrt->vif_deletion_delay[vifi] = holdtime/3;
+    }
+    if (MRT_TIMER_LEFT(mrt->entry_timer) < holdtime)
+	MRT_SET_TIMER(mrt, mrt->entry_timer, holdtime);
+
+    return new_join;
+}
+
+/*
+ * Prune @vifi from @mrt.  If the link is point-to-point, timeout the
+ * oif immediately.  On a LAN where joins are tracked the oif is kept as
+ * long as any other downstream router is joined, and is otherwise also
+ * timed out immediately.  On other LANs, decrease the timer to the J/P
+ * override interval, the propagation delay and override interval of the
+ * LAN, to allow other downstream routers to override the prune.
+ */
+static void jp_prune_oif(mrtentry_t *mrt, vifi_t vifi, jp_message_t *jp, int asserted)
+{
+    struct uvif *v = &uvifs[vifi];
+    uint16_t delay;
+    int joined = 0;
+
+    if (mrt->track)
+	joined = jp_untrack(mrt, vifi, jp->sender);
+
+    /* TODO: XXX: increase the entry timer? */
+    if (v->uv_flags & VIFF_POINT_TO_POINT) {
+	MRT_FIRE_TIMER(mrt, mrt->vif_timers[vifi]);
+    } else if (jp_tracking(v)) {
+	if (joined) {
+	    jp_stats.tracked++;
+	    return;
 	}
 
-	if ((ntohl(group) == CLASSD_PREFIX)
-	    && (egaddr.masklen == STAR_STAR_RP_MSKLEN)) {
-	    /* This is (*,*,RP). Jump to the next group. */
-	    data += (num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
+	MRT_FIRE_TIMER(mrt, mrt->vif_timers[vifi]);
+	jp_stats.fast_prunes++;
+    } else {
+	/* Rounded up, and one more for the part of a tick already gone */
+	delay = (v->uv_prop_delay + v->uv_override_ivl + 999) / 1000 + ROUTE_INTERVAL;
+	if (delay > mrt->vif_deletion_delay[vifi])
+	    delay = mrt->vif_deletion_delay[vifi];
+
+	if (MRT_TIMER_LEFT(mrt->vif_timers[vifi]) > delay)
+	    MRT_SET_TIMER(mrt, mrt->vif_timers[vifi], delay);
+    }
+
+    if (!MRT_TIMER_LEFT(mrt->vif_timers[vifi])) {
+	PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
+	PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
+	if (asserted)
+	    PIMD_VIFM_SET(vifi, mrt->asserted_oifs);
+	jp_change_interfaces(mrt);
+    }
+}
+
+/* Create a pruned (*,G) or (S,G)RPbit entry, overriding the Join inherited from above */
+static void jp_prune_new(mrtentry_t *mrt, vifi_t vifi)
+{
+    mrt->flags &= ~MRTF_NEW;
+    MRT_FIRE_TIMER(mrt, mrt->vif_timers[vifi]);
+    /* TODO: XXX: The spec says to delete the oif. However, its
+     * timer only should be lowered, so the prune can be overwritten
+     * on multiaccess LAN. Spec BUG.
+     */
+    PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
+    PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
+    jp_change_interfaces(mrt);
+}
+
+/*
+ * The Prune part of a (*,G) or (S,G) group record, processed before the
+ * Join part so that a (*,G) Join and ~(S,G) Prune in the same message
+ * leave the ~(S,G) prune in place.  The group is looked up once by the
+ * caller, @grp may be NULL and is updated if a new entry creates it.
+ */
+static void jp_receive_prunes(vifi_t vifi, jp_message_t *jp, jp_group_t *jpg, grpentry_t *grp)
+{
+    uint16_t holdtime = jp->holdtime;
+    uint32_t group = jpg->group;
+    jp_entry_t *entry, *end;
+    mrtentry_t *mrt;
+
+    entry = &jp->entries[jpg->first + jpg->num_j];
+    end   = entry + jpg->num_p;
+
+    for (; entry < end; entry++) {
+	uint32_t source = entry->source;
+	uint8_t s_flags = entry->flags;
+
+	if (!inet_valid_host(source))
+	    continue;
+
+	if (!(s_flags & (USADDR_WC_BIT | USADDR_RP_BIT))) {
+	    /* (S,G) prune sent toward S */
+	    mrt = find_sg_route(grp, source);
+	    if (!mrt)
+		continue;   /* I don't have (S,G) to prune. Ignore. */
+
+	    jp_prune_oif(mrt, vifi, jp, 0);
 	    continue;
 	}
 
-	rpentry = rp_match(group);
-	if (!rpentry) {
-	    data += (num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
+	if ((s_flags & USADDR_RP_BIT) && (!(s_flags & USADDR_WC_BIT))) {
+	    /* ~(S,G)RPbit prune sent toward the RP */
+	    mrt = find_sg_route(grp, source);
+	    if (mrt) {
+		MRT_SET_TIMER(mrt, mrt->entry_timer, holdtime);
+		jp_prune_oif(mrt, vifi, jp, 0);
+		continue;
+	    }
+
+	    /* There is no (S,G) entry. Check for (*,G) or (*,*,RP) */
+	    mrt = find_route(INADDR_ANY_N, group, MRTF_WC | MRTF_PMBR, DONT_CREATE);
+	    if (mrt) {
+		mrt = find_route(source, group, MRTF_SG | MRTF_RP, CREATE);
+		grp = find_group(group);
+		if (!mrt)
+		    continue;
+
+		/* TODO: XXX: The spec doens't say what value to use for
+		 * the entry time. Use the J/P holdtime.
+		 */
+		MRT_SET_TIMER(mrt, mrt->entry_timer, holdtime);
+		jp_prune_new(mrt, vifi);
+	    }
 	    continue;
 	}
 
-	data_group_j_start = data;
-	data_group_p_start = data + num_j_srcs * sizeof(pim_encod_src_addr_t);
-	data_group_end = data + (num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
+	if ((s_flags & USADDR_RP_BIT) && (s_flags & USADDR_WC_BIT)) {
+	    /* (*,G) Prune */
+	    mrt = find_route(INADDR_ANY_N, group, MRTF_WC | MRTF_PMBR, DONT_CREATE);
+	    if (!mrt)
+		continue;
 
-	/* Scan the Join part for (*,G) Join and then clear the
-	 * particular interface from pruned_oifs for all (S,G).
-	 * If the RP address in the Join message is different from
-	 * the local match, ignore the whole group.
-	 */
-	num_j_srcs_tmp = num_j_srcs;
-	ignore_group = FALSE;
-	while (num_j_srcs_tmp--) {
-	    GET_ESADDR(&esaddr, data);
-	    if ((esaddr.flags & USADDR_RP_BIT) && (esaddr.flags & USADDR_WC_BIT)) {
-		/* This is the RP address, i.e. (*,G) Join.
-		 * Check if the RP-mapping is consistent and if "yes",
-		 * then Reset the pruned_oifs for all (S,G) entries.
+	    if (mrt->flags & MRTF_WC) {
+		/* TODO: XXX: Should check the whole Prune list in
+		 * advance for (*,G) prune and if the RP address
+		 * does not match the local RP-map, then ignore the
+		 * whole group, not only this particular (*,G) prune.
 		 */
-		if (rpentry->address != esaddr.src_addr) {
-		    ignore_group = TRUE;
-		    break;
-		}
+		if (mrt->group->active_rp_grp->rp->rpentry->address != source)
+		    continue; /* The RP address doesn't match. */
 
-		mrt = find_route(INADDR_ANY_N, group, MRTF_WC, DONT_CREATE);
-		if (mrt) {
-		    for (mrt_srcs = mrt->group->mrtlink;
-			 mrt_srcs;
-			 mrt_srcs = mrt_srcs->grpnext)
-			PIMD_VIFM_CLR(vifi, mrt_srcs->pruned_oifs);
-		}
-		break;
+		jp_prune_oif(mrt, vifi, jp, 0);
+		continue;
 	    }
+
+	    /* No (*,G) entry, but found (*,*,RP). Create (*,G) */
+	    if (mrt->source->address != source)
+		continue; /* The RP address doesn't match. */
+
+	    mrt = find_route(INADDR_ANY_N, group, MRTF_WC, CREATE);
+	    grp = find_group(group);
+	    if (!mrt)
+		continue;
+
+	    jp_prune_new(mrt, vifi);
 	}
+    }
+}
+
+/* The Join part of a (*,G) or (S,G) group record, see jp_receive_prunes() */
+static void jp_receive_joins(vifi_t vifi, jp_message_t *jp, jp_group_t *jpg)
+{
+    uint32_t group = jpg->group;
+    jp_entry_t *entry, *end;
+    mrtentry_t *mrt, *mrt_srcs;
+    int new_join;
 
-	if (ignore_group == TRUE) {
-	    data += (num_j_srcs_tmp + num_p_srcs) * sizeof(pim_encod_src_addr_t);
+    entry = &jp->entries[jpg->first];
+    end   = entry + jpg->num_j;
+
+    for (; entry < end; entry++) {
+	uint32_t source = entry->source;
+	uint8_t s_flags = entry->flags;
+
+	if (!inet_valid_host(source))
 	    continue;
-	}
 
-	data = data_group_p_start;
-	/* Process the Prune part first */
-	while (num_p_srcs--) {
-	    GET_ESADDR(&esaddr, data);
-	    source = esaddr.src_addr;
-	    if (!inet_valid_host(source))
+	if ((s_flags & USADDR_WC_BIT) && (s_flags & USADDR_RP_BIT)) {
+	    /* (*,G) Join toward RP */
+	    /* It has been checked already that this RP address is
+	     * the same as the local RP-maping.
+	     */
+	    mrt = find_route(INADDR_ANY_N, group, MRTF_WC, CREATE);
+	    if (!mrt)
 		continue;
 
-	    s_flags = esaddr.flags;
-	    if (!(s_flags & (USADDR_WC_BIT | USADDR_RP_BIT))) {
-		/* (S,G) prune sent toward S */
-		mrt = find_route(source, group, MRTF_SG, DONT_CREATE);
-		if (!mrt)
-		    continue;   /* I don't have (S,G) to prune. Ignore. */
+	    new_join = jp_join_oif(mrt, vifi, jp);
+	    jp_change_interfaces(mrt);
+	    if (mrt->flags & MRTF_NEW) {
+		mrt->flags &= ~MRTF_NEW;
+		send_pim_join(mrt->upstream, mrt, MRTF_RP | MRTF_WC, PIM_JOIN_PRUNE_HOLDTIME);
+	    }
 
-		/* If the link is point-to-point, timeout the oif
-		 * immediately, otherwise decrease the timer to allow
-		 * other downstream routers to override the prune.
-		 */
-		/* TODO: XXX: increase the entry timer? */
-		if (v->uv_flags & VIFF_POINT_TO_POINT) {
-		    FIRE_TIMER(mrt->vif_timers[vifi]);
+	    /* Need to update the (S,G) entries, because of the previous
+	     * cleaning of the pruned_oifs. The reason is that if the
+	     * oifs for (*,G) weren't changed, the (S,G) entries won't
+	     * be updated by change_interfaces()
+	     */
+	    for (mrt_srcs = mrt->group->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext) {
+		if (new_join) {
+		    send_pim_join(mrt_srcs->upstream, mrt_srcs, MRTF_SG, PIM_JOIN_PRUNE_HOLDTIME);
+		    PIMD_VIFM_SET(vifi, mrt_srcs->joined_oifs);
+		    PIMD_VIFM_CLR(vifi, mrt_srcs->pruned_oifs);
+		    PIMD_VIFM_CLR(vifi, mrt_srcs->asserted_oifs);
+		    jp_change_interfaces(mrt_srcs);
+		    add_kernel_cache(mrt_srcs, mrt_srcs->source->address, mrt_srcs->group->group,
+				     MFC_MOVE_FORCE);
+		    mrt_srcs->flags |= MRTF_SPT;
+		    k_chg_mfc(igmp_socket, mrt_srcs->source->address, mrt_srcs->group->group,
+			      mrt_srcs->incoming, mrt_srcs->oifs, mrt_srcs->source->address);
 		} else {
-		    /* TODO: XXX: TIMER implem. dependency! */
-		    if (mrt->vif_timers[vifi] > mrt->vif_deletion_delay[vifi])
-			SET_TIMER(mrt->vif_timers[vifi],
-				  mrt->vif_deletion_delay[vifi]);
+		    jp_change_interfaces(mrt_srcs);
 		}
-		IF_TIMER_NOT_SET(mrt->vif_timers[vifi]) {
-		    PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
-		    PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
-		    change_interfaces(mrt,
-				      mrt->incoming,
-				      mrt->joined_oifs,
-				      mrt->pruned_oifs,
-				      mrt->leaves,
-				      mrt->asserted_oifs, 0);
-		}
-		continue;
 	    }
+	    continue;
+	}
 
-	    if ((s_flags & USADDR_RP_BIT) && (!(s_flags & USADDR_WC_BIT))) {
-		/* ~(S,G)RPbit prune sent toward the RP */
-		mrt = find_route(source, group, MRTF_SG, DONT_CREATE);
-		if (mrt) {
-		    SET_TIMER(mrt->entry_timer, holdtime);
-		    if (v->uv_flags & VIFF_POINT_TO_POINT) {
-			FIRE_TIMER(mrt->vif_timers[vifi]);
-		    } else {
-			/* TODO: XXX: TIMER implem. dependency! */
-			if (mrt->vif_timers[vifi] > mrt->vif_deletion_delay[vifi])
-			    SET_TIMER(mrt->vif_timers[vifi],
-				      mrt->vif_deletion_delay[vifi]);
-		    }
-		    IF_TIMER_NOT_SET(mrt->vif_timers[vifi]) {
-			PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
-			PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
-			change_interfaces(mrt,
-					  mrt->incoming,
-					  mrt->joined_oifs,
-					  mrt->pruned_oifs,
-					  mrt->leaves,
-					  mrt->asserted_oifs, 0);
-		    }
-		    continue;
-		}
+	if (!(s_flags & (USADDR_WC_BIT | USADDR_RP_BIT))) {
+	    /* (S,G) Join toward S */
+	    if (vifi == get_iif(source))
+		continue;  /* Ignore this (S,G) Join */
 
-		/* There is no (S,G) entry. Check for (*,G) or (*,*,RP) */
-		mrt = find_route(INADDR_ANY_N, group, MRTF_WC | MRTF_PMBR, DONT_CREATE);
-		if (mrt) {
-		    mrt = find_route(source, group, MRTF_SG | MRTF_RP, CREATE);
-		    if (!mrt)
-			continue;
-
-		    mrt->flags &= ~MRTF_NEW;
-		    RESET_TIMER(mrt->vif_timers[vifi]);
-		    /* TODO: XXX: The spec doens't say what value to use for
-		     * the entry time. Use the J/P holdtime.
-		     */
-		    SET_TIMER(mrt->entry_timer, holdtime);
-		    /* TODO: XXX: The spec says to delete the oif. However,
-		     * its timer only should be lowered, so the prune can be
-		     * overwritten on multiaccess LAN. Spec BUG.
-		     */
-		    PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
-		    PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
-		    change_interfaces(mrt,
-				      mrt->incoming,
-				      mrt->joined_oifs,
-				      mrt->pruned_oifs,
-				      mrt->leaves,
-				      mrt->asserted_oifs, 0);
-		}
+	    mrt = find_route(source, group, MRTF_SG, CREATE);
+	    if (!mrt)
 		continue;
+
+	    new_join = jp_join_oif(mrt, vifi, jp);
+	    /* If this is a new entry, send immediately the
+	     * Join message toward S.
+	     */
+	    if (mrt->flags & MRTF_NEW) {
+		mrt->flags &= ~MRTF_NEW;
+		send_pim_join(mrt->upstream, mrt, MRTF_SG, PIM_JOIN_PRUNE_HOLDTIME);
 	    }
 
-	    if ((s_flags & USADDR_RP_BIT) && (s_flags & USADDR_WC_BIT)) {
-		/* (*,G) Prune */
-		mrt = find_route(INADDR_ANY_N, group, MRTF_WC | MRTF_PMBR, DONT_CREATE);
-		if (mrt) {
-		    if (mrt->flags & MRTF_WC) {
-			/* TODO: XXX: Should check the whole Prune list in
-			 * advance for (*,G) prune and if the RP address
-			 * does not match the local RP-map, then ignore the
-			 * whole group, not only this particular (*,G) prune.
-			 */
-			if (mrt->group->active_rp_grp->rp->rpentry->address != source)
-			    continue; /* The RP address doesn't match. */
-
-			if (v->uv_flags & VIFF_POINT_TO_POINT) {
-			    FIRE_TIMER(mrt->vif_timers[vifi]);
-			} else {
-			    /* TODO: XXX: TIMER implem. dependency! */
-			    if (mrt->vif_timers[vifi] > mrt->vif_deletion_delay[vifi])
-				SET_TIMER(mrt->vif_timers[vifi],
-					  mrt->vif_deletion_delay[vifi]);
-			}
-			IF_TIMER_NOT_SET(mrt->vif_timers[vifi]) {
-			    PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
-			    PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
-			    change_interfaces(mrt,
-					      mrt->incoming,
-					      mrt->joined_oifs,
-					      mrt->pruned_oifs,
-					      mrt->leaves,
-					      mrt->asserted_oifs, 0);
-			}
-			continue;
-		    }
+	    /* Note that we must create (S,G) without the RPbit set.
+	     * If we already had such entry, change_interfaces() will
+	     * reset the RPbit propertly.
+	     */
+	    change_interfaces(mrt,
+			      mrt->source->incoming,
+			      mrt->joined_oifs,
+			      mrt->pruned_oifs,
+			      mrt->leaves,
+			      mrt->asserted_oifs, 0);
+	    /* If this is join from new interface and we have incoming data
+	     * start forwarding immediately.
+	     */
+	    if (new_join) {
+		add_kernel_cache(mrt, mrt->source->address, mrt->group->group, MFC_MOVE_FORCE);
+		k_chg_mfc(igmp_socket, mrt->source->address, mrt->group->group,
+			  mrt->incoming, mrt->oifs, mrt->source->address);
+	    }
+	}
+    }
+}
 
-		    /* No (*,G) entry, but found (*,*,RP). Create (*,G) */
-		    if (mrt->source->address != source)
-			continue; /* The RP address doesn't match. */
-
-		    mrt = find_route(INADDR_ANY_N, group, MRTF_WC, CREATE);
-		    if (!mrt)
-			continue;
-
-		    mrt->flags &= ~MRTF_NEW;
-		    RESET_TIMER(mrt->vif_timers[vifi]);
-		    /* TODO: XXX: should only lower the oif timer, so it can
-		     * be overwritten on multiaccess LAN. Spec bug.
-		     */
-		    PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
-		    PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
-		    change_interfaces(mrt,
-				      mrt->incoming,
-				      mrt->joined_oifs,
-				      mrt->pruned_oifs,
-				      mrt->leaves,
-				      mrt->asserted_oifs, 0);
-		} /* (*,G) or (*,*,RP) found */
-	    } /* (*,G) prune */
-	} /* while (num_p_srcs--) */
-	/* End of (S,G) and (*,G) Prune handling */
-
-	/* Jump back to the Join part and process it */
-	data = data_group_j_start;
-	while (num_j_srcs--) {
-	    GET_ESADDR(&esaddr, data);
-	    source = esaddr.src_addr;
-	    if (!inet_valid_host(source))
+/* One (*,G) or (S,G) group record of a message to us */
+static void jp_receive_group(vifi_t vifi, jp_message_t *jp, jp_group_t *jpg)
+{
+    rpentry_t *rpentry;
+    grpentry_t *grp;
+    mrtentry_t *mrt;
+
+    rpentry = rp_match(jpg->group);
+    if (!rpentry)
+	return;
+
+    grp = find_group(jpg->group);
+
+    /* If there is a (*,G) Join, clear the particular interface from
+     * pruned_oifs for all (S,G).  If the RP address in the Join
+     * message is different from the local match, ignore the whole
+     * group.
+     */
+    if (jpg->wc < jpg->num_j) {
+	if (rpentry->address != jp->entries[jpg->first + jpg->wc].source)
+	    return;
+
+	if (grp && grp->grp_route) {
+	    for (mrt = grp->mrtlink; mrt; mrt = mrt->grpnext)
+		PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
+	}
+    }
+
+    jp_receive_prunes(vifi, jp, jpg, grp);
+    jp_receive_joins(vifi, jp, jpg);
+}
+
+/* (*,*,RP) Join/Prune, processed after all groups in the message */
+static void jp_receive_rp(vifi_t vifi, jp_message_t *jp, jp_group_t *jpg)
+{
+    jp_entry_t *entry, *end;
+    rp_grp_entry_t *rp_grp;
+    mrtentry_t *mrt, *mrt_srcs;
+    grpentry_t *grp;
+
+    entry = &jp->entries[jpg->first];
+    end   = entry + jpg->num_j + jpg->num_p;
+
+    for (; entry < end; entry++) {
+	if (!inet_valid_host(entry->source))
+	    continue;
+
+	if (entry->action == PIM_ACTION_PRUNE) {
+	    /* TODO: XXX: can we have (*,*,RP) Prune? */
+	    mrt = find_route(entry->source, INADDR_ANY_N, MRTF_PMBR, DONT_CREATE);
+	    if (!mrt)
 		continue;
 
-	    s_flags = esaddr.flags;
-	    MASKLEN_TO_MASK(esaddr.masklen, s_mask);
-	    if ((s_flags & USADDR_WC_BIT) && (s_flags & USADDR_RP_BIT)) {
-		/* (*,G) Join toward RP */
-		/* It has been checked already that this RP address is
-		 * the same as the local RP-maping.
-		 */
-		mrt = find_route(INADDR_ANY_N, group, MRTF_WC, CREATE);
-		if (!mrt)
-		    continue;
+	    jp_prune_oif(mrt, vifi, jp, 1);
+	    continue;
+	}
+
+	/* TODO: XXX: check that the iif is different from the Join oifs */
+	mrt = find_route(entry->source, INADDR_ANY_N, MRTF_PMBR, CREATE);
+	if (!mrt)
+	    continue;
+
+	jp_join_oif(mrt, vifi, jp);
+	mrt->flags &= ~MRTF_NEW;
+	jp_change_interfaces(mrt);
+
+	/* Need to update the (S,G) and (*,G) entries, because of
+	 * the previous cleaning of the pruned_oifs. The reason is
+	 * that if the oifs for (*,*,RP) weren't changed, the
+	 * (*,G) and (S,G) entries won't be updated by change_interfaces()
+	 */
+	for (rp_grp = mrt->source->cand_rp->rp_grp_next; rp_grp; rp_grp = rp_grp->rp_grp_next) {
+	    for (grp = rp_grp->grplink; grp; grp = grp->rpnext) {
+		if (grp->grp_route)
+		    jp_change_interfaces(grp->grp_route);
+		for (mrt_srcs = grp->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext)
+		    jp_change_interfaces(mrt_srcs);
+	    }
+	}
+    }
+}
+
+/* For each RP with a (*,*,RP) Join, clear the pruned oif in all (*,G) and (S,G) */
+static void jp_clear_rp_pruned(vifi_t vifi, jp_message_t *jp, jp_group_t *jpg)
+{
+    jp_entry_t *entry, *end;
+    rp_grp_entry_t *rp_grp;
+    rpentry_t *rpentry;
+    grpentry_t *grp;
+    mrtentry_t *mrt;
+
+    entry = &jp->entries[jpg->first];
+    end   = entry + jpg->num_j;
+
+    for (; entry < end; entry++) {
+	rpentry = rp_find(entry->source);
+	if (!rpentry)
+	    continue;
+
+	for (rp_grp = rpentry->cand_rp->rp_grp_next; rp_grp; rp_grp = rp_grp->rp_grp_next) {
+	    for (grp = rp_grp->grplink; grp; grp = grp->rpnext) {
+		if (grp->grp_route)
+		    PIMD_VIFM_CLR(vifi, grp->grp_route->pruned_oifs);
+		for (mrt = grp->mrtlink; mrt; mrt = mrt->grpnext)
+		    PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
+	    }
+	}
+    }
+}
+
+static int jp_star_star_rp(jp_group_t *jpg)
+{
+    return ntohl(jpg->group) == CLASSD_PREFIX && jpg->masklen == STAR_STAR_RP_MSKLEN;
+}
+
+int receive_pim_join_prune(uint32_t src, uint32_t dst __attribute__((unused)), char *msg, size_t len)
+{
+    static jp_message_t jp;
+    vifi_t vifi;
+    struct uvif *v;
+    pim_nbr_entry_t *upstream_router;
+    jp_group_t *jpg, *end;
+
+    if ((vifi = find_vif_direct(src)) == NO_VIF) {
+	/* Either a local vif or somehow received PIM_JOIN_PRUNE from
+	 * non-directly connected router. Ignore it.
+	 */
+	if (local_address(src) == NO_VIF) {
+	    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
+		logit(LOG_INFO, 0, "Ignoring PIM_JOIN_PRUNE from non-neighbor router %s",
+		      inet_fmt(src, s1, sizeof(s1)));
+	}
+
+	return FALSE;
+    }
 
-		new_join = (PIMD_VIFM_ISSET(vifi, mrt->joined_oifs) == 0);
-		PIMD_VIFM_SET(vifi, mrt->joined_oifs);
-		PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
-		PIMD_VIFM_CLR(vifi, mrt->asserted_oifs);
-		/* TODO: XXX: TIMER implem. dependency! */
-		if (mrt->vif_timers[vifi] < holdtime) {
-		    SET_TIMER(mrt->vif_timers[vifi], holdtime);
-		    mrt->vif_deletion_delay[vifi] = holdtime/3;
-		}
-		if (mrt->entry_timer < holdtime)
-		    SET_TIMER(mrt->entry_timer, holdtime);
-		change_interfaces(mrt,
-				  mrt->incoming,
-				  mrt->joined_oifs,
-				  mrt->pruned_oifs,
-				  mrt->leaves,
-				  mrt->asserted_oifs, 0);
-		if (mrt->flags & MRTF_NEW) {
-		    mrt->flags &= ~MRTF_NEW;
-		    send_pim_join(mrt->upstream, mrt, MRTF_RP | MRTF_WC, PIM_JOIN_PRUNE_HOLDTIME);
-		}
-		/* Need to update the (S,G) entries, because of the previous
-		 * cleaning of the pruned_oifs. The reason is that if the
-		 * oifs for (*,G) weren't changed, the (S,G) entries won't
-		 * be updated by change_interfaces()
-		 */
-		for (mrt_srcs = mrt->group->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext) {
-		    if (new_join) {
-			send_pim_join(mrt_srcs->upstream, mrt_srcs, MRTF_SG, PIM_JOIN_PRUNE_HOLDTIME);
-			PIMD_VIFM_SET(vifi, mrt_srcs->joined_oifs);
-			PIMD_VIFM_CLR(vifi, mrt_srcs->pruned_oifs);
-			PIMD_VIFM_CLR(vifi, mrt_srcs->asserted_oifs);
-			change_interfaces(mrt_srcs,
-					  mrt_srcs->incoming,
-					  mrt_srcs->joined_oifs,
-					  mrt_srcs->pruned_oifs,
-					  mrt_srcs->leaves,
-					  mrt_srcs->asserted_oifs, 0);
-			add_kernel_cache(mrt_srcs, mrt_srcs->source->address, mrt_srcs->group->group,
-					 MFC_MOVE_FORCE);
-			mrt_srcs->flags |= MRTF_SPT;
-			k_chg_mfc(igmp_socket, mrt_srcs->source->address, mrt_srcs->group->group,
-				  mrt_srcs->incoming, mrt_srcs->oifs, mrt_srcs->source->address);
-		    }
-		   else {
-			change_interfaces(mrt_srcs,
-					  mrt_srcs->incoming,
-					  mrt_srcs->joined_oifs,
-					  mrt_srcs->pruned_oifs,
-					  mrt_srcs->leaves,
-					  mrt_srcs->asserted_oifs, 0);
-		    }
-		}
-		continue;
-	    }
+    /* Checksum */
+    if (inet_cksum((uint16_t *)msg, len))
+	return FALSE;
+
+    v = &uvifs[vifi];
+    if (uvifs[vifi].uv_flags & (VIFF_DOWN | VIFF_DISABLED | VIFF_NONBRS | VIFF_REGISTER))
+	return FALSE;    /* Shoudn't come on this interface */
 
-	    if (!(s_flags & (USADDR_WC_BIT | USADDR_RP_BIT))) {
-		/* (S,G) Join toward S */
-		if (vifi == get_iif(source))
-		    continue;  /* Ignore this (S,G) Join */
+    if (parse_pim_join_prune(msg, len, &jp) == FALSE) {
+	IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
+	    logit(LOG_NOTICE, 0, "Malformed Join/Prune message (%zu bytes) from %s on %s",
+		  len, inet_fmt(src, s1, sizeof(s1)), v->uv_name);
+	jp_stats.malformed++;
 
-		mrt = find_route(source, group, MRTF_SG, CREATE);
-		if (!mrt)
-		    continue;
+	return FALSE;
+    }
 
-		new_join = (PIMD_VIFM_ISSET(vifi, mrt->joined_oifs) == 0);
-		PIMD_VIFM_SET(vifi, mrt->joined_oifs);
-		PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
-		PIMD_VIFM_CLR(vifi, mrt->asserted_oifs);
-		/* TODO: XXX: TIMER implem. dependency! */
-		if (mrt->vif_timers[vifi] < holdtime) {
-		    SET_TIMER(mrt->vif_timers[vifi], holdtime);
-		    mrt->vif_deletion_delay[vifi] = holdtime/3;
-		}
-		if (mrt->entry_timer < holdtime)
-		    SET_TIMER(mrt->entry_timer, holdtime);
-		/* If this is a new entry, send immediately the
-		 * Join message toward S.
-		 */
-		if (mrt->flags & MRTF_NEW) {
-		    mrt->flags &= ~MRTF_NEW;
-		    send_pim_join(mrt->upstream, mrt, MRTF_SG, PIM_JOIN_PRUNE_HOLDTIME);
-		}
+    jp.sender = src;
+    jp_stats.received++;
+    jp_stats.rx_entries += jp.num;
 
-		/* Note that we must create (S,G) without the RPbit set.
-		 * If we already had such entry, change_interfaces() will
-		 * reset the RPbit propertly.
-		 */
-		change_interfaces(mrt,
-				  mrt->source->incoming,
-				  mrt->joined_oifs,
-				  mrt->pruned_oifs,
-				  mrt->leaves,
-				  mrt->asserted_oifs, 0);
-		/* If this is join from new interface and we have incoming data
-		 * start forwarding immediately.
-		 */
-		if (new_join) {
-		    add_kernel_cache(mrt, mrt->source->address, mrt->group->group, MFC_MOVE_FORCE);
-		    k_chg_mfc(igmp_socket, mrt->source->address, mrt->group->group,
-			      mrt->incoming, mrt->oifs, mrt->source->address);
-		}
-		continue;
-	    }
-	} /* while (num_j_srcs--) */
-	data = data_group_end;
-    } /* for all groups */
+    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE) {
+	logit(LOG_INFO, 0, "Received PIM JOIN/PRUNE from %s on %s",
+	      inet_fmt(src, s1, sizeof(s1)), v->uv_name);
+	log_pim_join_prune(src, &jp, v->uv_name);
+    }
 
-    /* Now process the (*,*,RP) Join/Prune */
-    if (star_star_rp_found != TRUE)
-	return TRUE;
+    end = &jp.groups[jp.num_groups];
 
-    data = data_start;
-    while (num_groups--) {
-	/* The conservative approach is to scan again the whole message,
-	 * just in case if we have more than one (*,*,RP) requests.
+    if (jp.target != v->uv_lcl_addr) {
+	/* if I am not the target of the join message */
+	/* Note that if we have (S,G) prune and (*,G) Join, we must send
+	 * them in the same message. We don't bother to modify both timers
+	 * here. The Join/Prune sending function will take care of that.
 	 */
-	GET_EGADDR(&egaddr, data);
-	GET_HOSTSHORT(num_j_srcs, data);
-	GET_HOSTSHORT(num_p_srcs, data);
-	group = egaddr.mcast_addr;
-	if ((ntohl(group) != CLASSD_PREFIX)
-	    || (egaddr.masklen != STAR_STAR_RP_MSKLEN)) {
-	    /* This is not (*,*,RP). Jump to the next group. */
-	    data +=
-		(num_j_srcs + num_p_srcs) * sizeof(pim_encod_src_addr_t);
-	    continue;
+	upstream_router = find_pim_nbr(jp.target);
+	if (!upstream_router || upstream_router->vifi != vifi)
+	    return FALSE;   /* I have no such neighbor on this LAN */
+
+	for (jpg = jp.groups; jpg < end; jpg++) {
+	    if (IN_MULTICAST(ntohl(jpg->group)))
+		jp_suppress_group(src, v, upstream_router, &jp, jpg);
 	}
-	/* (*,*,RP) found */
-	while (num_j_srcs--) {
-	    /* TODO: XXX: check that the iif is different from the Join oifs */
-	    GET_ESADDR(&esaddr, data);
-	    source = esaddr.src_addr;
-	    if (!inet_valid_host(source))
-		continue;
 
-	    s_flags = esaddr.flags;
-	    MASKLEN_TO_MASK(esaddr.masklen, s_mask);
-	    mrt = find_route(source, INADDR_ANY_N, MRTF_PMBR, CREATE);
-	    if (!mrt)
-		continue;
+	return TRUE;
+    }
 
-	    PIMD_VIFM_SET(vifi, mrt->joined_oifs);
-	    PIMD_VIFM_CLR(vifi, mrt->pruned_oifs);
-	    PIMD_VIFM_CLR(vifi, mrt->asserted_oifs);
-	    /* TODO: XXX: TIMER implem. dependency! */
-	    if (mrt->vif_timers[vifi] < holdtime) {
-		SET_TIMER(mrt->vif_timers[vifi], holdtime);
-		mrt->vif_deletion_delay[vifi] = holdtime/3;
-	    }
-	    if (mrt->entry_timer < holdtime)
-		SET_TIMER(mrt->entry_timer, holdtime);
-	    mrt->flags &= ~MRTF_NEW;
-	    change_interfaces(mrt,
-			      mrt->incoming,
-			      mrt->joined_oifs,
-			      mrt->pruned_oifs,
-			      mrt->leaves,
-			      mrt->asserted_oifs, 0);
+    /* I am the target of this join, so process the message */
 
-	    /* Need to update the (S,G) and (*,G) entries, because of
-	     * the previous cleaning of the pruned_oifs. The reason is
-	     * that if the oifs for (*,*,RP) weren't changed, the
-	     * (*,G) and (S,G) entries won't be updated by change_interfaces()
-	     */
-	    for (rp_grp = mrt->source->cand_rp->rp_grp_next; rp_grp; rp_grp = rp_grp->rp_grp_next) {
-		for (grp = rp_grp->grplink; grp; grp = grp->rpnext) {
-		    /* Update the (*,G) entry */
-		    if (grp->grp_route) {
-			change_interfaces(grp->grp_route,
-					  grp->grp_route->incoming,
-					  grp->grp_route->joined_oifs,
-					  grp->grp_route->pruned_oifs,
-					  grp->grp_route->leaves,
-					  grp->grp_route->asserted_oifs, 0);
-		    }
-		    /* Update the (S,G) entries */
-		    for (mrt_srcs = grp->mrtlink; mrt_srcs; mrt_srcs = mrt_srcs->grpnext)
-			change_interfaces(mrt_srcs,
-					  mrt_srcs->incoming,
-					  mrt_srcs->joined_oifs,
-					  mrt_srcs->pruned_oifs,
-					  mrt_srcs->leaves,
-					  mrt_srcs->asserted_oifs, 0);
-		}
-	    }
-	    continue;
+    /* The spec says that if there is (*,G) Join, it has priority over
+     * old existing ~(S,G) prunes in the routing table.
+     * However, if the (*,G) Join and the ~(S,G) prune are in
+     * the same message, ~(S,G) has the priority. The spec doesn't say it,
+     * but I think the same is true for (*,*,RP) and ~(S,G) prunes.
+     *
+     * The message is already decoded, so no re-parsing:
+     *  (1) For all (*,*,RP) Joins, clean all pruned_oifs for all (*,G)
+     *      and all (S,G) for each RP in the list, but do not update
+     *      the kernel cache.
+     *  (2) For each (*,G) and (S,G) group record, if it has a (*,G)
+     *      Join, clear the join interface from the pruned_oifs for all
+     *      (S,G), but DO NOT flush the change to the kernel.  Then
+     *      process the Prunes, setting the prune_oifs and flushing the
+     *      changes to the kernel, and last the Joins.
+     *  (3) Process the (*,*,RP) Joins/Prunes.
+     *
+     * The idea above is not to place any wrong info in the kernel,
+     * because it may result in short-time existing traffic
+     * forwarding on wrong interface.
+     */
+    if (jp.star_star_rp) {
+	for (jpg = jp.groups; jpg < end; jpg++) {
+	    if (jp_star_star_rp(jpg))
+		jp_clear_rp_pruned(vifi, &jp, jpg);
 	}
+    }
 
-	while (num_p_srcs--) {
-	    /* TODO: XXX: can we have (*,*,RP) Prune? */
-	    GET_ESADDR(&esaddr, data);
-	    source = esaddr.src_addr;
-	    if (!inet_valid_host(source))
-		continue;
-
-	    s_flags = esaddr.flags;
-	    MASKLEN_TO_MASK(esaddr.masklen, s_mask);
-	    mrt = find_route(source, INADDR_ANY_N, MRTF_PMBR, DONT_CREATE);
-	    if (!mrt)
-		continue;
+    for (jpg = jp.groups; jpg < end; jpg++) {
+	if (!IN_MULTICAST(ntohl(jpg->group)) || jp_star_star_rp(jpg))
+	    continue;
 
-	    /* If the link is point-to-point, timeout the oif
-	     * immediately, otherwise decrease the timer to allow
-	     * other downstream routers to override the prune.
-	     */
-	    /* TODO: XXX: increase the entry timer? */
-	    if (v->uv_flags & VIFF_POINT_TO_POINT) {
-		FIRE_TIMER(mrt->vif_timers[vifi]);
-	    } else {
-		/* TODO: XXX: TIMER implem. dependency! */
-		if (mrt->vif_timers[vifi] > mrt->vif_deletion_delay[vifi])
-		    SET_TIMER(mrt->vif_timers[vifi],
-			      mrt->vif_deletion_delay[vifi]);
-	    }
-	    IF_TIMER_NOT_SET(mrt->vif_timers[vifi]) {
-		PIMD_VIFM_CLR(vifi, mrt->joined_oifs);
-		PIMD_VIFM_SET(vifi, mrt->pruned_oifs);
-		PIMD_VIFM_SET(vifi, mrt->asserted_oifs);
-		change_interfaces(mrt,
-				  mrt->incoming,
-				  mrt->joined_oifs,
-				  mrt->pruned_oifs,
-				  mrt->leaves,
-				  mrt->asserted_oifs, 0);
-	    }
+	jp_receive_group(vifi, &jp, jpg);
+    }
 
+    if (jp.star_star_rp) {
+	for (jpg = jp.groups; jpg < end; jpg++) {
+	    if (jp_star_star_rp(jpg))
+		jp_receive_rp(vifi, &jp, jpg);
 	}
-    } /* For all groups processing (*,*,R) */
+    }
 
     return TRUE;
 }
 
 /*
- * Function for sending single PIM-JOIN instantly.
+ * Send a single (S,G) or (*,G) Join/Prune entry instantly.
  */
-void send_pim_join(pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags, uint16_t holdtime)
+static void send_pim_jp_entry(pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags,
+			      uint16_t holdtime, int action)
 {
     if (!pim_nbr)
         return;
@@ -2255,14 +2480,31 @@ void send_pim_join(pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags, ui
     if (flags & MRTF_SG)
         add_jp_entry(pim_nbr, holdtime, mrt->group->group,
                      SINGLE_GRP_MSKLEN, mrt->source->address,
-                     SINGLE_SRC_MSKLEN, 0, PIM_ACTION_JOIN);
+                     SINGLE_SRC_MSKLEN, 0, action);
     else
         add_jp_entry(pim_nbr, holdtime, mrt->group->group,
                      SINGLE_GRP_MSKLEN, mrt->group->rpaddr,
-                     SINGLE_SRC_MSKLEN, flags, PIM_ACTION_JOIN);
+                     SINGLE_SRC_MSKLEN, flags, action);
     pack_and_send_jp_message(pim_nbr);
 }
 
+/*
+ * Function for sending single PIM-JOIN instantly.
+ */
+void send_pim_join(pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags, uint16_t holdtime)
+{
+    send_pim_jp_entry(pim_nbr, mrt, flags, holdtime, PIM_ACTION_JOIN);
+}
+
+/*
+ * Function for sending single PIM-PRUNE instantly, e.g., when the last
+ * local member leaves, instead of waiting for the Join/Prune timer.
+ */
+void send_pim_prune(pim_nbr_entry_t *pim_nbr, mrtentry_t *mrt, uint16_t flags, uint16_t holdtime)
+{
+    send_pim_jp_entry(pim_nbr, mrt, flags, holdtime, PIM_ACTION_PRUNE);
+}
+
 /*
  * TODO: NOT USED, probably buggy, but may need it in the future.
  */
@@ -2304,7 +2546,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
     for (grp = grplist; grp; grp = grp->next) {
 	mrt = grp->grp_route;
 	/* TODO: XXX: TIMER implem. dependency! */
-	if (mrt && (mrt->incoming == vifi) && (mrt->jp_timer <= TIMER_INTERVAL)) {
+	if (mrt && (mrt->incoming == vifi) && (MRT_TIMER_LEFT(mrt->jp_timer) <= TIMER_INTERVAL)) {
 
 	    /* If join/prune to a particular neighbor only was specified */
 	    if (pim_nbr && mrt->upstream != pim_nbr)
@@ -2328,7 +2570,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 	    /* TODO: XXX: TIMER implem. dependency! */
 	    if (PIMD_VIFM_ISEMPTY(mrt->joined_oifs)
 		&& (!(v->uv_flags & VIFF_DR))
-		&& (mrt->jp_timer <= TIMER_INTERVAL)) {
+		&& (MRT_TIMER_LEFT(mrt->jp_timer) <= TIMER_INTERVAL)) {
 		add_jp_entry(mrt->upstream, holdtime,
 			     grp->group, SINGLE_GRP_MSKLEN,
 			     grp->rpaddr,
@@ -2349,7 +2591,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 		    /* TODO: XXX: TIMER implem. dependency! */
 		    if (grp->grp_route &&
 			grp->grp_route->incoming == vifi &&
-			grp->grp_route->jp_timer <= TIMER_INTERVAL)
+			MRT_TIMER_LEFT(grp->grp_route->jp_timer) <= TIMER_INTERVAL)
 			/* S is directly connected. Send toward RP */
 			add_jp_entry(grp->grp_route->upstream,
 				     holdtime,
@@ -2362,7 +2604,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 		/* RPbit cleared */
 		if (PIMD_VIFM_ISEMPTY(mrt->joined_oifs)) {
 		    /* TODO: XXX: TIMER implem. dependency! */
-		    if (mrt->incoming == vifi && mrt->jp_timer <= TIMER_INTERVAL)
+		    if (mrt->incoming == vifi && MRT_TIMER_LEFT(mrt->jp_timer) <= TIMER_INTERVAL)
 			add_jp_entry(mrt->upstream, holdtime,
 				     grp->group, SINGLE_GRP_MSKLEN,
 				     mrt->source->address,
@@ -2371,7 +2613,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 		    logit(LOG_DEBUG, 0 , "Joined not empty, group %s",
 			  inet_ntoa(*(struct in_addr *)&grp->group));
 		    /* TODO: XXX: TIMER implem. dependency! */
-		    if (mrt->incoming == vifi && mrt->jp_timer <= TIMER_INTERVAL)
+		    if (mrt->incoming == vifi && MRT_TIMER_LEFT(mrt->jp_timer) <= TIMER_INTERVAL)
 			add_jp_entry(mrt->upstream, holdtime,
 				     grp->group, SINGLE_GRP_MSKLEN,
 				     mrt->source->address,
@@ -2382,7 +2624,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 		    grp->grp_route &&
 		    mrt->incoming != grp->grp_route->incoming &&
 		    grp->grp_route->incoming == vifi &&
-		    grp->grp_route->jp_timer <= TIMER_INTERVAL)
+		    MRT_TIMER_LEFT(grp->grp_route->jp_timer) <= TIMER_INTERVAL)
 		    add_jp_entry(grp->grp_route->upstream, holdtime,
 				 grp->group, SINGLE_GRP_MSKLEN,
 				 mrt->source->address,
@@ -2403,7 +2645,7 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 	/* TODO: XXX: TIMER implem. dependency! */
 	if (rp->mrtlink &&
 	    rp->incoming == vifi &&
-	    rp->mrtlink->jp_timer <= TIMER_INTERVAL) {
+	    MRT_TIMER_LEFT(rp->mrtlink->jp_timer) <= TIMER_INTERVAL) {
 	    add_jp_entry(rp->upstream, holdtime, htonl(CLASSD_PREFIX), STAR_STAR_RP_MSKLEN,
 			 rp->address, SINGLE_SRC_MSKLEN, MRTF_RP | MRTF_WC, PIM_ACTION_JOIN);
 	}
@@ -2422,350 +2664,278 @@ int send_periodic_pim_join_prune(vifi_t vifi, pim_nbr_entry_t *pim_nbr, uint16_t
 }
 
 
+struct jpstats jp_stats;
+
+/*
+ * Queue a Join/Prune entry for the upstream neighbor, sent with all the
+ * others at the next pack_and_send_jp_message().
+ */
 int add_jp_entry(pim_nbr_entry_t *pim_nbr, uint16_t holdtime, uint32_t group,
 		 uint8_t grp_msklen, uint32_t source, uint8_t src_msklen,
 		 uint16_t addr_flags, uint8_t join_prune)
 {
     build_jp_message_t *bjpm;
-    uint8_t *data;
-    uint8_t flags = 0;
-    int rp_flag;
-    int new_grp = FALSE;
-
-    bjpm = pim_nbr->build_jp_message;
-
-    if (group == htonl(CLASSD_PREFIX) && grp_msklen == STAR_STAR_RP_MSKLEN) {
-	rp_flag = TRUE;
-    } else {
-	rp_flag = FALSE;
-
-	if (bjpm) {
-	    if ((bjpm->curr_group != group)
-	        || (bjpm->curr_group_msklen != grp_msklen)
-	        || (bjpm->holdtime != holdtime)) {
-
-		new_grp = TRUE;
-	    }
-	}
-    }
-
-    if (bjpm) {
-	if (new_grp == TRUE)
-	    pack_jp_message_grp(pim_nbr);
-
-	/* Check if we have already 254 groups. */
-	if (*bjpm->num_groups_ptr == ((uint8_t)~0 - 1)) {
-	    pack_and_send_jp_message(pim_nbr);
-	    bjpm = pim_nbr->build_jp_message;	/* The buffer will be freed */
-	}
-    }
-
-    if (bjpm) {
-	uint32_t jp_message_size = bjpm->jp_message_size;
+    jp_entry_t *entry;
 
-	/* sizeof(pim_jp_encod_grp_t) is used to precalculate the size. */
-	if (bjpm->join_list_size + bjpm->prune_list_size) {
-	    jp_message_size += sizeof(pim_jp_encod_grp_t);
-	    jp_message_size += bjpm->join_list_size;
-	    jp_message_size += bjpm->prune_list_size;
-	} else if (new_grp == TRUE) {
-	    jp_message_size += sizeof(pim_jp_encod_grp_t);
-	}
-
-	/* sizeof(pim_jp_encod_grp_t) is used to precalculate the size. */
-	if (bjpm->rp_list_join_size + bjpm->rp_list_prune_size) {
-	    jp_message_size += sizeof(pim_jp_encod_grp_t);
-	    jp_message_size += bjpm->rp_list_join_size;
-	    jp_message_size += bjpm->rp_list_prune_size;
-	} else if (rp_flag == TRUE) {
-	    jp_message_size += sizeof(pim_jp_encod_grp_t);
-	}
-
-	/* Check also would the new entry push us over the limit. */
-	jp_message_size += sizeof(pim_encod_src_addr_t);
-
-	/* TODO: Should check the jp_message_size also against MTU. */
-	if (jp_message_size > MAX_JP_MESSAGE_SIZE) {
-	    pack_and_send_jp_message(pim_nbr);
-	    bjpm = pim_nbr->build_jp_message;	/* The buffer will be freed */
-	}
-    }
+    if (join_prune != PIM_ACTION_JOIN && join_prune != PIM_ACTION_PRUNE)
+	return FALSE;
 
+    bjpm = pim_nbr->build_jp_message;
     if (!bjpm) {
-	bjpm = get_jp_working_buff();
+	bjpm = calloc(1, sizeof(build_jp_message_t));
 	if (!bjpm) {
 	    logit(LOG_ERR, 0, "Failed allocating working buffer in add_jp_entry()");
 	    return FALSE;
 	}
-
 	pim_nbr->build_jp_message = bjpm;
-	data = bjpm->jp_message;
-	PUT_EUADDR(pim_nbr->address, data);
-	PUT_BYTE(0, data);			/* Reserved */
-	bjpm->num_groups_ptr = data++;	/* The pointer for numgroups */
-	*(bjpm->num_groups_ptr) = 0;		/* Zero groups */
-	PUT_HOSTSHORT(holdtime, data);
-	bjpm->holdtime = holdtime;
-	bjpm->jp_message_size = data - bjpm->jp_message;
-
-	if (rp_flag == FALSE)
-	    new_grp = TRUE;
     }
 
-    if (new_grp == TRUE) {
-	bjpm->curr_group = group;
-	bjpm->curr_group_msklen = grp_msklen;
-    }
-
-    switch (join_prune) {
-	case PIM_ACTION_JOIN:
-	    if (rp_flag == TRUE)
-		data = bjpm->rp_list_join + bjpm->rp_list_join_size;
-	    else
-		data = bjpm->join_list + bjpm->join_list_size;
-	    break;
-
-	case PIM_ACTION_PRUNE:
-	    if (rp_flag == TRUE)
-		data = bjpm->rp_list_prune + bjpm->rp_list_prune_size;
-	    else
-		data = bjpm->prune_list + bjpm->prune_list_size;
-	    break;
+    if (bjpm->num == bjpm->max) {
+	size_t max = bjpm->max ? bjpm->max * 2 : JP_WORKING_MIN;
 
-	default:
+	entry = realloc(bjpm->entries, max * sizeof(jp_entry_t));
+	if (!entry) {
+	    logit(LOG_ERR, 0, "Failed allocating working buffer in add_jp_entry()");
 	    return FALSE;
+	}
+	bjpm->entries = entry;
+	bjpm->max     = max;
     }
 
-    flags |= USADDR_S_BIT;   /* Mandatory for PIMv2 */
+    entry = &bjpm->entries[bjpm->num++];
+    entry->group      = group;
+    entry->source     = source;
+    entry->holdtime   = holdtime;
+    entry->grp_msklen = grp_msklen;
+    entry->src_msklen = src_msklen;
+    entry->action     = join_prune;
+    entry->flags      = USADDR_S_BIT;   /* Mandatory for PIMv2 */
     if (addr_flags & MRTF_RP)
-	flags |= USADDR_RP_BIT;
+	entry->flags |= USADDR_RP_BIT;
     if (addr_flags & MRTF_WC)
-	flags |= USADDR_WC_BIT;
-    PUT_ESADDR(source, src_msklen, flags, data);
-
-    switch (join_prune) {
-	case PIM_ACTION_JOIN:
-	    if (rp_flag == TRUE) {
-		bjpm->rp_list_join_size = data - bjpm->rp_list_join;
-		bjpm->rp_list_join_number++;
-	    } else {
-		bjpm->join_list_size = data - bjpm->join_list;
-		bjpm->join_addr_number++;
-	    }
-	    break;
+	entry->flags |= USADDR_WC_BIT;
 
-	case PIM_ACTION_PRUNE:
-	    if (rp_flag == TRUE) {
-		bjpm->rp_list_prune_size = data - bjpm->rp_list_prune;
-		bjpm->rp_list_prune_number++;
-	    } else {
-		bjpm->prune_list_size = data - bjpm->prune_list;
-		bjpm->prune_addr_number++;
-	    }
-	    break;
-
-	default:
-	    return FALSE;
-    }
+    jp_stats.entries++;
 
     return TRUE;
 }
 
 
-static build_jp_message_t *get_jp_working_buff(void)
+static void free_jp_working_buff(pim_nbr_entry_t *pim_nbr)
 {
-    build_jp_message_t *bjpm;
+    build_jp_message_t *bjpm = pim_nbr->build_jp_message;
 
-    if (build_jp_message_pool_counter == 0) {
-	bjpm = calloc(1, sizeof(build_jp_message_t));
-	if (!bjpm)
-	    return NULL;
+    if (!bjpm)
+	return;
 
-	bjpm->next = NULL;
+    free(bjpm->entries);
+    free(bjpm);
+    pim_nbr->build_jp_message = NULL;
+}
 
-	bjpm->jp_message_size = 0;
-	bjpm->jp_message = calloc(1, MAX_JP_MESSAGE_SIZE + sizeof(pim_jp_header_t));
-	if (!bjpm->jp_message) {
-	    free(bjpm);
-	    return NULL;
-	}
+#define JP_IS_STAR_STAR_RP(e) ((e)->group == htonl(CLASSD_PREFIX) && (e)->grp_msklen == STAR_STAR_RP_MSKLEN)
+#define JP_CMP(a, b)	      do { if ((a) != (b)) return (a) < (b) ? -1 : 1; } while (0)
 
-	bjpm->join_list_size = 0;
-	bjpm->join_addr_number = 0;
-	bjpm->join_list = calloc(1, MAX_JP_MESSAGE_SIZE - sizeof(pim_jp_encod_grp_t));
-	if (!bjpm->join_list) {
-	    free(bjpm->jp_message);
-	    free(bjpm);
-	    return NULL;
-	}
+/*
+ * Order of the entries in the messages: by holdtime, since there is one
+ * per message, then group, with the joins first in each group.  The
+ * (*,*,RP) entries are placed last, as before.
+ */
+static int jp_entry_cmp(const void *p1, const void *p2)
+{
+    const jp_entry_t *a = p1, *b = p2;
+
+    JP_CMP(a->holdtime, b->holdtime);
+    JP_CMP(JP_IS_STAR_STAR_RP(a), JP_IS_STAR_STAR_RP(b));
+    JP_CMP(ntohl(a->group), ntohl(b->group));
+    JP_CMP(a->grp_msklen, b->grp_msklen);
+    JP_CMP(a->action, b->action);
+    JP_CMP(ntohl(a->source), ntohl(b->source));
+    JP_CMP(a->src_msklen, b->src_msklen);
+    JP_CMP(a->flags, b->flags);
+
+    return 0;
+}
 
-	bjpm->prune_list_size = 0;
-	bjpm->prune_addr_number = 0;
-	bjpm->prune_list = calloc(1, MAX_JP_MESSAGE_SIZE - sizeof(pim_jp_encod_grp_t));
-	if (!bjpm->prune_list) {
-	    free(bjpm->join_list);
-	    free(bjpm->jp_message);
-	    free(bjpm);
-	    return NULL;
-	}
+/*
+ * Messages are built back-to-back in pim_send_buf, each with room for
+ * the IP and PIM headers, and sent with send_pim_batch() when the
+ * buffer, or batch, is full.
+ */
+typedef struct {
+    pim_nbr_entry_t *nbr;
+    char	*buf[PIM_SEND_BATCH];
+    size_t	 len[PIM_SEND_BATCH];
+    int		 num;		/* Messages in buf[]            */
+    size_t	 off;		/* Next free in pim_send_buf    */
+    size_t	 maxlen;	/* Max message length, from MTU */
+    uint8_t	*msg;		/* Current message, or NULL     */
+    uint8_t	*data;		/* Write position in msg        */
+    uint8_t	*num_groups;
+    uint16_t	 holdtime;
+} jp_packer_t;
+
+#define JP_HDR_LEN	(PIM_ENCODE_UNI_ADDR_LEN + 4)	/* Upstream neighbor, reserved, groups, holdtime */
+#define JP_GRP_LEN	(PIM_ENCODE_GRP_ADDR_LEN + 4)	/* Group, number of joined and pruned sources */
+#define JP_SRC_LEN	PIM_ENCODE_SRC_ADDR_LEN
+#define JP_MAX_GROUPS	255
+#define JP_ROOM(p)	((p)->maxlen - (size_t)((p)->data - (p)->msg))
+
+static void jp_flush(jp_packer_t *p)
+{
+    struct uvif *v = &uvifs[p->nbr->vifi];
 
-	bjpm->rp_list_join_size = 0;
-	bjpm->rp_list_join_number = 0;
-	bjpm->rp_list_join = calloc(1, MAX_JP_MESSAGE_SIZE - sizeof(pim_jp_encod_grp_t));
-	if (!bjpm->rp_list_join) {
-	    free(bjpm->prune_list);
-	    free(bjpm->join_list);
-	    free(bjpm->jp_message);
-	    free(bjpm);
-	    return NULL;
-	}
+    if (!p->num)
+	return;
 
-	bjpm->rp_list_prune_size = 0;
-	bjpm->rp_list_prune_number = 0;
-	bjpm->rp_list_prune = calloc(1, MAX_JP_MESSAGE_SIZE - sizeof(pim_jp_encod_grp_t));
-	if (!bjpm->rp_list_prune) {
-	    free(bjpm->rp_list_join);
-	    free(bjpm->prune_list);
-	    free(bjpm->join_list);
-	    free(bjpm->jp_message);
-	    free(bjpm);
-	    return NULL;
-	}
+    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
+	logit(LOG_INFO, 0, "Send %d PIM JOIN/PRUNE from %s on %s", p->num,
+	      inet_fmt(v->uv_lcl_addr, s1, sizeof(s1)), v->uv_name);
 
-	bjpm->curr_group = INADDR_ANY_N;
-	bjpm->curr_group_msklen = 0;
-	bjpm->holdtime = 0;
+    send_pim_batch(p->buf, p->len, p->num, v->uv_lcl_addr, allpimrouters_group, PIM_JOIN_PRUNE);
+    jp_stats.messages += p->num;
+    jp_stats.batches++;
 
-	return bjpm;
-    }
+    p->num = 0;
+    p->off = 0;
+}
+
+static void jp_close(jp_packer_t *p)
+{
+    size_t len = p->data - p->msg;
 
-    bjpm = build_jp_message_pool;
-    build_jp_message_pool = build_jp_message_pool->next;
-    build_jp_message_pool_counter--;
-    bjpm->jp_message_size   = 0;
-    bjpm->join_list_size    = 0;
-    bjpm->join_addr_number  = 0;
-    bjpm->prune_list_size   = 0;
-    bjpm->prune_addr_number = 0;
-    bjpm->curr_group        = INADDR_ANY_N;
-    bjpm->curr_group_msklen = 0;
+    p->len[p->num++] = len;
+    p->off += (sizeof(struct ip) + sizeof(pim_header_t) + len + 3) & ~3;
+    p->msg  = NULL;
 
-    return bjpm;
+    if (p->num == PIM_SEND_BATCH)
+	jp_flush(p);
 }
 
-
-static void return_jp_working_buff(pim_nbr_entry_t *pim_nbr)
+static void jp_open(jp_packer_t *p, uint16_t holdtime)
 {
-    build_jp_message_t *bjpm = pim_nbr->build_jp_message;
+    char *buf;
+
+    if (p->off + sizeof(struct ip) + sizeof(pim_header_t) + p->maxlen > SEND_BUF_SIZE)
+	jp_flush(p);
+
+    buf = pim_send_buf + p->off;
+    p->buf[p->num] = buf;
+    p->msg  = (uint8_t *)buf + sizeof(struct ip) + sizeof(pim_header_t);
+    p->data = p->msg;
+
+    PUT_EUADDR(p->nbr->address, p->data);
+    PUT_BYTE(0, p->data);			/* Reserved */
+    p->num_groups = p->data++;		/* The pointer for numgroups */
+    *p->num_groups = 0;			/* Zero groups */
+    PUT_HOSTSHORT(holdtime, p->data);
+    p->holdtime = holdtime;
+}
 
-    if (!bjpm)
-	return;
+/* Add a group with num of its sources, the joins sorted first */
+static void jp_put_group(jp_packer_t *p, jp_entry_t *entry, size_t num)
+{
+    uint16_t joins = 0;
+    size_t i;
 
-    /* Don't waste memory by keeping too many free buffers */
-    /* TODO: check/modify the definitions for POOL_NUMBER and size */
-    if (build_jp_message_pool_counter >= MAX_JP_MESSAGE_POOL_NUMBER) {
-	free(bjpm->jp_message);
-	free(bjpm->join_list);
-	free(bjpm->prune_list);
-	free(bjpm->rp_list_join);
-	free(bjpm->rp_list_prune);
-	free(bjpm);
-    } else {
-	bjpm->next = build_jp_message_pool;
-	build_jp_message_pool = bjpm;
-	build_jp_message_pool_counter++;
+    for (i = 0; i < num; i++) {
+	if (entry[i].action == PIM_ACTION_JOIN)
+	    joins++;
     }
 
-    pim_nbr->build_jp_message = NULL;
-}
+    PUT_EGADDR(entry->group, entry->grp_msklen, 0, p->data);
+    PUT_HOSTSHORT(joins, p->data);
+    PUT_HOSTSHORT(num - joins, p->data);
+    for (i = 0; i < num; i++)
+	PUT_ESADDR(entry[i].source, entry[i].src_msklen, entry[i].flags, p->data);
 
+    (*p->num_groups)++;
+}
 
-static void pack_jp_message_grp(pim_nbr_entry_t *pim_nbr)
+/*
+ * Send all queued Join/Prune entries to the neighbor.  Entries for the
+ * same group are kept in one message unless more than a whole message
+ * of them, and as many groups as fit are packed in each message.
+ */
+void pack_and_send_jp_message(pim_nbr_entry_t *pim_nbr)
 {
     build_jp_message_t *bjpm;
-    uint8_t *data;
+    jp_entry_t *entry, *end, *last;
+    jp_packer_t p;
+    size_t i, num;
+
+    if (!pim_nbr)
+	return;
 
     bjpm = pim_nbr->build_jp_message;
-    if (!bjpm)
+    if (!bjpm || !bjpm->num)
 	return;
 
-    if (bjpm->join_list_size + bjpm->prune_list_size) {
-	data = bjpm->jp_message + bjpm->jp_message_size;
-	PUT_EGADDR(bjpm->curr_group, bjpm->curr_group_msklen, 0, data);
-	PUT_HOSTSHORT(bjpm->join_addr_number, data);
-	PUT_HOSTSHORT(bjpm->prune_addr_number, data);
-	memcpy(data, bjpm->join_list, bjpm->join_list_size);
-	data += bjpm->join_list_size;
-	memcpy(data, bjpm->prune_list, bjpm->prune_list_size);
-	data += bjpm->prune_list_size;
-	bjpm->jp_message_size = (data - bjpm->jp_message);
-	bjpm->curr_group = INADDR_ANY_N;
-	bjpm->curr_group_msklen = 0;
-	bjpm->join_list_size = 0;
-	bjpm->join_addr_number = 0;
-	bjpm->prune_list_size = 0;
-	bjpm->prune_addr_number = 0;
-	(*bjpm->num_groups_ptr)++;
+    /* Sort and drop duplicates */
+    qsort(bjpm->entries, bjpm->num, sizeof(jp_entry_t), jp_entry_cmp);
+    for (i = 1, num = 1; i < bjpm->num; i++) {
+	if (!jp_entry_cmp(&bjpm->entries[num - 1], &bjpm->entries[i]))
+	    continue;
+	bjpm->entries[num++] = bjpm->entries[i];
     }
-}
+    jp_stats.duplicates += bjpm->num - num;
 
-static void pack_jp_message_rp(pim_nbr_entry_t *pim_nbr)
-{
-    build_jp_message_t *bjpm;
-    uint8_t *data;
+    memset(&p, 0, sizeof(p));
+    p.nbr    = pim_nbr;
+    p.maxlen = MAX(uvifs[pim_nbr->vifi].uv_mtu, MIN_JP_MTU);
+    p.maxlen = MIN(p.maxlen, SEND_BUF_SIZE) - sizeof(struct ip) - sizeof(pim_header_t);
 
-    bjpm = pim_nbr->build_jp_message;
-    if (!bjpm)
-	return;
+    end = bjpm->entries + num;
+    for (entry = bjpm->entries; entry < end; ) {
+	size_t need, fit;
 
-    if (bjpm->rp_list_join_size + bjpm->rp_list_prune_size) {
-	data = bjpm->jp_message + bjpm->jp_message_size;
-	PUT_EGADDR(htonl(CLASSD_PREFIX), STAR_STAR_RP_MSKLEN, 0, data);
-	PUT_HOSTSHORT(bjpm->rp_list_join_number, data);
-	PUT_HOSTSHORT(bjpm->rp_list_prune_number, data);
-	memcpy(data, bjpm->rp_list_join, bjpm->rp_list_join_size);
-	data += bjpm->rp_list_join_size;
-	memcpy(data, bjpm->rp_list_prune, bjpm->rp_list_prune_size);
-	data += bjpm->rp_list_prune_size;
-	bjpm->jp_message_size = (data - bjpm->jp_message);
-	bjpm->rp_list_join_size = 0;
-	bjpm->rp_list_join_number = 0;
-	bjpm->rp_list_prune_size = 0;
-	bjpm->rp_list_prune_number = 0;
-	(*bjpm->num_groups_ptr)++;
-    }
-}
+	/* The entries for this group, with this holdtime */
+	for (last = entry + 1; last < end; last++) {
+	    if (last->holdtime != entry->holdtime || last->group != entry->group ||
+		last->grp_msklen != entry->grp_msklen)
+		break;
+	}
 
+	while (entry < last) {
+	    num  = last - entry;
+	    need = JP_GRP_LEN + num * JP_SRC_LEN;
 
-void pack_and_send_jp_message(pim_nbr_entry_t *pim_nbr)
-{
-    if (!pim_nbr)
-	return;
+	    if (p.msg) {
+		if (p.holdtime != entry->holdtime || *p.num_groups == JP_MAX_GROUPS)
+		    jp_close(&p);
+		else if (need > JP_ROOM(&p) && JP_HDR_LEN + need <= p.maxlen)
+		    jp_close(&p);	/* Fits whole in the next one */
+		else if (JP_ROOM(&p) < JP_GRP_LEN + JP_SRC_LEN)
+		    jp_close(&p);
+	    }
+	    if (!p.msg)
+		jp_open(&p, entry->holdtime);
 
-    pack_jp_message_grp(pim_nbr);
-    pack_jp_message_rp(pim_nbr);
-    send_jp_message(pim_nbr);
-}
+	    fit = (JP_ROOM(&p) - JP_GRP_LEN) / JP_SRC_LEN;
+	    if (fit < num) {
+		jp_stats.split++;
+		num = fit;
+	    }
 
+	    jp_put_group(&p, entry, num);
+	    entry += num;
+	}
+    }
 
-static void send_jp_message(pim_nbr_entry_t *pim_nbr)
-{
-    build_jp_message_t *bjpm;
-    vifi_t vifi;
+    if (p.msg)
+	jp_close(&p);
+    jp_flush(&p);
 
-    bjpm = pim_nbr->build_jp_message;
-    if (!bjpm)
-	return;
+    /* Keep the working area, unless it has grown far beyond the need */
+    if (bjpm->max > JP_WORKING_MIN && bjpm->num < bjpm->max / 4) {
+	jp_entry_t *entries = realloc(bjpm->entries, bjpm->max / 2 * sizeof(jp_entry_t));
 
-    vifi = pim_nbr->vifi;
-    memcpy(pim_send_buf + sizeof(struct ip) + sizeof(pim_header_t),
-	   bjpm->jp_message, bjpm->jp_message_size);
-    IF_DEBUG(DEBUG_PIM_JOIN_PRUNE)
-	logit(LOG_INFO, 0, "Send PIM JOIN/PRUNE from %s on %s",
-	      inet_fmt(uvifs[vifi].uv_lcl_addr, s1, sizeof(s1)), uvifs[vifi].uv_name);
-    send_pim(pim_send_buf, uvifs[vifi].uv_lcl_addr, allpimrouters_group,
-	     PIM_JOIN_PRUNE, bjpm->jp_message_size);
-    return_jp_working_buff(pim_nbr);
+	if (entries) {
+	    bjpm->entries = entries;
+	    bjpm->max    /= 2;
+	}
+    }
+    bjpm->num = 0;
 }
 
 
@@ -2934,7 +3104,7 @@ int receive_pim_assert(uint32_t src, uint32_t dst, char *msg, size_t len)
 	    /* TODO: XXX: The spec doesn't say what entry timer value
 	     * to use when the routing entry is created because of asserts.
 	     */
-	    SET_TIMER(mrt2->entry_timer, PIM_DATA_TIMEOUT);
+	    MRT_SET_TIMER(mrt2, mrt2->entry_timer, PIM_DATA_TIMEOUT);
 	    if (mrt2->flags & MRTF_RP) {
 		/* Either (*,G) or (S,G)RPbit entry.
 		 * Get what we need from the RP info.
@@ -2975,8 +3145,8 @@ int receive_pim_assert(uint32_t src, uint32_t dst, char *msg, size_t len)
 	/* Have to remove that outgoing vifi from mrt */
 	PIMD_VIFM_SET(vifi, mrt->asserted_oifs);
 	mrt->flags |= MRTF_ASSERTED;
-	if (mrt->assert_timer < PIM_ASSERT_TIMEOUT)
-	    SET_TIMER(mrt->assert_timer, PIM_ASSERT_TIMEOUT);
+	if (MRT_TIMER_LEFT(mrt->assert_timer) < PIM_ASSERT_TIMEOUT)
+	    MRT_SET_TIMER(mrt, mrt->assert_timer, PIM_ASSERT_TIMEOUT);
 
 	/* TODO: XXX: check that the timer of all affected routing entries
 	 * has been restarted.
@@ -3037,7 +3207,7 @@ int receive_pim_assert(uint32_t src, uint32_t dst, char *msg, size_t len)
 
 	if (mrt->upstream != original_upstream_router) {
 	    mrt->flags |= MRTF_ASSERTED;
-	    SET_TIMER(mrt->assert_timer, PIM_ASSERT_TIMEOUT);
+	    MRT_SET_TIMER(mrt, mrt->assert_timer, PIM_ASSERT_TIMEOUT);
 	} else {
 	    mrt->flags &= ~MRTF_ASSERTED;
 	}
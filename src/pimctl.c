@@ -92,6 +92,7 @@ struct cmd {
 static int plain = 0;
 static int debug = 0;
 static int heading = 1;
+static int json = 0;
 
 static int cmdind;
 static TAILQ_HEAD(head, cmd) cmds = TAILQ_HEAD_INITIALIZER(cmds);
@@ -387,6 +388,7 @@ static int get(char *cmd, FILE *fp)
 	struct pollfd pfd;
 	FILE *lfp = NULL;
 	int indent = 0;
+	int follow = 0;
 	char buf[768];
 	ssize_t len;
 	int sd;
@@ -413,6 +415,12 @@ static int get(char *cmd, FILE *fp)
 		return 2;
 	}
 
+	/* Events are printed as they arrive, until pimd or the user quits */
+	if (!strncasecmp(cmd, "subscribe", 9)) {
+		follow = 1;
+		fp = stdout;
+	}
+
 	if (!fp) {
 		lfp = tempfile();
 		if (!lfp) {
@@ -426,7 +434,7 @@ static int get(char *cmd, FILE *fp)
 
 	pfd.fd = sd;
 	pfd.events = POLLIN | POLLHUP;
-	while (poll(&pfd, 1, 2000) > 0) {
+	while (poll(&pfd, 1, follow ? -1 : 2000) > 0) {
 		if (pfd.events & POLLIN) {
 			ssize_t blen = sizeof(buf) - 1;
 
@@ -437,8 +445,13 @@ static int get(char *cmd, FILE *fp)
 				break;
 			}
 
+			if (len == 0 && follow)
+				break;
+
 			buf[len] = 0;
 			fwrite(buf, len, 1, fp);
+			if (follow)
+				fflush(fp);
 			if (len == blen)
 				continue;
 		}
@@ -447,12 +460,19 @@ static int get(char *cmd, FILE *fp)
 	}
 	close(sd);
 
+	if (follow)
+		return 0;
+
 	rewind(fp);
 	if (!lfp)
 		return 0;
 
-	while (fgets(buf, sizeof(buf), fp))
-		print(buf, indent);
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (json)
+			fputs(buf, stdout);
+		else
+			print(buf, indent);
+	}
 
 	fclose(lfp);
 
@@ -554,6 +574,7 @@ static int usage(int rc)
 	       "\n"
 	       "Options:\n"
 	       "  -i, --ident=NAME           Connect to named pimd instance\n"
+	       "  -j, --json                 JSON output, for scripts and collectors\n"
 	       "  -m, --monitor              Run 'COMMAND' every two seconds, like watch(1)\n"
 	       "  -p, --plain                Use plain table headings, no ctrl chars\n"
 	       "  -t, --no-heading           Skip table headings\n"
@@ -613,6 +634,8 @@ static int cmd(int argc, char *argv[])
 		strlcat(buf, " ", sizeof(buf));
 		strlcat(buf, argv[cmdind++], sizeof(buf));
 	}
+	if (json)
+		strlcat(buf, " json", sizeof(buf));
 
 	if (strlen(cmd) < 1) {
 		warnx("Invalid command.");
@@ -631,6 +654,7 @@ int main(int argc, char *argv[])
 		{ "debug",      0, NULL, 'd' },
 		{ "help",       0, NULL, 'h' },
 		{ "ident",      1, NULL, 'i' },
+		{ "json",       0, NULL, 'j' },
 		{ "monitor",    0, NULL, 'm' },
 		{ "no-heading", 0, NULL, 't' },
 		{ "plain",      0, NULL, 'p' },
@@ -641,7 +665,7 @@ int main(int argc, char *argv[])
 	int monitor = 0;
 	int c, rc;
 
-	while ((c = getopt_long(argc, argv, "dh?i:mptu:v", long_options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "dh?i:jmptu:v", long_options, NULL)) != EOF) {
 		switch(c) {
 		case 'd':
 			debug = 1;
@@ -655,6 +679,10 @@ int main(int argc, char *argv[])
 			ident = optarg;
 			break;
 
+		case 'j':
+			json = 1;
+			break;
+
 		case 'm':
 			monitor = 1;
 			break;
@@ -686,7 +714,7 @@ int main(int argc, char *argv[])
 		}
 
 		if (optind >= argc)
-			rc = get("show", NULL);
+			rc = get(json ? "show json" : "show", NULL);
 		else
 			rc = cmd(argc - optind, &argv[optind]);
 
@@ -302,6 +302,12 @@ typedef struct pim_jp_encod_grp_ {
 #define PIM_HELLO_HOLDTIME_LEN          2
 #define PIM_HELLO_HOLDTIME_FOREVER      0xffff
 
+#define PIM_HELLO_LAN_PRUNE_DELAY       2
+#define PIM_HELLO_LAN_PRUNE_DELAY_LEN   4
+#define PIM_HELLO_LAN_PRUNE_DELAY_TBIT  0x8000 /* Join tracking support */
+#define PIM_PROPAGATION_DELAY_DEFAULT   500    /* msec */
+#define PIM_OVERRIDE_INTERVAL_DEFAULT   2500   /* msec */
+
 #define PIM_HELLO_DR_PRIO               19
 #define PIM_HELLO_DR_PRIO_LEN           4
 #define PIM_HELLO_DR_PRIO_DEFAULT       1
@@ -403,7 +409,7 @@ typedef struct pim_jp_encod_grp_ {
 #define GET_HOSTLONG(val, cp)                   \
         do {                                    \
                 uint32_t Xv;                    \
-                Xv  = (*(cp)++) << 24;          \
+                Xv  = (uint32_t)*(cp)++ << 24;  \
                 Xv |= (*(cp)++) << 16;          \
                 Xv |= (*(cp)++) <<  8;          \
                 Xv |= *(cp)++;                  \
@@ -427,7 +433,7 @@ typedef struct pim_jp_encod_grp_ {
                 Xv  = *(cp)++;                  \
                 Xv |= (*(cp)++) <<  8;          \
                 Xv |= (*(cp)++) << 16;          \
-                Xv |= (*(cp)++) << 24;          \
+                Xv |= (uint32_t)*(cp)++ << 24;  \
                 (val) = Xv;                     \
         } while (0)
 
@@ -0,0 +1,175 @@
+/*
+ * Slab allocator for the fixed size routing table objects
+ *
+ * Routing entries come and go all the time, and with them their kernel
+ * cache entries.  Allocating them one by one from the heap fragments it
+ * and the RSS grows without bound under churn.  Instead, each type has
+ * its own pool of POOL_SLAB_SIZE slabs, aligned to their size so the
+ * slab of an object is found by masking its address.  Objects are
+ * handed out from slabs with free objects, and a slab that becomes
+ * empty is given back to the system, unless it is the last one.
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+
+#include "defs.h"
+
+struct slab {
+    struct slab *next;		/* On the partial list, when not full */
+    struct slab *prev;
+    void	*free;		/* Freed objects                     */
+    uint32_t	 carved;	/* Objects handed out at least once  */
+    uint32_t	 inuse;
+};
+
+#define SLAB_HDR_SIZE	((sizeof(struct slab) + 15) & ~(size_t)15)
+#define SLAB_OF(ptr)	((struct slab *)((uintptr_t)(ptr) & ~(uintptr_t)(POOL_SLAB_SIZE - 1)))
+
+struct pool *pools;
+
+static void slab_link(struct pool *pool, struct slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = pool->partial;
+    if (slab->next)
+	slab->next->prev = slab;
+    pool->partial = slab;
+}
+
+static void slab_unlink(struct pool *pool, struct slab *slab)
+{
+    if (slab->prev)
+	slab->prev->next = slab->next;
+    else
+	pool->partial = slab->next;
+    if (slab->next)
+	slab->next->prev = slab->prev;
+
+    slab->next = slab->prev = NULL;
+}
+
+static struct slab *slab_new(struct pool *pool)
+{
+    struct slab *slab;
+    void *mem;
+
+    if (posix_memalign(&mem, POOL_SLAB_SIZE, POOL_SLAB_SIZE))
+	return NULL;
+
+    slab = mem;
+    memset(slab, 0, sizeof(*slab));
+    slab_link(pool, slab);
+    pool->slabs++;
+
+    return slab;
+}
+
+/*
+ * Set up a pool of @size byte objects, only the first call for a pool
+ * has any effect.
+ */
+void pool_init(struct pool *pool, const char *name, size_t size)
+{
+    if (pool->per_slab)
+	return;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->name     = name;
+    pool->size     = (size + 7) & ~(size_t)7;
+    pool->per_slab = (POOL_SLAB_SIZE - SLAB_HDR_SIZE) / pool->size;
+
+    pool->next = pools;
+    pools      = pool;
+}
+
+/*
+ * Change the object size of @pool, only possible while it is unused.
+ * Returns -1 if there are objects still allocated from it.
+ */
+int pool_resize(struct pool *pool, size_t size)
+{
+    struct slab *slab;
+
+    size = (size + 7) & ~(size_t)7;
+    if (size == pool->size)
+	return 0;
+    if (pool->inuse)
+	return -1;
+
+    /* No objects in use, so all slabs are on the partial list */
+    while ((slab = pool->partial)) {
+	slab_unlink(pool, slab);
+	free(slab);
+	pool->slabs--;
+    }
+
+    pool->size     = size;
+    pool->per_slab = (POOL_SLAB_SIZE - SLAB_HDR_SIZE) / size;
+
+    return 0;
+}
+
+/* Zeroed object from @pool, or NULL when out of memory */
+void *pool_alloc(struct pool *pool)
+{
+    struct slab *slab;
+    void *obj;
+
+    pool->allocs++;
+
+    slab = pool->partial;
+    if (!slab) {
+	slab = slab_new(pool);
+	if (!slab) {
+	    pool->failed++;
+	    return NULL;
+	}
+    }
+
+    if (slab->free) {
+	obj = slab->free;
+	slab->free = *(void **)obj;
+    } else {
+	obj = (char *)slab + SLAB_HDR_SIZE + slab->carved++ * pool->size;
+    }
+
+    if (++slab->inuse == pool->per_slab)
+	slab_unlink(pool, slab);
+
+    if (++pool->inuse > pool->peak)
+	pool->peak = pool->inuse;
+
+    memset(obj, 0, pool->size);
+
+    return obj;
+}
+
+void pool_free(struct pool *pool, void *ptr)
+{
+    struct slab *slab;
+
+    if (!ptr)
+	return;
+
+    slab = SLAB_OF(ptr);
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+
+    if (slab->inuse-- == pool->per_slab)
+	slab_link(pool, slab);
+    pool->inuse--;
+
+    /* Keep the last slab, to not thrash when on the edge */
+    if (!slab->inuse && (slab->next || slab->prev)) {
+	slab_unlink(pool, slab);
+	free(slab);
+	pool->slabs--;
+    }
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
@@ -0,0 +1,40 @@
+/*
+ * Slab allocator for the fixed size routing table objects
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#ifndef PIMD_POOL_H_
+#define PIMD_POOL_H_
+
+#define POOL_SLAB_SIZE	(64 * 1024)	/* Also the alignment of a slab */
+
+struct slab;
+
+struct pool {
+    struct pool *next;		/* All pools, for 'show memory'     */
+    const char	*name;
+    size_t	 size;		/* Object size, rounded up          */
+    size_t	 per_slab;	/* Objects per slab                 */
+    struct slab *partial;	/* Slabs with free objects          */
+    size_t	 slabs;		/* Slabs allocated                  */
+    size_t	 inuse;		/* Objects allocated                */
+    size_t	 peak;		/* Most objects allocated at once   */
+    uint64_t	 allocs;	/* Calls to pool_alloc()            */
+    uint64_t	 failed;	/* ... that ran out of memory       */
+};
+
+extern struct pool *pools;
+
+extern void	 pool_init	(struct pool *pool, const char *name, size_t size);
+extern int	 pool_resize	(struct pool *pool, size_t size);
+extern void	*pool_alloc	(struct pool *pool);
+extern void	 pool_free	(struct pool *pool, void *ptr);
+
+#endif /* PIMD_POOL_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
@@ -85,11 +85,17 @@ spt_threshold_t spt_threshold = {
  * Local variables
  */
 uint16_t unicast_routing_interval = UCAST_ROUTING_CHECK_INTERVAL;
-uint16_t unicast_routing_timer;   /* Used to check periodically for any
+uint32_t unicast_routing_timer;   /* Used to check periodically for any
 				   * change in the unicast routing. */
-uint16_t pim_spt_threshold_timer; /* Used for periodic check of spt-threshold
+uint32_t pim_spt_threshold_timer; /* Used for periodic check of spt-threshold
 				   * for the RP or the lasthop router. */
 
+uint32_t route_clock;		  /* Seconds, advanced by age_routes() */
+
+#define AGE_WHEEL_SIZE 256
+static mrtentry_t *age_wheel[AGE_WHEEL_SIZE];
+static mrtentry_t *age_pending[3]; /* (*,*,RP), (*,G), and (S,G) due */
+
 /*
  * TODO: XXX: the timers below are not used. Instead, the data rate timer is used.
  */
@@ -100,6 +106,36 @@ uint16_t kernel_cache_interval;
 /* to request and compare any route changes */
 srcentry_t srcentry_save;
 rpentry_t  rpentry_save;
+struct rpfstats rpf_stats;
+
+/*
+ * Cache miss upcalls that cannot be forwarded are rate limited by a
+ * token bucket per (S,G), in a direct-mapped table.  The kernel repeats
+ * an unresolved upcall about every ten seconds, so a source that keeps
+ * missing, e.g. a sender without any receivers, soon runs out of tokens
+ * and gets a negative MFC entry without oifs, which stops the upcalls.
+ * With a matching route the entry goes on its kernel_cache list, and
+ * gets oifs with the route.  Without one, or on another iif, there is
+ * no mrtentry to hold it, so it goes on the negative_cache list until
+ * it expires, or a route for the group gets oifs or a new iif.
+ */
+#define UPCALL_HASH_SIZE	4096
+#define UPCALL_BURST		3	/* Cache misses before limiting  */
+#define UPCALL_REFILL		60	/* Seconds per new token         */
+#define NEGATIVE_CACHE_MAX	1024
+#define NEGATIVE_CACHE_TIMEOUT	60	/* Seconds                       */
+
+struct upcall_bucket {
+    uint32_t source;
+    uint32_t group;
+    uint32_t stamp;			/* route_clock at last refill    */
+    uint32_t tokens;
+};
+
+static struct upcall_bucket upcall_bucket[UPCALL_HASH_SIZE];
+kernel_cache_t *negative_cache;		/* Null oif MFC entries          */
+static uint32_t negative_count;
+struct upcallstats upcall_stats;
 
 /*
  * Forward declarations
@@ -109,13 +145,145 @@ static void   process_wrong_iif   (struct igmpmsg *igmpctl);
 static void   process_whole_pkt   (char *buf);
 static void   check_spt_threshold (mrtentry_t *mrt);
 
+/* Take a token for a cache miss upcall of (S,G), FALSE if none left */
+static int upcall_allowed(uint32_t source, uint32_t group)
+{
+    struct upcall_bucket *b;
+    uint32_t tokens;
+
+    b = &upcall_bucket[((source ^ group) * 2654435761u) >> 20];
+    if (b->source != source || b->group != group) {
+	b->source = source;
+	b->group  = group;
+	b->tokens = UPCALL_BURST;
+	b->stamp  = route_clock;
+    } else {
+	tokens = (route_clock - b->stamp) / UPCALL_REFILL;
+	b->stamp += tokens * UPCALL_REFILL;
+	if (b->tokens + tokens >= UPCALL_BURST) {
+	    b->tokens = UPCALL_BURST;
+	    b->stamp  = route_clock;
+	} else {
+	    b->tokens += tokens;
+	}
+    }
+
+    if (!b->tokens)
+	return FALSE;
+    b->tokens--;
+
+    return TRUE;
+}
+
+static void delete_negative_cache(kernel_cache_t *kc)
+{
+    if (kc->prev)
+	kc->prev->next = kc->next;
+    else
+	negative_cache = kc->next;
+    if (kc->next)
+	kc->next->prev = kc->prev;
+
+    k_del_mfc(igmp_socket, kc->source, kc->group);
+    pool_free(&kernel_cache_pool, kc);
+    negative_count--;
+}
+
+/* Install a null oif MFC entry for (S,G) to stop the upcalls */
+static void add_negative_cache(uint32_t source, uint32_t group, vifi_t iif)
+{
+    vifset_t no_oifs;
+    kernel_cache_t *kc;
+
+    for (kc = negative_cache; kc; kc = kc->next) {
+	if (kc->source == source && kc->group == group)
+	    return;		/* Upcall was already queued */
+    }
+
+    if (negative_count >= NEGATIVE_CACHE_MAX)
+	return;
+
+    kc = pool_alloc(&kernel_cache_pool);
+    if (!kc) {
+	logit(LOG_ERR, 0, "Ran out of memory in add_negative_cache()");
+	return;
+    }
+
+    kc->source  = source;
+    kc->group   = group;
+    kc->expires = route_clock + NEGATIVE_CACHE_TIMEOUT;
+    kc->next    = negative_cache;
+    if (negative_cache)
+	negative_cache->prev = kc;
+    negative_cache = kc;
+    negative_count++;
+
+    PIMD_VIFM_CLRALL(no_oifs);
+    k_chg_mfc(igmp_socket, source, group, iif, no_oifs, INADDR_ANY_N);
+    upcall_stats.negative++;
+
+    IF_DEBUG(DEBUG_MFC)
+	logit(LOG_DEBUG, 0, "Too many cache misses, negative cache entry for src %s grp %s",
+	      inet_fmt(source, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)));
+}
+
+/* A route for @group, or all groups with INADDR_ANY, can now forward */
+static void flush_negative_cache(uint32_t group)
+{
+    kernel_cache_t *kc, *kc_next;
+
+    for (kc = negative_cache; kc; kc = kc_next) {
+	kc_next = kc->next;
+	if (group != INADDR_ANY_N && kc->group != group)
+	    continue;
+
+	delete_negative_cache(kc);
+	upcall_stats.flushed++;
+    }
+}
+
+/* Nothing to forward (S,G) on, when it keeps missing stop the upcalls */
+static void cache_miss_unrouted(mrtentry_t *mrt, uint32_t source, uint32_t group, vifi_t iif)
+{
+    if (upcall_allowed(source, group))
+	return;
+
+    upcall_stats.limited++;
+    if (!mrt || mrt->incoming != iif) {
+	add_negative_cache(source, group, iif);
+	return;
+    }
+
+    add_kernel_cache(mrt, source, group, 0);
+    k_chg_mfc(igmp_socket, source, group, iif, mrt->oifs, INADDR_ANY_N);
+    upcall_stats.negative++;
+
+    IF_DEBUG(DEBUG_MFC)
+	logit(LOG_DEBUG, 0, "Too many cache misses, no oifs yet for src %s grp %s",
+	      inet_fmt(source, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)));
+}
+
+static void age_negative_cache(void)
+{
+    kernel_cache_t *kc, *kc_next;
+
+    for (kc = negative_cache; kc; kc = kc_next) {
+	kc_next = kc->next;
+	if (!MRT_TIMEOUT(kc->expires))
+	    continue;
+
+	delete_negative_cache(kc);
+	upcall_stats.expired++;
+    }
+}
+
 /*
  * Init some timers
  */
 void init_route(void)
 {
-    SET_TIMER(unicast_routing_timer, unicast_routing_interval);
-    SET_TIMER(pim_spt_threshold_timer, spt_threshold.interval);
+    unicast_routing_timer   = route_clock + unicast_routing_interval;
+    pim_spt_threshold_timer = route_clock + spt_threshold.interval;
 
     /* Initialize the srcentry and rpentry used to save the old routes
      * during unicast routing change discovery process. */
@@ -310,9 +478,9 @@ void add_leaf(vifi_t vifi, uint32_t source, uint32_t group)
 {
     mrtentry_t *mrt;
     mrtentry_t *srcs;
-    uint8_t old_oifs[MAXVIFS];
-    uint8_t new_oifs[MAXVIFS];
-    uint8_t new_leaves[MAXVIFS];
+    vifset_t old_oifs;
+    vifset_t new_oifs;
+    vifset_t new_leaves;
     uint16_t flags;
 
     /* Don't create routing entries for the LAN scoped addresses */
@@ -382,10 +550,10 @@ void add_leaf(vifi_t vifi, uint32_t source, uint32_t group)
 	mrt->flags &= ~MRTF_NEW;
 	if (mrt->upstream) {
 	    send_pim_join(mrt->upstream, mrt, flags, PIM_JOIN_PRUNE_HOLDTIME);
-	    SET_TIMER(mrt->jp_timer, PIM_JOIN_PRUNE_PERIOD);
+	    MRT_SET_TIMER(mrt, mrt->jp_timer, PIM_JOIN_PRUNE_PERIOD);
 	}
 	else  {
-	    FIRE_TIMER(mrt->jp_timer); /* Timeout the Join/Prune timer */
+	    MRT_FIRE_TIMER(mrt, mrt->jp_timer); /* Timeout the Join/Prune timer */
 	    logit(LOG_DEBUG, 0, "Upstream router not available.");
 	}
     }
@@ -422,9 +590,9 @@ void delete_leaf(vifi_t vifi, uint32_t source, uint32_t group)
 {
     mrtentry_t *mrt;
     mrtentry_t *srcs;
-    uint8_t new_oifs[MAXVIFS];
-    uint8_t old_oifs[MAXVIFS];
-    uint8_t new_leaves[MAXVIFS];
+    vifset_t new_oifs;
+    vifset_t old_oifs;
+    vifset_t new_leaves;
 
     if (IN_PIM_SSM_RANGE(group))
 	mrt = find_route(source, group, MRTF_SG, DONT_CREATE);
@@ -456,14 +624,16 @@ void delete_leaf(vifi_t vifi, uint32_t source, uint32_t group)
     calc_oifs(mrt, new_oifs);
 
     if ((!PIMD_VIFM_ISEMPTY(old_oifs)) && PIMD_VIFM_ISEMPTY(new_oifs)) {
-	/* The result oifs have changed from non-NULL to NULL */
-	FIRE_TIMER(mrt->jp_timer); /* Timeout the Join/Prune timer */
-
-	/* TODO: explicitly call the function below?
-	send_pim_join_prune(mrt->upstream->vifi,
-			    mrt->upstream,
-			    PIM_JOIN_PRUNE_HOLDTIME);
-	*/
+	/* The result oifs have changed from non-NULL to NULL, prune
+	 * ourselves from the tree now rather than at the next aging
+	 * pass.  Anything more involved is left to the J/P timer. */
+	if (mrt->upstream && join_or_prune(mrt, mrt->upstream) == PIM_ACTION_PRUNE) {
+	    send_pim_prune(mrt->upstream, mrt, (mrt->flags & MRTF_SG) ? MRTF_SG : MRTF_RP | MRTF_WC,
+			   PIM_JOIN_PRUNE_HOLDTIME);
+	    MRT_SET_TIMER(mrt, mrt->jp_timer, PIM_JOIN_PRUNE_PERIOD);
+	} else {
+	    MRT_FIRE_TIMER(mrt, mrt->jp_timer); /* Timeout the Join/Prune timer */
+	}
     }
 
     /* Check all (S,G) entries and clear the inherited "leaf" flag.
@@ -484,9 +654,9 @@ void delete_leaf(vifi_t vifi, uint32_t source, uint32_t group)
 }
 
 
-void calc_oifs(mrtentry_t *mrt, uint8_t *oifs_ptr)
+void calc_oifs(mrtentry_t *mrt, vifset_t oifs_ptr)
 {
-    uint8_t oifs[MAXVIFS];
+    vifset_t oifs;
     mrtentry_t *grp;
     mrtentry_t *mrp;
 
@@ -507,29 +677,21 @@ void calc_oifs(mrtentry_t *mrt, uint8_t *oifs_ptr)
     if (!(mrt->flags & MRTF_PMBR)) {
 	/* Either (*,G) or (S,G). Merge with the oifs from the (*,*,RP) */
 	mrp = mrt->group->active_rp_grp->rp->rpentry->mrtlink;
-	if (mrp) {
-	    PIMD_VIFM_MERGE(oifs, mrp->joined_oifs, oifs);
-	    PIMD_VIFM_CLR_MASK(oifs, mrp->pruned_oifs);
-	    PIMD_VIFM_MERGE(oifs, mrp->leaves, oifs);
-	    PIMD_VIFM_CLR_MASK(oifs, mrp->asserted_oifs);
-	}
+	if (mrp)
+	    PIMD_VIFM_APPLY(oifs, mrp->joined_oifs, mrp->pruned_oifs,
+			    mrp->leaves, mrp->asserted_oifs);
     }
     if (mrt->flags & MRTF_SG) {
 	/* (S,G) entry. Merge with the oifs from (*,G) */
 	grp = mrt->group->grp_route;
-	if (grp) {
-	    PIMD_VIFM_MERGE(oifs, grp->joined_oifs, oifs);
-	    PIMD_VIFM_CLR_MASK(oifs, grp->pruned_oifs);
-	    PIMD_VIFM_MERGE(oifs, grp->leaves, oifs);
-	    PIMD_VIFM_CLR_MASK(oifs, grp->asserted_oifs);
-	}
+	if (grp)
+	    PIMD_VIFM_APPLY(oifs, grp->joined_oifs, grp->pruned_oifs,
+			    grp->leaves, grp->asserted_oifs);
     }
 
     /* Calculate my own stuff */
-    PIMD_VIFM_MERGE(oifs, mrt->joined_oifs, oifs);
-    PIMD_VIFM_CLR_MASK(oifs, mrt->pruned_oifs);
-    PIMD_VIFM_MERGE(oifs, mrt->leaves, oifs);
-    PIMD_VIFM_CLR_MASK(oifs, mrt->asserted_oifs);
+    PIMD_VIFM_APPLY(oifs, mrt->joined_oifs, mrt->pruned_oifs,
+		    mrt->leaves, mrt->asserted_oifs);
 
     PIMD_VIFM_COPY(oifs, oifs_ptr);
 }
@@ -546,20 +708,20 @@ void calc_oifs(mrtentry_t *mrt, uint8_t *oifs_ptr)
  */
 int change_interfaces(mrtentry_t *mrt,
 		      vifi_t new_iif,
-		      uint8_t *new_joined_oifs_,
-		      uint8_t *new_pruned_oifs,
-		      uint8_t *new_leaves_,
-		      uint8_t *new_asserted_oifs,
+		      vifset_t new_joined_oifs_,
+		      vifset_t new_pruned_oifs,
+		      vifset_t new_leaves_,
+		      vifset_t new_asserted_oifs,
 		      uint16_t flags)
 {
-    uint8_t new_joined_oifs[MAXVIFS];  /* The oifs for that particular mrtentry */
-    uint8_t old_joined_oifs[MAXVIFS] __attribute__ ((unused));
-    uint8_t old_pruned_oifs[MAXVIFS] __attribute__ ((unused));
-    uint8_t old_leaves[MAXVIFS] __attribute__ ((unused));
-    uint8_t new_leaves[MAXVIFS];
-    uint8_t old_asserted_oifs[MAXVIFS] __attribute__ ((unused));
-    uint8_t new_real_oifs[MAXVIFS];    /* The result oifs */
-    uint8_t old_real_oifs[MAXVIFS];
+    vifset_t new_joined_oifs;  /* The oifs for that particular mrtentry */
+    vifset_t old_joined_oifs __attribute__ ((unused));
+    vifset_t old_pruned_oifs __attribute__ ((unused));
+    vifset_t old_leaves __attribute__ ((unused));
+    vifset_t new_leaves;
+    vifset_t old_asserted_oifs __attribute__ ((unused));
+    vifset_t new_real_oifs;    /* The result oifs */
+    vifset_t old_real_oifs;
     vifi_t      old_iif;
     rpentry_t   *rp;
     cand_rp_t   *cand_rp;
@@ -615,10 +777,15 @@ int change_interfaces(mrtentry_t *mrt,
 	&& !(flags & MFC_UPDATE_FORCE))
 	return 0;		/* Nothing to change */
 
+    /* Let the kernel ask again about sources we told it to drop */
+    if (negative_cache && (result == 1 || new_iif != old_iif))
+	flush_negative_cache(mrt->flags & MRTF_PMBR ? INADDR_ANY_N : mrt->group->group);
+
     if ((result != 0) || (new_iif != old_iif) || (flags & MFC_UPDATE_FORCE)) {
-	FIRE_TIMER(mrt->jp_timer);
+	MRT_FIRE_TIMER(mrt, mrt->jp_timer);
     }
     PIMD_VIFM_COPY(new_real_oifs, mrt->oifs);
+    ipc_route_event(IPC_EV_CHANGE, mrt);
 
     if (mrt->flags & MRTF_PMBR) {
 	/* (*,*,RP) entry */
@@ -697,7 +864,7 @@ int change_interfaces(mrtentry_t *mrt,
 	    }
 	}
 	if (fire_timer_flag == TRUE)
-	    FIRE_TIMER(mrt->jp_timer);
+	    MRT_FIRE_TIMER(mrt, mrt->jp_timer);
 	if (delete_mrt_flag == TRUE) {
 	    /* TODO: XXX: trigger a Prune message? Don't delete now, it will
 	     * be automatically timed out. If want to delete now, don't
@@ -756,7 +923,7 @@ int change_interfaces(mrtentry_t *mrt,
 	}
 
 	if (fire_timer_flag == TRUE)
-	    FIRE_TIMER(mrt->jp_timer);
+	    MRT_FIRE_TIMER(mrt, mrt->jp_timer);
 
 	if (delete_mrt_flag == TRUE) {
 	    /* TODO: XXX: the oifs are NULL. Send a Prune message? */
@@ -777,7 +944,7 @@ int change_interfaces(mrtentry_t *mrt,
 	 * the (S,G). If "yes", then forbid creating (*,G) MFC. */
 	for (tmp = mrp; 1; tmp = mwc) {
 	    while (1) {
-		uint8_t oifs[MAXVIFS];
+		vifset_t oifs;
 
 		if (!tmp)
 		    break;
@@ -871,9 +1038,9 @@ int delete_vif_from_mrt(vifi_t vifi __attribute__((unused)))
 }
 
 
-void process_kernel_call(void)
+void process_kernel_call(char *buf)
 {
-    struct igmpmsg *igmpctl = (struct igmpmsg *)igmp_recv_buf;
+    struct igmpmsg *igmpctl = (struct igmpmsg *)buf;
 
     switch (igmpctl->im_msgtype) {
 	case IGMPMSG_NOCACHE:
@@ -885,7 +1052,7 @@ void process_kernel_call(void)
 	    break;
 
 	case IGMPMSG_WHOLEPKT:
-	    process_whole_pkt(igmp_recv_buf);
+	    process_whole_pkt(buf);
 	    break;
 
 	default:
@@ -896,6 +1063,22 @@ void process_kernel_call(void)
 }
 
 
+/*
+ * At the RP, record in the kernel cache entry of (S,G) if it arrives
+ * decapsulated on tunl0, or as PIM Register on the register vif.
+ */
+static void regtun_mark(uint32_t source, uint32_t group, int decap)
+{
+    kernel_cache_t *kc;
+
+    if (!register_kernel_encap)
+	return;
+
+    kc = find_kernel_cache(source, group, NULL);
+    if (kc)
+	kc->decap = decap;
+}
+
 /*
  * TODO: when cache miss, check the iif, because probably ASSERTS
  * shoult take place
@@ -907,6 +1090,7 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
     vifi_t iif;
     mrtentry_t *mrt;
     mrtentry_t *mrp;
+    int decap;
 
     /* When there is a cache miss, we check only the header of the packet
      * (and only it should be sent up by the kernel. */
@@ -914,15 +1098,21 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
     group  = igmpctl->im_dst.s_addr;
     source = mfc_source = igmpctl->im_src.s_addr;
     iif    = igmpctl->im_vif;
+    upcall_stats.misses++;
 
-    IF_DEBUG(DEBUG_MRT)
-	logit(LOG_DEBUG, 0, "Cache miss, src %s, dst %s, iif %s",
-	      inet_fmt(source, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)), uvifs[iif].uv_name);
+    /* Encapsulated by a DR with register-encap kernel, as if registered */
+    decap = register_kernel_encap && k_regtun_input(iif);
+    if (decap)
+	iif = PIMREG_VIF;
 
     /* TODO: XXX: check whether the kernel generates cache miss for the LAN scoped addresses */
     if (ntohl(group) <= INADDR_MAX_LOCAL_GROUP)
 	return; /* Don't create routing entries for the LAN scoped addresses */
 
+    IF_DEBUG(DEBUG_MRT)
+	logit(LOG_DEBUG, 0, "Cache miss, src %s, dst %s, iif %s",
+	      inet_fmt(source, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)), uvifs[iif].uv_name);
+
     /* TODO: check if correct in case the source is one of my addresses */
     /* If I am the DR for this source, create (S,G) and add the register_vif
      * to the oifs. */
@@ -942,10 +1132,16 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
 			  mrt->pruned_oifs,
 			  mrt->leaves,
 			  mrt->asserted_oifs, 0);
+
+	/* The kernel encapsulates, tell the RP so it can Register-Stop us */
+	if (register_kernel_encap && PIMD_VIFM_ISSET(PIMREG_VIF, mrt->oifs))
+	    send_pim_null_register(mrt);
     } else {
 	mrt = find_route(source, group, MRTF_SG | MRTF_WC | MRTF_PMBR, DONT_CREATE);
-	if (!mrt)
+	if (!mrt) {
+	    cache_miss_unrouted(NULL, source, group, iif);
 	    return;
+	}
 
 	if (IN_PIM_SSM_RANGE(group))
 	    switch_shortest_path(source, group);
@@ -953,10 +1149,6 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
 	    check_spt_threshold(mrt);
     }
 
-    /* TODO: if there are too many cache miss for the same (S,G),
-     * install negative cache entry in the kernel (oif==NULL) to prevent
-     * too many upcalls. */
-
     if (mrt->incoming == iif) {
 	if (!PIMD_VIFM_ISEMPTY(mrt->oifs)) {
 	    uint32_t rp_addr;
@@ -964,8 +1156,8 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
 	    if (mrt->flags & MRTF_SG) {
 		/* TODO: check that the RPbit is not set? */
 		/* TODO: XXX: TIMER implem. dependency! */
-		if (mrt->entry_timer < PIM_DATA_TIMEOUT)
-		    SET_TIMER(mrt->entry_timer, PIM_DATA_TIMEOUT);
+		if (MRT_TIMER_LEFT(mrt->entry_timer) < PIM_DATA_TIMEOUT)
+		    MRT_SET_TIMER(mrt, mrt->entry_timer, PIM_DATA_TIMEOUT);
 
 		if (!(mrt->flags & MRTF_SPT)) {
 		    mrp = mrt->group->grp_route;
@@ -997,11 +1189,14 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
 #endif /* KERNEL_MFC_WC_G */
 
 	    add_kernel_cache(mrt, mfc_source, group, MFC_MOVE_FORCE);
+	    regtun_mark(mfc_source, group, decap);
 
 	    APPLY_SCOPE(group, mrt);
 	    k_chg_mfc(igmp_socket, mfc_source, group, iif, mrt->oifs, rp_addr);
 
 	    /* No need for RSRR message, because nothing has changed. */
+	} else {
+	    cache_miss_unrouted(mrt, source, group, iif);
 	}
 
 	return;			/* iif match */
@@ -1010,8 +1205,10 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
     /* The iif doesn't match */
     if (mrt->flags & MRTF_SG) {
 	/* Arrived on wrong interface */
-	if (mrt->flags & MRTF_SPT)
+	if (mrt->flags & MRTF_SPT) {
+	    cache_miss_unrouted(mrt, source, group, iif);
 	    return;
+	}
 
 	mrp = mrt->group->grp_route;
 	if (!mrp)
@@ -1026,6 +1223,7 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
 #endif /* KERNEL_MFC_WC_G */
 
 		add_kernel_cache(mrp, mfc_source, group, 0);
+		regtun_mark(mfc_source, group, decap);
 
 		/* marian: not sure if we reach here with our scoped traffic? */
 		APPLY_SCOPE(group, mrt);
@@ -1033,12 +1231,62 @@ static void process_cache_miss(struct igmpmsg *igmpctl)
 #ifdef RSRR
 		rsrr_cache_send(mrp, RSRR_NOTIFICATION_OK);
 #endif /* RSRR */
+		return;
 	    }
 	}
     }
+
+    cache_miss_unrouted(mrt, source, group, iif);
 }
 
 
+/*
+ * At the RP, the kernel now receives (S,G) from a DR on the other of
+ * tunl0 and the register vif, update the iif of its MFC entry.
+ */
+static void regtun_moved(uint32_t source, uint32_t group, int decap)
+{
+    kernel_cache_t *kc;
+    mrtentry_t *mrt;
+    uint32_t rp_addr;
+
+    kc = find_kernel_cache(source, group, &mrt);
+    if (!kc || mrt->incoming != PIMREG_VIF)
+	return;
+
+    kc->decap = decap;
+    if (mrt->flags & MRTF_PMBR)
+	rp_addr = mrt->source->address;
+    else
+	rp_addr = mrt->group->rpaddr;
+
+    k_chg_mfc(igmp_socket, source, group, PIMREG_VIF, mrt->oifs, rp_addr);
+}
+
+/*
+ * With register-encap kernel a DR gets no WHOLEPKT upcalls for active
+ * sources, check the kernel counters of the (S,G) instead.  They are
+ * compared to a snapshot of our own, kc->sg_count is the previous
+ * sample of check_spt_threshold().
+ */
+static int regtun_active(mrtentry_t *mrt)
+{
+    kernel_cache_t *kc;
+    struct sg_count sg;
+    int active = FALSE;
+
+    for (kc = mrt->kernel_cache; kc; kc = kc->next) {
+	if (k_get_sg_cnt(udp_socket, kc->source, kc->group, &sg))
+	    continue;
+
+	if (sg.pktcnt != kc->keepalive)
+	    active = TRUE;
+	kc->keepalive = sg.pktcnt;
+    }
+
+    return active;
+}
+
 /*
  * A multicast packet has been received on wrong iif by the kernel.
  * Check for a matching entry. If there is (S,G) with reset SPTbit and
@@ -1059,6 +1307,19 @@ static void process_wrong_iif(struct igmpmsg *igmpctl)
     source = igmpctl->im_src.s_addr;
     iif    = igmpctl->im_vif;
 
+    /* With register-encap kernel, (S,G) moved between tunl0 and pimreg */
+    if (register_kernel_encap) {
+	if (k_regtun_input(iif)) {
+	    regtun_moved(source, group, TRUE);
+	    return;
+	}
+
+	if (iif == PIMREG_VIF) {
+	    regtun_moved(source, group, FALSE);
+	    return;
+	}
+    }
+
     IF_DEBUG(DEBUG_MRT)
 	logit(LOG_DEBUG, 0, "Wrong iif: src %s, dst %s, iif %s",
 	      inet_fmt(source, s1, sizeof(s1)), inet_fmt(group, s2, sizeof(s2)), uvifs[iif].uv_name);
@@ -1089,7 +1350,7 @@ static void process_wrong_iif(struct igmpmsg *igmpctl)
 		add_kernel_cache(mrt, source, group, MFC_MOVE_FORCE);
 		k_chg_mfc(igmp_socket, source, group, iif,
 			  mrt->oifs, mrt->group->rpaddr);
-		FIRE_TIMER(mrt->jp_timer);
+		MRT_FIRE_TIMER(mrt, mrt->jp_timer);
 #ifdef RSRR
 		rsrr_cache_send(mrt, RSRR_NOTIFICATION_OK);
 #endif /* RSRR */
@@ -1148,8 +1409,8 @@ mrtentry_t *switch_shortest_path(uint32_t source, uint32_t group)
 			      mrt->asserted_oifs, 0);
 	}
 
-	SET_TIMER(mrt->entry_timer, PIM_DATA_TIMEOUT);
-	FIRE_TIMER(mrt->jp_timer);
+	MRT_SET_TIMER(mrt, mrt->entry_timer, PIM_DATA_TIMEOUT);
+	MRT_FIRE_TIMER(mrt, mrt->jp_timer);
     }
 
     return mrt;
@@ -1227,6 +1488,10 @@ static void check_spt_threshold(mrtentry_t *mrt)
 	    continue;
 	}
 
+	/* The counters are also the keepalive, see regtun_active() */
+	if (register_kernel_encap && (mrt->flags & MRTF_SG))
+	    MRT_SET_TIMER(mrt, mrt->entry_timer, PIM_DATA_TIMEOUT);
+
 	IF_DEBUG(DEBUG_MRT)
 	    logit(LOG_DEBUG, 0, "Checking SPT threshold for (%s,%s) pkt cnt now %d vs %d",
 		  inet_fmt(kc->source, s1, sizeof(s1)), inet_fmt(kc->group, s2, sizeof(s2)),
@@ -1259,15 +1524,633 @@ static void check_spt_threshold(mrtentry_t *mrt)
 
 
 /*
- * Scan the whole routing table and timeout a bunch of timers:
+ * Routing entries are aged on a wheel of one second slots, keyed on the
+ * next time age_routes() needs to look at them, i.e., their earliest
+ * running timer.  Entries further away than the wheel size stay in
+ * their slot and are skipped until their time comes around.  At each
+ * tick the entries due are moved to per type pending lists, (*,*,RP)
+ * before (*,G) before (S,G), since the Join/Prune action of a wider
+ * entry may override the narrower ones.
+ */
+static void age_link(mrtentry_t **head, mrtentry_t *mrt)
+{
+    mrt->agehead = head;
+    mrt->ageprev = NULL;
+    mrt->agenext = *head;
+    if (*head)
+	(*head)->ageprev = mrt;
+    *head = mrt;
+}
+
+void mrt_unschedule(mrtentry_t *mrt)
+{
+    if (!mrt->agehead)
+	return;
+
+    if (mrt->ageprev)
+	mrt->ageprev->agenext = mrt->agenext;
+    else
+	*mrt->agehead = mrt->agenext;
+    if (mrt->agenext)
+	mrt->agenext->ageprev = mrt->ageprev;
+
+    mrt->agehead = NULL;
+    mrt->agenext = NULL;
+    mrt->ageprev = NULL;
+    mrt->agedue  = 0;
+}
+
+/*
+ * Make sure age_routes() visits the entry no later than @when, at the
+ * earliest at the next tick.
+ */
+void mrt_schedule(mrtentry_t *mrt, uint32_t when)
+{
+    if (when <= route_clock)
+	when = route_clock + 1;
+
+    if (mrt->agehead && mrt->agedue <= when)
+	return;
+
+    mrt_unschedule(mrt);
+    mrt->agedue = when;
+    age_link(&age_wheel[when % AGE_WHEEL_SIZE], mrt);
+}
+
+static void earliest(uint32_t *due, uint32_t timer)
+{
+    if (timer > route_clock && timer < *due)
+	*due = timer;
+}
+
+/* Schedule the next visit of an entry at its earliest running timer */
+static void mrt_reschedule(mrtentry_t *mrt)
+{
+    uint32_t due = route_clock + PIM_JOIN_PRUNE_PERIOD;
+    vifi_t vifi;
+
+    if (MRT_TIMEOUT(mrt->jp_timer))
+	due = route_clock + 1;
+    else
+	earliest(&due, mrt->jp_timer);
+
+    /* An expired entry lingers while it has local members */
+    if (MRT_TIMEOUT(mrt->entry_timer))
+	earliest(&due, route_clock + TIMER_INTERVAL);
+    else
+	earliest(&due, mrt->entry_timer);
+
+    for (vifi = 0; vifi < numvifs; vifi++) {
+	if ((mrt->flags & MRTF_SG) && vifi == PIMREG_VIF)
+	    continue;
+	if (PIMD_VIFM_ISSET(vifi, mrt->joined_oifs))
+	    earliest(&due, mrt->vif_timers[vifi]);
+    }
+
+    if (mrt->flags & MRTF_ASSERTED)
+	earliest(&due, mrt->assert_timer);
+
+    if (mrt->rs_timer) {
+	/* Send NULL register PIM_REGISTER_PROBE_TIME before expiry */
+	if (mrt->rs_timer > route_clock + PIM_REGISTER_PROBE_TIME)
+	    earliest(&due, mrt->rs_timer - PIM_REGISTER_PROBE_TIME);
+	else
+	    earliest(&due, mrt->rs_timer);
+    }
+
+    mrt_unschedule(mrt);
+    mrt_schedule(mrt, due);
+}
+
+/* The RP entry for a (*,G) or (S,G) routing entry, if any */
+static rpentry_t *mrt_rp(mrtentry_t *mrt)
+{
+    if (!mrt->group || !mrt->group->active_rp_grp)
+	return NULL;
+
+    return mrt->group->active_rp_grp->rp->rpentry;
+}
+
+/* Age the (*,*,RP) entry, if any, return its Join/Prune action */
+static int age_rp_entry(cand_rp_t *cand_rp, int update_rp_iif, int rate_flag)
+{
+    rpentry_t *rp = cand_rp->rpentry;
+    mrtentry_t *mrt_rp = rp->mrtlink;
+    int rp_action = PIM_ACTION_NOTHING;
+    int change_flag = FALSE;
+    vifi_t vifi;
+
+    if (!mrt_rp)
+	return PIM_ACTION_NOTHING;
+
+    mrt_unschedule(mrt_rp);
+    mrt_rp->aged = route_clock;
+
+    /* outgoing interfaces timers */
+    for (vifi = 0; vifi < numvifs; vifi++) {
+	if (PIMD_VIFM_ISSET(vifi, mrt_rp->joined_oifs)) {
+	    if (MRT_TIMEOUT(mrt_rp->vif_timers[vifi])) {
+		PIMD_VIFM_CLR(vifi, mrt_rp->joined_oifs);
+		change_flag = TRUE;
+	    }
+	}
+    }
+    if ((change_flag == TRUE) || (update_rp_iif == TRUE)) {
+	change_interfaces(mrt_rp,
+			  rp->incoming,
+			  mrt_rp->joined_oifs,
+			  mrt_rp->pruned_oifs,
+			  mrt_rp->leaves,
+			  mrt_rp->asserted_oifs, 0);
+	mrt_rp->upstream = rp->upstream;
+    }
+
+    /* Check the activity for this entry */
+    if (rate_flag == TRUE)
+	check_spt_threshold(mrt_rp);
+
+    /* Join/Prune timer */
+    if (MRT_TIMEOUT(mrt_rp->jp_timer)) {
+	rp_action = join_or_prune(mrt_rp, mrt_rp->upstream);
+
+	if (rp_action != PIM_ACTION_NOTHING)
+	    add_jp_entry(mrt_rp->upstream,
+			 PIM_JOIN_PRUNE_HOLDTIME,
+			 htonl(CLASSD_PREFIX),
+			 STAR_STAR_RP_MSKLEN,
+			 mrt_rp->source->address,
+			 SINGLE_SRC_MSKLEN,
+			 MRTF_RP | MRTF_WC,
+			 rp_action);
+
+	MRT_SET_TIMER(mrt_rp, mrt_rp->jp_timer, PIM_JOIN_PRUNE_PERIOD);
+    }
+
+    /* Assert timer */
+    if (mrt_rp->flags & MRTF_ASSERTED) {
+	if (MRT_TIMEOUT(mrt_rp->assert_timer)) {
+	    /* TODO: XXX: reset the upstream router now */
+	    mrt_rp->flags &= ~MRTF_ASSERTED;
+	}
+    }
+
+    /* TODO: can we have Register-Suppression timer for (*,*,RP)?
+     * Currently no...
+     */
+
+    /* routing entry */
+    if ((MRT_TIMEOUT(mrt_rp->entry_timer)) && (PIMD_VIFM_ISEMPTY(mrt_rp->leaves))) {
+	delete_mrtentry(mrt_rp);
+	return rp_action;
+    }
+
+    mrt_reschedule(mrt_rp);
+
+    return rp_action;
+}
+
+/* Age a (*,G) entry, return its Join/Prune action */
+static int age_grp_entry(mrtentry_t *mrt_grp, rpentry_t *rp, int update_rp_iif,
+			 int rate_flag, int rp_action)
+{
+    int grp_action = PIM_ACTION_NOTHING;
+    int assert_timer_expired = 0;
+    int dont_calc_action;
+    int change_flag = FALSE;
+    vifi_t vifi;
+
+    mrt_unschedule(mrt_grp);
+    mrt_grp->aged = route_clock;
+
+    /* outgoing interfaces timers */
+    if (mrt_grp->flags & MRTF_ASSERTED)
+	assert_timer_expired = MRT_TIMEOUT(mrt_grp->assert_timer);
+
+    for (vifi = 0; vifi < numvifs; vifi++) {
+	if (PIMD_VIFM_ISSET(vifi, mrt_grp->joined_oifs)) {
+	    if (MRT_TIMEOUT(mrt_grp->vif_timers[vifi])) {
+		PIMD_VIFM_CLR(vifi, mrt_grp->joined_oifs);
+		change_flag = TRUE;
+	    }
+	}
+
+	if (assert_timer_expired) {
+	    PIMD_VIFM_CLR(vifi, mrt_grp->asserted_oifs);
+	    change_flag = TRUE;
+	    mrt_grp->flags &= ~MRTF_ASSERTED;
+	}
+    }
+
+    if ((change_flag == TRUE) || (update_rp_iif == TRUE)) {
+	change_interfaces(mrt_grp,
+			  rp->incoming,
+			  mrt_grp->joined_oifs,
+			  mrt_grp->pruned_oifs,
+			  mrt_grp->leaves,
+			  mrt_grp->asserted_oifs, 0);
+	mrt_grp->upstream = rp->upstream;
+    }
+
+    /* Check the sources activity */
+    if (rate_flag == TRUE)
+	check_spt_threshold(mrt_grp);
+
+    dont_calc_action = FALSE;
+    if (rp_action != PIM_ACTION_NOTHING) {
+	dont_calc_action = TRUE;
+
+	grp_action = join_or_prune(mrt_grp, mrt_grp->upstream);
+	if (((rp_action == PIM_ACTION_JOIN)  && (grp_action == PIM_ACTION_PRUNE)) ||
+	    ((rp_action == PIM_ACTION_PRUNE) && (grp_action == PIM_ACTION_JOIN)))
+	    MRT_FIRE_TIMER(mrt_grp, mrt_grp->jp_timer);
+    }
+
+    /* Join/Prune timer */
+    if (MRT_TIMEOUT(mrt_grp->jp_timer)) {
+	if (dont_calc_action != TRUE)
+	    grp_action = join_or_prune(mrt_grp, mrt_grp->upstream);
+
+	if (grp_action != PIM_ACTION_NOTHING)
+	    add_jp_entry(mrt_grp->upstream,
+			 PIM_JOIN_PRUNE_HOLDTIME,
+			 mrt_grp->group->group,
+			 SINGLE_GRP_MSKLEN,
+			 rp->address,
+			 SINGLE_SRC_MSKLEN,
+			 MRTF_RP | MRTF_WC,
+			 grp_action);
+	MRT_SET_TIMER(mrt_grp, mrt_grp->jp_timer, PIM_JOIN_PRUNE_PERIOD);
+    }
+
+    /* TODO: currently cannot have Register-Suppression timer for
+     * (*,G) entry, but keep this around.
+     */
+
+    /* routing entry */
+    if ((MRT_TIMEOUT(mrt_grp->entry_timer)) && (PIMD_VIFM_ISEMPTY(mrt_grp->leaves))) {
+	delete_mrtentry(mrt_grp);
+	return grp_action;
+    }
+
+    mrt_reschedule(mrt_grp);
+
+    return grp_action;
+}
+
+/* Age an (S,G) entry, may delete it */
+static void age_src_entry(mrtentry_t *mrt_srcs, rpentry_t *rp, int ucast_flag,
+			  int rate_flag, int rp_action, int grp_action)
+{
+    mrtentry_t *mrt_wide;
+    vifset_t new_pruned_oifs;
+    int src_action = PIM_ACTION_NOTHING, src_action_rp = PIM_ACTION_NOTHING;
+    int assert_timer_expired = 0;
+    int dont_calc_action;
+    int update_src_iif;
+    int change_flag = FALSE;
+    uint32_t last_aged;
+    vifi_t vifi;
+
+    mrt_unschedule(mrt_srcs);
+    last_aged = mrt_srcs->aged;
+    mrt_srcs->aged = route_clock;
+
+    /* outgoing interfaces timers */
+    if (mrt_srcs->flags & MRTF_ASSERTED)
+	assert_timer_expired = MRT_TIMEOUT(mrt_srcs->assert_timer);
+
+    for (vifi = 0; vifi < numvifs; vifi++) {
+	if (PIMD_VIFM_ISSET(vifi, mrt_srcs->joined_oifs)) {
+	    /* TODO: checking for reg_num_vif is slow! */
+	    if (vifi != PIMREG_VIF) {
+		if (MRT_TIMEOUT(mrt_srcs->vif_timers[vifi])) {
+		    PIMD_VIFM_CLR(vifi, mrt_srcs->joined_oifs);
+		    change_flag = TRUE;
+		}
+	    }
+	}
+
+	if (assert_timer_expired) {
+	    PIMD_VIFM_CLR(vifi, mrt_srcs->asserted_oifs);
+	    change_flag = TRUE;
+	    mrt_srcs->flags &= ~MRTF_ASSERTED;
+	}
+    }
+
+    update_src_iif = FALSE;
+    if (ucast_flag == TRUE) {
+	if (!(mrt_srcs->flags & MRTF_RP)) {
+	    /* iif toward the source */
+	    srcentry_save.incoming = mrt_srcs->source->incoming;
+	    srcentry_save.upstream = mrt_srcs->source->upstream;
+	    if (set_incoming(mrt_srcs->source, PIM_IIF_SOURCE) != TRUE) {
+		/* XXX: not in the spec!
+		 * Cannot find route toward that source.
+		 * This is bad. Delete the entry.
+		 */
+		delete_mrtentry(mrt_srcs);
+		return;
+	    }
+
+	    /* iif info found */
+	    if ((srcentry_save.incoming != mrt_srcs->source->incoming) ||
+		(srcentry_save.upstream != mrt_srcs->source->upstream)) {
+		/* Route change has occur */
+		update_src_iif = TRUE;
+		mrt_srcs->incoming = mrt_srcs->source->incoming;
+		mrt_srcs->upstream = mrt_srcs->source->upstream;
+	    }
+	} else {
+	    /* (S,G)RPBit with iif toward RP */
+	    if ((rpentry_save.upstream != mrt_srcs->upstream) ||
+		(rpentry_save.incoming != mrt_srcs->incoming)) {
+		update_src_iif = TRUE; /* XXX: a hack */
+		/* XXX: setup the iif now! */
+		mrt_srcs->incoming = rp->incoming;
+		mrt_srcs->upstream = rp->upstream;
+	    }
+	}
+    }
+
+    if ((change_flag == TRUE) || (update_src_iif == TRUE))
+	/* Flush the changes */
+	change_interfaces(mrt_srcs,
+			  mrt_srcs->incoming,
+			  mrt_srcs->joined_oifs,
+			  mrt_srcs->pruned_oifs,
+			  mrt_srcs->leaves,
+			  mrt_srcs->asserted_oifs, MFC_UPDATE_FORCE);
+
+    if (rate_flag == TRUE)
+	check_spt_threshold(mrt_srcs);
+
+    mrt_wide = mrt_srcs->group->grp_route;
+    if (!mrt_wide)
+	mrt_wide = rp->mrtlink;
+
+    dont_calc_action = FALSE;
+    if ((rp_action  != PIM_ACTION_NOTHING) ||
+	(grp_action != PIM_ACTION_NOTHING)) {
+	src_action_rp    = join_or_prune(mrt_srcs, rp->upstream);
+	src_action       = src_action_rp;
+	dont_calc_action = TRUE;
+
+	if (src_action_rp == PIM_ACTION_JOIN) {
+	    if ((grp_action == PIM_ACTION_PRUNE) ||
+		(rp_action  == PIM_ACTION_PRUNE))
+		MRT_FIRE_TIMER(mrt_srcs, mrt_srcs->jp_timer);
+	} else if (src_action_rp == PIM_ACTION_PRUNE) {
+	    if ((grp_action == PIM_ACTION_JOIN) ||
+		(rp_action  == PIM_ACTION_JOIN))
+		MRT_FIRE_TIMER(mrt_srcs, mrt_srcs->jp_timer);
+	}
+    }
+
+    /* Join/Prune timer */
+    if (MRT_TIMEOUT(mrt_srcs->jp_timer)) {
+	if ((dont_calc_action != TRUE) || (rp->upstream != mrt_srcs->upstream))
+	    src_action = join_or_prune(mrt_srcs, mrt_srcs->upstream);
+
+	if (src_action != PIM_ACTION_NOTHING)
+	    add_jp_entry(mrt_srcs->upstream,
+			 PIM_JOIN_PRUNE_HOLDTIME,
+			 mrt_srcs->group->group,
+			 SINGLE_GRP_MSKLEN,
+			 mrt_srcs->source->address,
+			 SINGLE_SRC_MSKLEN,
+			 mrt_srcs->flags & MRTF_RP,
+			 src_action);
+
+	if (mrt_wide) {
+	    /* Have both (S,G) and (*,G) (or (*,*,RP)).
+	     * Check if need to send (S,G) PRUNE toward RP */
+	    if (mrt_srcs->upstream != mrt_wide->upstream) {
+		if (dont_calc_action != TRUE)
+		    src_action_rp = join_or_prune(mrt_srcs, mrt_wide->upstream);
+
+		/* XXX: TODO: do error check if
+		 * src_action == PIM_ACTION_JOIN, which
+		 * should be an error. */
+		if (src_action_rp == PIM_ACTION_PRUNE)
+		    add_jp_entry(mrt_wide->upstream,
+				 PIM_JOIN_PRUNE_HOLDTIME,
+				 mrt_srcs->group->group,
+				 SINGLE_GRP_MSKLEN,
+				 mrt_srcs->source->address,
+				 SINGLE_SRC_MSKLEN,
+				 MRTF_RP,
+				 src_action_rp);
+	    }
+	}
+	MRT_SET_TIMER(mrt_srcs, mrt_srcs->jp_timer, PIM_JOIN_PRUNE_PERIOD);
+
+	/* The RP sees no Registers from the kernel, probe it regularly */
+	if (register_kernel_encap && PIMD_VIFM_ISSET(PIMREG_VIF, mrt_srcs->oifs))
+	    send_pim_null_register(mrt_srcs);
+    }
+
+    /* Register-Suppression timer */
+    /* TODO: to reduce the kernel calls, if the timer
+     * is running, install a negative cache entry in
+     * the kernel? */
+    if (mrt_srcs->rs_timer) {
+	if (MRT_TIMEOUT(mrt_srcs->rs_timer)) {
+	    /* Start encapsulating the packets */
+	    RESET_TIMER(mrt_srcs->rs_timer);
+	    PIMD_VIFM_COPY(mrt_srcs->pruned_oifs, new_pruned_oifs);
+	    PIMD_VIFM_CLR(PIMREG_VIF, new_pruned_oifs);
+	    change_interfaces(mrt_srcs,
+			      mrt_srcs->incoming,
+			      mrt_srcs->joined_oifs,
+			      new_pruned_oifs,
+			      mrt_srcs->leaves,
+			      mrt_srcs->asserted_oifs, 0);
+	} else {
+	    uint32_t probe = mrt_srcs->rs_timer - PIM_REGISTER_PROBE_TIME;
+
+	    /* The register suppression timer is running. Check
+	     * whether it is time to send PIM_NULL_REGISTER, once,
+	     * when we pass PIM_REGISTER_PROBE_TIME before expiry.
+	     */
+	    if (route_clock >= probe && last_aged < probe)
+		send_pim_null_register(mrt_srcs);
+	}
+    }
+
+    /* routing entry */
+    if (MRT_TIMEOUT(mrt_srcs->entry_timer) && register_kernel_encap &&
+	PIMD_VIFM_ISSET(PIMREG_VIF, mrt_srcs->oifs) && regtun_active(mrt_srcs))
+	MRT_SET_TIMER(mrt_srcs, mrt_srcs->entry_timer, PIM_DATA_TIMEOUT);
+
+    if (MRT_TIMEOUT(mrt_srcs->entry_timer)) {
+	if (PIMD_VIFM_ISEMPTY(mrt_srcs->leaves)) {
+	    delete_mrtentry(mrt_srcs);
+	    return;
+	}
+	/* XXX: if DR, Register suppressed,
+	 * and leaf oif inherited from (*,G), the
+	 * directly connected source is not active anymore,
+	 * this (S,G) entry won't timeout. Check if the leaf
+	 * oifs are inherited from (*,G); if true. delete the
+	 * (S,G) entry.
+	 */
+	if (mrt_srcs->group->grp_route) {
+	    if (PIMD_VIFM_LASTHOP_ROUTER(mrt_srcs->group->grp_route->leaves, mrt_srcs->leaves)) {
+		delete_mrtentry(mrt_srcs);
+		return;
+	    }
+	}
+    }
+
+    mrt_reschedule(mrt_srcs);
+}
+
+/*
+ * Age the (*,G) entry of a group and, if @all_sources is set or the
+ * (*,G) Join/Prune timer fired, all its (S,G) entries.
+ */
+static void age_group(grpentry_t *grp, rpentry_t *rp, int ucast_flag, int rate_flag,
+		      int update_rp_iif, int rp_action, int all_sources)
+{
+    mrtentry_t *mrt_grp  = grp->grp_route;
+    mrtentry_t *mrt_srcs = grp->mrtlink;
+    mrtentry_t *mrt_srcs_next;
+    int grp_action = PIM_ACTION_NOTHING;
+
+    if (mrt_grp)
+	grp_action = age_grp_entry(mrt_grp, rp, update_rp_iif, rate_flag, rp_action);
+
+    if (!all_sources && grp_action == PIM_ACTION_NOTHING)
+	return;
+
+    /* For all (S,G) for this group */
+    /* XXX: mrt_srcs was set before */
+    for (; mrt_srcs; mrt_srcs = mrt_srcs_next) {
+	mrt_srcs_next = mrt_srcs->grpnext;
+	age_src_entry(mrt_srcs, rp, ucast_flag, rate_flag, rp_action, grp_action);
+    }
+}
+
+/*
+ * Age all entries of an RP, with @rp_flag also check for unicast route
+ * changes toward the RP, and with @ucast_flag toward the sources.
+ */
+static void age_rp_sweep(cand_rp_t *cand_rp, int rp_flag, int ucast_flag, int rate_flag)
+{
+    rpentry_t *rp = cand_rp->rpentry;
+    rp_grp_entry_t *rp_grp;
+    grpentry_t *grp, *grp_next;
+    int update_rp_iif;
+    int rp_action;
+
+    /* Need to save only `incoming` and `upstream` to discover
+     * unicast route changes. `metric` and `preference` are not
+     * interesting for us.
+     */
+    rpentry_save.incoming = rp->incoming;
+    rpentry_save.upstream = rp->upstream;
+
+    update_rp_iif = FALSE;
+    if ((rp_flag == TRUE) && (rp->address != my_cand_rp_address)) {
+	/* I am not the RP. If I was the RP, then the iif is
+	 * register_vif and no need to reset it. */
+	if (set_incoming(rp, PIM_IIF_RP) != TRUE) {
+	    /* TODO: XXX: no route to that RP. Panic? There is a high
+	     * probability the network is partitioning so immediately
+	     * remapping to other RP is not a good idea. Better wait
+	     * the Bootstrap mechanism to take care of it and provide
+	     * me with correct Cand-RP-Set. */
+	}
+	else {
+	    if ((rpentry_save.upstream != rp->upstream) ||
+		(rpentry_save.incoming != rp->incoming)) {
+		/* Routing change has occur. Update all (*,G)
+		 * and (S,G)RPbit iifs mapping to that RP */
+		update_rp_iif = TRUE;
+		k_mfc_rp_change();
+	    }
+	}
+    }
+
+    rp_action = age_rp_entry(cand_rp, update_rp_iif, rate_flag);
+
+    /* Check the (*,G) and (S,G) entries */
+    for (rp_grp = cand_rp->rp_grp_next; rp_grp; rp_grp = rp_grp->rp_grp_next) {
+	for (grp = rp_grp->grplink; grp; grp = grp_next) {
+	    grp_next = grp->rpnext;
+	    age_group(grp, rp, ucast_flag, rate_flag, update_rp_iif, rp_action, TRUE);
+	}
+    }
+}
+
+/*
+ * Called when the unicast route toward @address may have changed, e.g.
+ * from the netlink RPF cache.  Update the iif and upstream router of
+ * the (S,G) entries of that source, and of all entries of an RP with
+ * that address.
+ */
+void rpf_changed(uint32_t address)
+{
+    cand_rp_t *cand_rp, *cand_rp_next;
+    srcentry_t *src;
+    mrtentry_t *mrt, *mrt_next;
+    int changed;
+
+    src = find_source(address);
+    if (src) {
+	srcentry_save.incoming = src->incoming;
+	srcentry_save.upstream = src->upstream;
+
+	if (set_incoming(src, PIM_IIF_SOURCE) != TRUE) {
+	    /* XXX: not in the spec! No route toward the source, delete
+	     * the entries, the source entry itself may go with them. */
+	    for (mrt = src->mrtlink; mrt; mrt = mrt_next) {
+		mrt_next = mrt->srcnext;
+		if (!(mrt->flags & MRTF_RP))
+		    delete_mrtentry(mrt);
+	    }
+	} else {
+	    changed = srcentry_save.incoming != src->incoming ||
+		      srcentry_save.upstream != src->upstream;
+
+	    for (mrt = src->mrtlink; mrt; mrt = mrt->srcnext) {
+		if (mrt->flags & MRTF_RP)
+		    continue;
+		if (!changed && mrt->incoming == src->incoming)
+		    continue;
+
+		mrt->incoming = src->incoming;
+		mrt->upstream = src->upstream;
+		change_interfaces(mrt,
+				  mrt->incoming,
+				  mrt->joined_oifs,
+				  mrt->pruned_oifs,
+				  mrt->leaves,
+				  mrt->asserted_oifs, MFC_UPDATE_FORCE);
+	    }
+	}
+    }
+
+    /* Sources with a changed RPF are called for on their own */
+    for (cand_rp = cand_rp_list; cand_rp; cand_rp = cand_rp_next) {
+	cand_rp_next = cand_rp->next;
+	if (cand_rp->rpentry->address == address)
+	    age_rp_sweep(cand_rp, TRUE, FALSE, FALSE);
+    }
+}
+
+/*
+ * Called every ROUTE_INTERVAL to visit the routing entries that are due
+ * and timeout a bunch of timers:
  *  - oifs timers
  *  - Join/Prune timer
  *  - routing entry
  *  - Assert timer
  *  - Register-Suppression timer
  *
- *  - If the global timer for checking the unicast routing has expired, perform
- *  also iif/upstream router change verification
+ *  - If the global timer for checking the unicast routing has expired, scan
+ *  the whole routing table and perform also iif/upstream router change
+ *  verification
  *  - If the global timer for checking the data rate has expired, check the
  *  number of bytes forwarded after the lastest timeout. If bigger than
  *  a given threshold, then switch to the shortest path.
@@ -1310,429 +2193,108 @@ void age_routes(void)
     cand_rp_t  *cand_rp;
     grpentry_t *grp;
     grpentry_t *grp_next;
-    mrtentry_t *mrt_grp;
-    mrtentry_t *mrt_rp;
-    mrtentry_t *mrt_wide;
-    mrtentry_t *mrt_srcs;
-    mrtentry_t *mrt_srcs_next;
+    mrtentry_t *mrt;
+    mrtentry_t *mrt_next;
     rp_grp_entry_t *rp_grp;
     struct uvif *v;
     vifi_t  vifi;
     pim_nbr_entry_t *nbr;
-    int change_flag;
-    int grp_action, src_action = PIM_ACTION_NOTHING, src_action_rp = PIM_ACTION_NOTHING;
-    int dont_calc_action;
     rpentry_t *rp;
-    int update_src_iif;
-    uint8_t new_pruned_oifs[MAXVIFS];
-    int assert_timer_expired = 0;
+    int rp_action;
     uint8_t ucast_flag = FALSE;
     uint8_t rate_flag = FALSE;
 
+    route_clock += ROUTE_INTERVAL;
+
     /*
      * Timing out of the global `unicast_routing_timer`
      * and `data_rate_timer`
      */
-    IF_TIMEOUT(unicast_routing_timer) {
-	ucast_flag = TRUE;
-	SET_TIMER(unicast_routing_timer, unicast_routing_interval);
+    if (MRT_TIMEOUT(unicast_routing_timer)) {
+	/* Not needed when the kernel tells us about route changes */
+	ucast_flag = !k_route_notify();
+	unicast_routing_timer = route_clock + unicast_routing_interval;
     }
 
-    IF_TIMEOUT(pim_spt_threshold_timer) {
+    if (MRT_TIMEOUT(pim_spt_threshold_timer)) {
 	rate_flag = TRUE;
-	SET_TIMER(pim_spt_threshold_timer, spt_threshold.interval);
+	pim_spt_threshold_timer = route_clock + spt_threshold.interval;
     }
 
-    /* Scan the (*,*,RP) entries */
-    for (cand_rp = cand_rp_list; cand_rp; cand_rp = cand_rp->next) {
-	int update_rp_iif;
-	int rp_action;
-
-	rp = cand_rp->rpentry;
-
-	/* Need to save only `incoming` and `upstream` to discover
-	 * unicast route changes. `metric` and `preference` are not
-	 * interesting for us.
-	 */
-	rpentry_save.incoming = rp->incoming;
-	rpentry_save.upstream = rp->upstream;
-
-	update_rp_iif = FALSE;
-	if ((ucast_flag == TRUE) && (rp->address != my_cand_rp_address)) {
-	    /* I am not the RP. If I was the RP, then the iif is
-	     * register_vif and no need to reset it. */
-	    if (set_incoming(rp, PIM_IIF_RP) != TRUE) {
-		/* TODO: XXX: no route to that RP. Panic? There is a high
-		 * probability the network is partitioning so immediately
-		 * remapping to other RP is not a good idea. Better wait
-		 * the Bootstrap mechanism to take care of it and provide
-		 * me with correct Cand-RP-Set. */
-	    }
-	    else {
-		if ((rpentry_save.upstream != rp->upstream) ||
-		    (rpentry_save.incoming != rp->incoming)) {
-		    /* Routing change has occur. Update all (*,G)
-		     * and (S,G)RPbit iifs mapping to that RP */
-		    update_rp_iif = TRUE;
-		}
-	    }
-	}
-
-	rp_action = PIM_ACTION_NOTHING;
-	mrt_rp = cand_rp->rpentry->mrtlink;
-	if (mrt_rp) {
-	    /* outgoing interfaces timers */
-	    change_flag = FALSE;
-	    for (vifi = 0; vifi < numvifs; vifi++) {
-		if (PIMD_VIFM_ISSET(vifi, mrt_rp->joined_oifs)) {
-		    IF_TIMEOUT(mrt_rp->vif_timers[vifi]) {
-			PIMD_VIFM_CLR(vifi, mrt_rp->joined_oifs);
-			change_flag = TRUE;
-		    }
-		}
-	    }
-	    if ((change_flag == TRUE) || (update_rp_iif == TRUE)) {
-		change_interfaces(mrt_rp,
-				  rp->incoming,
-				  mrt_rp->joined_oifs,
-				  mrt_rp->pruned_oifs,
-				  mrt_rp->leaves,
-				  mrt_rp->asserted_oifs, 0);
-		mrt_rp->upstream = rp->upstream;
-	    }
-
-	    /* Check the activity for this entry */
-	    if (rate_flag == TRUE)
-		check_spt_threshold(mrt_rp);
-
-	    /* Join/Prune timer */
-	    IF_TIMEOUT(mrt_rp->jp_timer) {
-		rp_action = join_or_prune(mrt_rp, mrt_rp->upstream);
+    if (negative_cache)
+	age_negative_cache();
 
-		if (rp_action != PIM_ACTION_NOTHING)
-		    add_jp_entry(mrt_rp->upstream,
-				 PIM_JOIN_PRUNE_HOLDTIME,
-				 htonl(CLASSD_PREFIX),
-				 STAR_STAR_RP_MSKLEN,
-				 mrt_rp->source->address,
-				 SINGLE_SRC_MSKLEN,
-				 MRTF_RP | MRTF_WC,
-				 rp_action);
-
-		SET_TIMER(mrt_rp->jp_timer, PIM_JOIN_PRUNE_PERIOD);
-	    }
-
-	    /* Assert timer */
-	    if (mrt_rp->flags & MRTF_ASSERTED) {
-		IF_TIMEOUT(mrt_rp->assert_timer) {
-		    /* TODO: XXX: reset the upstream router now */
-		    mrt_rp->flags &= ~MRTF_ASSERTED;
-		}
-	    }
+    /*
+     * Checking for unicast routing changes and the SPT threshold
+     * needs a look at every entry, at their own, longer, intervals.
+     */
+    if (ucast_flag || rate_flag) {
+	for (cand_rp = cand_rp_list; cand_rp; cand_rp = cand_rp->next)
+	    age_rp_sweep(cand_rp, ucast_flag, ucast_flag, rate_flag);
+    }
 
-	    /* Register-Suppression timer */
-	    /* TODO: to reduce the kernel calls, if the timer is running,
-	     * install a negative cache entry in the kernel?
-	     */
-	    /* TODO: can we have Register-Suppression timer for (*,*,RP)?
-	     * Currently no...
-	     */
-	    IF_TIMEOUT(mrt_rp->rs_timer) {}
+    /* Move all entries due now to the pending lists, wider entries first */
+    for (mrt = age_wheel[route_clock % AGE_WHEEL_SIZE]; mrt; mrt = mrt_next) {
+	mrt_next = mrt->agenext;
+	if (mrt->agedue > route_clock)
+	    continue;	/* Next time around */
+
+	mrt_unschedule(mrt);
+	mrt->agedue = route_clock;
+	if (mrt->flags & MRTF_PMBR)
+	    age_link(&age_pending[0], mrt);
+	else if (mrt->flags & MRTF_WC)
+	    age_link(&age_pending[1], mrt);
+	else
+	    age_link(&age_pending[2], mrt);
+    }
 
-	    /* routing entry */
-	    if ((TIMEOUT(mrt_rp->entry_timer)) && (PIMD_VIFM_ISEMPTY(mrt_rp->leaves)))
-		delete_mrtentry(mrt_rp);
-	} /* if (mrt_rp) */
+    /* The (*,*,RP) entries */
+    while ((mrt = age_pending[0])) {
+	cand_rp = mrt->source->cand_rp;
+	if (!cand_rp) {
+	    mrt_unschedule(mrt);
+	    mrt_schedule(mrt, route_clock + PIM_JOIN_PRUNE_PERIOD);
+	    continue;
+	}
 
-	/* Just in case if that (*,*,RP) was deleted */
-	mrt_rp = cand_rp->rpentry->mrtlink;
+	rp = cand_rp->rpentry;
+	rp_action = age_rp_entry(cand_rp, FALSE, FALSE);
+	if (rp_action == PIM_ACTION_NOTHING)
+	    continue;
 
-	/* Check the (*,G) and (S,G) entries */
+	/* Join/Prune for the (*,*,RP) may override narrower entries */
 	for (rp_grp = cand_rp->rp_grp_next; rp_grp; rp_grp = rp_grp->rp_grp_next) {
 	    for (grp = rp_grp->grplink; grp; grp = grp_next) {
-		grp_next   = grp->rpnext;
-		grp_action = PIM_ACTION_NOTHING;
-		mrt_grp    = grp->grp_route;
-		mrt_srcs   = grp->mrtlink;
-
-		if (mrt_grp) {
-		    /* The (*,G) entry */
-		    /* outgoing interfaces timers */
-		    change_flag = FALSE;
-		    assert_timer_expired = 0;
-		    if (mrt_grp->flags & MRTF_ASSERTED)
-			assert_timer_expired = TIMEOUT(mrt_grp->assert_timer);
-
-		    for (vifi = 0; vifi < numvifs; vifi++) {
-			if (PIMD_VIFM_ISSET(vifi, mrt_grp->joined_oifs)) {
-			    IF_TIMEOUT(mrt_grp->vif_timers[vifi]) {
-				PIMD_VIFM_CLR(vifi, mrt_grp->joined_oifs);
-				change_flag = TRUE;
-			    }
-			}
-
-			if (assert_timer_expired) {
-			    PIMD_VIFM_CLR(vifi, mrt_grp->asserted_oifs);
-			    change_flag = TRUE;
-			    mrt_grp->flags &= ~MRTF_ASSERTED;
-			}
-		    }
-
-		    if ((change_flag == TRUE) || (update_rp_iif == TRUE)) {
-			change_interfaces(mrt_grp,
-					  rp->incoming,
-					  mrt_grp->joined_oifs,
-					  mrt_grp->pruned_oifs,
-					  mrt_grp->leaves,
-					  mrt_grp->asserted_oifs, 0);
-			mrt_grp->upstream = rp->upstream;
-		    }
-
-		    /* Check the sources activity */
-		    if (rate_flag == TRUE)
-			check_spt_threshold(mrt_grp);
-
-		    dont_calc_action = FALSE;
-		    if (rp_action != PIM_ACTION_NOTHING) {
-			dont_calc_action = TRUE;
-
-			grp_action = join_or_prune(mrt_grp, mrt_grp->upstream);
-			if (((rp_action == PIM_ACTION_JOIN)  && (grp_action == PIM_ACTION_PRUNE)) ||
-			    ((rp_action == PIM_ACTION_PRUNE) && (grp_action == PIM_ACTION_JOIN)))
-			    FIRE_TIMER(mrt_grp->jp_timer);
-		    }
-
-
-		    /* Join/Prune timer */
-		    IF_TIMEOUT(mrt_grp->jp_timer) {
-			if (dont_calc_action != TRUE)
-			    grp_action = join_or_prune(mrt_grp, mrt_grp->upstream);
-
-			if (grp_action != PIM_ACTION_NOTHING)
-			    add_jp_entry(mrt_grp->upstream,
-					 PIM_JOIN_PRUNE_HOLDTIME,
-					 mrt_grp->group->group,
-					 SINGLE_GRP_MSKLEN,
-					 cand_rp->rpentry->address,
-					 SINGLE_SRC_MSKLEN,
-					 MRTF_RP | MRTF_WC,
-					 grp_action);
-			SET_TIMER(mrt_grp->jp_timer, PIM_JOIN_PRUNE_PERIOD);
-		    }
-
-		    /* Register-Suppression timer */
-		    /* TODO: to reduce the kernel calls, if the timer
-		     * is running, install a negative cache entry in
-		     * the kernel?
-		     */
-		    /* TODO: currently cannot have Register-Suppression
-		     * timer for (*,G) entry, but keep this around.
-		     */
-		    IF_TIMEOUT(mrt_grp->rs_timer) {}
-
-		    /* routing entry */
-		    if ((TIMEOUT(mrt_grp->entry_timer)) && (PIMD_VIFM_ISEMPTY(mrt_grp->leaves)))
-			delete_mrtentry(mrt_grp);
-		} /* if (mrt_grp) */
-
-
-		/* For all (S,G) for this group */
-		/* XXX: mrt_srcs was set before */
-		for (; mrt_srcs; mrt_srcs = mrt_srcs_next) {
-		    /* routing entry */
-		    mrt_srcs_next = mrt_srcs->grpnext;
-
-		    /* outgoing interfaces timers */
-		    change_flag = FALSE;
-		    assert_timer_expired = 0;
-		    if (mrt_srcs->flags & MRTF_ASSERTED)
-			assert_timer_expired = TIMEOUT(mrt_srcs->assert_timer);
-
-		    for (vifi = 0; vifi < numvifs; vifi++) {
-			if (PIMD_VIFM_ISSET(vifi, mrt_srcs->joined_oifs)) {
-			    /* TODO: checking for reg_num_vif is slow! */
-			    if (vifi != PIMREG_VIF) {
-				IF_TIMEOUT(mrt_srcs->vif_timers[vifi]) {
-				    PIMD_VIFM_CLR(vifi, mrt_srcs->joined_oifs);
-				    change_flag = TRUE;
-				}
-			    }
-			}
-
-			if (assert_timer_expired) {
-			    PIMD_VIFM_CLR(vifi, mrt_srcs->asserted_oifs);
-			    change_flag = TRUE;
-			    mrt_srcs->flags &= ~MRTF_ASSERTED;
-			}
-		    }
-
-		    update_src_iif = FALSE;
-		    if (ucast_flag == TRUE) {
-			if (!(mrt_srcs->flags & MRTF_RP)) {
-			    /* iif toward the source */
-			    srcentry_save.incoming = mrt_srcs->source->incoming;
-			    srcentry_save.upstream = mrt_srcs->source->upstream;
-			    if (set_incoming(mrt_srcs->source, PIM_IIF_SOURCE) != TRUE) {
-				/* XXX: not in the spec!
-				 * Cannot find route toward that source.
-				 * This is bad. Delete the entry.
-				 */
-				delete_mrtentry(mrt_srcs);
-				continue;
-			    }
-
-			    /* iif info found */
-			    if ((srcentry_save.incoming != mrt_srcs->source->incoming) ||
-				(srcentry_save.upstream != mrt_srcs->source->upstream)) {
-				/* Route change has occur */
-				update_src_iif = TRUE;
-				mrt_srcs->incoming = mrt_srcs->source->incoming;
-				mrt_srcs->upstream = mrt_srcs->source->upstream;
-			    }
-			} else {
-			    /* (S,G)RPBit with iif toward RP */
-			    if ((rpentry_save.upstream != mrt_srcs->upstream) ||
-				(rpentry_save.incoming != mrt_srcs->incoming)) {
-				update_src_iif = TRUE; /* XXX: a hack */
-				/* XXX: setup the iif now! */
-				mrt_srcs->incoming = rp->incoming;
-				mrt_srcs->upstream = rp->upstream;
-			    }
-			}
-		    }
-
-		    if ((change_flag == TRUE) || (update_src_iif == TRUE))
-			/* Flush the changes */
-			change_interfaces(mrt_srcs,
-					  mrt_srcs->incoming,
-					  mrt_srcs->joined_oifs,
-					  mrt_srcs->pruned_oifs,
-					  mrt_srcs->leaves,
-					  mrt_srcs->asserted_oifs, MFC_UPDATE_FORCE);
-
-		    if (rate_flag == TRUE)
-			check_spt_threshold(mrt_srcs);
-
-		    mrt_wide = mrt_srcs->group->grp_route;
-		    if (!mrt_wide)
-			mrt_wide = mrt_rp;
-
-		    dont_calc_action = FALSE;
-		    if ((rp_action  != PIM_ACTION_NOTHING) ||
-			(grp_action != PIM_ACTION_NOTHING)) {
-			src_action_rp    = join_or_prune(mrt_srcs, rp->upstream);
-			src_action       = src_action_rp;
-			dont_calc_action = TRUE;
-
-			if (src_action_rp == PIM_ACTION_JOIN) {
-			    if ((grp_action == PIM_ACTION_PRUNE) ||
-				(rp_action  == PIM_ACTION_PRUNE))
-				FIRE_TIMER(mrt_srcs->jp_timer);
-			} else if (src_action_rp == PIM_ACTION_PRUNE) {
-			    if ((grp_action == PIM_ACTION_JOIN) ||
-				(rp_action  == PIM_ACTION_JOIN))
-				FIRE_TIMER(mrt_srcs->jp_timer);
-			}
-		    }
+		grp_next = grp->rpnext;
+		age_group(grp, rp, FALSE, FALSE, FALSE, rp_action, TRUE);
+	    }
+	}
+    }
 
-		    /* Join/Prune timer */
-		    IF_TIMEOUT(mrt_srcs->jp_timer) {
-			if ((dont_calc_action != TRUE) || (rp->upstream != mrt_srcs->upstream))
-			    src_action = join_or_prune(mrt_srcs, mrt_srcs->upstream);
-
-			if (src_action != PIM_ACTION_NOTHING)
-			    add_jp_entry(mrt_srcs->upstream,
-					 PIM_JOIN_PRUNE_HOLDTIME,
-					 mrt_srcs->group->group,
-					 SINGLE_GRP_MSKLEN,
-					 mrt_srcs->source->address,
-					 SINGLE_SRC_MSKLEN,
-					 mrt_srcs->flags & MRTF_RP,
-					 src_action);
-
-			if (mrt_wide) {
-			    /* Have both (S,G) and (*,G) (or (*,*,RP)).
-			     * Check if need to send (S,G) PRUNE toward RP */
-			    if (mrt_srcs->upstream != mrt_wide->upstream) {
-				if (dont_calc_action != TRUE)
-				    src_action_rp = join_or_prune(mrt_srcs, mrt_wide->upstream);
-
-				/* XXX: TODO: do error check if
-				 * src_action == PIM_ACTION_JOIN, which
-				 * should be an error. */
-				if (src_action_rp == PIM_ACTION_PRUNE)
-				    add_jp_entry(mrt_wide->upstream,
-						 PIM_JOIN_PRUNE_HOLDTIME,
-						 mrt_srcs->group->group,
-						 SINGLE_GRP_MSKLEN,
-						 mrt_srcs->source->address,
-						 SINGLE_SRC_MSKLEN,
-						 MRTF_RP,
-						 src_action_rp);
-			    }
-			}
-			SET_TIMER(mrt_srcs->jp_timer, PIM_JOIN_PRUNE_PERIOD);
-		    }
+    /* The (*,G) entries, and their (S,G) on Join/Prune */
+    while ((mrt = age_pending[1])) {
+	rp = mrt_rp(mrt);
+	if (!rp) {
+	    mrt_unschedule(mrt);
+	    mrt_schedule(mrt, route_clock + PIM_JOIN_PRUNE_PERIOD);
+	    continue;
+	}
 
-		    /* Register-Suppression timer */
-		    /* TODO: to reduce the kernel calls, if the timer
-		     * is running, install a negative cache entry in
-		     * the kernel? */
-		    IF_TIMER_SET(mrt_srcs->rs_timer) {
-			IF_TIMEOUT(mrt_srcs->rs_timer) {
-			    /* Start encapsulating the packets */
-			    PIMD_VIFM_COPY(mrt_srcs->pruned_oifs, new_pruned_oifs);
-			    PIMD_VIFM_CLR(PIMREG_VIF, new_pruned_oifs);
-			    change_interfaces(mrt_srcs,
-					      mrt_srcs->incoming,
-					      mrt_srcs->joined_oifs,
-					      new_pruned_oifs,
-					      mrt_srcs->leaves,
-					      mrt_srcs->asserted_oifs, 0);
-			}
-			ELSE {
-			    /* The register suppression timer is running. Check
-			     * whether it is time to send PIM_NULL_REGISTER.
-			     */
-			    /* TODO: XXX: TIMER implem. dependency! */
-			    if (mrt_srcs->rs_timer <= PIM_REGISTER_PROBE_TIME)
-				/* Time to send a PIM_NULL_REGISTER */
-				/* XXX: a (bad) hack! This will be sending
-				 * periodically NULL_REGISTERS between
-				 * PIM_REGISTER_PROBE_TIME and 0. Well,
-				 * because PROBE_TIME is 5 secs, it will
-				 * happen only once, so it helps to avoid
-				 * adding a flag to the routing entry whether
-				 * a NULL_REGISTER was sent.
-				 */
-				send_pim_null_register(mrt_srcs);
-			}
-		    }
+	age_group(mrt->group, rp, FALSE, FALSE, FALSE, PIM_ACTION_NOTHING, FALSE);
+    }
 
-		    /* routing entry */
-		    if (TIMEOUT(mrt_srcs->entry_timer)) {
-			if (PIMD_VIFM_ISEMPTY(mrt_srcs->leaves)) {
-			    delete_mrtentry(mrt_srcs);
-			    continue;
-			}
-			/* XXX: if DR, Register suppressed,
-			 * and leaf oif inherited from (*,G), the
-			 * directly connected source is not active anymore,
-			 * this (S,G) entry won't timeout. Check if the leaf
-			 * oifs are inherited from (*,G); if true. delete the
-			 * (S,G) entry.
-			 */
-			if (mrt_srcs->group->grp_route) {
-			    if (PIMD_VIFM_LASTHOP_ROUTER(mrt_srcs->group->grp_route->leaves, mrt_srcs->leaves)) {
-				delete_mrtentry(mrt_srcs);
-				continue;
-			    }
-			}
-		    }
-		} /* End of (S,G) loop */
-	    } /* End of (*,G) loop */
+    /* The (S,G) entries */
+    while ((mrt = age_pending[2])) {
+	rp = mrt_rp(mrt);
+	if (!rp) {
+	    mrt_unschedule(mrt);
+	    mrt_schedule(mrt, route_clock + PIM_JOIN_PRUNE_PERIOD);
+	    continue;
 	}
-    } /* For all cand RPs */
+
+	age_src_entry(mrt, rp, FALSE, FALSE, PIM_ACTION_NOTHING, PIM_ACTION_NOTHING);
+    }
 
     /* TODO: check again! */
     for (vifi = 0, v = &uvifs[0]; vifi < numvifs; vifi++, v++) {
@@ -437,6 +437,32 @@ int k_req_incoming(uint32_t source, struct rpfctl *rpf)
 }
 #endif /* HAVE_ROUTING_SOCKETS */
 
+/* Route changes are not tracked, the RPF is polled periodically instead */
+int k_route_notify(void)
+{
+    return FALSE;
+}
+
+/* Lookups are synchronous, none in flight to age */
+void k_rpf_age(void)
+{
+}
+
+/* Kernel register encapsulation is only supported on Linux */
+int k_tunnel_add(const char *ifname, uint32_t remote)
+{
+    (void)ifname;
+    (void)remote;
+
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+void k_tunnel_del(int ifindex)
+{
+    (void)ifindex;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
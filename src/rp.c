@@ -335,6 +335,7 @@ rp_grp_entry_t *add_rp_grp_entry(cand_rp_t  **used_cand_rp_list,
     if (!IN_CLASSD(ntohl(group_addr)))
 	return NULL;
 
+    register_gen++;		/* Invalidate cached RP of registers */
     mask_ptr = add_grp_mask(used_grp_mask_list, group_addr, group_mask, bsr_hash_mask);
     if (mask_ptr == NULL)
 	return NULL;
@@ -446,6 +447,8 @@ rp_grp_entry_t *add_rp_grp_entry(cand_rp_t  **used_cand_rp_list,
     }
 
     mask_ptr->group_rp_number++;
+    if (used_cand_rp_list == &cand_rp_list)
+	ipc_rp_event(IPC_EV_ADD, entry_new);
 
     if (mask_ptr->grp_rp_next->priority == rp_priority) {
 	/* The first entries are with the best priority. */
@@ -475,6 +478,9 @@ void delete_rp_grp_entry(cand_rp_t **used_cand_rp_list, grp_mask_t **used_grp_ma
 
     if (entry == NULL)
 	return;
+    if (used_cand_rp_list == &cand_rp_list)
+	ipc_rp_event(IPC_EV_DEL, entry);
+    register_gen++;
     entry->group->group_rp_number--;
 
     /* Free the rp_grp* and grp_rp* links */
@@ -522,6 +528,7 @@ void delete_rp_list(cand_rp_t  **used_cand_rp_list, grp_mask_t **used_grp_mask_l
     grp_mask_t     *mask_ptr, *mask_next;
     grpentry_t     *gentry_ptr, *gentry_ptr_next;
 
+    register_gen++;
     for (cand_ptr = *used_cand_rp_list; cand_ptr; ) {
 	cand_next = cand_ptr->next;
 
@@ -531,11 +538,12 @@ void delete_rp_list(cand_rp_t  **used_cand_rp_list, grp_mask_t **used_grp_mask_l
 		delete_mrtentry_all_kernel_cache(cand_ptr->rpentry->mrtlink);
 	    FREE_MRTENTRY(cand_ptr->rpentry->mrtlink);
 	}
-	free(cand_ptr->rpentry);
 
 	/* Free the whole chain of entry for this RP */
 	for (entry_ptr = cand_ptr->rp_grp_next; entry_ptr; entry_ptr = entry_next) {
 	    entry_next = entry_ptr->rp_grp_next;
+	    if (used_cand_rp_list == &cand_rp_list)
+		ipc_rp_event(IPC_EV_DEL, entry_ptr);
 
 	    /* Clear the RP related invalid pointers for all group entries */
 	    for (gentry_ptr = entry_ptr->grplink; gentry_ptr; gentry_ptr = gentry_ptr_next) {
@@ -549,6 +557,7 @@ void delete_rp_list(cand_rp_t  **used_cand_rp_list, grp_mask_t **used_grp_mask_l
 	    free(entry_ptr);
 	}
 
+	free(cand_ptr->rpentry);
 	free(cand_ptr);
 	cand_ptr = cand_next;
     }
@@ -567,6 +576,7 @@ void delete_grp_mask(cand_rp_t **used_cand_rp_list, grp_mask_t **used_grp_mask_l
     grp_mask_t *ptr;
     uint32_t prefix_h = ntohl(group_addr & group_mask);
 
+    register_gen++;
     for (ptr = *used_grp_mask_list; ptr; ptr = ptr->next) {
 	if (ntohl(ptr->group_addr & ptr->group_mask) > prefix_h)
 	    continue;
@@ -638,6 +648,7 @@ void delete_rp(cand_rp_t **used_cand_rp_list, grp_mask_t **used_grp_mask_list, u
     cand_rp_t *ptr;
     uint32_t rp_addr_h = ntohl(rp_addr);
 
+    register_gen++;
     for (ptr = *used_cand_rp_list; ptr; ptr = ptr->next) {
 	if (ntohl(ptr->rpentry->address) > rp_addr_h)
 	    continue;
@@ -728,6 +739,8 @@ int remap_grpentry(grpentry_t *grpentry_ptr)
     if (grpentry_ptr == NULL)
 	return FALSE;
 
+    k_mfc_rp_change();
+
     /* Remove from the list of all groups matching to the same RP */
     if (grpentry_ptr->rpprev) {
 	grpentry_ptr->rpprev->rpnext = grpentry_ptr->rpnext;
@@ -98,7 +98,7 @@ void rsrr_init(void)
     if (rc < 0)
 	logit(LOG_ERR, errno, "Cannot bind RSRR socket");
 
-    rc = register_input_handler(rsrr_socket, rsrr_read);
+    rc = register_input_handler(rsrr_socket, rsrr_read, IH_LEVEL);
     if (rc < 0)
 	logit(LOG_ERR, 0, "Could not register RSRR as an input handler");
 }
@@ -235,6 +235,17 @@ static void rsrr_accept_iq(void)
     rsrr_send(sendlen);
 }
 
+#ifdef PIM
+/* The Route Reply has one byte per vif, unlike our packed vif sets */
+static void rsrr_out_vifs(vifset_t oifs, uint8_t *out_vifs)
+{
+    vifi_t vifi;
+
+    for (vifi = 0; vifi < MAXVIFS; vifi++)
+	out_vifs[vifi] = PIMD_VIFM_ISSET(vifi, oifs);
+}
+#endif /* PIM */
+
 /* Send a Route Reply to the reservation protocol.  The Route Query
  * contains the query to which we are responding.  The flags contain
  * the incoming flags from the query or, for route change
@@ -275,7 +286,7 @@ static int rsrr_accept_rq(struct rsrr_rq *route_query, uint8_t flags, struct gta
     /* Blank routing entry for error. */
     route_reply->in_vif = 0;
     route_reply->reserved = 0;
-    PIMD_VIFM_CLRALL(route_reply->out_vifs);
+    memset(route_reply->out_vifs, 0, sizeof(route_reply->out_vifs));
 
     /* Get the size. */
     sendlen = RSRR_RR_LEN;
@@ -289,7 +300,7 @@ static int rsrr_accept_rq(struct rsrr_rq *route_query, uint8_t flags, struct gta
     if (gt_notify) {
 	/* Include the routing entry. */
 	route_reply->in_vif = gt_notify->incoming;
-	PIMD_VIFM_COPY(gt_notify->oifs, route_reply->out_vifs);
+	rsrr_out_vifs(gt_notify->oifs, route_reply->out_vifs);
 	gt = gt_notify;
 	status_ok = TRUE;
     } else if ((gt = find_route(route_query->source_addr,
@@ -298,7 +309,7 @@ static int rsrr_accept_rq(struct rsrr_rq *route_query, uint8_t flags, struct gta
 				DONT_CREATE)) != (struct gtable *)NULL) {
 	status_ok = TRUE;
 	route_reply->in_vif = gt->incoming;
-	PIMD_VIFM_COPY(gt->oifs, route_reply->out_vifs);
+	rsrr_out_vifs(gt->oifs, route_reply->out_vifs);
     }
     if (status_ok != TRUE) {
 	/* Set error bit. */
@@ -424,7 +435,7 @@ static int rsrr_accept_rq(struct rsrr_rq *route_query, uint8_t flags, struct gta
 	int vifi;
 
 	for (vifi = 0; vifi < numvifs; vifi++)
-	    oifs[vifi] =  PIMD_VIFM_ISSET(vifi, route_reply->out_vifs) ? 'o' : '.';
+	    oifs[vifi] = route_reply->out_vifs[vifi] ? 'o' : '.';
 	oifs[vifi] = 0;
 
 	logit(LOG_DEBUG, 0, "%sSend RSRR Route Reply for src %s dst %s in vif %d out vifs %s",
@@ -9,18 +9,64 @@
  */
 
 #include "defs.h"
+#include "queue.h"
 
-static struct tmr *Q = NULL;
-static int id = 0;
+/*
+ * The callout queue is a hierarchical timing wheel with TIMER_HZ ticks
+ * per second.  The first level has one slot per tick for the next 256
+ * ticks, each following level covers 64 times the range of the level
+ * below and is cascaded down when the level below wraps around.  Timers
+ * due at, or before, the current tick are kept on a separate due list.
+ *
+ * Timer nodes are allocated from a pool in chunks and are looked up by
+ * id in a hash table, so set, clear and get are all O(1).
+ */
+#define WHEEL0_BITS	8
+#define WHEEL0_SIZE	(1 << WHEEL0_BITS)
+#define WHEEL0_MASK	(WHEEL0_SIZE - 1)
+#define WHEELN_BITS	6
+#define WHEELN_SIZE	(1 << WHEELN_BITS)
+#define WHEELN_MASK	(WHEELN_SIZE - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_MAX	((1 << (WHEEL0_BITS + (WHEEL_LEVELS - 1) * WHEELN_BITS)) - 1)
+
+#define WHEEL_SHIFT(l)	(WHEEL0_BITS + ((l) - 1) * WHEELN_BITS)
+#define WHEEL_INDEX(t, l) (((t) >> WHEEL_SHIFT(l)) & WHEELN_MASK)
+
+#define POOL_CHUNK	64	/* Nodes allocated at a time       */
+#define IDHASH_MIN	64	/* Initial size of id hash table   */
 
 struct tmr {
-    struct tmr      *next;		/* next event */
-    int        	     id;  
+    TAILQ_ENTRY(tmr) link;		/* slot or free list linkage */
+    struct tmr_list *list;		/* list we are on, NULL if free */
+    struct tmr      *hnext;		/* next in id hash bucket */
+    int        	     id;
     cfunc_t          func;    	        /* function to call */
     void	    *data;		/* func's data */
-    int              time;		/* time offset to next event*/
+    uint64_t         expires;		/* absolute tick to expire at */
 };
 
+TAILQ_HEAD(tmr_list, tmr);
+
+struct tmr_chunk {
+    struct tmr_chunk *next;
+    struct tmr        node[POOL_CHUNK];
+};
+
+static struct tmr_list wheel0[WHEEL0_SIZE];
+static struct tmr_list wheeln[WHEEL_LEVELS - 1][WHEELN_SIZE];
+static struct tmr_list due;
+static struct tmr_list pool;
+static struct tmr_chunk *chunks;
+
+static struct tmr **idhash;
+static uint32_t idhash_size;
+static uint32_t count;
+
+static uint64_t now;			/* current tick */
+static int carry;			/* msec not yet accounted for */
+static int id = 0;
+
 static void print_Q(void);
 
 /* Get next free (non-zero) ID
@@ -40,191 +86,410 @@ static int next_id(void)
     return id;
 }
 
+static struct tmr *node_alloc(void)
+{
+    struct tmr *node;
+
+    if (TAILQ_EMPTY(&pool)) {
+	struct tmr_chunk *chunk;
+	int i;
+
+	chunk = calloc(1, sizeof(struct tmr_chunk));
+	if (!chunk)
+	    return NULL;
+
+	chunk->next = chunks;
+	chunks = chunk;
+	for (i = 0; i < POOL_CHUNK; i++)
+	    TAILQ_INSERT_TAIL(&pool, &chunk->node[i], link);
+    }
+
+    node = TAILQ_FIRST(&pool);
+    TAILQ_REMOVE(&pool, node, link);
+
+    return node;
+}
+
+static void node_free(struct tmr *node)
+{
+    node->list = NULL;
+    node->func = NULL;
+    node->data = NULL;
+    node->id   = 0;
+    TAILQ_INSERT_HEAD(&pool, node, link);
+}
+
+static int idhash_grow(void)
+{
+    struct tmr **tbl, *node, *next;
+    uint32_t size, i;
+
+    size = idhash_size ? idhash_size * 2 : IDHASH_MIN;
+    tbl = calloc(size, sizeof(struct tmr *));
+    if (!tbl)
+	return -1;
+
+    for (i = 0; i < idhash_size; i++) {
+	for (node = idhash[i]; node; node = next) {
+	    next = node->hnext;
+	    node->hnext = tbl[node->id & (size - 1)];
+	    tbl[node->id & (size - 1)] = node;
+	}
+    }
+
+    free(idhash);
+    idhash = tbl;
+    idhash_size = size;
+
+    return 0;
+}
+
+static struct tmr *idhash_find(int timer_id)
+{
+    struct tmr *node;
+
+    if (!idhash)
+	return NULL;
+
+    for (node = idhash[timer_id & (idhash_size - 1)]; node; node = node->hnext) {
+	if (node->id == timer_id)
+	    return node;
+    }
+
+    return NULL;
+}
+
+static void idhash_remove(struct tmr *node)
+{
+    struct tmr **pp;
+
+    for (pp = &idhash[node->id & (idhash_size - 1)]; *pp; pp = &(*pp)->hnext) {
+	if (*pp == node) {
+	    *pp = node->hnext;
+	    break;
+	}
+    }
+}
+
+/* Put node on the wheel, or due list, according to its expiry */
+static void enqueue(struct tmr *node)
+{
+    struct tmr_list *list;
+    uint64_t expires = node->expires;
+    uint64_t delta;
+    int l;
+
+    if (expires <= now) {
+	list = &due;
+    } else {
+	/* Relative to the next tick to be processed */
+	delta = expires - (now + 1);
+	if (delta < WHEEL0_SIZE) {
+	    list = &wheel0[expires & WHEEL0_MASK];
+	} else {
+	    if (delta > WHEEL_MAX) {
+		expires = now + 1 + WHEEL_MAX;
+		node->expires = expires;
+	    }
+
+	    for (l = 1; l < WHEEL_LEVELS - 1; l++) {
+		if (delta < (1ULL << WHEEL_SHIFT(l + 1)))
+		    break;
+	    }
+	    list = &wheeln[l - 1][WHEEL_INDEX(expires, l)];
+	}
+    }
+
+    node->list = list;
+    TAILQ_INSERT_TAIL(list, node, link);
+}
+
+static void dequeue(struct tmr *node)
+{
+    TAILQ_REMOVE(node->list, node, link);
+    node->list = NULL;
+}
+
+/* Move all timers in one slot of a higher level down the wheel */
+static int cascade(int level, int index)
+{
+    struct tmr_list *list = &wheeln[level - 1][index];
+    struct tmr *node;
+
+    while ((node = TAILQ_FIRST(list))) {
+	TAILQ_REMOVE(list, node, link);
+	enqueue(node);
+    }
+
+    return index;
+}
+
+/* Run everything on the due list, callbacks may add more */
+static void run_due(void)
+{
+    struct tmr *node;
+
+    while ((node = TAILQ_FIRST(&due))) {
+	cfunc_t func = node->func;
+	void *data = node->data;
+
+	dequeue(node);
+	idhash_remove(node);
+	node_free(node);
+	count--;
+
+	if (func)
+	    func(data);
+    }
+}
+
 void timer_init(void)
 {
-    Q = NULL;
+    int i, l;
+
+    for (i = 0; i < WHEEL0_SIZE; i++)
+	TAILQ_INIT(&wheel0[i]);
+    for (l = 0; l < WHEEL_LEVELS - 1; l++) {
+	for (i = 0; i < WHEELN_SIZE; i++)
+	    TAILQ_INIT(&wheeln[l][i]);
+    }
+    TAILQ_INIT(&due);
+    TAILQ_INIT(&pool);
+
+    chunks = NULL;
+    idhash = NULL;
+    idhash_size = 0;
+    count = 0;
+    now = 0;
+    carry = 0;
     id = 0;
 }
 
 void timer_exit(void)
 {
-    struct tmr *p;
-    
-    while (Q) {
-	p = Q;
-	Q = Q->next;
-	if (p->data)
-	    free(p->data);
-	free(p);
+    struct tmr_chunk *chunk;
+    uint32_t i;
+
+    for (i = 0; i < idhash_size; i++) {
+	struct tmr *node;
+
+	for (node = idhash[i]; node; node = node->hnext) {
+	    if (node->data)
+		free(node->data);
+	}
+    }
+    free(idhash);
+
+    while (chunks) {
+	chunk = chunks;
+	chunks = chunks->next;
+	free(chunk);
     }
 
     timer_init();
 }
 
 /*
- * elapsed_time seconds have passed; perform all the events that should
- * happen.
+ * elapsed_ms milliseconds have passed; perform all the events that
+ * should happen.  Fractions of a tick are carried over to next call.
  */
-void timer_age_queue(int elapsed_time)
+void timer_age_queue_ms(int elapsed_ms)
 {
-    struct tmr *ptr;
+    int ticks;
 
     IF_DEBUG(DEBUG_TIMEOUT)
-	logit(LOG_DEBUG, 0, "aging queue (elapsed time %d):", elapsed_time);
+	logit(LOG_DEBUG, 0, "aging queue (elapsed time %d msec):", elapsed_ms);
     print_Q();
-    
-    for (ptr = Q; Q; ptr = Q) {
-	if (ptr->time  > elapsed_time) {
-	    ptr->time -= elapsed_time;
+
+    if (elapsed_ms > 0)
+	carry += elapsed_ms;
+    ticks  = carry / (1000 / TIMER_HZ);
+    carry -= ticks * (1000 / TIMER_HZ);
+
+    run_due();
+    while (ticks-- > 0) {
+	uint64_t next = now + 1;
+	int index = next & WHEEL0_MASK;
+	struct tmr *node;
+
+	if (!count) {
+	    now += ticks + 1;
 	    break;
 	}
 
-	/* ptr has expired, push Q */
-	Q             = ptr->next;
-	elapsed_time -= ptr->time;
+	if (!index) {
+	    int l;
 
-	if (ptr->func)
-	    ptr->func(ptr->data);
-	free(ptr);
+	    for (l = 1; l < WHEEL_LEVELS; l++) {
+		if (cascade(l, WHEEL_INDEX(next, l)))
+		    break;
+	    }
+	}
+
+	now = next;
+	while ((node = TAILQ_FIRST(&wheel0[index]))) {
+	    dequeue(node);
+	    node->list = &due;
+	    TAILQ_INSERT_TAIL(&due, node, link);
+	}
+	run_due();
     }
 }
 
 /*
- * Return in how many seconds timer_age_queue() would like to be called.
- * Return -1 if there are no events pending.
+ * elapsed_time seconds have passed; perform all the events that should
+ * happen.
  */
-int timer_next_delay(void)
+void timer_age_queue(int elapsed_time)
 {
-    if (!Q)
+    timer_age_queue_ms(elapsed_time * 1000);
+}
+
+/*
+ * Return in how many milliseconds timer_age_queue_ms() would like to be
+ * called.  Return -1 if there are no events pending.  Timers further
+ * away than the first level of the wheel wake us up when it wraps.
+ */
+int timer_next_delay_ms(void)
+{
+    int i, ms;
+
+    if (!count)
 	return -1;
 
-    if (Q->time < 0) {
-	logit(LOG_WARNING, 0, "%s(): top of queue says %d", __func__, Q->time);
+    if (!TAILQ_EMPTY(&due))
 	return 0;
+
+    for (i = 1; i < WHEEL0_SIZE; i++) {
+	if (!TAILQ_EMPTY(&wheel0[(now + i) & WHEEL0_MASK]))
+	    break;
     }
+    if (i == WHEEL0_SIZE)
+	i = WHEEL0_SIZE - (now & WHEEL0_MASK);
+
+    ms = i * (1000 / TIMER_HZ) - carry;
+
+    return ms < 0 ? 0 : ms;
+}
+
+/*
+ * Return in how many seconds timer_age_queue() would like to be called.
+ * Return -1 if there are no events pending.
+ */
+int timer_next_delay(void)
+{
+    int ms = timer_next_delay_ms();
+
+    if (ms < 0)
+	return -1;
 
-    return Q->time;
+    return (ms + 999) / 1000;
 }
 
-/* 
+/*
  * Create a timer
- * @delay: Number of seconds for timeout
+ * @delay_ms: Number of milliseconds for timeout, rounded up to ticks
  * @action: Timer callback
  * @data: Optional callback data, must be a dynically allocated ptr
  */
-int timer_set(int delay, cfunc_t action, void *data)
+int timer_set_ms(int delay_ms, cfunc_t action, void *data)
 {
-    struct tmr *ptr, *node, *prev;
-    
+    struct tmr *node;
+    int ticks;
+
     IF_DEBUG(DEBUG_TIMEOUT)
 	logit(LOG_DEBUG, 0, "setting timer:");
     print_Q();
-    
-    /* create a node */	
-    node = calloc(1, sizeof(struct tmr));
+
+    if (count >= idhash_size && idhash_grow()) {
+	logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
+	return -1;
+    }
+
+    node = node_alloc();
     if (!node) {
 	logit(LOG_ERR, 0, "Ran out of memory in %s()", __func__);
 	return -1;
     }
 
-    node->func = action; 
-    node->data = data;
-    node->time = delay; 
-    node->next = 0;	
-    node->id   = next_id();
-    
-    prev = ptr = Q;
-    
-    /* insert node in the queue */
-    
-    /* if the queue is empty, insert the node and return */
-    if (!Q)
-	Q = node;
-    else {
-	/* chase the pointer looking for the right place */
-	while (ptr) {
-	    if (delay < ptr->time) {
-		/* right place */
-		node->next = ptr;
-		if (ptr == Q)
-		    Q = node;
-		else
-		    prev->next = node;
-		ptr->time -= node->time;
-		print_Q();
-
-		return node->id;
-	    }
+    if (delay_ms < 0)
+	delay_ms = 0;
+    ticks = (delay_ms + (1000 / TIMER_HZ) - 1) / (1000 / TIMER_HZ);
 
-	    /* keep moving */
-	    delay -= ptr->time;
-	    node->time = delay;
-	    prev = ptr;
-	    ptr = ptr->next;
-	}
-	prev->next = node;
-    }
+    node->func    = action;
+    node->data    = data;
+    node->expires = now + ticks;
+    node->id      = next_id();
+    while (idhash_find(node->id))
+	node->id  = next_id();
+
+    node->hnext = idhash[node->id & (idhash_size - 1)];
+    idhash[node->id & (idhash_size - 1)] = node;
+    enqueue(node);
+    count++;
     print_Q();
 
     return node->id;
 }
 
+/*
+ * Create a timer
+ * @delay: Number of seconds for timeout
+ * @action: Timer callback
+ * @data: Optional callback data, must be a dynically allocated ptr
+ */
+int timer_set(int delay, cfunc_t action, void *data)
+{
+    return timer_set_ms(delay * 1000, action, data);
+}
+
+/* returns the time, in milliseconds, until the timer is scheduled */
+int timer_get_ms(int timer_id)
+{
+    struct tmr *node;
+
+    if (!timer_id)
+	return -1;
+
+    node = idhash_find(timer_id);
+    if (!node)
+	return -1;
+
+    if (node->expires <= now)
+	return 0;
+
+    return (int)(node->expires - now) * (1000 / TIMER_HZ) - carry;
+}
+
 /* returns the time until the timer is scheduled */
 int timer_get(int timer_id)
 {
-    struct tmr *ptr;
-    int left = 0;
-	
-    if (!timer_id)
+    int ms = timer_get_ms(timer_id);
+
+    if (ms < 0)
 	return -1;
-    
-    for (ptr = Q; ptr; ptr = ptr->next) {
-	left += ptr->time;
-	if (ptr->id == timer_id)
-	    return left;
-    }
 
-    return -1;
+    return (ms + 999) / 1000;
 }
 
 /* clears the associated timer */
 void timer_clear(int timer_id)
 {
-    struct tmr  *ptr, *prev;
-    
+    struct tmr *node;
+
     if (!timer_id)
 	return;
-    
-    prev = ptr = Q;
-    
-    /*
-     * find the right node, delete it. the subsequent node's time
-     * gets bumped up
-     */
-    
-    print_Q();
-    while (ptr) {
-	if (ptr->id != timer_id) {
-	    prev = ptr;
-	    ptr = ptr->next;
-	    continue;
-	}
 
-	/* Found it, now unlink it from the queue */
-	if (ptr == Q)
-	    Q = ptr->next;
-	else
-	    prev->next = ptr->next;
-	    
-	/* increment next node if any */
-	if (ptr->next)
-	    (ptr->next)->time += ptr->time;
-	    
-	if (ptr->data)
-	    free(ptr->data);
-	free(ptr);
-	break;
-    }
+    node = idhash_find(timer_id);
+    if (!node)
+	return;
+
+    dequeue(node);
+    idhash_remove(node);
+    if (node->data)
+	free(node->data);
+    node_free(node);
+    count--;
     print_Q();
 }
 
@@ -234,10 +499,13 @@ void timer_clear(int timer_id)
 static void print_Q(void)
 {
     struct tmr  *ptr;
-    
+    uint32_t i;
+
     IF_DEBUG(DEBUG_TIMEOUT) {
-	for (ptr = Q; ptr; ptr = ptr->next)
-	    logit(LOG_DEBUG, 0, "(%d,%d) ", ptr->id, ptr->time);
+	for (i = 0; i < idhash_size; i++) {
+	    for (ptr = idhash[i]; ptr; ptr = ptr->hnext)
+		logit(LOG_DEBUG, 0, "(%d,%d) ", ptr->id, timer_get_ms(ptr->id));
+	}
     }
 }
 
@@ -166,6 +166,9 @@ void zero_vif(struct uvif *v, int t)
     v->uv_subnetbcast	= INADDR_ANY_N;
     strlcpy(v->uv_name, "", IFNAMSIZ);
     v->uv_groups	= (struct listaddr *)NULL;
+    v->uv_grphash	= NULL;
+    v->uv_grphash_size	= 0;
+    v->uv_ngroups	= 0;
     v->uv_dvmrp_neighbors = (struct listaddr *)NULL;
     NBRM_CLRALL(v->uv_nbrmap);
     v->uv_querier	= (struct listaddr *)NULL;
@@ -179,6 +182,9 @@ void zero_vif(struct uvif *v, int t)
     RESET_TIMER(v->uv_hello_timer);
     v->uv_dr_prio       = PIM_HELLO_DR_PRIO_DEFAULT;
     v->uv_genid         = 0;
+    v->uv_prop_delay    = PIM_PROPAGATION_DELAY_DEFAULT;
+    v->uv_override_ivl  = PIM_OVERRIDE_INTERVAL_DEFAULT;
+    v->uv_tracking      = 0;
 
     RESET_TIMER(v->uv_gq_timer);
     RESET_TIMER(v->uv_jp_timer);
@@ -299,6 +305,7 @@ static void start_vif(vifi_t vifi)
     struct uvif *v;
 
     v	= &uvifs[vifi];
+    register_gen++;		/* Invalidate cached source vif of registers */
     /* Initialy no router on any vif */
     if (v->uv_flags & VIFF_REGISTER)
 	v->uv_flags = v->uv_flags & ~VIFF_DOWN;
@@ -366,10 +373,10 @@ static void start_vif(vifi_t vifi)
 static void stop_vif(vifi_t vifi)
 {
     struct uvif *v;
-    struct listaddr *a, *b;
     pim_nbr_entry_t *n, *next;
     struct vif_acl *acl;
 
+    register_gen++;
     /*
      * TODO: make sure that the kernel viftable is
      * consistent with the daemon table
@@ -384,25 +391,7 @@ static void stop_vif(vifi_t vifi)
 	 * Discard all group addresses.  (No need to tell kernel;
 	 * the k_del_vif() call will clean up kernel state.)
 	 */
-	while (v->uv_groups) {
-	    a = v->uv_groups;
-	    v->uv_groups = a->al_next;
-
-	    while (a->al_sources) {
-		b = a->al_sources;
-		a->al_sources = b->al_next;
-		free(b);
-	    }
-
-	    /* Clear timers, preventing possible memory double free */
-            if (a->al_timerid)
-                timer_clear(a->al_timerid);
-            if (a->al_versiontimer)
-                timer_clear(a->al_versiontimer);
-            if (a->al_query)
-                timer_clear(a->al_query);
-	    free(a);
-	}
+	flush_groups(v);
     }
 
     if (v->uv_querier) {
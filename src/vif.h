@@ -37,58 +37,78 @@
  *
  */
 
-#define	PIMD_VIFM_SET(n, m)		(m[n] = 1)
-#define	PIMD_VIFM_CLR(n, m)		(m[n] = 0)
-#define	PIMD_VIFM_ISSET(n, m)		(m[n] ? 1 : 0)
-#define PIMD_VIFM_CLRALL(m)		(memset(m, 0, MAXVIFS))
-#define PIMD_VIFM_COPY(mfrom, mto)	(memcpy(mto, mfrom, MAXVIFS))
+/*
+ * Sets of vifs, e.g. the oifs of a routing entry, are packed bitmaps of
+ * machine words so set operations work a word at a time.  There is room
+ * for the NO_VIF bit, some callers clear the iif without checking it.
+ */
+typedef unsigned long vifword_t;
+
+#define VIFM_WORD_BITS			(8 * sizeof(vifword_t))
+#define VIFM_WORDS			((MAXVIFS + VIFM_WORD_BITS) / VIFM_WORD_BITS)
+#define VIFM_WORD(n)			((n) / VIFM_WORD_BITS)
+#define VIFM_BIT(n)			((vifword_t)1 << ((n) % VIFM_WORD_BITS))
 
-inline static int PIMD_VIFM_SAME(uint8_t *m1, uint8_t *m2)
+typedef vifword_t vifset_t[VIFM_WORDS];
+
+#define	PIMD_VIFM_SET(n, m)		((m)[VIFM_WORD(n)] |=  VIFM_BIT(n))
+#define	PIMD_VIFM_CLR(n, m)		((m)[VIFM_WORD(n)] &= ~VIFM_BIT(n))
+#define	PIMD_VIFM_ISSET(n, m)		(((m)[VIFM_WORD(n)] & VIFM_BIT(n)) ? 1 : 0)
+#define PIMD_VIFM_CLRALL(m)		(memset(m, 0, sizeof(vifset_t)))
+#define PIMD_VIFM_COPY(mfrom, mto)	(memcpy(mto, mfrom, sizeof(vifset_t)))
+
+inline static int PIMD_VIFM_SAME(vifset_t m1, vifset_t m2)
 {
-    return memcmp(m1, m2, MAXVIFS) ? 0 : 1;
+    return memcmp(m1, m2, sizeof(vifset_t)) ? 0 : 1;
 }
 
-inline static int PIMD_VIFM_ISEMPTY(uint8_t *m)
+inline static int PIMD_VIFM_ISEMPTY(vifset_t m)
 {
-    int n;
+    vifword_t any = 0;
+    size_t i;
 
-    for (n = 0; n < MAXVIFS; n ++) {
-	if (m[n] != 0)
-	    return 0;
-    }
+    for (i = 0; i < VIFM_WORDS; i++)
+	any |= m[i];
 
-    return 1;
+    return any ? 0 : 1;
 }
 
-inline static void PIMD_VIFM_CLR_MASK(uint8_t *m, uint8_t *mask)
+inline static void PIMD_VIFM_CLR_MASK(vifset_t m, vifset_t mask)
 {
-    int n;
+    size_t i;
 
-    for (n = 0; n < MAXVIFS; n ++) {
-	if (mask[n] != 0)
-	    m[n] = 0;
-    }
+    for (i = 0; i < VIFM_WORDS; i++)
+	m[i] &= ~mask[i];
 }
 
-inline static void PIMD_VIFM_MERGE(uint8_t *m1, uint8_t *m2, uint8_t *result)
+inline static void PIMD_VIFM_MERGE(vifset_t m1, vifset_t m2, vifset_t result)
 {
-    int n;
+    size_t i;
 
-    for (n = 0; n < MAXVIFS; n ++)
-	result[n] = m1[n] | m2[n];
+    for (i = 0; i < VIFM_WORDS; i++)
+	result[i] = m1[i] | m2[i];
+}
+
+/* oifs = (((oifs + joined) - pruned) + leaves) - asserted, see calc_oifs() */
+inline static void PIMD_VIFM_APPLY(vifset_t oifs, vifset_t joined, vifset_t pruned,
+				   vifset_t leaves, vifset_t asserted)
+{
+    size_t i;
+
+    for (i = 0; i < VIFM_WORDS; i++)
+	oifs[i] = (((oifs[i] | joined[i]) & ~pruned[i]) | leaves[i]) & ~asserted[i];
 }
 
 /* Check with any oifs whether I am the last hop on some LAN */
-inline static int PIMD_VIFM_LASTHOP_ROUTER(uint8_t *leaves, uint8_t *oifs)
+inline static int PIMD_VIFM_LASTHOP_ROUTER(vifset_t leaves, vifset_t oifs)
 {
-    int i;
+    vifword_t any = 0;
+    size_t i;
 
-    for (i = 0; i < MAXVIFS; i++) {
-        if (leaves[i] && oifs[i])
-            return 1;
-    }
+    for (i = 0; i < VIFM_WORDS; i++)
+	any |= leaves[i] & oifs[i];
 
-    return 0;
+    return any ? 1 : 0;
 }
 
 /*
@@ -195,6 +215,9 @@ struct uvif {
     uint32_t	     uv_subnetbcast;/* subnet broadcast addr (phyints only) */
     char	     uv_name[IFNAMSIZ]; /* interface name                   */
     struct listaddr *uv_groups;     /* list of local groups  (phyints only) */
+    struct listaddr **uv_grphash;   /* ... hashed on group address          */
+    uint32_t	     uv_grphash_size; /* ... buckets, a power of two        */
+    uint32_t	     uv_ngroups;    /* ... number of groups                 */
     struct listaddr *uv_dvmrp_neighbors; /* list of neighboring routers     */
     nbrbitmap_t	     uv_nbrmap;	    /* bitmap of active neighboring routers */
     struct listaddr *uv_querier;    /* IGMP querier on vif                  */
@@ -207,6 +230,10 @@ struct uvif {
     uint16_t	    uv_hello_timer; /* Timer for sending PIM hello msgs     */
     uint32_t        uv_dr_prio;     /* PIM Hello DR Priority                */
     uint32_t        uv_genid;       /* Random PIM Hello Generation ID       */
+    uint16_t        uv_prop_delay;  /* Effective propagation delay, msec    */
+    uint16_t        uv_override_ivl;/* Effective override interval, msec    */
+    uint8_t         uv_tracking;    /* All neighbors do explicit tracking   */
+    uint32_t        uv_tracking_since; /* ... since this route_clock        */
     uint16_t	    uv_gq_timer;    /* Group Query timer        	    */
     uint16_t        uv_jp_timer;    /* The Join/Prune timer                 */
     uint16_t        uv_stquery_cnt; /* Startup Query Count */
@@ -239,6 +266,7 @@ struct uvif {
 #define VIFF_PIM_NBR            0x200000       /* PIM neighbor              */
 #define VIFF_DVMRP_NBR          0x400000       /* DVMRP neighbor            */
 #define VIFF_IGMPV2	        0x800000       /* Act as an IGMPv2 Router   */
+#define VIFF_FAST_LEAVE		0x1000000      /* IGMPv3 host tracking      */
 
 struct phaddr {
     struct phaddr   *pa_next;
@@ -271,10 +299,23 @@ struct vf_element {
 #define	VFEF_EXACT	0x0001
 };
 
+/* A host reporting a group, or SSM source, on a fast-leave vif */
+struct listhost {
+    uint32_t	     lh_addr;
+    time_t	     lh_time;		/* last report                      */
+};
+
 struct listaddr {
     struct listaddr *al_next;		/* link to next addr, MUST BE FIRST */
+    struct listaddr *al_prev;		/* link to prev group               */
+    struct listaddr *al_hnext;		/* next in group hash bucket        */
     uint32_t	     al_addr;		/* local group or neighbor address  */
-    struct listaddr *al_sources;	/* link to sources                  */
+    struct listaddr **al_sources;	/* SSM sources, sorted by address   */
+    uint32_t	     al_nsources;	/* ... number of sources            */
+    uint32_t	     al_maxsources;	/* ... allocated                    */
+    struct listhost *al_hosts;		/* fast-leave hosts, sorted by address */
+    uint32_t	     al_nhosts;		/* ... number of hosts              */
+    uint32_t	     al_maxhosts;	/* ... allocated                    */
     uint32_t	     al_timer;		/* for timing out group or neighbor */
     time_t	     al_ctime;		/* entry creation time		    */
     union {
@@ -289,6 +330,7 @@ struct listaddr {
     uint32_t	     al_query;		/* timer for repeated leave query   */
     uint16_t	     al_flags;		/* flags related to this neighbor   */
     u_long	     al_versiontimer;	/* timer for version switch         */
+    int64_t	     al_leave;		/* when the last member queries began */
 };
 #define	al_genid	al_alu.alu_genid
 #define	al_reporter	al_alu.alu_reporter
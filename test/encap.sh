@@ -0,0 +1,140 @@
+#!/bin/sh
+# Verify kernel register encapsulation, 'register-encap kernel', where
+# the DR sends to the RP in an IP-in-IP tunnel instead of pimd sending
+# PIM Register messages.  Static routes, R2 is the RP, and no SPT switch
+# so all traffic from ED1 to ED2 must pass the tunnel.
+#
+# ED1         R1 (DR)          R2 (RP)          ED2
+# [ED1:eth0]--[eth1:R1:eth2]---[eth3:R2:eth4]---[eth0:ED2]
+#       10.0.1.0/24     10.0.0.0/24      10.0.2.0/24
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+# Throughput in kbps, and lowest accepted share received at ED2
+RATE=20000
+SHARE=90
+
+print "Check deps ..."
+check_dep ethtool
+check_dep iperf
+check_dep ip link add "encap$$" type ipip remote 192.0.2.1
+ip link del "encap$$"
+
+print "Creating world ..."
+ED1="/tmp/$NM/ED1"
+ED2="/tmp/$NM/ED2"
+R1="/tmp/$NM/R1"
+R2="/tmp/$NM/R2"
+touch "$ED1" "$ED2" "$R1" "$R2"
+
+echo "$ED1"  > "/tmp/$NM/mounts"
+echo "$ED2" >> "/tmp/$NM/mounts"
+echo "$R1"  >> "/tmp/$NM/mounts"
+echo "$R2"  >> "/tmp/$NM/mounts"
+
+unshare --net="$ED1" -- ip link set lo up
+unshare --net="$ED2" -- ip link set lo up
+unshare --net="$R1"  -- ip link set lo up
+unshare --net="$R2"  -- ip link set lo up
+
+# Creates a VETH pair in $1, $2 stays and $3 is moved to netns $4
+vpair()
+{
+    nsenter --net="$1" -- ip link add "$2" type veth peer "$3"
+    ifsetup "$1" "$2" "$3"
+    nsenter --net="$1" -- ip link set "$3" netns "$4"
+}
+
+# Set address and bring up interface $2 in $1
+addr()
+{
+    nsenter --net="$1" -- ip link set "$2" up
+    nsenter --net="$1" -- ip addr add "$3" broadcast + dev "$2"
+}
+
+nsenter --net="$R1" -- sleep 5 &
+pid1=$!
+nsenter --net="$R2" -- sleep 5 &
+pid2=$!
+
+vpair "$ED1" eth0 eth1 "$pid1"
+vpair "$ED2" eth0 eth4 "$pid2"
+vpair "$R1"  eth2 eth3 "$pid2"
+
+addr "$ED1" eth0 10.0.1.10/24
+addr "$ED2" eth0 10.0.2.10/24
+addr "$R1"  eth1 10.0.1.1/24
+addr "$R1"  eth2 10.0.0.1/24
+addr "$R2"  eth3 10.0.0.2/24
+addr "$R2"  eth4 10.0.2.1/24
+
+nsenter --net="$ED1" -- ip route add default via 10.0.1.1
+nsenter --net="$ED2" -- ip route add default via 10.0.2.1
+nsenter --net="$R1"  -- ip route add 10.0.2.0/24 via 10.0.0.2
+nsenter --net="$R2"  -- ip route add 10.0.1.0/24 via 10.0.0.1
+
+print "Disabling rp_filter on routers ..."
+nsenter --net="$R1" -- sysctl -w net.ipv4.conf.all.rp_filter=0
+nsenter --net="$R2" -- sysctl -w net.ipv4.conf.all.rp_filter=0
+nsenter --net="$R2" -- sysctl -w net.ipv4.conf.default.rp_filter=0
+
+print "Creating PIM config ..."
+cat <<EOF > "/tmp/$NM/conf"
+rp-address 10.0.0.2
+spt-threshold infinity
+register-encap kernel
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting pimd ..."
+nsenter --net="$R1" -- ../src/pimd -i R1 -f "/tmp/$NM/conf" -n -p "/tmp/$NM/r1.pid" -l debug -d registers -u "/tmp/$NM/r1.sock" &
+echo $! >> "/tmp/$NM/PIDs"
+nsenter --net="$R2" -- ../src/pimd -i R2 -f "/tmp/$NM/conf" -n -p "/tmp/$NM/r2.pid" -l debug -d registers -u "/tmp/$NM/r2.sock" &
+echo $! >> "/tmp/$NM/PIDs"
+
+print "Sleeping 10 sec to allow pimd instances to peer ..."
+sleep 10
+dprint "PIM Status $R1"
+nsenter --net="$R1" -- ../src/pimctl -u "/tmp/$NM/r1.sock" show compat detail
+dprint "PIM Status $R2"
+nsenter --net="$R2" -- ../src/pimctl -u "/tmp/$NM/r2.sock" show compat detail
+
+print "Starting receiver ..."
+nsenter --net="$ED2" -- iperf -s -u -B 225.1.2.3 -i 1 > "/tmp/$NM/iperf.log" 2>&1 &
+echo $! >> "/tmp/$NM/PIDs"
+sleep 2
+
+print "Starting sender, $RATE kbps for 10 sec ..."
+nsenter --net="$ED1" -- iperf -c 225.1.2.3 -u -T 5 -b "${RATE}K" -t 10 -l 1200
+sleep 2
+
+dprint "Tunnels on $R1"
+nsenter --net="$R1" -- ip -s link show type ipip
+show_mroute "$R1"
+show_mroute "$R2"
+nsenter --net="$R1" -- ../src/pimctl -u "/tmp/$NM/r1.sock" show stats
+
+sent=$(nsenter --net="$R1" -- ../src/pimctl -u "/tmp/$NM/r1.sock" show stats | awk '/^ *Sent/ { print $3; exit }')
+tunnels=$(nsenter --net="$R1" -- ../src/pimctl -u "/tmp/$NM/r1.sock" show stats | awk '/Kernel tunnels/ { print $4 }')
+txpkts=$(nsenter --net="$R1" -- ip -s link show dev pimtun0 2>/dev/null | awk '/TX:/ { getline; print $2 }')
+rxpkts=$(nsenter --net="$ED2" -- ip -s link show dev eth0 | awk '/RX:/ { getline; print $2 }')
+expect=$((RATE * 1000 / 8 / 1200 * 10))
+
+dprint "Sent registers $sent, tunnels $tunnels, tunnel TX $txpkts, ED2 RX $rxpkts, expected $expect"
+
+if [ "$tunnels" != "1" ] || [ -z "$txpkts" ]; then
+    FAIL "Expected one kernel tunnel to the RP"
+fi
+
+# Only the first packets, before the tunnel is up, may be registered
+if [ "$sent" -gt 10 ]; then
+    FAIL "Expected the kernel to encapsulate, pimd sent $sent registers"
+fi
+
+if [ "$rxpkts" -lt $((expect * SHARE / 100)) ]; then
+    cat "/tmp/$NM/iperf.log"
+    FAIL "Expected at least $SHARE% of $expect packets at ED2"
+fi
+
+OK
@@ -0,0 +1,795 @@
+/* Benchmark for structured output on the IPC socket
+ *
+ * Links the daemon, except main.c and the unicast routing socket, sets
+ * up a router with an uplink toward the RP and a LAN with receivers for
+ * GROUPS (*,G) and SOURCES SSM (S,G) routes, and fetches the routing
+ * table over the IPC socket, as text, JSON, and binary.  Reports the
+ * size and time of each reply, the time to decode the routes, with
+ * flags, interfaces and timers, from 'show mrt detail' and from the
+ * binary records, and the size of incremental replies with 'since'.
+ * Last, the cost of route changes with and without a subscriber to the
+ * change events, and that a subscriber which does not keep up is told
+ * how many events it lost.  Then many clients at once, a client that
+ * does not read its reply, and several commands over one connection.
+ *
+ * Usage: ipcbench [-g GROUPS] [-s SOURCES] [-c CHANGES] [-l LOOPS]
+ *
+ *   -g GROUPS   Number of (*,G) routes, default 2000
+ *   -s SOURCES  Number of SSM (S,G) routes, default 2000
+ *   -c CHANGES  Routes changed, and deleted, before the delta, default 20
+ *   -l LOOPS    Number of times to fetch each reply, default 20
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#include <err.h>
+#include <getopt.h>
+#include <time.h>
+#include "defs.h"
+
+#define UPLINK		1
+#define LAN		2
+#define LOCAL_UP	htonl(0x0aff0001)	/* 10.255.0.1  */
+#define RP_ADDR		htonl(0x0aff0002)	/* 10.255.0.2, also the upstream router */
+#define LOCAL_LAN	htonl(0xc0a80101)	/* 192.168.1.1 */
+
+/* Binary record types, see doc/README-ipc.md */
+#define REC_HEADER	1
+#define REC_ROUTE	18
+#define REC_DELETED	19
+#define REC_EVENT	29
+
+struct route {
+    uint32_t source;
+    uint32_t group;
+    uint32_t rp;
+    uint16_t flags;
+    uint16_t iif;
+    uint8_t  oifs[5][MAXVIFS / 8 + 1];	/* oifs, joined, pruned, leaves, asserted */
+    uint32_t timers[4];
+    uint16_t vif_timers[MAXVIFS];
+};
+
+/* A subscriber, reading change events from binary records */
+struct sub {
+    int      sd;
+    uint8_t  buf[70000];
+    size_t   len;
+    size_t   bytes;
+    uint64_t seq;		/* Last seen */
+    uint64_t events;
+    uint64_t routes;
+    uint64_t rp;
+    uint64_t dropped;		/* Reported by the daemon */
+    uint64_t gaps;		/* Missing, not reported as dropped */
+};
+
+int stub_poll(int timeout);
+
+static struct route route;
+static char sock[80];
+
+/* Stubs for netlink.c and routesock.c, sources and the RP are upstream */
+int routing_socket = -1;
+
+int init_routesock(void)
+{
+    return 0;
+}
+
+void routesock_clean(void)
+{
+}
+
+int k_req_incoming(uint32_t source, struct rpfctl *rpf)
+{
+    rpf->source.s_addr      = source;
+    rpf->rpfneighbor.s_addr = RP_ADDR;
+    rpf->iif                = UPLINK;
+
+    return TRUE;
+}
+
+int k_route_notify(void)
+{
+    return TRUE;
+}
+
+int k_tunnel_add(const char *ifname, uint32_t remote)
+{
+    (void)ifname; (void)remote;
+
+    return 0;
+}
+
+void k_tunnel_del(int ifindex)
+{
+    (void)ifindex;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_vif(vifi_t vifi, const char *name, uint32_t addr, uint32_t flags)
+{
+    struct uvif *v = &uvifs[vifi];
+
+    strlcpy(v->uv_name, name, sizeof(v->uv_name));
+    v->uv_flags      = flags;
+    v->uv_lcl_addr   = addr;
+    v->uv_subnet     = addr & htonl(0xffffff00);
+    v->uv_subnetmask = htonl(0xffffff00);
+    v->uv_mtu        = 1500;
+}
+
+static uint32_t asm_group(uint32_t i)
+{
+    return htonl(0xe1010000 + i);		/* 225.1.0.0+ */
+}
+
+static uint32_t ssm_group(uint32_t i)
+{
+    return htonl(0xe8010000 + i / 4);		/* 232.1.0.0+ */
+}
+
+static uint32_t ssm_source(uint32_t i)
+{
+    return htonl(0x0a010001 + i % 4);		/* 10.1.0.1-4 */
+}
+
+static void setup(uint32_t groups, uint32_t sources)
+{
+    pim_nbr_entry_t *nbr;
+    uint32_t i;
+
+    loglevel = LOG_ERR;	/* Send errors, no sockets */
+    igmp_socket = -1;
+    pim_socket  = -1;
+    pim_send_buf = calloc(1, SEND_BUF_SIZE);
+    if (!pim_send_buf)
+	err(1, "calloc");
+
+    init_pim_mrt();
+
+    add_vif(0, "pimreg", LOCAL_UP, VIFF_REGISTER);
+    add_vif(UPLINK, "eth0", LOCAL_UP, 0);
+    add_vif(LAN, "eth1", LOCAL_LAN, VIFF_DR);
+    numvifs = 3;
+
+    nbr = calloc(1, sizeof(*nbr));
+    if (!nbr)
+	err(1, "calloc");
+    nbr->address = RP_ADDR;
+    nbr->vifi    = UPLINK;
+    uvifs[UPLINK].uv_pim_neighbors = nbr;
+
+    add_rp_grp_entry(&cand_rp_list, &grp_mask_list, RP_ADDR, 1, (uint16_t)0xffffff,
+		     htonl(INADDR_UNSPEC_GROUP), htonl(0xf0000000),
+		     curr_bsr_hash_mask, curr_bsr_fragment_tag);
+
+    for (i = 0; i < groups; i++)
+	add_leaf(LAN, INADDR_ANY_N, asm_group(i));
+    for (i = 0; i < sources; i++)
+	add_leaf(LAN, ssm_source(i), ssm_group(i));
+
+    snprintf(sock, sizeof(sock), "/tmp/ipcbench.%d.sock", getpid());
+    ipc_init(sock);
+}
+
+static int connect_cmd(const char *cmd)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    int sd;
+
+    strlcpy(sun.sun_path, sock, sizeof(sun.sun_path));
+    sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd < 0 || connect(sd, (struct sockaddr *)&sun, sizeof(sun)))
+	err(1, "failed connecting to %s", sock);
+    if (write(sd, cmd, strlen(cmd)) < 0)
+	err(1, "failed sending %s", cmd);
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+
+    return sd;
+}
+
+/* Run the event loop once, without waiting, keeping track of the longest turn */
+static void turn(double *longest)
+{
+    double t = now();
+
+    stub_poll(0);
+    t = now() - t;
+    if (t > *longest)
+	*longest = t;
+}
+
+/* Send @cmd and run the event loop until the whole reply is in @buf */
+static size_t request(const char *cmd, char **buf)
+{
+    char chunk[65536];
+    size_t len = 0;
+    ssize_t num;
+    FILE *fp;
+    int sd;
+
+    free(*buf);
+    *buf = NULL;
+    fp = open_memstream(buf, &len);
+    if (!fp)
+	err(1, "open_memstream");
+
+    sd = connect_cmd(cmd);
+
+    while (1) {
+	num = read(sd, chunk, sizeof(chunk));
+	if (num == 0)
+	    break;
+	if (num < 0) {
+	    if (errno == EAGAIN || errno == EINTR) {
+		stub_poll(10);
+		continue;
+	    }
+	    err(1, "failed reading reply to %s", cmd);
+	}
+	fwrite(chunk, num, 1, fp);
+    }
+    close(sd);
+    fclose(fp);
+
+    return len;
+}
+
+static double fetch(const char *cmd, uint32_t loops, char **buf, size_t *len)
+{
+    double t;
+    uint32_t l;
+
+    t = now();
+    for (l = 0; l < loops; l++)
+	*len = request(cmd, buf);
+
+    return (now() - t) * 1e3 / loops;
+}
+
+static uint32_t text_addr(const char *str)
+{
+    struct in_addr ina = { 0 };
+
+    if (strcmp(str, "ANY") && strcmp(str, "SSM") && strcmp(str, "NULL"))
+	inet_pton(AF_INET, str, &ina);
+
+    return ina.s_addr;
+}
+
+static void text_vifs(const char *str, uint8_t *set)
+{
+    int vifi;
+
+    memset(set, 0, MAXVIFS / 8 + 1);
+    for (vifi = 0; str[vifi] && vifi < MAXVIFS; vifi++) {
+	if (str[vifi] != '.')
+	    set[vifi / 8] |= 1 << (vifi % 8);
+    }
+}
+
+/* What a collector scraping 'show mrt detail' has to do, returns routes */
+static size_t parse_text(char *buf)
+{
+    static const char *flags[] = { "SPT", "WC", "RP", "REG", "IIF_REG", "NULL_OIF",
+				   "CACHE", "ASSERTED", "REG_SUPP", "SG", "PMBR" };
+    char src[16], grp[16], rp[16], *line, *ptr, *tok, *tptr;
+    size_t num = 0;
+    int timers = 0;
+
+    for (line = strtok_r(buf, "\n", &ptr); line; line = strtok_r(NULL, "\n", &ptr)) {
+	if (timers) {
+	    for (int i = 0; i < 4; i++)
+		route.timers[i] = strtoul(line, &line, 10);
+	    for (int i = 0; i < numvifs; i++)
+		route.vif_timers[i] = strtoul(line, &line, 10);
+	    timers = 0;
+	    continue;
+	}
+
+	if (!strncmp(line, "TIMERS", 6)) {
+	    timers = 1;
+	} else if (strlen(line) > 15 && !strncmp(line + 9, "oifs:", 5)) {
+	    int set = line[0] == 'J' ? 1 : line[0] == 'P' ? 2 : line[0] == 'L' ? 3 : line[0] == 'A' ? 4 : 0;
+
+	    text_vifs(line + 15, route.oifs[set]);
+	} else if (!strncmp(line, "Incoming", 8)) {
+	    tok = strchr(line + 15, 'I');
+	    route.iif = tok ? tok - (line + 15) : 0xffff;
+	} else if (sscanf(line, "%15s %15s %15s", src, grp, rp) == 3 &&
+		   (isdigit((int)src[0]) || !strcmp(src, "ANY"))) {
+	    route.source = text_addr(src);
+	    route.group  = text_addr(grp);
+	    route.rp     = text_addr(rp);
+	    route.flags  = 0;
+	    for (tok = strtok_r(line + 50, " ", &tptr); tok; tok = strtok_r(NULL, " ", &tptr)) {
+		for (size_t i = 0; i < NELEMS(flags); i++) {
+		    if (!strcmp(tok, flags[i]))
+			route.flags |= 1 << i;
+		}
+	    }
+	    num++;
+	}
+    }
+
+    return num;
+}
+
+static const uint8_t *get_vifs(const uint8_t *p, uint8_t *set)
+{
+    uint8_t len = *p++;
+
+    memcpy(set, p, MIN(len, MAXVIFS / 8 + 1));
+
+    return p + len;
+}
+
+/* The same from the binary records, returns the routes */
+static size_t parse_binary(const uint8_t *buf, size_t len, size_t *deleted)
+{
+    const uint8_t *end = buf + len, *p;
+    size_t num = 0;
+    uint16_t cnt;
+
+    *deleted = 0;
+    while (buf + 3 <= end) {
+	len = buf[0] << 8 | buf[1];
+	if (len < 3 || buf + len > end)
+	    break;
+
+	if (buf[2] == REC_DELETED)
+	    (*deleted)++;
+	if (buf[2] != REC_ROUTE) {
+	    buf += len;
+	    continue;
+	}
+
+	p = buf + 3;
+	p += 1 + *p;			/* type */
+	memcpy(&route.source, p, 4); p += 4;
+	memcpy(&route.group, p, 4);  p += 4;
+	memcpy(&route.rp, p, 4);     p += 4;
+	p += 8;				/* gen */
+	route.flags = p[0] << 8 | p[1]; p += 2;
+	route.iif   = p[0] << 8 | p[1]; p += 2;
+	p += 4;				/* upstream */
+	for (int i = 0; i < 5; i++)
+	    p = get_vifs(p, route.oifs[i]);
+	for (int i = 0; i < 4; i++, p += 4)
+	    route.timers[i] = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	cnt = p[0] << 8 | p[1]; p += 2;
+	for (int i = 0; i < cnt && i < MAXVIFS; i++, p += 2)
+	    route.vif_timers[i] = p[0] << 8 | p[1];
+
+	num++;
+	buf += len;
+    }
+
+    return num;
+}
+
+static uint64_t generation(const uint8_t *buf, size_t len)
+{
+    uint64_t gen = 0;
+
+    if (len < 20 || buf[2] != REC_HEADER)
+	errx(1, "no header in binary reply");
+
+    for (int i = 0; i < 8; i++)
+	gen = gen << 8 | buf[12 + i];	/* After version and epoch */
+
+    return gen;
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    uint64_t val = 0;
+
+    for (int i = 0; i < 8; i++)
+	val = val << 8 | p[i];
+
+    return val;
+}
+
+static void subscribe(struct sub *s, const char *cmd)
+{
+    memset(s, 0, sizeof(*s));
+    s->sd = connect_cmd(cmd);
+    stub_poll(0);
+}
+
+/* Decode the event records received so far, checking sequence numbers */
+static void parse_events(struct sub *s)
+{
+    uint8_t *buf = s->buf, *end = s->buf + s->len, *p;
+    uint64_t seq, count;
+    size_t len;
+    char name[32];
+
+    while (buf + 3 <= end) {
+	len = buf[0] << 8 | buf[1];
+	if (len < 3 || buf + len > end)
+	    break;
+	if (buf[2] != REC_EVENT)
+	    errx(1, "unexpected record type %d in event stream", buf[2]);
+
+	p = buf + 3;
+	seq = get_u64(p);    p += 8;
+	snprintf(name, sizeof(name), "%.*s", p[0], p + 1);
+	p += 1 + *p;
+	p += 1 + *p;			/* type */
+	p += 2 + 12 + 2;		/* vif, source, group, address, masklen, priority */
+	p += 1 + *p;			/* oifs */
+	count = get_u64(p);
+
+	if (!strcmp(name, "dropped")) {
+	    s->dropped += count;
+	    if (seq != s->seq + count)
+		errx(1, "dropped %" PRIu64 " events, but seq %" PRIu64 " after %" PRIu64,
+		     count, seq, s->seq);
+	} else {
+	    s->events++;
+	    if (!strncmp(name, "route-", 6))
+		s->routes++;
+	    else if (!strncmp(name, "rp-", 3))
+		s->rp++;
+	    if (seq != s->seq + 1)
+		s->gaps += seq - s->seq - 1;
+	}
+	s->seq = seq;
+	buf += len;
+    }
+
+    len = end - buf;
+    memmove(s->buf, buf, len);
+    s->len = len;
+}
+
+/* Run the event loop until the daemon has nothing more queued for @s */
+static void drain(struct sub *s)
+{
+    ssize_t num;
+    int idle = 0;
+
+    while (idle < 3) {
+	stub_poll(0);
+
+	num = read(s->sd, s->buf + s->len, sizeof(s->buf) - s->len);
+	if (num <= 0) {
+	    if (num == 0 || (errno != EAGAIN && errno != EINTR))
+		errx(1, "subscriber disconnected");
+	    idle++;
+	    continue;
+	}
+
+	idle = 0;
+	s->len   += num;
+	s->bytes += num;
+	parse_events(s);
+    }
+}
+
+/*
+ * Fetch @cmd on @num connections at once, more than the daemon serves
+ * at a time, each reply must be @len bytes.  Returns msec for all.
+ */
+static double parallel(const char *cmd, int num, size_t len, double *longest)
+{
+    size_t got[64] = { 0 };
+    int sd[64], left = 0;
+    char chunk[65536];
+    ssize_t n;
+    double t;
+
+    t = now();
+    *longest = 0;
+    while (left < num) {
+	/* In batches, the rest wait in the backlog of the listening socket */
+	for (int i = 0; i < 8 && left < num; i++)
+	    sd[left++] = connect_cmd(cmd);
+	turn(longest);
+    }
+
+    while (left) {
+	turn(longest);
+	for (int i = 0; i < num; i++) {
+	    if (sd[i] < 0)
+		continue;
+
+	    n = read(sd[i], chunk, sizeof(chunk));
+	    if (n > 0) {
+		got[i] += n;
+		continue;
+	    }
+	    if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+		    continue;
+		err(1, "failed reading reply to %s", cmd);
+	    }
+
+	    close(sd[i]);
+	    sd[i] = -1;
+	    left--;
+	    if (got[i] != len)
+		errx(1, "client %d got %zu bytes of %zu", i, got[i], len);
+	}
+    }
+
+    return (now() - t) * 1e3;
+}
+
+/* Read @len bytes from @sd, running the event loop while waiting */
+static void read_all(int sd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+	n = read(sd, buf, len);
+	if (n == 0)
+	    errx(1, "connection closed");
+	if (n < 0) {
+	    if (errno != EAGAIN && errno != EINTR)
+		err(1, "failed reading");
+	    stub_poll(10);
+	    continue;
+	}
+
+	buf  = (char *)buf + n;
+	len -= n;
+    }
+}
+
+/* Read a framed reply, of slices up to one of zero length, into @buf */
+static size_t framed(int sd, char **buf)
+{
+    size_t len = 0;
+    uint32_t hdr;
+    char *slice;
+    FILE *fp;
+
+    free(*buf);
+    *buf = NULL;
+    fp = open_memstream(buf, &len);
+    if (!fp)
+	err(1, "open_memstream");
+
+    while (1) {
+	read_all(sd, &hdr, sizeof(hdr));
+	hdr = ntohl(hdr);
+	if (!hdr)
+	    break;
+
+	slice = malloc(hdr);
+	if (!slice)
+	    err(1, "malloc");
+	read_all(sd, slice, hdr);
+	fwrite(slice, hdr, 1, fp);
+	free(slice);
+    }
+    fclose(fp);
+
+    return len;
+}
+
+static void send_cmd(int sd, const char *cmd)
+{
+    if (write(sd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd))
+	err(1, "failed sending %s", cmd);
+}
+
+/* Leave and join again @groups (*,G), every other one on the last loop */
+static void churn(uint32_t groups, struct sub *s)
+{
+    for (uint32_t i = 0; i < groups; i++) {
+	delete_leaf(LAN, INADDR_ANY_N, asm_group(i));
+	add_leaf(LAN, INADDR_ANY_N, asm_group(i));
+
+	if (s && i % 64 == 63)
+	    drain(s);
+    }
+    if (s)
+	drain(s);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t groups = 2000, sources = 2000, changes = 20, loops = 20, l, i;
+    size_t len, num, text_num = 0, deleted, sent;
+    double t, text_ms, bin_ms;
+    char *buf = NULL, *copy;
+    char chunk[65536];
+    rp_grp_entry_t *rp;
+    ssize_t n;
+    struct sub s;
+    char cmd[64];
+    uint64_t gen;
+    int c, sd;
+
+    while ((c = getopt(argc, argv, "c:g:l:s:")) != EOF) {
+	switch (c) {
+	case 'c':
+	    changes = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'g':
+	    groups = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'l':
+	    loops = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 's':
+	    sources = strtoul(optarg, NULL, 0);
+	    break;
+
+	default:
+	    fprintf(stderr, "Usage: %s [-g GROUPS] [-s SOURCES] [-c CHANGES] [-l LOOPS]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if (!loops || groups > 65536 || sources > 4 * 65536 || changes > MIN(groups, sources))
+	errx(1, "invalid arguments");
+
+    setup(groups, sources);
+
+    t = fetch("show mrt", loops, &buf, &len);
+    printf("text:     %8zu bytes, %7.2f ms/reply\n", len, t);
+    t = fetch("show mrt detail", loops, &buf, &len);
+    printf("detail:   %8zu bytes, %7.2f ms/reply\n", len, t);
+    t = fetch("show mrt json", loops, &buf, &len);
+    printf("json:     %8zu bytes, %7.2f ms/reply\n", len, t);
+    t = fetch("show mrt binary", loops, &buf, &len);
+    printf("binary:   %8zu bytes, %7.2f ms/reply\n", len, t);
+
+    /* Decode routes with flags, interfaces and timers */
+    request("show mrt detail", &buf);
+    copy = malloc(strlen(buf) + 1);
+    if (!copy)
+	err(1, "malloc");
+    t = now();
+    for (l = 0; l < loops; l++) {
+	strcpy(copy, buf);
+	text_num = parse_text(copy);
+    }
+    text_ms = (now() - t) * 1e3 / loops;
+    free(copy);
+
+    len = request("show mrt binary", &buf);
+    t = now();
+    for (l = 0; l < loops; l++)
+	num = parse_binary((uint8_t *)buf, len, &deleted);
+    bin_ms = (now() - t) * 1e3 / loops;
+
+    printf("decode:   text %zu routes %.3f ms, binary %zu routes %.3f ms, %.1f%%\n",
+	   text_num, text_ms, num, bin_ms, text_ms > 0 ? bin_ms * 100 / text_ms : 0.0);
+
+    /* Incremental, first with nothing changed */
+    gen = generation((uint8_t *)buf, len);
+    snprintf(cmd, sizeof(cmd), "show mrt binary since %" PRIu64, gen);
+    len = request(cmd, &buf);
+    num = parse_binary((uint8_t *)buf, len, &deleted);
+    printf("delta:    %8zu bytes, %zu routes, %zu deleted, nothing changed\n", len, num, deleted);
+
+    for (i = 0; i < changes; i++) {
+	mrtentry_t *r;
+
+	delete_leaf(LAN, INADDR_ANY_N, asm_group(i));
+	r = find_route(ssm_source(i), ssm_group(i), MRTF_SG, DONT_CREATE);
+	if (r)
+	    delete_mrtentry(r);
+    }
+
+    len = request(cmd, &buf);
+    num = parse_binary((uint8_t *)buf, len, &deleted);
+    printf("delta:    %8zu bytes, %zu routes, %zu deleted, after %u leaves\n", len, num, deleted, changes);
+
+    /* Change events, the cost of a leave and join without and with a subscriber */
+    t = now();
+    for (l = 0; l < loops; l++)
+	churn(groups, NULL);
+    t = (now() - t) * 1e9 / loops / groups;
+
+    subscribe(&s, "subscribe binary");
+    text_ms = now();
+    for (l = 0; l < loops; l++)
+	churn(groups, &s);
+    text_ms = (now() - text_ms) * 1e9 / loops / groups;
+    printf("events:   %7.0f ns/change, %.0f ns/change subscribed, %" PRIu64 " events, %zu bytes\n",
+	   t, text_ms, s.events, s.bytes);
+    if (!s.routes || s.dropped || s.gaps)
+	errx(1, "subscriber lost events, %" PRIu64 " dropped", s.dropped);
+    close(s.sd);
+
+    /* A subscriber that does not read loses events, and is told so */
+    subscribe(&s, "subscribe routes binary");
+    churn(groups, NULL);
+    churn(groups, NULL);
+    drain(&s);
+    printf("events:   %" PRIu64 " received, %" PRIu64 " dropped while not reading\n", s.events, s.dropped);
+    if (!s.dropped || s.gaps || s.events + s.dropped != s.seq)
+	errx(1, "%" PRIu64 " events dropped, but %" PRIu64 " missing", s.dropped, s.seq - s.events);
+    close(s.sd);
+
+    /* RP-set changes */
+    subscribe(&s, "subscribe rp binary");
+    rp = add_rp_grp_entry(&cand_rp_list, &grp_mask_list, htonl(0x0aff0003), 1, (uint16_t)0xffffff,
+			  htonl(0xef000000), htonl(0xff000000), curr_bsr_hash_mask, curr_bsr_fragment_tag);
+    delete_rp_grp_entry(&cand_rp_list, &grp_mask_list, rp);
+    drain(&s);
+    if (s.rp != 2 || s.events != 2)
+	errx(1, "expected rp-add and rp-del, got %" PRIu64 " events", s.events);
+    close(s.sd);
+
+    /* Many clients at once, and the longest the daemon is busy with one of them */
+    len = request("show mrt binary", &buf);
+    t = parallel("show mrt binary", 24, len, &text_ms);
+    request("show stats", &buf);
+    copy = strstr(buf, "Longest slice");
+    if (!copy || sscanf(copy, "Longest slice : %zu", &num) != 1)
+	errx(1, "no longest slice in show stats");
+    printf("clients:  24 in parallel %7.2f ms, %.2f ms/reply, longest slice %.2f ms, turn %.2f ms, budget %u ms\n",
+	   t, t / 24, num / 1e3, text_ms * 1e3, ipc_budget);
+
+    /* A client that does not read its reply holds up no one, and times out */
+    num = request("show mrt detail", &buf);
+    sd = connect_cmd("show mrt detail");
+    for (i = 0; i < 10; i++)
+	stub_poll(0);
+    len = request("show mrt json", &buf);
+    virtual_time += ipc_timeout;
+    ipc_age();
+    for (sent = 0; (n = read(sd, chunk, sizeof(chunk))) > 0; sent += n)
+	;
+    if (n < 0)
+	errx(1, "stuck client not timed out");
+    close(sd);
+    printf("stuck:    %zu of %zu bytes sent before timing out, %zu byte reply to others meanwhile\n",
+	   sent, num, len);
+
+    /* Several commands over one connection, framed replies */
+    sd = connect_cmd("keepalive\n");
+    if (framed(sd, &buf))
+	errx(1, "expected an empty reply to keepalive");
+    t = now();
+    for (l = 0; l < loops * 10; l++) {
+	send_cmd(sd, "show status json\n");
+	len = framed(sd, &buf);
+    }
+    t = (now() - t) * 1e3 / (loops * 10);
+    text_ms = fetch("show status json", loops * 10, &buf, &num);
+    printf("keep:     %8zu bytes, %7.3f ms/reply, %.3f ms/reply reconnecting\n", len, t, text_ms);
+    if (len != num)
+	errx(1, "kept connection reply %zu bytes, expected %zu", len, num);
+
+    send_cmd(sd, "show version\nshow rp json\nno such command\n");
+    for (i = 0; i < 3; i++) {
+	if (!framed(sd, &buf))
+	    errx(1, "empty reply to pipelined command %u", i);
+    }
+    if (strncmp(buf, "No such command", 15))
+	errx(1, "expected an error, got %s", buf);
+    close(sd);
+
+    free(buf);
+    ipc_exit();
+
+    return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
@@ -0,0 +1,378 @@
+/* Fuzz harness for the PIM Join/Prune receive path
+ *
+ * Links the daemon, except main.c and the unicast routing socket, sets
+ * up a router with an uplink toward the RP and a LAN with two other PIM
+ * routers, and feeds each input as a Join/Prune message, after the PIM
+ * header, from one of the LAN routers.  The input is first decoded with
+ * parse_pim_join_prune() and the result checked against the input
+ * length, then the whole message is run through receive_pim_join_prune().
+ * Routing state is kept between inputs, nothing is sent.
+ *
+ * Usage: jpfuzz [-n ITERATIONS] [-w DIR] [FILE ...]
+ *
+ *   -n ITERATIONS  Generate and run random, mostly valid, messages, some
+ *                  truncated or with flipped bytes
+ *   -w DIR         Write a seed corpus of valid messages to DIR
+ *
+ * Without options each FILE, or stdin, is run once, e.g. with AFL:
+ *
+ *   make -C test jpfuzz CC=afl-clang-fast
+ *   test/jpfuzz -w seeds
+ *   afl-fuzz -i seeds -o findings -- test/jpfuzz @@
+ *
+ * For libFuzzer the harness provides LLVMFuzzerTestOneInput(), build
+ * with -DLIBFUZZER to leave out main():
+ *
+ *   make -C test jpfuzz CC=clang CFLAGS="-g -O1 -fsanitize=fuzzer,address -DLIBFUZZER"
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#include <err.h>
+#include <getopt.h>
+#include "defs.h"
+
+#define UPLINK		1
+#define LAN		2
+#define LOCAL_UP	htonl(0x0aff0001)	/* 10.255.0.1  */
+#define RP_ADDR		htonl(0x0aff0002)	/* 10.255.0.2, also the upstream router */
+#define LOCAL_LAN	htonl(0xc0a80101)	/* 192.168.1.1 */
+#define LAN_SENDER	htonl(0xc0a80102)	/* 192.168.1.2 */
+#define LAN_OTHER	htonl(0xc0a80103)	/* 192.168.1.3 */
+
+#define MAX_MSG		65535
+
+static uint64_t parsed, malformed;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* Stubs for netlink.c and routesock.c, sources and the RP are upstream */
+int routing_socket = -1;
+
+int init_routesock(void)
+{
+    return 0;
+}
+
+void routesock_clean(void)
+{
+}
+
+int k_req_incoming(uint32_t source, struct rpfctl *rpf)
+{
+    vifi_t vifi;
+
+    rpf->source.s_addr      = source;
+    rpf->rpfneighbor.s_addr = source;
+    for (vifi = UPLINK; vifi < numvifs; vifi++) {
+	if ((source & uvifs[vifi].uv_subnetmask) == uvifs[vifi].uv_subnet) {
+	    rpf->iif = vifi;
+	    return TRUE;
+	}
+    }
+
+    rpf->iif = UPLINK;
+    rpf->rpfneighbor.s_addr = RP_ADDR;
+
+    return TRUE;
+}
+
+int k_route_notify(void)
+{
+    return TRUE;
+}
+
+int k_tunnel_add(const char *ifname, uint32_t remote)
+{
+    (void)ifname; (void)remote;
+
+    return 0;
+}
+
+void k_tunnel_del(int ifindex)
+{
+    (void)ifindex;
+}
+
+static void add_nbr(vifi_t vifi, uint32_t addr)
+{
+    pim_nbr_entry_t *nbr;
+
+    nbr = calloc(1, sizeof(*nbr));
+    if (!nbr)
+	err(1, "calloc");
+
+    nbr->address = addr;
+    nbr->vifi    = vifi;
+    nbr->next    = uvifs[vifi].uv_pim_neighbors;
+    if (nbr->next)
+	nbr->next->prev = nbr;
+    uvifs[vifi].uv_pim_neighbors = nbr;
+}
+
+static void add_vif(vifi_t vifi, const char *name, uint32_t addr, uint32_t flags)
+{
+    struct uvif *v = &uvifs[vifi];
+
+    strlcpy(v->uv_name, name, sizeof(v->uv_name));
+    v->uv_flags      = flags;
+    v->uv_lcl_addr   = addr;
+    v->uv_subnet     = addr & htonl(0xffffff00);
+    v->uv_subnetmask = htonl(0xffffff00);
+    v->uv_mtu        = 1500;
+}
+
+static void setup(void)
+{
+    static int done;
+
+    if (done)
+	return;
+    done = 1;
+
+    loglevel = LOG_ERR;	/* Send errors, no sockets */
+    igmp_socket = -1;
+    pim_socket  = -1;
+    pim_send_buf = calloc(1, SEND_BUF_SIZE);
+    if (!pim_send_buf)
+	err(1, "calloc");
+
+    init_pim_mrt();
+
+    add_vif(0, "pimreg", LOCAL_UP, VIFF_REGISTER);
+    add_vif(UPLINK, "eth0", LOCAL_UP, 0);
+    add_vif(LAN, "eth1", LOCAL_LAN, VIFF_DR);
+    numvifs = 3;
+
+    add_nbr(UPLINK, RP_ADDR);
+    add_nbr(LAN, LAN_OTHER);
+    add_nbr(LAN, LAN_SENDER);
+
+    /* All routers on the LAN do explicit tracking, have done so a while */
+    uvifs[LAN].uv_tracking = 1;
+    uvifs[LAN].uv_tracking_since = route_clock - PIM_JOIN_PRUNE_HOLDTIME;
+
+    add_rp_grp_entry(&cand_rp_list, &grp_mask_list, RP_ADDR, 1, (uint16_t)0xffffff,
+		     htonl(INADDR_UNSPEC_GROUP), htonl(0xf0000000),
+		     curr_bsr_hash_mask, curr_bsr_fragment_tag);
+}
+
+/* The decoded message must account for every byte it claims */
+static void check(jp_message_t *jp, size_t len)
+{
+    size_t i, num = 0, need;
+
+    need = sizeof(pim_header_t) + PIM_ENCODE_UNI_ADDR_LEN + 4;
+    for (i = 0; i < jp->num_groups; i++) {
+	jp_group_t *jpg = &jp->groups[i];
+
+	if (jpg->first != num || jpg->wc > jpg->num_j)
+	    abort();
+	num  += jpg->num_j + jpg->num_p;
+	need += PIM_ENCODE_GRP_ADDR_LEN + 4 + (jpg->num_j + jpg->num_p) * PIM_ENCODE_SRC_ADDR_LEN;
+    }
+
+    if (num != jp->num || num > jp->max || need > len)
+	abort();
+}
+
+static void run(const uint8_t *data, size_t size)
+{
+    static jp_message_t jp;
+    static uint8_t buf[MAX_MSG];
+    uint16_t sum;
+    size_t len;
+
+    setup();
+
+    if (size > sizeof(buf) - sizeof(pim_header_t))
+	size = sizeof(buf) - sizeof(pim_header_t);
+
+    len = sizeof(pim_header_t) + size;
+    memcpy(buf + sizeof(pim_header_t), data, size);
+    buf[0] = (PIM_PROTOCOL_VERSION << 4) | PIM_JOIN_PRUNE;
+    buf[1] = buf[2] = buf[3] = 0;
+    sum = inet_cksum((uint16_t *)buf, len);
+    memcpy(&buf[2], &sum, sizeof(sum));
+
+    if (parse_pim_join_prune((char *)buf, len, &jp)) {
+	check(&jp, len);
+	parsed++;
+    } else {
+	malformed++;
+    }
+
+    receive_pim_join_prune(LAN_SENDER, allpimrouters_group, (char *)buf, len);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    run(data, size);
+
+    return 0;
+}
+
+#ifndef LIBFUZZER
+static uint32_t pick_source(uint8_t *flags)
+{
+    switch (random() % 4) {
+    case 0:			/* (*,G) toward the RP */
+	*flags = USADDR_S_BIT | USADDR_WC_BIT | USADDR_RP_BIT;
+	return RP_ADDR;
+
+    case 1:			/* (S,G,rpt) */
+	*flags = USADDR_S_BIT | USADDR_RP_BIT;
+	break;
+
+    default:			/* (S,G) */
+	*flags = USADDR_S_BIT;
+	break;
+    }
+
+    return htonl(0x0a010000 + random() % 64);	/* 10.1.0.0/26 */
+}
+
+/* A valid message, after the PIM header, to us or the other LAN router */
+static size_t generate(uint8_t *buf)
+{
+    uint8_t *data = buf;
+    uint8_t num_groups = 1 + random() % 8;
+    uint16_t num_j, num_p, i;
+    uint8_t flags;
+
+    PUT_EUADDR(random() % 4 ? LOCAL_LAN : LAN_OTHER, data);
+    PUT_BYTE(0, data);
+    PUT_BYTE(num_groups, data);
+    PUT_HOSTSHORT(random() % 4 ? PIM_JOIN_PRUNE_HOLDTIME : 0, data);
+
+    while (num_groups--) {
+	if (random() % 16 == 0) {
+	    PUT_EGADDR(htonl(CLASSD_PREFIX), STAR_STAR_RP_MSKLEN, 0, data);
+	    num_j = random() % 2;
+	    num_p = !num_j;
+	    PUT_HOSTSHORT(num_j, data);
+	    PUT_HOSTSHORT(num_p, data);
+	    PUT_ESADDR(RP_ADDR, SINGLE_SRC_MSKLEN, USADDR_S_BIT | USADDR_WC_BIT | USADDR_RP_BIT, data);
+	    continue;
+	}
+
+	PUT_EGADDR(htonl(0xe1010000 + random() % 64), SINGLE_GRP_MSKLEN, 0, data);	/* 225.1.0.0/26 */
+	num_j = random() % 4;
+	num_p = random() % 4;
+	PUT_HOSTSHORT(num_j, data);
+	PUT_HOSTSHORT(num_p, data);
+	for (i = 0; i < num_j + num_p; i++) {
+	    uint32_t source = pick_source(&flags);
+
+	    PUT_ESADDR(source, SINGLE_SRC_MSKLEN, flags, data);
+	}
+    }
+
+    return data - buf;
+}
+
+static void mutate(uint8_t *buf, size_t *len)
+{
+    int i;
+
+    switch (random() % 4) {
+    case 0:
+	*len = random() % (*len + 1);
+	break;
+
+    case 1:
+	for (i = 1 + random() % 4; i > 0; i--)
+	    buf[random() % *len] = random();
+	break;
+    }
+}
+
+static void write_seeds(const char *dir)
+{
+    uint8_t buf[MAX_MSG];
+    char file[PATH_MAX];
+    size_t len;
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < 32; i++) {
+	len = generate(buf);
+	snprintf(file, sizeof(file), "%s/jp-%02d", dir, i);
+	fp = fopen(file, "w");
+	if (!fp)
+	    err(1, "failed creating %s", file);
+	fwrite(buf, len, 1, fp);
+	fclose(fp);
+    }
+}
+
+static void run_file(FILE *fp)
+{
+    static uint8_t buf[MAX_MSG];
+    size_t len;
+
+    len = fread(buf, 1, sizeof(buf), fp);
+    run(buf, len);
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t buf[MAX_MSG];
+    uint32_t i, n = 0;
+    size_t len;
+    FILE *fp;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:w:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    n = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'w':
+	    srandom(4711);
+	    write_seeds(optarg);
+	    return 0;
+
+	default:
+	    fprintf(stderr, "Usage: %s [-n ITERATIONS] [-w DIR] [FILE ...]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if (n) {
+	srandom(4711);
+	for (i = 0; i < n; i++) {
+	    len = generate(buf);
+	    if (random() % 2)
+		mutate(buf, &len);
+	    run(buf, len);
+	}
+
+	printf("jpfuzz: %u messages, %" PRIu64 " parsed, %" PRIu64 " malformed, %" PRIu64 " entries\n",
+	       n, parsed, malformed, jp_stats.rx_entries);
+	return 0;
+    }
+
+    if (optind >= argc) {
+	run_file(stdin);
+	return 0;
+    }
+
+    for (c = optind; c < argc; c++) {
+	fp = fopen(argv[c], "r");
+	if (!fp)
+	    err(1, "failed opening %s", argv[c]);
+	run_file(fp);
+	fclose(fp);
+    }
+
+    return 0;
+}
+#endif /* LIBFUZZER */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
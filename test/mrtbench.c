@@ -0,0 +1,250 @@
+/* Micro benchmark for (S,G) insert and lookup in the pimd routing table
+ *
+ * Builds mrt.c stand-alone, with the few external dependencies stubbed
+ * out, fills the table with N (S,G) entries spread over a number of
+ * groups and reports average insert and lookup latency.
+ *
+ * Usage: mrtbench [-n ENTRIES] [-g GROUPS] [-s]
+ *
+ *   -n ENTRIES  Number of (S,G) entries, default 100000
+ *   -g GROUPS   Number of groups to spread entries over, default 1000
+ *   -s          Insert in sorted order, default is random order
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#include <err.h>
+#include <getopt.h>
+#include <time.h>
+#include "defs.h"
+
+/* Stubs for what mrt.c needs from the rest of pimd */
+unsigned long   debug;
+int             loglevel;
+int             log_nmsgs;
+int             log_syslog;
+int             igmp_socket = -1;
+vifi_t          numvifs = 4;
+int             total_interfaces = 4;
+cand_rp_t      *cand_rp_list;
+grp_mask_t     *grp_mask_list;
+uint16_t        curr_bsr_fragment_tag;
+uint32_t        curr_bsr_hash_mask;
+char            s1[MAX_INET_BUF_LEN];
+char            s2[MAX_INET_BUF_LEN];
+uint32_t        route_clock;
+uint32_t        decap_gen;
+
+static rpentry_t      rpentry;
+static cand_rp_t      cand_rp = { .rpentry = &rpentry };
+static rp_grp_entry_t rp_grp  = { .rp = &cand_rp };
+
+void log_msg(int severity, int syserr, const char *fmt, ...)
+{
+    (void)syserr;
+    (void)fmt;
+
+    if (severity == LOG_ERR)
+	errx(1, "fatal error in mrt.c");
+}
+
+char *inet_fmt(uint32_t addr, char *s, size_t len)
+{
+    (void)addr;
+    (void)len;
+
+    return s;
+}
+
+void mrt_schedule(mrtentry_t *mrt, uint32_t when)
+{
+    (void)mrt; (void)when;
+}
+
+void mrt_unschedule(mrtentry_t *mrt)
+{
+    (void)mrt;
+}
+
+void register_forget(mrtentry_t *mrt)
+{
+    mrt->reg = NULL;
+}
+
+void jp_forget(mrtentry_t *mrt)
+{
+    mrt->track = NULL;
+}
+
+void ipc_route_event(int op, mrtentry_t *mrt)
+{
+    (void)op; (void)mrt;
+}
+
+int inet_valid_host(uint32_t naddr)
+{
+    return naddr != 0;
+}
+
+int k_del_mfc(int socket, uint32_t source, uint32_t group)
+{
+    (void)socket; (void)source; (void)group;
+
+    return TRUE;
+}
+
+int set_incoming(srcentry_t *src, int srctype)
+{
+    (void)srctype;
+
+    src->incoming = 1;
+    src->upstream = NULL;
+
+    return TRUE;
+}
+
+rp_grp_entry_t *add_rp_grp_entry(cand_rp_t **cand, grp_mask_t **mask, uint32_t rp_addr,
+				 uint8_t rp_priority, uint16_t rp_holdtime, uint32_t group_addr,
+				 uint32_t group_mask, uint32_t bsr_hash_mask, uint16_t fragment_tag)
+{
+    (void)cand; (void)mask; (void)rp_addr; (void)rp_priority; (void)rp_holdtime;
+    (void)group_addr; (void)group_mask; (void)bsr_hash_mask; (void)fragment_tag;
+
+    return &rp_grp;
+}
+
+rpentry_t *rp_match(uint32_t group)
+{
+    (void)group;
+
+    return &rpentry;
+}
+
+rp_grp_entry_t *rp_grp_match(uint32_t group)
+{
+    (void)group;
+
+    return &rp_grp;
+}
+
+rpentry_t *rp_find(uint32_t rp_address)
+{
+    (void)rp_address;
+
+    return &rpentry;
+}
+
+#ifdef RSRR
+void rsrr_cache_clean(mrtentry_t *mrt)
+{
+    (void)mrt;
+}
+
+void rsrr_cache_bring_up(mrtentry_t *mrt)
+{
+    (void)mrt;
+}
+#endif /* RSRR */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void shuffle(uint32_t *idx, size_t n)
+{
+    size_t i;
+
+    for (i = n - 1; i > 0; i--) {
+	size_t j = random() % (i + 1);
+	uint32_t tmp = idx[i];
+
+	idx[i] = idx[j];
+	idx[j] = tmp;
+    }
+}
+
+static void sg(uint32_t i, uint32_t groups, uint32_t *source, uint32_t *group)
+{
+    *group  = htonl(0xef000000 + (i % groups) + 1);	/* 239.0.0.1 ... */
+    *source = htonl(0x0a000000 + (i / groups) + 1);	/* 10.0.0.1 ...  */
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t source, group, *idx;
+    uint32_t i, entries = 100000, groups = 1000;
+    int c, sorted = 0;
+    double t;
+
+    while ((c = getopt(argc, argv, "g:n:s")) != EOF) {
+	switch (c) {
+	case 'g':
+	    groups = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'n':
+	    entries = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 's':
+	    sorted = 1;
+	    break;
+
+	default:
+	    fprintf(stderr, "Usage: %s [-n ENTRIES] [-g GROUPS] [-s]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if (!entries || !groups)
+	errx(1, "invalid arguments");
+
+    idx = calloc(entries, sizeof(uint32_t));
+    if (!idx)
+	err(1, "calloc");
+    for (i = 0; i < entries; i++)
+	idx[i] = i;
+
+    srandom(4711);
+    if (!sorted)
+	shuffle(idx, entries);
+
+    rpentry.address = htonl(0x0a0000fe);
+    rpentry.incoming = 1;
+    init_pim_mrt();
+
+    t = now();
+    for (i = 0; i < entries; i++) {
+	sg(idx[i], groups, &source, &group);
+	if (!find_route(source, group, MRTF_SG, CREATE))
+	    errx(1, "failed creating (S,G) entry %u", idx[i]);
+    }
+    t = now() - t;
+    printf("insert: %u entries, %u groups, %.1f ns/op\n", entries, groups, t * 1e9 / entries);
+    printf("entry:  %zu bytes, %u vifs\n", mrtentry_pool.size, total_interfaces);
+
+    shuffle(idx, entries);
+    t = now();
+    for (i = 0; i < entries; i++) {
+	sg(idx[i], groups, &source, &group);
+	if (!find_route(source, group, MRTF_SG, DONT_CREATE))
+	    errx(1, "failed finding (S,G) entry %u", idx[i]);
+    }
+    t = now() - t;
+    printf("lookup: %u entries, %u groups, %.1f ns/op\n", entries, groups, t * 1e9 / entries);
+
+    free(idx);
+
+    return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
@@ -0,0 +1,377 @@
+/* Benchmark for the PIM Register receive path on the RP
+ *
+ * Links the daemon, except main.c, sets up a minimal RP with a static
+ * RP-set for 224.0.0.0/4 and (*,G) state with receivers on a LAN for
+ * all groups in the capture, then replays the PIM Register messages in
+ * a pcap file through receive_pim_register() and reports registers/sec.
+ * Nothing is sent, the PIM and IGMP sockets are not opened.
+ *
+ * Usage: regbench [-w] [-d DRS] [-s SOURCES] [-g GROUPS] [-l LOOPS] FILE
+ *
+ *   -w          Write a synthetic capture to FILE first, the RP is
+ *               10.255.0.1 and each DR 10.0.N.1 registers SOURCES
+ *               senders to each of GROUPS groups
+ *   -d DRS      Number of DRs, default 50
+ *   -s SOURCES  Number of sources per DR, default 2
+ *   -g GROUPS   Number of groups, default 4
+ *   -l LOOPS    Number of times to replay the capture, default 1000
+ *
+ * Captures from tcpdump or Wireshark, Ethernet or Linux cooked, work as
+ * well.  The RP address is the destination of the first register.
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#include <err.h>
+#include <getopt.h>
+#include <time.h>
+#include "defs.h"
+
+#define PCAP_MAGIC	0xa1b2c3d4
+#define PCAP_MAGIC_NS	0xa1b23c4d
+#define PCAP_SWAP32(x)	(swap ? __builtin_bswap32(x) : (x))
+
+struct pcap_hdr {
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    int32_t  zone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_rec {
+    uint32_t sec;
+    uint32_t usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+struct reg {
+    uint32_t src;
+    uint32_t dst;
+    size_t   len;
+    char    *msg;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint16_t cksum(void *buf, size_t len)
+{
+    uint16_t *w = buf;
+    uint32_t sum = 0;
+
+    for (; len > 1; len -= 2)
+	sum += *w++;
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+
+    return ~sum;
+}
+
+static void put_ip(uint8_t *buf, uint8_t proto, uint32_t src, uint32_t dst, size_t len)
+{
+    struct ip *ip = (struct ip *)buf;
+
+    memset(ip, 0, sizeof(*ip));
+    ip->ip_v   = IPVERSION;
+    ip->ip_hl  = sizeof(*ip) >> 2;
+    ip->ip_len = htons(len);
+    ip->ip_ttl = 64;
+    ip->ip_p   = proto;
+    ip->ip_src.s_addr = src;
+    ip->ip_dst.s_addr = dst;
+    ip->ip_sum = cksum(ip, sizeof(*ip));
+}
+
+/*
+ * Ethernet frames with one data register, 100 bytes of UDP payload, from
+ * each (DR,S,G) in turn.  Header only checksum, as sent by pimd.
+ */
+static void write_capture(const char *file, uint32_t drs, uint32_t sources, uint32_t groups)
+{
+    struct pcap_hdr hdr = { PCAP_MAGIC, 2, 4, 0, 0, 65535, 1 };
+    size_t len = 14 + 20 + sizeof(pim_header_t) + sizeof(pim_register_t) + 20 + 8 + 100;
+    uint8_t frame[256];
+    uint32_t d, s, g;
+    FILE *fp;
+
+    fp = fopen(file, "w");
+    if (!fp)
+	err(1, "failed creating %s", file);
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    memset(frame, 0, sizeof(frame));
+    frame[12] = 0x08;		/* ETHERTYPE_IP */
+
+    for (s = 0; s < sources; s++) {
+	for (g = 0; g < groups; g++) {
+	    for (d = 0; d < drs; d++) {
+		struct pcap_rec rec = { 0, d, len, len };
+		uint32_t dr     = htonl(0x0a000001 + (d << 8));		/* 10.0.N.1    */
+		uint32_t source = htonl(0x0a000064 + (d << 8) + s);	/* 10.0.N.100+ */
+		uint32_t group  = htonl(0xe1010101 + g);		/* 225.1.1.1+  */
+		uint8_t *outer = &frame[14];
+		uint8_t *pim   = outer + 20;
+		uint8_t *inner = pim + sizeof(pim_header_t) + sizeof(pim_register_t);
+
+		memset(pim, 0, len - 14 - 20);
+		put_ip(outer, IPPROTO_PIM, dr, htonl(0x0aff0001), len - 14);
+		put_ip(inner, IPPROTO_UDP, source, group, 20 + 8 + 100);
+		inner[20 + 1] = 42;	/* sport */
+		inner[20 + 3] = 42;	/* dport */
+		inner[20 + 5] = 108;	/* length */
+		pim[0] = (PIM_PROTOCOL_VERSION << 4) | PIM_REGISTER;
+		*(uint16_t *)&pim[2] = cksum(pim, sizeof(pim_header_t) + sizeof(pim_register_t));
+
+		fwrite(&rec, sizeof(rec), 1, fp);
+		fwrite(frame, len, 1, fp);
+	    }
+	}
+    }
+
+    fclose(fp);
+}
+
+/* Skip link layer header, returns offset to the IP header, or -1 */
+static int link_offset(uint32_t linktype, uint8_t *pkt, size_t len)
+{
+    uint16_t type;
+    size_t off;
+
+    switch (linktype) {
+    case 1:			/* Ethernet */
+	for (off = 12; off + 2 <= len; off += 4) {
+	    type = pkt[off] << 8 | pkt[off + 1];
+	    if (type != 0x8100 && type != 0x88a8)
+		break;
+	}
+	return type == 0x0800 ? (int)off + 2 : -1;
+
+    case 101:			/* Raw IP */
+    case 228:			/* Raw IPv4 */
+	return 0;
+
+    case 113:			/* Linux cooked */
+	if (len < 16)
+	    return -1;
+	return (pkt[14] << 8 | pkt[15]) == 0x0800 ? 16 : -1;
+
+    case 276:			/* Linux cooked v2 */
+	if (len < 20)
+	    return -1;
+	return (pkt[0] << 8 | pkt[1]) == 0x0800 ? 20 : -1;
+    }
+
+    return -1;
+}
+
+/* Load all PIM Registers, unfragmented, from @file */
+static struct reg *read_capture(const char *file, size_t *num)
+{
+    struct reg *regs = NULL;
+    struct pcap_hdr hdr;
+    struct pcap_rec rec;
+    size_t n = 0, max = 0;
+    uint8_t *pkt;
+    int swap;
+    FILE *fp;
+
+    fp = fopen(file, "r");
+    if (!fp)
+	err(1, "failed opening %s", file);
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+	errx(1, "%s: truncated pcap header", file);
+    if (hdr.magic == PCAP_MAGIC || hdr.magic == PCAP_MAGIC_NS)
+	swap = 0;
+    else if (hdr.magic == __builtin_bswap32(PCAP_MAGIC) || hdr.magic == __builtin_bswap32(PCAP_MAGIC_NS))
+	swap = 1;
+    else
+	errx(1, "%s: not a pcap file", file);
+
+    pkt = malloc(65536);
+    if (!pkt)
+	err(1, "malloc");
+
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+	size_t caplen = PCAP_SWAP32(rec.caplen);
+	struct ip *ip;
+	size_t hlen, iplen;
+	uint8_t *pim;
+	int off;
+
+	if (caplen > 65536 || fread(pkt, caplen, 1, fp) != 1)
+	    break;
+
+	off = link_offset(PCAP_SWAP32(hdr.linktype), pkt, caplen);
+	if (off < 0 || caplen < (size_t)off + sizeof(struct ip))
+	    continue;
+
+	ip    = (struct ip *)(pkt + off);
+	hlen  = ip->ip_hl << 2;
+	iplen = ntohs(ip->ip_len);
+	if (ip->ip_v != IPVERSION || ip->ip_p != IPPROTO_PIM || (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)))
+	    continue;
+	if (iplen > caplen - off || iplen < hlen + sizeof(pim_header_t))
+	    continue;
+
+	pim = (uint8_t *)ip + hlen;
+	if ((pim[0] & 0x0f) != PIM_REGISTER)
+	    continue;
+
+	if (n == max) {
+	    max = max ? max * 2 : 1024;
+	    regs = realloc(regs, max * sizeof(*regs));
+	    if (!regs)
+		err(1, "realloc");
+	}
+
+	regs[n].src = ip->ip_src.s_addr;
+	regs[n].dst = ip->ip_dst.s_addr;
+	regs[n].len = iplen - hlen;
+	regs[n].msg = malloc(regs[n].len);
+	if (!regs[n].msg)
+	    err(1, "malloc");
+	memcpy(regs[n].msg, pim, regs[n].len);
+	n++;
+    }
+
+    free(pkt);
+    fclose(fp);
+    *num = n;
+
+    return regs;
+}
+
+/*
+ * pimreg, an uplink with the RP address and a LAN with receivers for
+ * all groups registered, where we are the DR.
+ */
+static void setup_rp(struct reg *regs, size_t num)
+{
+    uint32_t rp = regs[0].dst;
+    size_t i;
+
+    loglevel = LOG_ERR;	/* Register-Stop and MFC errors, no sockets */
+    igmp_socket = -1;
+    pim_socket  = -1;
+    pim_send_buf = calloc(1, SEND_BUF_SIZE);
+    if (!pim_send_buf)
+	err(1, "calloc");
+
+    init_pim_mrt();
+
+    strlcpy(uvifs[0].uv_name, "pimreg", sizeof(uvifs[0].uv_name));
+    uvifs[0].uv_flags    = VIFF_REGISTER;
+    uvifs[0].uv_lcl_addr = rp;
+    strlcpy(uvifs[1].uv_name, "eth0", sizeof(uvifs[1].uv_name));
+    uvifs[1].uv_lcl_addr = rp;
+    uvifs[1].uv_subnet   = rp & htonl(0xffffff00);
+    uvifs[1].uv_subnetmask = htonl(0xffffff00);
+    strlcpy(uvifs[2].uv_name, "eth1", sizeof(uvifs[2].uv_name));
+    uvifs[2].uv_flags    = VIFF_DR;
+    uvifs[2].uv_lcl_addr = htonl(0xc0a80101);
+    uvifs[2].uv_subnet   = htonl(0xc0a80100);
+    uvifs[2].uv_subnetmask = htonl(0xffffff00);
+    numvifs = 3;
+
+    add_rp_grp_entry(&cand_rp_list, &grp_mask_list, rp, 1, (uint16_t)0xffffff,
+		     htonl(INADDR_UNSPEC_GROUP), htonl(0xf0000000),
+		     curr_bsr_hash_mask, curr_bsr_fragment_tag);
+
+    for (i = 0; i < num; i++) {
+	struct ip *ip = (struct ip *)(regs[i].msg + sizeof(pim_header_t) + sizeof(pim_register_t));
+
+	if (regs[i].len < sizeof(pim_header_t) + sizeof(pim_register_t) + sizeof(struct ip))
+	    continue;
+	if (!IN_MULTICAST(ntohl(ip->ip_dst.s_addr)) || find_route(0, ip->ip_dst.s_addr, MRTF_WC, DONT_CREATE))
+	    continue;
+
+	add_leaf(2, INADDR_ANY_N, ip->ip_dst.s_addr);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t drs = 50, sources = 2, groups = 4, loops = 1000, l;
+    int c, write = 0;
+    struct reg *regs;
+    size_t i, num;
+    double t;
+
+    while ((c = getopt(argc, argv, "d:g:l:s:w")) != EOF) {
+	switch (c) {
+	case 'd':
+	    drs = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'g':
+	    groups = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'l':
+	    loops = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 's':
+	    sources = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'w':
+	    write = 1;
+	    break;
+
+	default:
+	usage:
+	    fprintf(stderr, "Usage: %s [-w] [-d DRS] [-s SOURCES] [-g GROUPS] [-l LOOPS] FILE\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if (optind >= argc)
+	goto usage;
+    if (!drs || drs > 255 || !sources || sources > 100 || !groups || !loops)
+	errx(1, "invalid arguments");
+
+    if (write)
+	write_capture(argv[optind], drs, sources, groups);
+
+    regs = read_capture(argv[optind], &num);
+    if (!num)
+	errx(1, "no PIM Register messages in %s", argv[optind]);
+
+    setup_rp(regs, num);
+
+    t = now();
+    for (l = 0; l < loops; l++) {
+	for (i = 0; i < num; i++)
+	    receive_pim_register(regs[i].src, regs[i].dst, regs[i].msg, regs[i].len);
+    }
+    t = now() - t;
+
+    printf("replay: %zu registers x %u loops, %.0f registers/sec, %.1f ns/op\n",
+	   num, loops, num * loops / t, t * 1e9 / (num * loops));
+    printf("decap:  %" PRIu64 " cache hits, %" PRIu64 " cache misses\n",
+	   reg_stats.decap_hits, reg_stats.decap_misses);
+
+    for (i = 0; i < num; i++)
+	free(regs[i].msg);
+    free(regs);
+
+    return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
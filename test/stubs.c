@@ -0,0 +1,115 @@
+/* Stubs for what the rest of pimd needs from main.c
+ *
+ * Shared by the test programs that link the whole daemon, except main.c,
+ * to drive one of its receive paths directly.
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#include <poll.h>
+#include "defs.h"
+
+char            versionstring[100];
+int             do_vifs = 1;
+int             retry_forever;
+struct rp_hold *g_rp_hold;
+int             mrt_table_id;
+char           *ident = PACKAGE_NAME;
+char           *prognm = PACKAGE_NAME;
+char           *pid_file;
+char           *sock_file;
+char           *config_file;
+uint32_t        virtual_time;
+
+/* Input handlers, only run by test programs that call stub_poll() */
+static struct {
+    int      fd;
+    ihfunc_t func;
+    int      flags;
+} handlers[32];
+static int nhandlers;
+
+int register_input_handler(int fd, ihfunc_t func, int flags)
+{
+    if (nhandlers >= (int)NELEMS(handlers))
+	return -1;
+
+    handlers[nhandlers].fd    = fd;
+    handlers[nhandlers].func  = func;
+    handlers[nhandlers].flags = flags;
+    nhandlers++;
+
+    return 0;
+}
+
+int deregister_input_handler(int fd)
+{
+    int i;
+
+    for (i = 0; i < nhandlers; i++) {
+	if (handlers[i].fd != fd)
+	    continue;
+
+	handlers[i] = handlers[--nhandlers];
+	return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Wait at most @timeout msec for any registered descriptor, then call
+ * the handlers of those ready, like the event loop in main.c does.
+ */
+int stub_poll(int timeout)
+{
+    struct pollfd pfd[NELEMS(handlers)];
+    ihfunc_t func[NELEMS(handlers)];
+    int i, num = nhandlers;
+
+    for (i = 0; i < num; i++) {
+	pfd[i].fd     = handlers[i].fd;
+	pfd[i].events = (handlers[i].flags & IH_WRITE) ? POLLOUT : POLLIN;
+	func[i]       = handlers[i].func;
+    }
+
+    if (poll(pfd, num, timeout) <= 0)
+	return 0;
+
+    /* A handler may deregister the others, skip those */
+    for (i = 0; i < num; i++) {
+	int j;
+
+	if (!pfd[i].revents)
+	    continue;
+
+	for (j = 0; j < nhandlers; j++) {
+	    if (handlers[j].fd == pfd[i].fd && handlers[j].func == func[i])
+		break;
+	}
+	if (j < nhandlers)
+	    func[i](pfd[i].fd);
+    }
+
+    return 1;
+}
+
+int daemon_restart(char *buf, size_t len)
+{
+    (void)buf; (void)len;
+
+    return 0;
+}
+
+int daemon_kill(char *buf, size_t len)
+{
+    (void)buf; (void)len;
+
+    return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */
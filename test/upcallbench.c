@@ -0,0 +1,161 @@
+/* Benchmark for the cache miss upcall path of a DR
+ *
+ * Links the daemon, except main.c, sets up a DR with directly connected
+ * sources and a static RP, then feeds IGMPMSG_NOCACHE upcalls for each
+ * (S,G) through process_kernel_call(), flushing the MFC update of each,
+ * and reports CPU time per upcall.  The first round creates the (S,G)
+ * entries, the following rounds find them.  Nothing is sent, the kernel
+ * MFC is not touched.
+ *
+ * Usage: upcallbench [-f] [-L LEVEL] [-s SOURCES] [-g GROUPS] [-l LOOPS]
+ *
+ *   -f          Log to stderr, as in the foreground, default syslog
+ *   -L LEVEL    Log level, default notice
+ *   -s SOURCES  Number of sources, default 100
+ *   -g GROUPS   Number of groups, default 100
+ *   -l LOOPS    Number of rounds over all (S,G), default 20
+ *
+ * This file is distributed under the same terms as pimd itself.
+ */
+#include <err.h>
+#include <getopt.h>
+#include <time.h>
+#include "defs.h"
+
+static double cpu(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* No multicast routing socket here, let all MFC updates succeed */
+int setsockopt(int sd, int level, int optname, const void *optval, socklen_t optlen)
+{
+    (void)sd; (void)level; (void)optname; (void)optval; (void)optlen;
+
+    return 0;
+}
+
+/*
+ * pimreg, an uplink where we are the RP, and a LAN with the sources,
+ * where we are the DR.
+ */
+static void setup_dr(void)
+{
+    uint32_t rp = htonl(0x0aff0001);	/* 10.255.0.1 */
+
+    igmp_socket = -1;
+    pim_socket  = -1;
+    pim_send_buf = calloc(1, SEND_BUF_SIZE);
+    if (!pim_send_buf)
+	err(1, "calloc");
+
+    init_pim_mrt();
+
+    strlcpy(uvifs[0].uv_name, "pimreg", sizeof(uvifs[0].uv_name));
+    uvifs[0].uv_flags    = VIFF_REGISTER;
+    uvifs[0].uv_lcl_addr = rp;
+    uvifs[0].uv_threshold = 1;
+    strlcpy(uvifs[1].uv_name, "eth0", sizeof(uvifs[1].uv_name));
+    uvifs[1].uv_lcl_addr = rp;
+    uvifs[1].uv_threshold = 1;
+    uvifs[1].uv_subnet   = rp & htonl(0xffffff00);
+    uvifs[1].uv_subnetmask = htonl(0xffffff00);
+    strlcpy(uvifs[2].uv_name, "eth1", sizeof(uvifs[2].uv_name));
+    uvifs[2].uv_flags    = VIFF_DR;
+    uvifs[2].uv_lcl_addr = htonl(0xc0a80101);
+    uvifs[2].uv_threshold = 1;
+    uvifs[2].uv_subnet   = htonl(0xc0a80000);
+    uvifs[2].uv_subnetmask = htonl(0xffff0000);
+    numvifs = 3;
+
+    add_rp_grp_entry(&cand_rp_list, &grp_mask_list, rp, 1, (uint16_t)0xffffff,
+		     htonl(INADDR_UNSPEC_GROUP), htonl(0xf0000000),
+		     curr_bsr_hash_mask, curr_bsr_fragment_tag);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t sources = 100, groups = 100, loops = 20, l, s, g;
+    struct igmpmsg msg;
+    int c, foreground = 0;
+    double t, first = 0;
+
+    while ((c = getopt(argc, argv, "fg:l:L:s:")) != EOF) {
+	switch (c) {
+	case 'f':
+	    foreground = 1;
+	    break;
+
+	case 'g':
+	    groups = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'l':
+	    loops = strtoul(optarg, NULL, 0);
+	    break;
+
+	case 'L':
+	    loglevel = log_str2lvl(optarg);
+	    break;
+
+	case 's':
+	    sources = strtoul(optarg, NULL, 0);
+	    break;
+
+	default:
+	    fprintf(stderr, "Usage: %s [-f] [-L LEVEL] [-s SOURCES] [-g GROUPS] [-l LOOPS]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if (!sources || sources > 10000 || !groups || groups > 10000 || loops < 2 || loglevel < 0)
+	errx(1, "invalid arguments");
+
+    log_init(!foreground);
+    setup_dr();
+
+    memset(&msg, 0, sizeof(msg));
+    msg.im_msgtype = IGMPMSG_NOCACHE;
+    msg.im_vif     = 2;
+
+    t = cpu();
+    for (l = 0; l < loops; l++) {
+	for (s = 0; s < sources; s++) {
+	    for (g = 0; g < groups; g++) {
+		msg.im_src.s_addr = htonl(0xc0a80200 + s);	/* 192.168.2.0+ */
+		msg.im_dst.s_addr = htonl(0xe1010101 + g);	/* 225.1.1.1+   */
+		process_kernel_call((char *)&msg);
+		k_mfc_flush();
+	    }
+	}
+
+	if (!l) {
+	    first = cpu() - t;
+	    t = cpu();
+	}
+
+	/* Refill the upcall rate limiter of all (S,G) */
+	route_clock += 3600;
+    }
+    t = cpu() - t;
+
+    printf("create: %u upcalls, %.1f ns/upcall CPU\n", sources * groups,
+	   first * 1e9 / (sources * groups));
+    printf("found:  %u upcalls x %u loops, %.1f ns/upcall CPU\n", sources * groups, loops - 1,
+	   t * 1e9 / ((double)sources * groups * (loops - 1)));
+    printf("kernel: %" PRIu64 " misses, %" PRIu64 " limited, %" PRIu64 " MFC updates\n",
+	   upcall_stats.misses, upcall_stats.limited, mfc_stats.syscalls);
+
+    return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "cc-mode"
+ * End:
+ */